@@ -159,6 +159,17 @@
 #define ADD_RET_META 2
 #define DEL_RET_META 3
 
+/**
+ * Command that blocks until the last mutation of a key is persisted
+ * and/or acked by a number of TAP replicas, or the timeout passes.
+ */
+#define CMD_WAIT_DURABILITY 0xb3
+
+/**
+ * Command that gets the values of a batch of keys in one response.
+ */
+#define CMD_GET_MULTI 0xb4
+
 /**
  * TAP OPAQUE command list
  */
@@ -274,4 +285,36 @@ typedef union {
     uint8_t bytes[sizeof(protocol_binary_request_header) + 12];
 } protocol_binary_request_return_meta;
 
+/**
+ * The physical layout for the CMD_WAIT_DURABILITY.  A timeout of 0
+ * means the engine's durability_wait_timeout.
+ */
+typedef union {
+    struct {
+        protocol_binary_request_header header;
+        struct {
+            uint32_t timeout;
+            uint8_t persist;
+            uint8_t replicas;
+            uint16_t reserved;
+        } body;
+    } message;
+    uint8_t bytes[sizeof(protocol_binary_request_header) + 8];
+} protocol_binary_request_wait_durability;
+
+/**
+ * The response to CMD_WAIT_DURABILITY carries whether the mutation was
+ * persisted and how many replicas acked it, whether or not it timed out.
+ */
+typedef union {
+    struct {
+        protocol_binary_response_header header;
+        struct {
+            uint8_t persisted;
+            uint8_t replicated;
+        } body;
+    } message;
+    uint8_t bytes[sizeof(protocol_binary_response_header) + 2];
+} protocol_binary_response_wait_durability;
+
 #endif /* EP_ENGINE_COMMAND_IDS_H */
@@ -167,6 +167,33 @@ class MemcachedClient(object):
         persisted = struct.unpack('>B', data[4+len(key)])[0]
         return opaque, rep_time, persist_time, persisted
 
+    def waitDurability(self, key, persist, replicas, timeout=0):
+        """Wait for the last mutation of a key to be persisted and/or
+        acked by replicas (timeout in ms, 0 for the server's default)."""
+        extra = struct.pack('>IBBH', timeout, persist and 1 or 0, replicas, 0)
+        opaque, cas, data = self._doCmd(memcacheConstants.CMD_WAIT_DURABILITY,
+                                        key, '', extra)
+        persisted, replicated = struct.unpack('>BB', data[:2])
+        return persisted, replicated
+
+    def getMulti(self, keys, vbucket):
+        """Get a list of keys of a vbucket in one request.
+
+        Returns a dict of key to (status, flags, cas, value)."""
+        value = ''.join([struct.pack('>HH', vbucket, len(k)) + k for k in keys])
+        opaque, cas, data = self._doCmd(memcacheConstants.CMD_GET_MULTI, '', value)
+        rv = {}
+        offset = 0
+        while offset < len(data):
+            vb, klen, status, flags, kcas, nbytes = \
+                struct.unpack('>HHHIQI', data[offset:offset + 22])
+            offset += 22
+            key = data[offset:offset + klen]
+            offset += klen
+            rv[key] = (status, flags, kcas, data[offset:offset + nbytes])
+            offset += nbytes
+        return rv
+
     def __parseGet(self, data, klen=0):
         flags=struct.unpack(memcacheConstants.GET_RES_FMT, data[-1][:4])[0]
         return flags, data[1], data[-1][4 + klen:]
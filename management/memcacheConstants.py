@@ -66,6 +66,9 @@ CMD_ADDQ_WITH_META = 0xa5
 CMD_DELETE_WITH_META = 0xa8
 CMD_DELETEQ_WITH_META = 0xa9
 
+CMD_WAIT_DURABILITY = 0xb3
+CMD_GET_MULTI = 0xb4
+
 # Replication
 CMD_TAP_CONNECT = 0x40
 CMD_TAP_MUTATION = 0x41
@@ -27,33 +27,56 @@ public:
     ItemAccessVisitor(EventuallyPersistentStore &_store, EPStats &_stats,
                       bool *sfin) :
         store(_store), stats(_stats), startTime(ep_real_time()),
-        stateFinalizer(sfin)
+        startSize(0), stateFinalizer(sfin)
     {
         Configuration &conf = store.getEPEngine().getConfiguration();
         name = conf.getAlogPath();
         prev = name + ".old";
         next = name + ".next";
+        delta = name + ".delta";
+
+        // Only the items that changed since the last run are appended to
+        // the delta log, until it gets too big next to the full log.
+        size_t baseItems = stats.alogBaseItems.get();
+        full = baseItems == 0 ||
+            stats.alogDeltaItems.get() * 100 >= baseItems * conf.getAlogDeltaRatio();
+        if (full) {
+            remove(next.c_str());
+        }
 
-        log = new MutationLog(next, conf.getAlogBlockSize());
+        log = new MutationLog(full ? next : delta, conf.getAlogBlockSize());
         assert(log != NULL);
         log->open();
         if (!log->isOpen()) {
             LOG(EXTENSION_LOG_WARNING, "FATAL: Failed to open access log: %s",
-                next.c_str());
+                log->getLogFile().c_str());
             delete log;
             log = NULL;
+        } else if (!full) {
+            startSize = log->logSize;
         }
     }
 
     void visit(StoredValue *v) {
-        if (log != NULL && v->isResident()) {
+        uint8_t nru = NO_LOGGED_NRU_VALUE;
+        if (v->isResident()) {
             if (v->isExpired(startTime) || v->isDeleted()) {
                 LOG(EXTENSION_LOG_INFO, "INFO: Skipping expired/deleted item: %s",
                     v->getKey().c_str());
             } else {
+                nru = v->getNRUValue();
+            }
+        }
+
+        if (full || nru != v->getLoggedNRUValue()) {
+            if (nru != NO_LOGGED_NRU_VALUE) {
+                // Warmup loads the keys of the hottest class first.
                 log->newItem(currentBucket->getId(), v->getKey(),
-                             v->getBySeqno());
+                             v->getBySeqno(), nru);
+            } else if (!full) {
+                log->delItem(currentBucket->getId(), v->getKey());
             }
+            v->setLoggedNRUValue(nru);
         }
     }
 
@@ -71,15 +94,28 @@ public:
         }
 
         if (log != NULL) {
-            size_t num_items = log->itemsLogged[ML_NEW];
-            log->commit1();
-            log->commit2();
+            size_t num_items = log->itemsLogged[ML_NEW] + log->itemsLogged[ML_DEL];
+            if (full || num_items > 0) {
+                log->commit1();
+                log->commit2();
+            }
+            size_t written = log->logSize - startSize;
             delete log;
             log = NULL;
             ++stats.alogRuns;
             stats.alogRuntime.set(ep_real_time() - startTime);
             stats.alogNumItems.set(num_items);
+            stats.alogBytesWritten.set(written);
+            stats.alogTotalBytesWritten.incr(written);
 
+            if (!full) {
+                stats.alogDeltaItems.incr(num_items);
+                return;
+            }
+
+            // Whatever happens, the next run has to start over unless
+            // the new log replaces the current one.
+            stats.alogBaseItems.set(0);
             if (num_items == 0) {
                 LOG(EXTENSION_LOG_INFO, "The new access log is empty. "
                     "Delete it without replacing the current access log...\n");
@@ -87,7 +123,14 @@ public:
                 return;
             }
 
-            if (access(prev.c_str(), F_OK) == 0 && remove(prev.c_str()) == -1) {
+            // The deltas were against the current log, so they go before
+            // it is replaced: should this stop halfway, warmup must not
+            // find them next to the new one.
+            if (access(delta.c_str(), F_OK) == 0 && remove(delta.c_str()) == -1) {
+                LOG(EXTENSION_LOG_WARNING, "FATAL: Failed to remove '%s': %s",
+                    delta.c_str(), strerror(errno));
+                remove(next.c_str());
+            } else if (access(prev.c_str(), F_OK) == 0 && remove(prev.c_str()) == -1) {
                 LOG(EXTENSION_LOG_WARNING, "FATAL: Failed to remove '%s': %s",
                     prev.c_str(), strerror(errno));
                 remove(next.c_str());
@@ -99,6 +142,9 @@ public:
                 LOG(EXTENSION_LOG_WARNING, "FATAL: Failed to rename '%s' to '%s': %s",
                     next.c_str(), name.c_str(), strerror(errno));
                 remove(next.c_str());
+            } else {
+                stats.alogBaseItems.set(num_items);
+                stats.alogDeltaItems.set(0);
             }
         }
     }
@@ -110,33 +156,38 @@ private:
     std::string prev;
     std::string next;
     std::string name;
+    std::string delta;
 
     MutationLog *log;
+    //! True if every item is logged, false if only the changed ones are.
+    bool full;
+    //! Size of the log before this run appended to it.
+    size_t startSize;
     bool *stateFinalizer;
 };
 
 AccessScanner::AccessScanner(EventuallyPersistentStore &_store, EPStats &st,
                              size_t sleeptime) :
+    GlobalTask(&_store.getEPEngine(), Priority::AccessScannerPriority,
+               sleeptime,
+               _store.getEPEngine().getConfiguration().getAlogTaskTime(),
+               false),
     store(_store), stats(st), sleepTime(sleeptime), available(true)
 { }
 
-bool AccessScanner::callback(Dispatcher &d, TaskId &t) {
+bool AccessScanner::run() {
     if (available) {
         available = false;
         shared_ptr<ItemAccessVisitor> pv(new ItemAccessVisitor(store, stats, &available));
         store.resetAccessScannerTasktime();
-        store.visit(pv, "Item access scanner", &d, Priority::AccessScannerPriority);
+        store.visit(pv, "Item access scanner", AUXIO_TASK_IDX,
+                    Priority::AccessScannerPriority);
     }
-    d.snooze(t, sleepTime);
-    stats.alogTime.set(t->getWaketime().tv_sec);
+    snooze(sleepTime, false);
+    stats.alogTime.set(getWaketime().tv_sec);
     return true;
 }
 
-std::string AccessScanner::description() {
+std::string AccessScanner::getDescription() {
     return std::string("Generating access log");
 }
-
-size_t AccessScanner::startTime() {
-    Configuration &cfg = store.getEPEngine().getConfiguration();
-    return cfg.getAlogTaskTime();
-}
@@ -23,21 +23,20 @@
 #include <string>
 
 #include "common.h"
-#include "dispatcher.h"
 #include "ep_engine.h"
+#include "tasks.h"
 
 // Forward declaration.
 class EventuallyPersistentStore;
 class AccessScannerValueChangeListener;
 
-class AccessScanner : public DispatcherCallback {
+class AccessScanner : public GlobalTask {
     friend class AccessScannerValueChangeListener;
 public:
     AccessScanner(EventuallyPersistentStore &_store, EPStats &st,
                   size_t sleetime);
-    bool callback(Dispatcher &d, TaskId &t);
-    std::string description();
-    size_t startTime();
+    bool run();
+    std::string getDescription();
 
 private:
     EventuallyPersistentStore &store;
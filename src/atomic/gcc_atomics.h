@@ -27,4 +27,17 @@
 #define ep_sync_lock_test_and_set(a, b) __sync_lock_test_and_set(a, b)
 #define ep_sync_synchronize() __sync_synchronize()
 
+/*
+ * Order loads against later loads and stores (read barrier), and
+ * stores against later stores (write barrier).  x86 never reorders
+ * any of these, so there only the compiler has to be stopped.
+ */
+#if defined(__i386__) || defined(__x86_64__)
+#define ep_sync_read_barrier() __asm__ __volatile__("" ::: "memory")
+#define ep_sync_write_barrier() __asm__ __volatile__("" ::: "memory")
+#else
+#define ep_sync_read_barrier() __sync_synchronize()
+#define ep_sync_write_barrier() __sync_synchronize()
+#endif
+
 #endif  // SRC_ATOMIC_GCC_ATOMICS_H_
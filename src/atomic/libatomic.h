@@ -43,6 +43,14 @@ inline void ep_sync_synchronize(void) {
 
 }
 
+inline void ep_sync_read_barrier(void) {
+    membar_consumer();
+}
+
+inline void ep_sync_write_barrier(void) {
+    membar_producer();
+}
+
 inline rel_time_t ep_sync_add_and_fetch(volatile uint64_t *dest, uint64_t value) {
      if (value == 1) {
          return atomic_inc_64_nv(dest);
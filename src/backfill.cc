@@ -22,6 +22,7 @@
 #include "atomic.h"
 #include "backfill.h"
 #include "ep.h"
+#include "iomanager/iomanager.h"
 #include "vbucket.h"
 
 static bool isMemoryUsageTooHigh(EPStats &stats) {
@@ -61,12 +62,22 @@ void BackfillDiskCallback::callback(GetValue &gv) {
     }
 }
 
-bool BackfillDiskLoad::callback(Dispatcher &d, TaskId &t) {
+bool BackfillDiskLoad::run() {
     if (isMemoryUsageTooHigh(engine->getEpStats())) {
         LOG(EXTENSION_LOG_INFO, "VBucket %d backfill task from disk is "
             "temporarily suspended  because the current memory usage is too high",
             vbucket);
-        d.snooze(t, 1);
+        snooze(1, false);
+        return true;
+    }
+
+    ssize_t queueMem = connMap.queueMemory(name);
+    if (queueMem > 0 && static_cast<size_t>(queueMem) >
+        engine->getTapConfig().getQueueMemLimit()) {
+        LOG(EXTENSION_LOG_INFO, "VBucket %d backfill task from disk is "
+            "temporarily suspended because %s has too much to send",
+            vbucket, name.c_str());
+        snooze(1, false);
         return true;
     }
 
@@ -96,7 +107,7 @@ bool BackfillDiskLoad::callback(Dispatcher &d, TaskId &t) {
     return false;
 }
 
-std::string BackfillDiskLoad::description() {
+std::string BackfillDiskLoad::getDescription() {
     std::stringstream rv;
     rv << "Loading TAP backfill from disk for vb " << vbucket;
     return rv.str();
@@ -165,20 +176,15 @@ void BackFillVisitor::apply(void) {
     if (efficientVBDump) {
         std::map<uint16_t, backfill_t>::iterator it = vbuckets.begin();
         for (; it != vbuckets.end(); ++it) {
-            Dispatcher *d(engine->epstore->getAuxIODispatcher());
             KVStore *underlying(engine->epstore->getAuxUnderlying());
-            assert(d);
             LOG(EXTENSION_LOG_INFO,
                 "Schedule a full backfill from disk for vbucket %d.\n",
                 it->first);
-            shared_ptr<DispatcherCallback> cb(new BackfillDiskLoad(name,
-                                                                   engine,
-                                                                   *engine->tapConnMap,
-                                                                   underlying,
-                                                                   it->first,
-                                                                   it->second,
-                                                                   connToken));
-            d->schedule(cb, NULL, Priority::TapBgFetcherPriority);
+            ExTask task = new BackfillDiskLoad(name, engine,
+                                               *engine->tapConnMap,
+                                               underlying, it->first,
+                                               it->second, connToken);
+            IOManager::get()->scheduleTask(task, AUXIO_TASK_IDX);
         }
         vbuckets.clear();
     }
@@ -197,7 +203,7 @@ void BackFillVisitor::setEvents() {
 bool BackFillVisitor::pauseVisitor() {
     bool pause(true);
 
-    ssize_t theSize(engine->tapConnMap->backfillQueueDepth(name));
+    ssize_t theSize(engine->tapConnMap->queueMemory(name));
     if (!checkValidity() || theSize < 0) {
         LOG(EXTENSION_LOG_WARNING, "TapProducer %s went away. Stopping backfill",
             name.c_str());
@@ -205,11 +211,11 @@ bool BackFillVisitor::pauseVisitor() {
         return false;
     }
 
-    ssize_t maxBackfillSize = engine->getTapConfig().getBackfillBacklogLimit();
-    pause = theSize > maxBackfillSize;
+    size_t maxBackfillSize = engine->getTapConfig().getQueueMemLimit();
+    pause = static_cast<size_t>(theSize) > maxBackfillSize;
 
     if (pause) {
-        LOG(EXTENSION_LOG_INFO, "Tap queue depth is too big for %s!!! ",
+        LOG(EXTENSION_LOG_INFO, "Tap queue memory is too big for %s!!! "
             "Pausing backfill temporarily...\n", name.c_str());
     }
     return pause;
@@ -235,9 +241,8 @@ bool BackFillVisitor::checkValidity() {
     return valid;
 }
 
-bool BackfillTask::callback(Dispatcher &d, TaskId &t) {
-    (void) t;
-    engine->getEpStore()->visit(bfv, "Backfill task", &d,
-                                Priority::BackfillTaskPriority, true, 1);
+bool BackfillTask::run() {
+    engine->getEpStore()->visit(bfv, "Backfill task", NONIO_TASK_IDX,
+                                Priority::BackfillTaskPriority, 1);
     return false;
 }
@@ -28,9 +28,9 @@
 #include <string>
 
 #include "common.h"
-#include "dispatcher.h"
 #include "ep_engine.h"
 #include "stats.h"
+#include "tasks.h"
 
 
 
@@ -42,30 +42,28 @@ typedef enum backfill_t {
 } backfill_t;
 
 /**
- * Dispatcher callback responsible for bulk backfilling tap queues
- * from a KVStore.
+ * Task responsible for bulk backfilling tap queues from a KVStore.
  *
  * Note that this is only used if the KVStore reports that it has
  * efficient vbucket ops.
  */
-class BackfillDiskLoad : public DispatcherCallback {
+class BackfillDiskLoad : public GlobalTask {
 public:
 
     BackfillDiskLoad(const std::string &n, EventuallyPersistentEngine* e,
                      TapConnMap &tcm, KVStore *s, uint16_t vbid, backfill_t type,
                      hrtime_t token)
-        : name(n), engine(e), connMap(tcm), store(s), vbucket(vbid), backfillType(type),
+        : GlobalTask(e, Priority::TapBgFetcherPriority, 0, NO_START_TIME,
+                     false),
+          name(n), connMap(tcm), store(s), vbucket(vbid), backfillType(type),
        connToken(token) { }
 
-    void callback(GetValue &gv);
+    bool run();
 
-    bool callback(Dispatcher &, TaskId &);
-
-    std::string description();
+    std::string getDescription();
 
 private:
     const std::string           name;
-    EventuallyPersistentEngine *engine;
     TapConnMap                 &connMap;
     KVStore                    *store;
     uint16_t                    vbucket;
@@ -123,28 +121,28 @@ private:
 };
 
 /**
- * Backfill task scheduled by non-IO dispatcher. Each backfill task performs backfill from
+ * Backfill task run by the non-IO threads. Each backfill task performs backfill from
  * memory or disk depending on the resident ratio. Each backfill task can backfill more than one
  * vbucket, but will snooze for 1 sec if the current backfill backlog for the corresponding TAP
  * producer is greater than the threshold (5000 by default).
  */
-class BackfillTask : public DispatcherCallback {
+class BackfillTask : public GlobalTask {
 public:
 
     BackfillTask(EventuallyPersistentEngine *e, TapProducer *tc,
                  const VBucketFilter &backfillVBFilter):
-      bfv(new BackFillVisitor(e, tc, backfillVBFilter)), engine(e) {}
+      GlobalTask(e, Priority::BackfillTaskPriority, 0, NO_START_TIME, false),
+      bfv(new BackFillVisitor(e, tc, backfillVBFilter)) {}
 
     virtual ~BackfillTask() {}
 
-    bool callback(Dispatcher &d, TaskId &t);
+    bool run();
 
-    std::string description() {
+    std::string getDescription() {
         return std::string("Backfilling items from memory and disk.");
     }
 
     shared_ptr<BackFillVisitor> bfv;
-    EventuallyPersistentEngine *engine;
 };
 
 #endif  // SRC_BACKFILL_H_
@@ -46,6 +46,10 @@ void BgFetcher::stop() {
 
 void BgFetcher::notifyBGEvent(void) {
     ++stats.numRemainingBgJobs;
+    wakeUp();
+}
+
+void BgFetcher::wakeUp(void) {
     if (pendingFetch.cas(false, true)) {
         LockHolder lh(taskMutex);
         assert(taskId > 0);
@@ -87,6 +91,7 @@ void BgFetcher::doFetch(uint16_t vbId) {
         store->completeBGFetchMulti(vbId, fetchedItems, startTime);
         stats.getMultiHisto.add((gethrtime()-startTime)/1000, totalfetches);
     }
+    stats.getMultiBatchSizeHisto.add(items2fetch.size());
 
     // failed requests will get requeued for retry within clearItems()
     clearItems(vbId);
@@ -129,7 +134,20 @@ void BgFetcher::clearItems(uint16_t vbId) {
 
 bool BgFetcher::run(size_t tid) {
     assert(tid > 0);
+
+    hrtime_t hold = window.get();
+    if (!holding && hold > 0 && pendingFetch.get()) {
+        // Let more fetches queue up before going to disk.  As long as
+        // pendingFetch is set, wakeUp() leaves us sleeping.
+        holding = true;
+        IOManager::get()->snooze(taskId, static_cast<double>(hold) / 1000000);
+        return true;
+    }
+    holding = false;
+
     size_t num_fetched_items = 0;
+    hrtime_t start = gethrtime();
+    hrtime_t oldest = start;
 
     pendingFetch.cas(true, false);
 
@@ -147,6 +165,13 @@ bool BgFetcher::run(size_t tid) {
         uint16_t vbId = *ita;
         RCPtr<VBucket> vb = shard->getBucket(vbId);
         if (vb && vb->getBGFetchItems(items2fetch)) {
+            vb_bgfetch_queue_t::iterator qit = items2fetch.begin();
+            for (; qit != items2fetch.end(); ++qit) {
+                std::list<VBucketBGFetchItem *>::iterator fit;
+                for (fit = qit->second.begin(); fit != qit->second.end(); ++fit) {
+                    oldest = std::min(oldest, (*fit)->initTime);
+                }
+            }
             doFetch(vbId);
             num_fetched_items += items2fetch.size();
             items2fetch.clear();
@@ -155,6 +180,12 @@ bool BgFetcher::run(size_t tid) {
 
     stats.numRemainingBgJobs.decr(num_fetched_items);
 
+    if (num_fetched_items > 0) {
+        adjustWindow(num_fetched_items, (gethrtime() - oldest) / 1000,
+                     lastBatch ? (start - lastBatch) / 1000 : 0);
+        lastBatch = start;
+    }
+
     if (!pendingFetch.get()) {
         // wait a bit until next fetch request arrives
         double sleep = std::max(store->getBGFetchDelay(), sleepInterval);
@@ -169,6 +200,11 @@ bool BgFetcher::run(size_t tid) {
     return true;
 }
 
+void BgFetcher::adjustWindow(size_t items, hrtime_t latency, hrtime_t gap) {
+    window.set(nextWindow(window.get(), store->getBGFetchLatencyTarget(),
+                          items, latency, gap));
+}
+
 bool BgFetcher::pendingJob() {
     std::vector<int> vbIds = shard->getVBuckets();
     size_t numVbuckets = vbIds.size();
@@ -20,21 +20,79 @@
 
 #include "config.h"
 
+#include <algorithm>
 #include <list>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "common.h"
-#include "dispatcher.h"
 #include "item.h"
 #include "stats.h"
 
 const uint16_t MAX_BGFETCH_RETRY=5;
 
+/**
+ * The keys of a batch get and what was found for each of them.
+ *
+ * The keys that aren't resident are fetched from disk together, and
+ * the connection is notified once the last of them is in.
+ */
+class MultiGetBatch {
+public:
+
+    struct Entry {
+        Entry(const std::string &k, uint16_t vb) :
+            key(k), vbucket(vb), item(NULL), status(ENGINE_KEY_ENOENT) {}
+
+        std::string       key;
+        uint16_t          vbucket;
+        //! The item found; only set if the status is ENGINE_SUCCESS.
+        Item             *item;
+        ENGINE_ERROR_CODE status;
+    };
+
+    MultiGetBatch(const void *c) : cookie(c), start(gethrtime()), pending(1) {}
+
+    /**
+     * Count one more key the batch waits for.
+     */
+    void addPending() {
+        ++pending;
+    }
+
+    /**
+     * Count a key the batch waited for (or the caller that put the
+     * batch together) as done.
+     *
+     * @return true if the batch doesn't wait for anything else
+     */
+    bool completed() {
+        return --pending == 0;
+    }
+
+    std::vector<Entry> entries;
+    const void        *cookie;
+    hrtime_t           start;
+
+private:
+    Atomic<size_t>     pending;
+
+    DISALLOW_COPY_AND_ASSIGN(MultiGetBatch);
+};
+
 class VBucketBGFetchItem {
 public:
     VBucketBGFetchItem(const std::string &k, uint64_t s, const void *c) :
-                       key(k), cookie(c), retryCount(0), initTime(gethrtime()) {
+                       key(k), cookie(c), retryCount(0), initTime(gethrtime()),
+                       batch(NULL), batchPos(0) {
+        value.setId(s);
+    }
+
+    VBucketBGFetchItem(MultiGetBatch *b, size_t pos, uint64_t s) :
+                       key(b->entries[pos].key), cookie(b->cookie),
+                       retryCount(0), initTime(gethrtime()),
+                       batch(b), batchPos(pos) {
         value.setId(s);
     }
     ~VBucketBGFetchItem() {}
@@ -58,6 +116,9 @@ public:
     GetValue value;
     uint16_t retryCount;
     hrtime_t initTime;
+    //! The batch get this fetch is for, if any.
+    MultiGetBatch *batch;
+    size_t batchPos;
 };
 
 typedef unordered_map<uint64_t, std::list<VBucketBGFetchItem *> > vb_bgfetch_queue_t;
@@ -68,8 +129,8 @@ class EventuallyPersistentStore;
 class KVShard;
 
 /**
- * Dispatcher job responsible for batching data reads and push to
- * underlying storage
+ * Reader task of a shard responsible for batching its data reads and
+ * pushing them to the underlying storage.
  */
 class BgFetcher {
 public:
@@ -78,10 +139,12 @@ public:
      * Construct a BgFetcher task.
      *
      * @param s the store
-     * @param d the dispatcher
+     * @param k the shard it fetches for
+     * @param st the engine's stats
      */
     BgFetcher(EventuallyPersistentStore *s, KVShard *k, EPStats &st) :
-        store(s), shard(k), taskId(0), stats(st) {}
+        store(s), shard(k), taskId(0), stats(st), window(0), holding(false),
+        lastBatch(0) {}
     ~BgFetcher() {
         LockHolder lh(queueMutex);
         if (!pendingVbs.empty()) {
@@ -97,16 +160,55 @@ public:
     bool run(size_t tid);
     bool pendingJob(void);
     void notifyBGEvent(void);
+    /**
+     * Wake the fetcher up for items queued without notifyBGEvent().
+     */
+    void wakeUp(void);
     void setTaskId(size_t newId) { taskId = newId; }
     void addPendingVB(uint16_t vbId) {
         LockHolder lh(queueMutex);
         pendingVbs.insert(vbId);
     }
 
+    /**
+     * Get the time (µs) this fetcher last chose to hold fetches for.
+     */
+    hrtime_t getWindow() const { return window.get(); }
+
+    /**
+     * Pick the window to hold the next batch for, given how the last
+     * one went: grow it by a sixteenth of the target while batches
+     * stay within the target, halve it otherwise.
+     *
+     * @param last the window the last batch was held for
+     * @param target the latency target (0 never holds fetches)
+     * @param items number of items the batch fetched
+     * @param latency time (µs) the oldest of them waited in all
+     * @param gap time (µs) since the batch before it was started
+     */
+    static hrtime_t nextWindow(hrtime_t last, hrtime_t target, size_t items,
+                               hrtime_t latency, hrtime_t gap) {
+        if (target == 0) {
+            return 0;
+        }
+        if (latency <= target && (items > 1 || gap <= target)) {
+            // The fetches come in often enough to be batched, and
+            // there's room left before the target: hold them a bit
+            // longer.
+            return std::min(last + target / 16, target);
+        }
+        // Too slow, or nothing to batch: back off quickly, so that an
+        // idle fetcher goes to disk right away.
+        last /= 2;
+        return last < target / 64 ? 0 : last;
+    }
+
 private:
     void doFetch(uint16_t vbId);
     void clearItems(uint16_t vbId);
 
+    void adjustWindow(size_t items, hrtime_t latency, hrtime_t gap);
+
     EventuallyPersistentStore *store;
     KVShard *shard;
     vb_bgfetch_queue_t items2fetch;
@@ -117,6 +219,15 @@ private:
 
     Atomic<bool> pendingFetch;
     std::set<uint16_t> pendingVbs;
+
+    //! Time (µs) to hold fetches for before going to disk; only
+    //! written by run(), read for the stats.
+    Atomic<hrtime_t> window;
+    // Only touched by run().
+    //! True while the fetches queued are held for the window.
+    bool holding;
+    //! When the last batch was started.
+    hrtime_t lastBatch;
 };
 
 #endif  // SRC_BGFETCHER_H_
@@ -58,6 +58,139 @@ private:
     CheckpointConfig &config;
 };
 
+void CheckpointQueue::push_back(const queued_item &qi, uint64_t mutationId) {
+    if (count == chunks.size() * CHUNK_ENTRIES) {
+        chunks.push_back(new checkpoint_entry[CHUNK_ENTRIES]);
+    }
+    checkpoint_entry &entry = chunks[count / CHUNK_ENTRIES][count % CHUNK_ENTRIES];
+    entry.item = qi;
+    entry.mutation_id = mutationId;
+    ++count;
+}
+
+void CheckpointQueue::pop_back() {
+    assert(count > 0);
+    --count;
+    checkpoint_entry &entry = chunks[count / CHUNK_ENTRIES][count % CHUNK_ENTRIES];
+    entry.item.reset();
+    entry.mutation_id = 0;
+    if (count % CHUNK_ENTRIES == 0) {
+        delete []chunks.back();
+        chunks.pop_back();
+    }
+}
+
+void CheckpointQueue::clear() {
+    std::vector<checkpoint_entry*>::iterator it = chunks.begin();
+    for (; it != chunks.end(); ++it) {
+        delete []*it;
+    }
+    chunks.clear();
+    count = 0;
+}
+
+const size_t CheckpointIndex::npos = static_cast<size_t>(-1);
+
+uint32_t CheckpointIndex::hashKey(const std::string &key) {
+    // FNV-1a
+    uint32_t h = 2166136261U;
+    for (size_t i = 0; i < key.size(); ++i) {
+        h ^= static_cast<unsigned char>(key[i]);
+        h *= 16777619U;
+    }
+    return h;
+}
+
+size_t CheckpointIndex::lookup(const std::string &key, uint32_t h,
+                               CheckpointQueue &queue) const {
+    size_t mask = table.size() - 1;
+    size_t i = h & mask;
+    while (table[i].position != EMPTY_SLOT) {
+        if (table[i].hash == h &&
+            queue[table[i].position].item->getKey() == key) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+size_t CheckpointIndex::find(const std::string &key, CheckpointQueue &queue) const {
+    if (used == 0) {
+        return npos;
+    }
+    size_t i = lookup(key, hashKey(key), queue);
+    return table[i].position == EMPTY_SLOT ? npos : table[i].position;
+}
+
+void CheckpointIndex::set(const std::string &key, size_t pos, CheckpointQueue &queue) {
+    assert(pos < EMPTY_SLOT);
+    // Keep at least a quarter of the slots empty.
+    if ((used + 1) * 4 > table.size() * 3) {
+        grow();
+    }
+    uint32_t h = hashKey(key);
+    size_t i = lookup(key, h, queue);
+    if (table[i].position == EMPTY_SLOT) {
+        table[i].hash = h;
+        ++used;
+    }
+    table[i].position = static_cast<uint32_t>(pos);
+}
+
+void CheckpointIndex::erase(const std::string &key, CheckpointQueue &queue) {
+    if (used == 0) {
+        return;
+    }
+    size_t i = lookup(key, hashKey(key), queue);
+    if (table[i].position == EMPTY_SLOT) {
+        return;
+    }
+    // Shift back the slots after it that would no longer be reachable.
+    size_t mask = table.size() - 1;
+    size_t j = i;
+    while (true) {
+        j = (j + 1) & mask;
+        if (table[j].position == EMPTY_SLOT) {
+            break;
+        }
+        size_t home = table[j].hash & mask;
+        bool reachable = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (!reachable) {
+            table[i] = table[j];
+            i = j;
+        }
+    }
+    table[i].position = EMPTY_SLOT;
+    --used;
+}
+
+void CheckpointIndex::remap(const std::vector<size_t> &newPositions) {
+    std::vector<index_slot>::iterator it = table.begin();
+    for (; it != table.end(); ++it) {
+        if (it->position != EMPTY_SLOT) {
+            it->position = static_cast<uint32_t>(newPositions[it->position]);
+        }
+    }
+}
+
+void CheckpointIndex::grow() {
+    index_slot empty = {EMPTY_SLOT, 0};
+    std::vector<index_slot> old(table.empty() ? 8 : table.size() * 2, empty);
+    table.swap(old);
+    size_t mask = table.size() - 1;
+    std::vector<index_slot>::iterator it = old.begin();
+    for (; it != old.end(); ++it) {
+        if (it->position != EMPTY_SLOT) {
+            size_t i = it->hash & mask;
+            while (table[i].position != EMPTY_SLOT) {
+                i = (i + 1) & mask;
+            }
+            table[i] = *it;
+        }
+    }
+}
+
 Checkpoint::~Checkpoint() {
     LOG(EXTENSION_LOG_INFO,
         "Checkpoint %llu for vbucket %d is purged from memory",
@@ -71,14 +204,16 @@ void Checkpoint::setState(checkpoint_state state) {
 }
 
 void Checkpoint::popBackCheckpointEndItem() {
-    if (!toWrite.empty() && toWrite.back()->getOperation() == queue_op_checkpoint_end) {
-        keyIndex.erase(toWrite.back()->getKey());
+    if (!toWrite.empty() && toWrite[toWrite.size() - 1].item &&
+        toWrite[toWrite.size() - 1].item->getOperation() == queue_op_checkpoint_end) {
+        keyIndex.erase(toWrite[toWrite.size() - 1].item->getKey(), toWrite);
         toWrite.pop_back();
+        updateMemOverhead();
     }
 }
 
 bool Checkpoint::keyExists(const std::string &key) {
-    return keyIndex.find(key) != keyIndex.end();
+    return keyIndex.find(key, toWrite) != CheckpointIndex::npos;
 }
 
 queue_dirty_t Checkpoint::queueDirty(const queued_item &qi, CheckpointManager *checkpointManager) {
@@ -87,127 +222,158 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi, CheckpointManager *c
     uint64_t newMutationId = checkpointManager->nextMutationId();
     queue_dirty_t rv;
 
-    checkpoint_index::iterator it = keyIndex.find(qi->getKey());
+    size_t currPos = CheckpointIndex::npos;
+    if (qi->getKey().size() > 0) {
+        currPos = keyIndex.find(qi->getKey(), toWrite);
+    }
     // Check if this checkpoint already had an item for the same key.
-    if (it != keyIndex.end()) {
+    if (currPos != CheckpointIndex::npos) {
         rv = EXISTING_ITEM;
-        std::list<queued_item>::iterator currPos = it->second.position;
-        uint64_t currMutationId = it->second.mutation_id;
         CheckpointCursor &pcursor = checkpointManager->persistenceCursor;
 
-        if (*(pcursor.currentCheckpoint) == this) {
-            // If the existing item is in the left-hand side of the item pointed by the
-            // persistence cursor, decrease the persistence cursor's offset by 1.
-            const std::string &key = (*(pcursor.currentPos))->getKey();
-            checkpoint_index::iterator ita = keyIndex.find(key);
-            if (ita != keyIndex.end()) {
-                uint64_t mutationId = ita->second.mutation_id;
-                if (currMutationId <= mutationId) {
-                    checkpointManager->decrCursorOffset_UNLOCKED(pcursor, 1);
-                    rv = PERSIST_AGAIN;
-                }
-            }
-            // If the persistence cursor points to the existing item for the same key,
-            // shift the cursor left by 1.
-            if (pcursor.currentPos == currPos) {
-                checkpointManager->decrCursorPos_UNLOCKED(pcursor);
-            }
+        // If the existing item is in the left-hand side of the item pointed by the
+        // persistence cursor, decrease the persistence cursor's offset by 1.
+        if (*(pcursor.currentCheckpoint) == this && currPos <= pcursor.currentPos) {
+            checkpointManager->decrCursorOffset_UNLOCKED(pcursor, 1);
+            rv = PERSIST_AGAIN;
         }
 
         std::map<const std::string, CheckpointCursor>::iterator map_it;
         for (map_it = checkpointManager->tapCursors.begin();
              map_it != checkpointManager->tapCursors.end(); ++map_it) {
-
-            if (*(map_it->second.currentCheckpoint) == this) {
-                const std::string &key = (*(map_it->second.currentPos))->getKey();
-                checkpoint_index::iterator ita = keyIndex.find(key);
-                if (ita != keyIndex.end()) {
-                    uint64_t mutationId = ita->second.mutation_id;
-                    if (currMutationId <= mutationId) {
-                        checkpointManager->decrCursorOffset_UNLOCKED(map_it->second, 1);
-                    }
-                }
-                // If an TAP cursor points to the existing item for the same key, shift it left by 1
-                if (map_it->second.currentPos == currPos) {
-                    checkpointManager->decrCursorPos_UNLOCKED(map_it->second);
-                }
+            if (*(map_it->second.currentCheckpoint) == this &&
+                currPos <= map_it->second.currentPos) {
+                checkpointManager->decrCursorOffset_UNLOCKED(map_it->second, 1);
             }
         }
 
-        queued_item &existing_itm = *currPos;
-        existing_itm->setOperation(qi->getOperation());
-        existing_itm->setQueuedTime(qi->getQueuedTime());
-        toWrite.push_back(existing_itm);
-        // Remove the existing item for the same key from the list.
-        toWrite.erase(currPos);
+        // The new item goes to the tail, and the existing entry becomes a
+        // tombstone. Cursors sitting on the tombstone simply skip it. The
+        // existing item isn't reused, as the flusher or a TAP connection
+        // may still hold it with its old mutation id.
+        qi->setMutationId(newMutationId);
+        toWrite.push_back(qi, newMutationId);
+        keyIndex.set(qi->getKey(), toWrite.size() - 1, toWrite);
+        toWrite[currPos].item.reset();
+        ++numTombstones;
+
+        // Don't let a few hot keys fill the checkpoint up with tombstones.
+        if (numTombstones > CheckpointQueue::CHUNK_ENTRIES &&
+            numTombstones > toWrite.size() / 2) {
+            compact(checkpointManager);
+        }
     } else {
         if (qi->getOperation() == queue_op_set || qi->getOperation() == queue_op_del) {
             ++numItems;
         }
         rv = NEW_ITEM;
-        // Push the new item into the list
-        toWrite.push_back(qi);
+        // Push the new item into the queue
+        qi->setMutationId(newMutationId);
+        toWrite.push_back(qi, newMutationId);
+        if (qi->getKey().size() > 0) {
+            keyIndex.set(qi->getKey(), toWrite.size() - 1, toWrite);
+        }
     }
 
-    if (qi->getKey().size() > 0) {
-        std::list<queued_item>::iterator last = toWrite.end();
-        // --last is okay as the list is not empty now.
-        index_entry entry = {--last, newMutationId};
-        // Set the index of the key to the new item that is pushed back into the list.
-        keyIndex[qi->getKey()] = entry;
-        if (rv == NEW_ITEM) {
-            size_t newEntrySize = qi->getKey().size() + sizeof(index_entry) + sizeof(queued_item);
-            memOverhead += newEntrySize;
-            stats.memOverhead.incr(newEntrySize);
-            assert(stats.memOverhead.get() < GIGANTOR);
+    updateMemOverhead();
+    return rv;
+}
+
+void Checkpoint::compact(CheckpointManager *checkpointManager) {
+    CheckpointQueue live;
+    std::vector<size_t> newPositions(toWrite.size());
+    for (size_t pos = 0; pos < toWrite.size(); ++pos) {
+        checkpoint_entry &entry = toWrite[pos];
+        if (entry.item) {
+            live.push_back(entry.item, entry.mutation_id);
+        }
+        // A cursor on a tombstone has consumed the last item before it.
+        newPositions[pos] = live.empty() ? 0 : live.size() - 1;
+    }
+    toWrite.swap(live);
+    keyIndex.remap(newPositions);
+    numTombstones = 0;
+
+    CheckpointCursor &pcursor = checkpointManager->persistenceCursor;
+    if (*(pcursor.currentCheckpoint) == this) {
+        pcursor.currentPos = newPositions[pcursor.currentPos];
+    }
+    std::map<const std::string, CheckpointCursor>::iterator map_it;
+    for (map_it = checkpointManager->tapCursors.begin();
+         map_it != checkpointManager->tapCursors.end(); ++map_it) {
+        if (*(map_it->second.currentCheckpoint) == this) {
+            map_it->second.currentPos = newPositions[map_it->second.currentPos];
         }
     }
-    return rv;
+}
+
+void Checkpoint::updateMemOverhead() {
+    size_t newOverhead = toWrite.memorySize() + keyIndex.memorySize();
+    if (newOverhead > memOverhead) {
+        stats.memOverhead.incr(newOverhead - memOverhead);
+    } else if (newOverhead < memOverhead) {
+        stats.memOverhead.decr(memOverhead - newOverhead);
+    }
+    memOverhead = newOverhead;
+    assert(stats.memOverhead.get() < GIGANTOR);
 }
 
 size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
     size_t numNewItems = 0;
-    size_t newEntryMemOverhead = 0;
-    std::list<queued_item>::reverse_iterator rit = pPrevCheckpoint->rbegin();
 
     LOG(EXTENSION_LOG_INFO,
         "Collapse the checkpoint %llu into the checkpoint %llu for vbucket %d",
         pPrevCheckpoint->getId(), checkpointId, vbucketId);
 
-    keyIndex["dummy_key"].mutation_id =
-        pPrevCheckpoint->getMutationIdForKey("dummy_key");
-    keyIndex["checkpoint_start"].mutation_id =
-        pPrevCheckpoint->getMutationIdForKey("checkpoint_start");
-    for (; rit != pPrevCheckpoint->rend(); ++rit) {
-        const std::string &key = (*rit)->getKey();
-        if ((*rit)->getOperation() != queue_op_del &&
-            (*rit)->getOperation() != queue_op_set) {
+    // Skip the first two meta items
+    size_t dummyPos = begin();
+    size_t startPos = next(dummyPos);
+    assert(startPos < end());
+
+    CheckpointQueue merged;
+    std::vector<size_t> newPositions(toWrite.size());
+    for (size_t pos = 0; pos <= startPos; ++pos) {
+        merged.push_back(toWrite[pos].item, toWrite[pos].mutation_id);
+        newPositions[pos] = pos;
+    }
+    size_t prevDummyPos = pPrevCheckpoint->begin();
+    merged[dummyPos].mutation_id = pPrevCheckpoint->getMutationId(prevDummyPos);
+    merged[startPos].mutation_id =
+        pPrevCheckpoint->getMutationId(pPrevCheckpoint->next(prevDummyPos));
+
+    size_t pos = prevDummyPos;
+    for (; pos != pPrevCheckpoint->end(); pos = pPrevCheckpoint->next(pos)) {
+        const queued_item &qi = pPrevCheckpoint->at(pos);
+        if (qi->getOperation() != queue_op_del &&
+            qi->getOperation() != queue_op_set) {
             continue;
         }
-        checkpoint_index::iterator it = keyIndex.find(key);
-        if (it == keyIndex.end()) {
-            std::list<queued_item>::iterator pos = toWrite.begin();
-            // Skip the first two meta items
-            ++pos; ++pos;
-            toWrite.insert(pos, *rit);
-            index_entry entry = {--pos, pPrevCheckpoint->getMutationIdForKey(key)};
-            keyIndex[key] = entry;
-            newEntryMemOverhead += key.size() + sizeof(index_entry);
+        if (!keyExists(qi->getKey())) {
+            merged.push_back(qi, pPrevCheckpoint->getMutationId(pos));
             ++numItems;
             ++numNewItems;
         }
     }
-    memOverhead += newEntryMemOverhead;
-    stats.memOverhead.incr(newEntryMemOverhead);
-    assert(stats.memOverhead.get() < GIGANTOR);
+
+    for (pos = startPos + 1; pos < toWrite.size(); ++pos) {
+        merged.push_back(toWrite[pos].item, toWrite[pos].mutation_id);
+        newPositions[pos] = pos + numNewItems;
+    }
+    toWrite.swap(merged);
+    keyIndex.remap(newPositions);
+    for (pos = startPos + 1; pos <= startPos + numNewItems; ++pos) {
+        keyIndex.set(toWrite[pos].item->getKey(), pos, toWrite);
+    }
+
+    updateMemOverhead();
     return numNewItems;
 }
 
 uint64_t Checkpoint::getMutationIdForKey(const std::string &key) {
     uint64_t mid = 0;
-    checkpoint_index::iterator it = keyIndex.find(key);
-    if (it != keyIndex.end()) {
-        mid = it->second.mutation_id;
+    size_t pos = keyIndex.find(key, toWrite);
+    if (pos != CheckpointIndex::npos) {
+        mid = toWrite[pos].mutation_id;
     }
     return mid;
 }
@@ -255,8 +421,8 @@ void CheckpointManager::setOpenCheckpointId_UNLOCKED(uint64_t id) {
         checkpointList.back()->setId(id);
         // Update the checkpoint_start item with the new Id.
         queued_item qi = createCheckpointItem(id, vbucketId, queue_op_checkpoint_start);
-        std::list<queued_item>::iterator it = ++(checkpointList.back()->begin());
-        *it = qi;
+        Checkpoint *chk = checkpointList.back();
+        chk->at(chk->next(chk->begin())) = qi;
     }
 }
 
@@ -272,9 +438,8 @@ bool CheckpointManager::addNewCheckpoint_UNLOCKED(uint64_t id) {
 
     bool empty = checkpointList.empty() ? true : false;
     Checkpoint *checkpoint = new Checkpoint(stats, id, vbucketId, CHECKPOINT_OPEN);
-    // Add a dummy item into the new checkpoint, so that any cursor referring to the actual first
-    // item in this new checkpoint can be safely shifted left by 1 if the first item is removed
-    // and pushed into the tail.
+    // Add a dummy item into the new checkpoint, so that a cursor that hasn't consumed anything
+    // in this new checkpoint yet has an item to point to.
     queued_item dummyItem(new QueuedItem("dummy_key", 0xffff, queue_op_empty));
     checkpoint->queueDirty(dummyItem, this);
 
@@ -289,28 +454,19 @@ bool CheckpointManager::addNewCheckpoint_UNLOCKED(uint64_t id) {
     }
     // Move the persistence cursor to the next checkpoint if it already reached to
     // the end of its current checkpoint.
-    ++(persistenceCursor.currentPos);
-    if (persistenceCursor.currentPos != (*(persistenceCursor.currentCheckpoint))->end()) {
-        if ((*(persistenceCursor.currentPos))->getOperation() == queue_op_checkpoint_end) {
-            // Skip checkpoint_end meta item that is only used by TAP replication cursors.
-            ++(persistenceCursor.offset);
-            ++(persistenceCursor.currentPos); // cursor now reaches to the checkpoint end.
-        }
-    }
-    if (persistenceCursor.currentPos == (*(persistenceCursor.currentCheckpoint))->end()) {
-        if ((*(persistenceCursor.currentCheckpoint))->getState() == CHECKPOINT_CLOSED) {
-            uint64_t chkid = (*(persistenceCursor.currentCheckpoint))->getId();
-            if (moveCursorToNextCheckpoint(persistenceCursor)) {
-                pCursorPreCheckpointId = chkid;
-            } else {
-                --(persistenceCursor.currentPos);
-            }
-        } else {
-            // The persistence cursor is already reached to the end of the open checkpoint.
-            --(persistenceCursor.currentPos);
+    Checkpoint *pchk = *(persistenceCursor.currentCheckpoint);
+    size_t pos = pchk->next(persistenceCursor.currentPos);
+    if (pos != pchk->end() && pchk->at(pos)->getOperation() == queue_op_checkpoint_end) {
+        // Skip checkpoint_end meta item that is only used by TAP replication cursors.
+        ++(persistenceCursor.offset);
+        persistenceCursor.currentPos = pos;
+        pos = pchk->next(pos); // cursor now reaches to the checkpoint end.
+    }
+    if (pos == pchk->end() && pchk->getState() == CHECKPOINT_CLOSED) {
+        uint64_t chkid = pchk->getId();
+        if (moveCursorToNextCheckpoint(persistenceCursor)) {
+            pCursorPreCheckpointId = chkid;
         }
-    } else {
-        --(persistenceCursor.currentPos);
     }
 
     return true;
@@ -400,7 +556,7 @@ bool CheckpointManager::registerTAPCursor_UNLOCKED(const std::string &name,
         (*it)->registerCursorName(name);
     } else {
         size_t offset = 0;
-        std::list<queued_item>::iterator curr;
+        size_t curr;
 
         LOG(EXTENSION_LOG_DEBUG,
             "Checkpoint %llu for vbucket %d exists in memory. "
@@ -533,11 +689,9 @@ size_t CheckpointManager::removeClosedUnrefCheckpoints(const RCPtr<VBucket> &vbu
         // If the persistence cursor reached to the end of the old open checkpoint, move it to
         // the new open checkpoint.
         if ((*(persistenceCursor.currentCheckpoint))->getId() == oldCheckpointId) {
-            if (++(persistenceCursor.currentPos) ==
-                (*(persistenceCursor.currentCheckpoint))->end()) {
+            Checkpoint *chk = *(persistenceCursor.currentCheckpoint);
+            if (chk->next(persistenceCursor.currentPos) == chk->end()) {
                 moveCursorToNextCheckpoint(persistenceCursor);
-            } else {
-                decrCursorPos_UNLOCKED(persistenceCursor);
             }
         }
         // If any of TAP cursors reached to the end of the old open checkpoint, move them to
@@ -546,10 +700,9 @@ size_t CheckpointManager::removeClosedUnrefCheckpoints(const RCPtr<VBucket> &vbu
         for (; tap_it != tapCursors.end(); ++tap_it) {
             CheckpointCursor &cursor = tap_it->second;
             if ((*(cursor.currentCheckpoint))->getId() == oldCheckpointId) {
-                if (++(cursor.currentPos) == (*(cursor.currentCheckpoint))->end()) {
+                Checkpoint *chk = *(cursor.currentCheckpoint);
+                if (chk->next(cursor.currentPos) == chk->end()) {
                     moveCursorToNextCheckpoint(cursor);
-                } else {
-                    decrCursorPos_UNLOCKED(cursor);
                 }
             }
         }
@@ -659,28 +812,49 @@ void CheckpointManager::collapseClosedCheckpoints(std::list<Checkpoint*> &collap
         --lastClosedChk; --lastClosedChk; // Move to the lastest closed checkpoint.
         fastCursors.insert((*lastClosedChk)->getCursorNameList().begin(),
                            (*lastClosedChk)->getCursorNameList().end());
+        // Merged items go right after the checkpoint_start item.
+        size_t startPos = (*lastClosedChk)->next((*lastClosedChk)->begin());
         std::list<Checkpoint*>::reverse_iterator rit = checkpointList.rbegin();
         ++rit; ++rit;// Move to the second lastest closed checkpoint.
-        size_t numDuplicatedItems = 0, numMetaItems = 0;
+        size_t numDuplicatedItems = 0, numMetaItems = 0, numMergedItems = 0;
         for (; rit != checkpointList.rend(); ++rit) {
             size_t numAddedItems = (*lastClosedChk)->mergePrevCheckpoint(*rit);
             numDuplicatedItems += ((*rit)->getNumItems() - numAddedItems);
             numMetaItems += 2; // checkpoint start and end meta items
+            numMergedItems += numAddedItems;
 
             std::set<std::string>::iterator nameItr =
                 (*rit)->getCursorNameList().begin();
             for (; nameItr != (*rit)->getCursorNameList().end(); ++nameItr) {
                 if (nameItr->compare(persistenceCursor.name) == 0) {
-                    const std::string& key = (*(persistenceCursor.currentPos))->getKey();
-                    slowCursors[*nameItr] = (*rit)->getMutationIdForKey(key);
+                    Checkpoint *chk = *(persistenceCursor.currentCheckpoint);
+                    slowCursors[*nameItr] = chk->getMutationId(persistenceCursor.currentPos);
                 } else {
                     std::map<const std::string, CheckpointCursor>::iterator cc =
                         tapCursors.find(*nameItr);
-                    const std::string& key = (*(cc->second.currentPos))->getKey();
-                    slowCursors[*nameItr] = (*rit)->getMutationIdForKey(key);
+                    Checkpoint *chk = *(cc->second.currentCheckpoint);
+                    slowCursors[*nameItr] = chk->getMutationId(cc->second.currentPos);
                 }
             }
         }
+
+        // The cursors in the last closed checkpoint past its checkpoint_start item keep
+        // pointing to the same items.
+        std::set<std::string>::const_iterator fit = fastCursors.begin();
+        for (; fit != fastCursors.end(); ++fit) {
+            CheckpointCursor *cursor = &persistenceCursor;
+            if (fit->compare(persistenceCursor.name) != 0) {
+                std::map<const std::string, CheckpointCursor>::iterator mit =
+                    tapCursors.find(*fit);
+                if (mit == tapCursors.end()) {
+                    continue;
+                }
+                cursor = &mit->second;
+            }
+            if (cursor->currentCheckpoint == lastClosedChk && cursor->currentPos > startPos) {
+                cursor->currentPos += numMergedItems;
+            }
+        }
         putCursorsInChk(slowCursors, lastClosedChk);
 
         numItems -= (numDuplicatedItems + numMetaItems);
@@ -746,23 +920,24 @@ void CheckpointManager::getAllItemsFromCurrentPosition(CheckpointCursor &cursor,
                 break;
             }
         }
-        while (++(cursor.currentPos) != (*(cursor.currentCheckpoint))->end()) {
-            items.push_back(*(cursor.currentPos));
+        Checkpoint *chk = *(cursor.currentCheckpoint);
+        size_t pos;
+        while ((pos = chk->next(cursor.currentPos)) != chk->end()) {
+            items.push_back(chk->at(pos));
+            cursor.currentPos = pos;
         }
-        if ((*(cursor.currentCheckpoint))->getState() == CHECKPOINT_CLOSED) {
+        if (chk->getState() == CHECKPOINT_CLOSED) {
             if (!moveCursorToNextCheckpoint(cursor)) {
-                --(cursor.currentPos);
                 break;
             }
         } else { // The cursor is currently in the open checkpoint and reached to
                  // the end() of the open checkpoint.
-            --(cursor.currentPos);
             break;
         }
     }
 }
 
-void CheckpointManager::getAllItemsForPersistence(std::vector<queued_item> &items) {
+uint64_t CheckpointManager::getAllItemsForPersistence(std::vector<queued_item> &items) {
     LockHolder lh(queueLock);
     // Get all the items up to the end of the current open checkpoint.
     getAllItemsFromCurrentPosition(persistenceCursor, 0, items);
@@ -772,6 +947,8 @@ void CheckpointManager::getAllItemsForPersistence(std::vector<queued_item> &item
     LOG(EXTENSION_LOG_DEBUG,
         "Grab %ld items through the persistence cursor from vbucket %d",
         items.size(), vbucketId);
+    return (*(persistenceCursor.currentCheckpoint))->getMutationId(
+                                                        persistenceCursor.currentPos);
 }
 
 void CheckpointManager::getAllItemsForTAPConnection(const std::string &name,
@@ -821,22 +998,25 @@ queued_item CheckpointManager::nextItem(const std::string &name, bool &isLastMut
 
 queued_item CheckpointManager::nextItemFromClosedCheckpoint(CheckpointCursor &cursor,
                                                             bool &isLastMutationItem) {
-    ++(cursor.currentPos);
-    if (cursor.currentPos != (*(cursor.currentCheckpoint))->end()) {
+    Checkpoint *chk = *(cursor.currentCheckpoint);
+    size_t pos = chk->next(cursor.currentPos);
+    if (pos != chk->end()) {
+        cursor.currentPos = pos;
         ++(cursor.offset);
         isLastMutationItem = isLastMutationItemInCheckpoint(cursor);
-        return *(cursor.currentPos);
+        return chk->at(pos);
     } else {
         if (!moveCursorToNextCheckpoint(cursor)) {
-            --(cursor.currentPos);
             queued_item qi(new QueuedItem("", 0xffff, queue_op_empty));
             return qi;
         }
-        if ((*(cursor.currentCheckpoint))->getState() == CHECKPOINT_CLOSED) {
-            ++(cursor.currentPos); // Move the cursor to point to the actual first item.
+        chk = *(cursor.currentCheckpoint);
+        if (chk->getState() == CHECKPOINT_CLOSED) {
+            // Move the cursor to point to the actual first item.
+            cursor.currentPos = chk->next(cursor.currentPos);
             ++(cursor.offset);
             isLastMutationItem = isLastMutationItemInCheckpoint(cursor);
-            return *(cursor.currentPos);
+            return chk->at(cursor.currentPos);
         } else { // the open checkpoint.
             return nextItemFromOpenCheckpoint(cursor, isLastMutationItem);
         }
@@ -845,13 +1025,14 @@ queued_item CheckpointManager::nextItemFromClosedCheckpoint(CheckpointCursor &cu
 
 queued_item CheckpointManager::nextItemFromOpenCheckpoint(CheckpointCursor &cursor,
                                                           bool &isLastMutationItem) {
-    ++(cursor.currentPos);
-    if (cursor.currentPos != (*(cursor.currentCheckpoint))->end()) {
+    Checkpoint *chk = *(cursor.currentCheckpoint);
+    size_t pos = chk->next(cursor.currentPos);
+    if (pos != chk->end()) {
+        cursor.currentPos = pos;
         ++(cursor.offset);
         isLastMutationItem = isLastMutationItemInCheckpoint(cursor);
-        return *(cursor.currentPos);
+        return chk->at(pos);
     } else {
-        --(cursor.currentPos);
         queued_item qi(new QueuedItem("", 0xffff, queue_op_empty));
         return qi;
     }
@@ -867,7 +1048,8 @@ void CheckpointManager::clear(vbucket_state_t vbState) {
     }
     checkpointList.clear();
     numItems = 0;
-    mutationCounter = 0;
+    // The mutation counter keeps going, so that the persisted and acked
+    // mutation ids a vbucket has seen stay behind anything queued later.
 
     uint64_t checkpointId = vbState == vbucket_state_active ? 1 : 0;
     // Add a new open checkpoint.
@@ -963,12 +1145,12 @@ bool CheckpointManager::eligibleForEviction(const std::string &key) {
     // Get the mutation id of the item pointed by the slowest cursor.
     // This won't cause much overhead as the number of cursors per vbucket is
     // usually bounded to 3 (persistence cursor + 2 replicas).
-    const std::string &pkey = (*(persistenceCursor.currentPos))->getKey();
-    smallest_mid = (*(persistenceCursor.currentCheckpoint))->getMutationIdForKey(pkey);
+    smallest_mid = (*(persistenceCursor.currentCheckpoint))->getMutationId(
+                                                        persistenceCursor.currentPos);
     std::map<const std::string, CheckpointCursor>::iterator mit = tapCursors.begin();
     for (; mit != tapCursors.end(); ++mit) {
-        const std::string &tkey = (*(mit->second.currentPos))->getKey();
-        uint64_t mid = (*(mit->second.currentCheckpoint))->getMutationIdForKey(tkey);
+        uint64_t mid = (*(mit->second.currentCheckpoint))->getMutationId(
+                                                        mit->second.currentPos);
         if (mid < smallest_mid) {
             smallest_mid = mid;
         }
@@ -990,6 +1172,19 @@ bool CheckpointManager::eligibleForEviction(const std::string &key) {
     return can_evict;
 }
 
+uint64_t CheckpointManager::getLastMutationIdForKey(const std::string &key) {
+    LockHolder lh(queueLock);
+    std::list<Checkpoint*>::reverse_iterator it = checkpointList.rbegin();
+    for (; it != checkpointList.rend(); ++it) {
+        uint64_t mid = (*it)->getMutationIdForKey(key);
+        if (mid != 0) {
+            return mid;
+        }
+    }
+    Checkpoint *oldest = checkpointList.front();
+    return oldest->getMutationId(oldest->begin());
+}
+
 size_t CheckpointManager::getNumItemsForTAPConnection(const std::string &name) {
     LockHolder lh(queueLock);
     size_t remains = 0;
@@ -1009,12 +1204,11 @@ size_t CheckpointManager::getNumItemsForPersistence_UNLOCKED() {
     std::list<Checkpoint*>::iterator curr_chk = persistenceCursor.currentCheckpoint;
     for (; curr_chk != checkpointList.end(); ++curr_chk) {
         if (curr_chk == persistenceCursor.currentCheckpoint) {
-            std::list<queued_item>::iterator curr_pos = persistenceCursor.currentPos;
-            ++curr_pos;
+            size_t curr_pos = (*curr_chk)->next(persistenceCursor.currentPos);
             if (curr_pos == (*curr_chk)->end()) {
                 continue;
             }
-            if ((*curr_pos)->getOperation() == queue_op_checkpoint_start) {
+            if ((*curr_chk)->at(curr_pos)->getOperation() == queue_op_checkpoint_start) {
                 if ((*curr_chk)->getState() == CHECKPOINT_CLOSED) {
                     meta_items += 2;
                 } else {
@@ -1041,8 +1235,11 @@ size_t CheckpointManager::getNumItemsForPersistence_UNLOCKED() {
 void CheckpointManager::decrTapCursorFromCheckpointEnd(const std::string &name) {
     LockHolder lh(queueLock);
     std::map<const std::string, CheckpointCursor>::iterator it = tapCursors.find(name);
-    if (it != tapCursors.end() &&
-        (*(it->second.currentPos))->getOperation() == queue_op_checkpoint_end) {
+    if (it == tapCursors.end()) {
+        return;
+    }
+    const queued_item &qi = (*(it->second.currentCheckpoint))->at(it->second.currentPos);
+    if (qi && qi->getOperation() == queue_op_checkpoint_end) {
         decrCursorOffset_UNLOCKED(it->second, 1);
         decrCursorPos_UNLOCKED(it->second);
     }
@@ -1059,10 +1256,9 @@ uint64_t CheckpointManager::getMutationIdForKey(uint64_t chk_id, std::string key
 }
 
 bool CheckpointManager::isLastMutationItemInCheckpoint(CheckpointCursor &cursor) {
-    std::list<queued_item>::iterator it = cursor.currentPos;
-    ++it;
-    if (it == (*(cursor.currentCheckpoint))->end() ||
-        (*it)->getOperation() == queue_op_checkpoint_end) {
+    Checkpoint *chk = *(cursor.currentCheckpoint);
+    size_t pos = chk->next(cursor.currentPos);
+    if (pos == chk->end() || chk->at(pos)->getOperation() == queue_op_checkpoint_end) {
         return true;
     }
     return false;
@@ -1146,13 +1342,12 @@ void CheckpointManager::collapseCheckpoints(uint64_t id) {
     std::map<const std::string, CheckpointCursor>::iterator itr;
     for (itr = tapCursors.begin(); itr != tapCursors.end(); itr++) {
         Checkpoint* chk = *(itr->second.currentCheckpoint);
-        const std::string& key = (*(itr->second.currentPos))->getKey();
-        cursorMap[itr->first.c_str()] = chk->getMutationIdForKey(key);
+        cursorMap[itr->first.c_str()] = chk->getMutationId(itr->second.currentPos);
     }
 
     Checkpoint* chk = *(persistenceCursor.currentCheckpoint);
-    std::string key = (*(persistenceCursor.currentPos))->getKey();
-    cursorMap[persistenceCursor.name.c_str()] = chk->getMutationIdForKey(key);
+    cursorMap[persistenceCursor.name.c_str()] =
+        chk->getMutationId(persistenceCursor.currentPos);
 
     std::list<Checkpoint*>::reverse_iterator rit = checkpointList.rbegin();
     ++rit; // Move to the last closed checkpoint.
@@ -1184,10 +1379,10 @@ void CheckpointManager::putCursorsInChk(std::map<std::string, uint64_t> &cursors
                                         std::list<Checkpoint*>::iterator chkItr) {
     int i;
     Checkpoint *chk = *chkItr;
-    std::list<queued_item>::iterator cit = chk->begin();
-    std::list<queued_item>::iterator last = chk->begin();
-    for (i = 0; cit != chk->end(); ++i, ++cit) {
-        uint64_t id = chk->getMutationIdForKey((*cit)->getKey());
+    size_t cit = chk->begin();
+    size_t last = chk->begin();
+    for (i = 0; cit != chk->end(); ++i, cit = chk->next(cit)) {
+        uint64_t id = chk->getMutationId(cit);
         std::map<std::string, uint64_t>::iterator mit = cursors.begin();
         while (mit != cursors.end()) {
             if (mit->second < id) {
@@ -1238,9 +1433,8 @@ bool CheckpointManager::hasNext(const std::string &name) {
     }
 
     bool hasMore = true;
-    std::list<queued_item>::iterator curr = it->second.currentPos;
-    ++curr;
-    if (curr == (*(it->second.currentCheckpoint))->end() &&
+    Checkpoint *chk = *(it->second.currentCheckpoint);
+    if (chk->next(it->second.currentPos) == chk->end() &&
         (*(it->second.currentCheckpoint)) == checkpointList.back()) {
         hasMore = false;
     }
@@ -1264,9 +1458,8 @@ queued_item CheckpointManager::createCheckpointItem(uint64_t id,
 bool CheckpointManager::hasNextForPersistence() {
     LockHolder lh(queueLock);
     bool hasMore = true;
-    std::list<queued_item>::iterator curr = persistenceCursor.currentPos;
-    ++curr;
-    if (curr == (*(persistenceCursor.currentCheckpoint))->end() &&
+    Checkpoint *chk = *(persistenceCursor.currentCheckpoint);
+    if (chk->next(persistenceCursor.currentPos) == chk->end() &&
         (*(persistenceCursor.currentCheckpoint)) == checkpointList.back()) {
         hasMore = false;
     }
@@ -1295,9 +1488,7 @@ void CheckpointManager::decrCursorOffset_UNLOCKED(CheckpointCursor &cursor, size
 }
 
 void CheckpointManager::decrCursorPos_UNLOCKED(CheckpointCursor &cursor) {
-    if (cursor.currentPos != (*(cursor.currentCheckpoint))->begin()) {
-        --(cursor.currentPos);
-    }
+    cursor.currentPos = (*(cursor.currentCheckpoint))->prev(cursor.currentPos);
 }
 
 uint64_t CheckpointManager::getPersistenceCursorPreChkId() {
@@ -22,6 +22,7 @@
 
 #include <assert.h>
 
+#include <algorithm>
 #include <list>
 #include <map>
 #include <set>
@@ -54,17 +55,133 @@ typedef enum {
 } checkpoint_state;
 
 /**
- * A checkpoint index entry.
+ * An item queued into a checkpoint, along with the mutation id it got.
+ * When a later mutation of the same key supersedes it, the item is
+ * dropped and the entry stays behind as a tombstone.
  */
-struct index_entry {
-    std::list<queued_item>::iterator position;
-    uint64_t mutation_id;
+struct checkpoint_entry {
+    checkpoint_entry() : mutation_id(0) { }
+
+    queued_item item;
+    uint64_t    mutation_id;
 };
 
 /**
- * The checkpoint index maps a key to a checkpoint index_entry.
+ * The entries of a checkpoint in the order they were queued.
+ *
+ * Entries are kept in fixed size chunks, so appending never moves an
+ * entry, and are addressed by their position from the start of the
+ * checkpoint.
  */
-typedef unordered_map<std::string, index_entry> checkpoint_index;
+class CheckpointQueue {
+public:
+    //! Number of entries in each chunk.
+    static const size_t CHUNK_ENTRIES = 64;
+
+    CheckpointQueue() : count(0) { }
+
+    ~CheckpointQueue() {
+        clear();
+    }
+
+    /**
+     * Return the number of entries, tombstones included.
+     */
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    checkpoint_entry &operator[](size_t pos) {
+        assert(pos < count);
+        return chunks[pos / CHUNK_ENTRIES][pos % CHUNK_ENTRIES];
+    }
+
+    void push_back(const queued_item &qi, uint64_t mutationId);
+
+    void pop_back();
+
+    void clear();
+
+    void swap(CheckpointQueue &other) {
+        chunks.swap(other.chunks);
+        std::swap(count, other.count);
+    }
+
+    /**
+     * Return the memory used by the chunks, whether they are filled up or not.
+     */
+    size_t memorySize() const {
+        return chunks.size() * CHUNK_ENTRIES * sizeof(checkpoint_entry) +
+            chunks.capacity() * sizeof(checkpoint_entry*);
+    }
+
+private:
+    std::vector<checkpoint_entry*> chunks;
+    size_t                         count;
+
+    DISALLOW_COPY_AND_ASSIGN(CheckpointQueue);
+};
+
+/**
+ * The checkpoint index maps a key to the position of its latest entry in
+ * a CheckpointQueue.
+ *
+ * It is an open addressing table of positions.  Keys are compared
+ * against the items the positions refer to, so the index holds no copy
+ * of them.
+ */
+class CheckpointIndex {
+public:
+    //! Returned by find() for a key that isn't indexed.
+    static const size_t npos;
+
+    CheckpointIndex() : used(0) { }
+
+    /**
+     * Get the position of the latest entry for a given key, or npos.
+     */
+    size_t find(const std::string &key, CheckpointQueue &queue) const;
+
+    /**
+     * Point a given key to a new position, adding it if needed.
+     *
+     * The previous entry for the key (if any) must still hold its item.
+     */
+    void set(const std::string &key, size_t pos, CheckpointQueue &queue);
+
+    void erase(const std::string &key, CheckpointQueue &queue);
+
+    /**
+     * Move every position to the one given for it after the queue was
+     * rearranged.
+     */
+    void remap(const std::vector<size_t> &newPositions);
+
+    size_t memorySize() const {
+        return table.capacity() * sizeof(index_slot);
+    }
+
+private:
+    struct index_slot {
+        uint32_t position;
+        uint32_t hash;
+    };
+
+    static const uint32_t EMPTY_SLOT = 0xffffffff;
+
+    static uint32_t hashKey(const std::string &key);
+
+    size_t lookup(const std::string &key, uint32_t h, CheckpointQueue &queue) const;
+
+    void grow();
+
+    std::vector<index_slot> table;
+    size_t                  used;
+};
 
 class Checkpoint;
 class CheckpointManager;
@@ -82,19 +199,20 @@ public:
     CheckpointCursor(const std::string &n)
         : name(n),
           currentCheckpoint(),
-          currentPos(),
+          currentPos(0),
           offset(0) { }
 
     CheckpointCursor(const std::string &n,
                      std::list<Checkpoint*>::iterator checkpoint,
-                     std::list<queued_item>::iterator pos,
+                     size_t pos,
                      size_t os = 0, bool isClosedCheckpointOnly = false ) :
         name(n), currentCheckpoint(checkpoint), currentPos(pos), offset(os) { }
 
 private:
     std::string                      name;
     std::list<Checkpoint*>::iterator currentCheckpoint;
-    std::list<queued_item>::iterator currentPos;
+    //! Position of the last entry consumed in the current checkpoint.
+    size_t                           currentPos;
     Atomic<size_t>                   offset;
 };
 
@@ -130,7 +248,7 @@ public:
     Checkpoint(EPStats &st, uint64_t id, uint16_t vbid,
                checkpoint_state state = CHECKPOINT_OPEN) :
         stats(st), checkpointId(id), vbucketId(vbid), creationTime(ep_real_time()),
-        checkpointState(state), numItems(0), memOverhead(0) {
+        checkpointState(state), numItems(0), numTombstones(0), memOverhead(0) {
         stats.memOverhead.incr(memorySize());
         assert(stats.memOverhead.get() < GIGANTOR);
     }
@@ -225,20 +343,64 @@ public:
     queue_dirty_t queueDirty(const queued_item &qi, CheckpointManager *checkpointManager);
 
 
-    std::list<queued_item>::iterator begin() {
-        return toWrite.begin();
+    /**
+     * Return the position of the first item in this checkpoint.
+     */
+    size_t begin() {
+        return (toWrite.empty() || toWrite[0].item) ? 0 : next(0);
+    }
+
+    /**
+     * Return the position past the last entry in this checkpoint.
+     */
+    size_t end() const {
+        return toWrite.size();
+    }
+
+    /**
+     * Return the position of the first item after a given position,
+     * skipping tombstones, or end().
+     */
+    size_t next(size_t pos) {
+        size_t last = toWrite.size();
+        while (++pos < last && !toWrite[pos].item) {
+            continue;
+        }
+        return pos < last ? pos : last;
+    }
+
+    /**
+     * Return the position of the last item before a given position,
+     * skipping tombstones, or the given position if there is none.
+     */
+    size_t prev(size_t pos) {
+        for (size_t p = pos; p > 0; --p) {
+            if (toWrite[p - 1].item) {
+                return p - 1;
+            }
+        }
+        return pos;
     }
 
-    std::list<queued_item>::iterator end() {
-        return toWrite.end();
+    /**
+     * Return the item at a given position (NULL for a tombstone).
+     */
+    queued_item &at(size_t pos) {
+        return toWrite[pos].item;
     }
 
-    std::list<queued_item>::reverse_iterator rbegin() {
-        return toWrite.rbegin();
+    /**
+     * Return the mutation id of the entry at a given position.
+     */
+    uint64_t getMutationId(size_t pos) {
+        return toWrite[pos].mutation_id;
     }
 
-    std::list<queued_item>::reverse_iterator rend() {
-        return toWrite.rend();
+    /**
+     * Return the number of tombstones left by de-duplication.
+     */
+    size_t getNumTombstones() const {
+        return numTombstones;
     }
 
     bool keyExists(const std::string &key);
@@ -269,16 +431,26 @@ public:
     uint64_t getMutationIdForKey(const std::string &key);
 
 private:
+
+    /**
+     * Drop the tombstones, moving the cursors in this checkpoint along.
+     */
+    void compact(CheckpointManager *checkpointManager);
+
+    void updateMemOverhead();
+
     EPStats                       &stats;
     uint64_t                       checkpointId;
     uint16_t                       vbucketId;
     rel_time_t                     creationTime;
     checkpoint_state               checkpointState;
     size_t                         numItems;
+    size_t                         numTombstones;
     std::set<std::string>          cursors; // List of cursors with their unique names.
-    // List is used for queueing mutations as vector incurs shift operations for deduplication.
-    std::list<queued_item>         toWrite;
-    checkpoint_index               keyIndex;
+    // De-duplication tombstones the old entry and appends a new one, so entries never move
+    // until the tombstones are compacted away.
+    CheckpointQueue                toWrite;
+    CheckpointIndex                keyIndex;
     size_t                         memOverhead;
 };
 
@@ -382,8 +554,10 @@ public:
      * Return the list of items, which needs to be persisted, to the flusher.
      * @param items the array that will contain the list of items to be persisted and
      * be pushed into the flusher's outgoing queue where the further IO optimization is performed.
+     * @return the mutation id of the last item grabbed; every item queued with a
+     * lower or equal id is in this or an earlier batch.
      */
-    void getAllItemsForPersistence(std::vector<queued_item> &items);
+    uint64_t getAllItemsForPersistence(std::vector<queued_item> &items);
 
     /**
      * Return the list of all the items to a given TAP cursor since its current position.
@@ -422,6 +596,14 @@ public:
      */
     bool eligibleForEviction(const std::string &key);
 
+    /**
+     * Get the mutation id of the last change queued for a given key.
+     *
+     * A key that isn't in any checkpoint anymore was queued before all of
+     * them, so the id of the oldest checkpoint's first item is returned.
+     */
+    uint64_t getLastMutationIdForKey(const std::string &key);
+
     /**
      * Clear all the checkpoints managed by this checkpoint manager.
      */
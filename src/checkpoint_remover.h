@@ -25,29 +25,35 @@
 #include <string>
 
 #include "common.h"
-#include "dispatcher.h"
 #include "stats.h"
+#include "tasks.h"
 
+class EventuallyPersistentEngine;
 class EventuallyPersistentStore;
 
 /**
- * Dispatcher job responsible for removing closed unreferenced checkpoints from memory.
+ * Task responsible for removing closed unreferenced checkpoints from memory.
  */
-class ClosedUnrefCheckpointRemover : public DispatcherCallback {
+class ClosedUnrefCheckpointRemover : public GlobalTask {
 public:
 
     /**
      * Construct ClosedUnrefCheckpointRemover.
+     * @param e the engine
      * @param s the store
      * @param st the stats
+     * @param interval number of seconds to wait between runs
      */
-    ClosedUnrefCheckpointRemover(EventuallyPersistentStore *s, EPStats &st,
+    ClosedUnrefCheckpointRemover(EventuallyPersistentEngine *e,
+                                 EventuallyPersistentStore *s, EPStats &st,
                                  size_t interval) :
+        GlobalTask(e, Priority::CheckpointRemoverPriority, interval,
+                   NO_START_TIME, false),
         store(s), stats(st), sleepTime(interval), available(true) {}
 
-    bool callback(Dispatcher &d, TaskId &t);
+    bool run();
 
-    std::string description() {
+    std::string getDescription() {
         return std::string("Removing closed unreferenced checkpoints from memory");
     }
 
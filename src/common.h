@@ -110,6 +110,22 @@ using UNORDERED_MAP_NAMESPACE::unordered_map;
     TypeName(const TypeName&);                  \
     void operator=(const TypeName&)
 
+//! Size of a cache line, for laying out data threads contend on.
+static const size_t CACHE_LINE_SIZE(64);
+
+/**
+ * Padding that rounds an object of the given size up to a whole number
+ * of cache lines when derived from after it.
+ */
+template <size_t Size, size_t Rest = Size % CACHE_LINE_SIZE>
+struct CacheLinePadding {
+    char padding[CACHE_LINE_SIZE - Rest];
+};
+
+template <size_t Size>
+struct CacheLinePadding<Size, 0> {
+};
+
 // Utility functions implemented in various modules.
 
 extern void LOG(EXTENSION_LOG_LEVEL severity, const char *fmt, ...);
@@ -17,6 +17,15 @@
 
 #include "config.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <limits>
+
+#include "atomic.h"
 #include "common.h"
 #include "couch-kvstore/couch-fs-stats.h"
 #include "histo.h"
@@ -54,43 +63,399 @@ struct StatFile {
     const couch_file_ops* orig_ops;
     couch_file_handle orig_handle;
     CouchstoreStats* stats;
-    cs_off_t last_offs;
+    // Reads may come from file reader threads too.
+    Atomic<cs_off_t> last_offs;
+    // The sync group this file belongs to, and a descriptor of our own
+    // to sync it with.
+    CouchSyncGroup* group;
+    int sync_fd;
+    bool dirty;
 };
 
+static ThreadLocalPtr<CouchSyncGroup> currentSyncGroup;
+static ThreadLocalPtr<CouchReadAhead> currentReadAhead;
+
+static const size_t noRun(std::numeric_limits<size_t>::max());
+
+static int syncData(int fd) {
+#ifdef HAVE_FDATASYNC
+    return fdatasync(fd);
+#else
+    return fsync(fd);
+#endif
+}
+
+CouchSyncGroup::CouchSyncGroup(CouchstoreStats *s) : stats(s) {
+    assert(currentSyncGroup.get() == NULL);
+    currentSyncGroup = this;
+}
+
+CouchSyncGroup::~CouchSyncGroup() {
+    currentSyncGroup = NULL;
+    sync();
+    // The files are still open, let them sync on their own from now on.
+    std::vector<StatFile*>::iterator it;
+    for (it = files.begin(); it != files.end(); ++it) {
+        (*it)->group = NULL;
+    }
+}
+
+CouchSyncGroup *CouchSyncGroup::current() {
+    return currentSyncGroup.get();
+}
+
+void CouchSyncGroup::join(StatFile *sf) {
+    sf->group = this;
+    files.push_back(sf);
+}
+
+void CouchSyncGroup::markDirty(StatFile *sf) {
+    if (!sf->dirty) {
+        sf->dirty = true;
+        dirty.push_back(sf);
+    }
+}
+
+void CouchSyncGroup::leave(StatFile *sf) {
+    if (sf->dirty) {
+        if (syncData(sf->sync_fd) != 0) {
+            LOG(EXTENSION_LOG_WARNING,
+                "Warning: failed to sync a file leaving its sync group: %s",
+                strerror(errno));
+        }
+        sf->dirty = false;
+        dirty.erase(std::remove(dirty.begin(), dirty.end(), sf), dirty.end());
+    }
+    files.erase(std::remove(files.begin(), files.end(), sf), files.end());
+    sf->group = NULL;
+}
+
+couchstore_error_t CouchSyncGroup::sync() {
+    if (dirty.empty()) {
+        return COUCHSTORE_SUCCESS;
+    }
+
+    hrtime_t start = gethrtime();
+    std::vector<StatFile*>::iterator it;
+#ifdef HAVE_SYNC_FILE_RANGE
+    // Get the writeback of all the files going before waiting for any.
+    for (it = dirty.begin(); it != dirty.end(); ++it) {
+        sync_file_range((*it)->sync_fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+    }
+#endif
+    couchstore_error_t rv = COUCHSTORE_SUCCESS;
+    for (it = dirty.begin(); it != dirty.end(); ++it) {
+        if (syncData((*it)->sync_fd) != 0) {
+            LOG(EXTENSION_LOG_WARNING,
+                "Warning: failed to sync a file of a sync group: %s",
+                strerror(errno));
+            rv = COUCHSTORE_ERROR_WRITE;
+        }
+        (*it)->dirty = false;
+    }
+    stats->groupSyncSizeHisto.add(dirty.size());
+    stats->groupSyncTimeHisto.add((gethrtime() - start) / 1000);
+    dirty.clear();
+    return rv;
+}
+
+static ssize_t statPread(StatFile* sf, void* buf, size_t sz, cs_off_t off) {
+    sf->stats->readSizeHisto.add(sz);
+    cs_off_t last_offs = sf->last_offs.get();
+    if(last_offs) {
+        sf->stats->readSeekHisto.add(abs(off - last_offs));
+    }
+    sf->last_offs.set(off);
+    BlockTimer bt(&sf->stats->readTimeHisto);
+    return sf->orig_ops->pread(sf->orig_handle, buf, sz, off);
+}
+
+extern "C" {
+    static void *launchFileReader(void *arg) {
+        static_cast<CouchFileReader*>(arg)->run();
+        return NULL;
+    }
+}
+
+CouchFileReader::CouchFileReader(size_t n) :
+    numThreads(n), inflight(0), running(false), stopping(false) {
+}
+
+CouchFileReader::~CouchFileReader() {
+    LockHolder lh(sync);
+    stopping = true;
+    sync.notify();
+    lh.unlock();
+    std::vector<pthread_t>::iterator it;
+    for (it = threads.begin(); it != threads.end(); ++it) {
+        pthread_join(*it, NULL);
+    }
+}
+
+bool CouchFileReader::start() {
+    running = true;
+    for (size_t i = 0; i < numThreads; ++i) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, launchFileReader, this) != 0) {
+            LOG(EXTENSION_LOG_WARNING,
+                "Warning: failed to start a file reader thread: %s",
+                strerror(errno));
+            break;
+        }
+        threads.push_back(tid);
+    }
+    return !threads.empty();
+}
+
+void CouchFileReader::submit(CouchFileRead *read) {
+    read->done = false;
+    LockHolder lh(sync);
+    if ((running || start()) && !threads.empty()) {
+        read->file->stats->readQueueDepthHisto.add(inflight);
+        ++inflight;
+        queue.push_back(read);
+        sync.notify();
+        return;
+    }
+    lh.unlock();
+    read->result = statPread(read->file, read->buf, read->size, read->offset);
+    read->done = true;
+}
+
+void CouchFileReader::wait(CouchFileRead *read) {
+    LockHolder lh(sync);
+    while (!read->done) {
+        sync.wait();
+    }
+}
+
+void CouchFileReader::run() {
+    LockHolder lh(sync);
+    while (true) {
+        while (queue.empty()) {
+            if (stopping) {
+                return;
+            }
+            sync.wait();
+        }
+        CouchFileRead *read = queue.front();
+        queue.pop_front();
+        lh.unlock();
+        ssize_t n = statPread(read->file, read->buf, read->size, read->offset);
+        lh.lock();
+        read->result = n;
+        read->done = true;
+        --inflight;
+        sync.notify();
+    }
+}
+
+CouchReadAhead::CouchReadAhead(CouchstoreStats *s, size_t w,
+                               CouchFileReader *r) :
+    stats(s), window(w), reader(r), entered(noRun), submitted(0), file(NULL) {
+    assert(currentReadAhead.get() == NULL);
+    currentReadAhead = this;
+}
+
+CouchReadAhead::~CouchReadAhead() {
+    currentReadAhead = NULL;
+    for (size_t i = 0; i < runs.size(); ++i) {
+        release(i);
+    }
+}
+
+CouchReadAhead *CouchReadAhead::current() {
+    return currentReadAhead.get();
+}
+
+void CouchReadAhead::plan(cs_off_t offset, size_t length) {
+    // The reads in flight point into the runs.
+    assert(entered == noRun);
+    if (!runs.empty()) {
+        Run &last = runs.back();
+        cs_off_t end = last.offset + static_cast<cs_off_t>(last.length);
+        // Don't read more than a quarter of the window that nobody wants.
+        if (offset >= end &&
+            offset - end <= static_cast<cs_off_t>(window / 4) &&
+            offset + static_cast<cs_off_t>(length) - last.offset <=
+            static_cast<cs_off_t>(window)) {
+            last.length = offset + length - last.offset;
+            ++last.bodies;
+            return;
+        }
+    }
+    runs.push_back(Run(offset, length));
+}
+
+bool CouchReadAhead::read(StatFile *sf, void *buf, size_t sz, cs_off_t off,
+                          ssize_t &rv) {
+    size_t lo(0), hi(runs.size());
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (runs[mid].offset <= off) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return false;
+    }
+    size_t i = lo - 1;
+    if (off + static_cast<cs_off_t>(sz) >
+        runs[i].offset + static_cast<cs_off_t>(runs[i].length)) {
+        return false;
+    }
+    if (file == NULL) {
+        file = sf;
+    } else if (sf != file) {
+        return false;
+    }
+
+    if (i != entered) {
+        // Done with the runs before this one.
+        for (size_t j = entered == noRun ? 0 : entered; j < i; ++j) {
+            release(j);
+        }
+        entered = i;
+        if (reader) {
+            submitted = std::max(submitted, i);
+            while (submitted < runs.size() &&
+                   submitted < i + reader->getDepth()) {
+                submit(submitted++);
+            }
+        } else if (i + 1 < runs.size()) {
+            sf->orig_ops->advise(sf->orig_handle, runs[i + 1].offset,
+                                 runs[i + 1].length,
+                                 COUCHSTORE_FILE_ADVICE_WILLNEED);
+        }
+    }
+
+    Run &run = runs[i];
+    if ((reader == NULL && run.bodies < 2) || !load(i)) {
+        // Let the read go to the file on its own.
+        return false;
+    }
+    size_t pos = static_cast<size_t>(off - run.offset);
+    if (pos + sz > run.data.size()) {
+        // Past the end of the file.
+        return false;
+    }
+    memcpy(buf, &run.data[pos], sz);
+    run.used += sz;
+    rv = static_cast<ssize_t>(sz);
+    return true;
+}
+
+void CouchReadAhead::submit(size_t i) {
+    Run &run = runs[i];
+    run.data.resize(run.length);
+    run.read.file = file;
+    run.read.buf = &run.data[0];
+    run.read.size = run.length;
+    run.read.offset = run.offset;
+    run.state = Run::pending;
+    reader->submit(&run.read);
+}
+
+bool CouchReadAhead::load(size_t i) {
+    Run &run = runs[i];
+    switch (run.state) {
+    case Run::planned:
+        run.data.resize(run.length);
+        run.read.result = statPread(file, &run.data[0], run.length,
+                                    run.offset);
+        break;
+    case Run::pending:
+        reader->wait(&run.read);
+        break;
+    case Run::loaded:
+        return !run.data.empty();
+    case Run::released:
+        return false;
+    }
+
+    run.state = Run::loaded;
+    if (run.read.result <= 0) {
+        std::vector<char>().swap(run.data);
+        return false;
+    }
+    run.data.resize(run.read.result);
+    if (run.bodies > 1) {
+        ++stats->mergedReads;
+    }
+    return true;
+}
+
+void CouchReadAhead::release(size_t i) {
+    Run &run = runs[i];
+    if (run.state == Run::pending) {
+        reader->wait(&run.read);
+        run.data.resize(run.read.result > 0 ? run.read.result : 0);
+    }
+    if (!run.data.empty()) {
+        stats->readaheadWasted.incr(run.data.size() -
+                                    std::min(run.used, run.data.size()));
+    }
+    std::vector<char>().swap(run.data);
+    run.state = Run::released;
+}
+
 extern "C" {
 static couch_file_handle cfs_construct(void* cookie) {
     StatFile* sf = new StatFile;
     sf->stats = static_cast<CouchstoreStats*>(cookie);
     sf->orig_ops = couchstore_get_default_file_ops();
     sf->orig_handle = sf->orig_ops->constructor(sf->orig_ops->cookie);
-    sf->last_offs = 0;
+    sf->last_offs.set(0);
+    sf->group = NULL;
+    sf->sync_fd = -1;
+    sf->dirty = false;
     return reinterpret_cast<couch_file_handle>(sf);
 }
 
 static couchstore_error_t cfs_open(couch_file_handle* h, const char* path, int flags) {
     StatFile* sf = reinterpret_cast<StatFile*>(*h);
-    return sf->orig_ops->open(&sf->orig_handle, path, flags);
+    couchstore_error_t rv = sf->orig_ops->open(&sf->orig_handle, path, flags);
+    CouchSyncGroup* group = CouchSyncGroup::current();
+    if (rv == COUCHSTORE_SUCCESS && group &&
+        (flags & O_ACCMODE) != O_RDONLY) {
+        sf->sync_fd = open(path, O_RDONLY);
+        if (sf->sync_fd != -1) {
+            group->join(sf);
+        }
+    }
+    return rv;
 }
 
 static void cfs_close(couch_file_handle h) {
     StatFile* sf = reinterpret_cast<StatFile*>(h);
+    if (sf->group) {
+        sf->group->leave(sf);
+    }
+    if (sf->sync_fd != -1) {
+        close(sf->sync_fd);
+        sf->sync_fd = -1;
+    }
     sf->orig_ops->close(sf->orig_handle);
 }
 
 static ssize_t cfs_pread(couch_file_handle h, void* buf, size_t sz, cs_off_t off) {
     StatFile* sf = reinterpret_cast<StatFile*>(h);
-    sf->stats->readSizeHisto.add(sz);
-    if(sf->last_offs) {
-        sf->stats->readSeekHisto.add(abs(off - sf->last_offs));
+    CouchReadAhead* readAhead = CouchReadAhead::current();
+    ssize_t rv;
+    if (readAhead && readAhead->read(sf, buf, sz, off, rv)) {
+        return rv;
     }
-    sf->last_offs = off;
-    BlockTimer bt(&sf->stats->readTimeHisto);
-    return sf->orig_ops->pread(sf->orig_handle, buf, sz, off);
+    return statPread(sf, buf, sz, off);
 }
 
 static ssize_t cfs_pwrite(couch_file_handle h, const void* buf, size_t sz, cs_off_t off) {
     StatFile* sf = reinterpret_cast<StatFile*>(h);
     sf->stats->writeSizeHisto.add(sz);
+    if (sf->group) {
+        sf->group->markDirty(sf);
+    }
     BlockTimer bt(&sf->stats->writeTimeHisto);
     return sf->orig_ops->pwrite(sf->orig_handle, buf, sz, off);
 }
@@ -102,6 +467,11 @@ static cs_off_t cfs_goto_eof(couch_file_handle h) {
 
 static couchstore_error_t cfs_sync(couch_file_handle h) {
     StatFile* sf = reinterpret_cast<StatFile*>(h);
+    if (sf->group) {
+        // Left for the group to sync.
+        sf->group->markDirty(sf);
+        return COUCHSTORE_SUCCESS;
+    }
     BlockTimer bt(&sf->stats->syncTimeHisto);
     return sf->orig_ops->sync(sf->orig_handle);
 }
@@ -114,6 +484,9 @@ static couchstore_error_t cfs_advise(couch_file_handle h, cs_off_t offs, cs_off_
 
 static void cfs_destroy(couch_file_handle h) {
     StatFile* sf = reinterpret_cast<StatFile*>(h);
+    if (sf->group) {
+        sf->group->leave(sf);
+    }
     sf->orig_ops->destructor(sf->orig_handle);
     delete sf;
 }
@@ -22,14 +22,22 @@
 
 #include <libcouchstore/couch_db.h>
 
+#include <deque>
+#include <vector>
+
+#include "atomic.h"
+#include "common.h"
 #include "histo.h"
+#include "syncobject.h"
 
 struct CouchstoreStats {
 public:
     CouchstoreStats() :
         readSeekHisto(ExponentialGenerator<size_t>(1, 2), 50),
         readSizeHisto(ExponentialGenerator<size_t>(1, 2), 25),
-        writeSizeHisto(ExponentialGenerator<size_t>(1, 2), 25) { }
+        writeSizeHisto(ExponentialGenerator<size_t>(1, 2), 25),
+        groupSyncSizeHisto(ExponentialGenerator<size_t>(1, 2), 15),
+        readQueueDepthHisto(ExponentialGenerator<size_t>(1, 2), 10) { }
 
     //Read time length
     Histogram<hrtime_t> readTimeHisto;
@@ -43,6 +51,16 @@ public:
     Histogram<size_t> writeSizeHisto;
     //Time spent in sync
     Histogram<hrtime_t> syncTimeHisto;
+    //Time spent syncing a group of files
+    Histogram<hrtime_t> groupSyncTimeHisto;
+    //Number of files synced together
+    Histogram<size_t> groupSyncSizeHisto;
+    //Reads that got the bodies of several documents at once
+    Atomic<size_t> mergedReads;
+    //Bytes read ahead that no document was read from
+    Atomic<size_t> readaheadWasted;
+    //Reads in flight when another one is handed to a file reader
+    Histogram<size_t> readQueueDepthHisto;
 
     void reset() {
         readTimeHisto.reset();
@@ -51,9 +69,191 @@ public:
         writeTimeHisto.reset();
         writeSizeHisto.reset();
         syncTimeHisto.reset();
+        groupSyncTimeHisto.reset();
+        groupSyncSizeHisto.reset();
+        mergedReads.set(0);
+        readaheadWasted.set(0);
+        readQueueDepthHisto.reset();
     }
 };
 
 couch_file_ops getCouchstoreStatsOps(CouchstoreStats* stats);
 
+struct StatFile;
+
+/**
+ * Defers the syncs of files opened for writing with the stat
+ * collecting file ops, so that they can be synced together.
+ *
+ * While a group exists, it is the current group of the thread that
+ * created it: files that thread opens for writing join the group, and
+ * syncs couchstore asks for on them are left for sync().  A file
+ * closed before sync() is synced on its own.
+ */
+class CouchSyncGroup {
+public:
+    CouchSyncGroup(CouchstoreStats *stats);
+
+    ~CouchSyncGroup();
+
+    /**
+     * Make everything written to the files of the group so far
+     * durable.
+     */
+    couchstore_error_t sync();
+
+    static CouchSyncGroup *current();
+
+    // Called by the file ops as files are opened, written and closed.
+    void join(StatFile *sf);
+    void markDirty(StatFile *sf);
+    void leave(StatFile *sf);
+
+private:
+    CouchstoreStats *stats;
+    //! Files written to since the last sync.
+    std::vector<StatFile*> dirty;
+    //! All files of the group.
+    std::vector<StatFile*> files;
+
+    DISALLOW_COPY_AND_ASSIGN(CouchSyncGroup);
+};
+
+/**
+ * A read of part of a file opened with the stat collecting file ops.
+ */
+struct CouchFileRead {
+    CouchFileRead() : file(NULL), buf(NULL), size(0), offset(0), result(0),
+                      done(false) {}
+
+    StatFile *file;
+    void     *buf;
+    size_t    size;
+    cs_off_t  offset;
+    //! What pread returned, once done.
+    ssize_t   result;
+    bool      done;
+};
+
+/**
+ * Keeps several reads of files in flight for the threads using it.
+ *
+ * Reads handed to submit() are done by a pool of threads, each with
+ * one pread at the disk at a time, so a thread that knows what it'll
+ * read next doesn't have to wait for one read before asking for the
+ * next.  The threads are started by the first submit().
+ *
+ * These threads are not part of the ExecutorPool: the reads are
+ * waited for from the pool's reader threads, which would deadlock if
+ * the reads had to get a reader thread themselves.  That's why a
+ * store only has one when couch_read_queue_depth asks for it.
+ */
+class CouchFileReader {
+public:
+    CouchFileReader(size_t threads);
+
+    ~CouchFileReader();
+
+    /**
+     * Get the number of reads that can be done at once.
+     */
+    size_t getDepth() const { return numThreads; }
+
+    /**
+     * Queue a read.  It has to stay around until wait() returned.
+     */
+    void submit(CouchFileRead *read);
+
+    /**
+     * Wait for a read handed to submit() to be done.
+     */
+    void wait(CouchFileRead *read);
+
+    // Body of the reader threads.
+    void run();
+
+private:
+    bool start();
+
+    size_t numThreads;
+    SyncObject sync;
+    std::deque<CouchFileRead *> queue;
+    std::vector<pthread_t> threads;
+    //! Reads queued or being done.
+    size_t inflight;
+    bool running;
+    bool stopping;
+
+    DISALLOW_COPY_AND_ASSIGN(CouchFileReader);
+};
+
+/**
+ * Merges the reads of document bodies that are close together in a
+ * file into one larger read, and gets the reads started before they
+ * are needed.
+ *
+ * The bodies about to be read are given to plan() in the order of
+ * their offsets, which groups them into runs no longer than the
+ * window.  While a read-ahead exists, it is the current one of the
+ * thread that created it, and the stat collecting file ops serve the
+ * reads it sees within a run out of one read of the whole run.
+ *
+ * With a file reader, entering a run hands the runs after it to the
+ * reader until as many reads as it can do at once are in flight, and
+ * the bodies of every run are read that way.  Without one, a run of
+ * several bodies is read when the first read within it is seen, and
+ * entering a run hints the OS to start reading the next one.
+ */
+class CouchReadAhead {
+public:
+    CouchReadAhead(CouchstoreStats *stats, size_t window,
+                   CouchFileReader *reader = NULL);
+
+    ~CouchReadAhead();
+
+    /**
+     * Add a body to be read, after all the ones at lower offsets.
+     */
+    void plan(cs_off_t offset, size_t length);
+
+    static CouchReadAhead *current();
+
+    // Called by the file ops for every read; true if it was served.
+    bool read(StatFile *sf, void *buf, size_t sz, cs_off_t off,
+              ssize_t &rv);
+
+private:
+    struct Run {
+        Run(cs_off_t o, size_t l) : offset(o), length(l), bodies(1),
+                                    used(0), state(planned) {}
+
+        cs_off_t offset;
+        size_t   length;
+        size_t   bodies;
+        //! What was read of the run.
+        std::vector<char> data;
+        //! Bytes of data handed out so far.
+        size_t   used;
+        CouchFileRead read;
+        enum { planned, pending, loaded, released } state;
+    };
+
+    void submit(size_t i);
+    bool load(size_t i);
+    void release(size_t i);
+
+    CouchstoreStats *stats;
+    size_t window;
+    CouchFileReader *reader;
+    std::vector<Run> runs;
+    //! The run reads were last seen in.
+    size_t entered;
+    //! Runs before this one were handed to the reader.
+    size_t submitted;
+    //! The file all the reads are from.
+    StatFile *file;
+
+    DISALLOW_COPY_AND_ASSIGN(CouchReadAhead);
+};
+
 #endif  // SRC_COUCH_KVSTORE_COUCH_FS_STATS_H_
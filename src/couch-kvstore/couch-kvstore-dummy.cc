@@ -92,6 +92,12 @@ void CouchKVStore::dump(uint16_t, shared_ptr<Callback<GetValue> >)
     throw std::runtime_error("This kvstore should never be used");
 }
 
+void CouchKVStore::dump(const std::vector<uint16_t> &,
+                        shared_ptr<Callback<GetValue> >)
+{
+    throw std::runtime_error("This kvstore should never be used");
+}
+
 StorageProperties CouchKVStore::getStorageProperties()
 {
     throw std::runtime_error("This kvstore should never be used");
@@ -58,6 +58,8 @@ public:
     bool snapshotVBuckets(const vbucket_map_t &m);
     void dump(shared_ptr<Callback<GetValue> > cb);
     void dump(uint16_t vbid, shared_ptr<Callback<GetValue> > cb);
+    void dump(const std::vector<uint16_t> &vbids,
+              shared_ptr<Callback<GetValue> > cb);
 };
 
 #endif  // SRC_COUCH_KVSTORE_COUCH_KVSTORE_DUMMY_H_
@@ -37,6 +37,7 @@
 #include "common.h"
 #include "couch-kvstore/couch-kvstore.h"
 #include "couch-kvstore/dirutils.h"
+#include "locks.h"
 #define STATWRITER_NAMESPACE couchstore_engine
 #include "statwriter.h"
 #undef STATWRITER_NAMESPACE
@@ -169,8 +170,24 @@ struct GetMultiCbCtx {
     CouchKVStore &cks;
     uint16_t vbId;
     vb_bgfetch_queue_t &fetches;
+    //! The docinfos found, kept to read their bodies in file order.
+    std::vector<DocInfo *> docinfos;
 };
 
+static bool docinfoOffsetLess(const DocInfo *a, const DocInfo *b) {
+    return a->bp < b->bp;
+}
+
+/**
+ * Get the number of bytes couchstore reads for the body of a document:
+ * it is preceded by an 8 byte chunk header, and a marker byte starts
+ * every 4k block the chunk runs into.
+ */
+static size_t bodyExtent(const DocInfo *docinfo) {
+    size_t len = docinfo->size + 8;
+    return len + len / 4095 + 1;
+}
+
 struct StatResponseCtx {
 public:
     StatResponseCtx(std::map<std::pair<uint16_t, uint16_t>, vbucket_state> &sm,
@@ -183,12 +200,26 @@ public:
 };
 
 struct LoadResponseCtx {
+    CouchKVStore *cks;
     shared_ptr<Callback<GetValue> > callback;
     uint16_t vbucketId;
     bool keysonly;
     EPStats *stats;
+    //! Docinfos of the bodies to read next.
+    std::vector<DocInfo *> docinfos;
 };
 
+//! Most documents a dump reads the bodies of at once.
+static const size_t loadBatchSize = 256;
+
+static void freeDocInfos(std::vector<DocInfo *> &docinfos) {
+    std::vector<DocInfo *>::iterator it;
+    for (it = docinfos.begin(); it != docinfos.end(); ++it) {
+        couchstore_free_docinfo(*it);
+    }
+    docinfos.clear();
+}
+
 CouchRequest::CouchRequest(const Item &it, uint64_t rev, CouchRequestCallback &cb, bool del) :
     value(it.getValue()), vbucketId(it.getVBucketId()), fileRevNum(rev),
     key(it.getKey()), deleteItem(del)
@@ -239,12 +270,47 @@ CouchRequest::CouchRequest(const Item &it, uint64_t rev, CouchRequestCallback &c
     start = gethrtime();
 }
 
+Mutex DbFileCommits::initMutex;
+std::map<std::string, DbFileCommits *> DbFileCommits::instances;
+
+DbFileCommits *DbFileCommits::acquire(const std::string &dbname,
+                                      uint16_t numFiles)
+{
+    LockHolder lh(initMutex);
+    DbFileCommits *commits;
+    std::map<std::string, DbFileCommits *>::iterator it;
+    it = instances.find(dbname);
+    if (it == instances.end()) {
+        commits = new DbFileCommits(dbname, numFiles);
+        instances[dbname] = commits;
+    } else {
+        commits = it->second;
+        assert(commits->numFiles >= numFiles);
+    }
+    ++commits->refCount;
+    return commits;
+}
+
+void DbFileCommits::release(DbFileCommits *commits)
+{
+    LockHolder lh(initMutex);
+    if (--commits->refCount == 0) {
+        instances.erase(commits->dbname);
+        delete commits;
+    }
+}
+
 CouchKVStore::CouchKVStore(EPStats &stats, Configuration &config, bool read_only) :
     KVStore(read_only), epStats(stats), configuration(config),
     dbname(configuration.getDbname()), couchNotifier(NULL), pendingCommitCnt(0),
-    intransaction(false), dbFileRevMapPopulated(false)
+    intransaction(false), dbFileRevMapPopulated(false),
+    dbCacheCapacity(configuration.getCouchDbCacheSize()), dbFileCommits(NULL),
+    readaheadWindow(configuration.getCouchReadaheadWindow()), fileReader(NULL)
 {
     open();
+    if (read_only && configuration.getCouchReadQueueDepth() > 0) {
+        fileReader = new CouchFileReader(configuration.getCouchReadQueueDepth());
+    }
     statCollectingFileOps = getCouchstoreStatsOps(&st.fsStats);
 
     // init db file map with default revision number, 1
@@ -252,6 +318,8 @@ CouchKVStore::CouchKVStore(EPStats &stats, Configuration &config, bool read_only
     for (uint16_t i = 0; i < numDbFiles; i++) {
         dbFileRevMap.push_back(1);
     }
+    vbFileLocks = new Mutex[numDbFiles];
+    dbFileCommits = DbFileCommits::acquire(dbname, numDbFiles);
 }
 
 CouchKVStore::CouchKVStore(const CouchKVStore &copyFrom) :
@@ -260,9 +328,17 @@ CouchKVStore::CouchKVStore(const CouchKVStore &copyFrom) :
     dbname(copyFrom.dbname),
     couchNotifier(NULL), dbFileRevMap(copyFrom.dbFileRevMap),
     numDbFiles(copyFrom.numDbFiles), pendingCommitCnt(0),
-    intransaction(false), dbFileRevMapPopulated(true)
+    intransaction(false), dbFileRevMapPopulated(true),
+    vbFileLocks(new Mutex[copyFrom.numDbFiles]),
+    dbCacheCapacity(copyFrom.dbCacheCapacity),
+    dbFileCommits(DbFileCommits::acquire(copyFrom.dbname,
+                                         copyFrom.numDbFiles)),
+    readaheadWindow(copyFrom.readaheadWindow), fileReader(NULL)
 {
     open();
+    if (copyFrom.fileReader) {
+        fileReader = new CouchFileReader(copyFrom.fileReader->getDepth());
+    }
     statCollectingFileOps = getCouchstoreStatsOps(&st.fsStats);
 }
 
@@ -275,11 +351,20 @@ void CouchKVStore::reset()
     couchNotifier->flush(cb);
     cb.waitForValue();
 
-    vbucket_map_t::iterator itor = cachedVBStates.begin();
-    for (; itor != cachedVBStates.end(); ++itor) {
+    vbucket_map_t states;
+    {
+        LockHolder lh(vbStateMutex);
+        vbucket_map_t::iterator itor = cachedVBStates.begin();
+        for (; itor != cachedVBStates.end(); ++itor) {
+            itor->second.checkpointId = 0;
+            itor->second.maxDeletedSeqno = 0;
+        }
+        states = cachedVBStates;
+    }
+
+    vbucket_map_t::iterator itor = states.begin();
+    for (; itor != states.end(); ++itor) {
         uint16_t vbucket = itor->first;
-        itor->second.checkpointId = 0;
-        itor->second.maxDeletedSeqno = 0;
         resetVBucket(vbucket, itor->second);
         updateDbFileMap(vbucket, 1);
     }
@@ -304,13 +389,13 @@ void CouchKVStore::get(const std::string &key, uint64_t, uint16_t vb,
                        Callback<GetValue> &cb)
 {
     hrtime_t start = gethrtime();
-    Db *db = NULL;
+    CachedDb handle;
     std::string dbFile;
     GetValue rv;
     uint64_t fileRev = dbFileRevMap[vb];
 
-    couchstore_error_t errCode = openDB(vb, fileRev, &db,
-                                        COUCHSTORE_OPEN_FLAG_RDONLY);
+    couchstore_error_t errCode = openCachedDB(vb, fileRev, handle);
+    Db *db = handle.db;
     if (errCode != COUCHSTORE_SUCCESS) {
         ++st.numGetFailure;
         LOG(EXTENSION_LOG_WARNING,
@@ -364,7 +449,8 @@ void CouchKVStore::get(const std::string &key, uint64_t, uint16_t vb,
     }
 
     couchstore_free_docinfo(docInfo);
-    closeDatabaseHandle(db);
+    releaseCachedDB(handle, errCode == COUCHSTORE_SUCCESS ||
+                    errCode == COUCHSTORE_ERROR_DOC_NOT_FOUND);
     rv.setStatus(couchErr2EngineErr(errCode));
     cb.callback(rv);
 }
@@ -375,9 +461,9 @@ void CouchKVStore::getMulti(uint16_t vb, vb_bgfetch_queue_t &itms)
     int numItems = itms.size();
     uint64_t fileRev = dbFileRevMap[vb];
 
-    Db *db = NULL;
-    couchstore_error_t errCode = openDB(vb, fileRev, &db,
-                                        COUCHSTORE_OPEN_FLAG_RDONLY);
+    CachedDb handle;
+    couchstore_error_t errCode = openCachedDB(vb, fileRev, handle);
+    Db *db = handle.db;
     if (errCode != COUCHSTORE_SUCCESS) {
         LOG(EXTENSION_LOG_WARNING,
             "Warning: failed to open database for data fetch, "
@@ -421,8 +507,11 @@ void CouchKVStore::getMulti(uint16_t vb, vb_bgfetch_queue_t &itms)
                 (*fitr)->value.setStatus(couchErr2EngineErr(errCode));
             }
         }
+        freeDocInfos(ctx.docinfos);
+    } else {
+        fetchMultiBodies(db, ctx);
     }
-    closeDatabaseHandle(db);
+    releaseCachedDB(handle, errCode == COUCHSTORE_SUCCESS);
 }
 
 void CouchKVStore::del(const Item &itm,
@@ -444,18 +533,25 @@ bool CouchKVStore::delVBucket(uint16_t vbucket, bool recreate)
     assert(couchNotifier);
     RememberingCallback<bool> cb;
 
-    couchNotifier->delVBucket(vbucket, cb);
-    cb.waitForValue();
+    {
+        LockHolder flh(vbFileLocks[vbucket]);
+        couchNotifier->delVBucket(vbucket, cb);
+        cb.waitForValue();
+    }
 
     if (recreate) {
         vbucket_state vbstate(vbucket_state_dead, 0, 0);
-        vbucket_map_t::iterator it = cachedVBStates.find(vbucket);
-        if (it != cachedVBStates.end()) {
-            vbstate.state = it->second.state;
+        {
+            LockHolder lh(vbStateMutex);
+            vbucket_map_t::iterator it = cachedVBStates.find(vbucket);
+            if (it != cachedVBStates.end()) {
+                vbstate.state = it->second.state;
+            }
+            cachedVBStates[vbucket] = vbstate;
         }
-        cachedVBStates[vbucket] = vbstate;
         resetVBucket(vbucket, vbstate);
     } else {
+        LockHolder lh(vbStateMutex);
         cachedVBStates.erase(vbucket);
     }
     updateDbFileMap(vbucket, 1);
@@ -472,10 +568,7 @@ vbucket_map_t CouchKVStore::listPersistedVbuckets()
         populateFileNameMap(files);
     }
 
-    if (!cachedVBStates.empty()) {
-        cachedVBStates.clear();
-    }
-
+    vbucket_map_t states;
     Db *db = NULL;
     couchstore_error_t errorCode;
     for (uint16_t id = 0; id < numDbFiles; id++) {
@@ -497,14 +590,17 @@ vbucket_map_t CouchKVStore::listPersistedVbuckets()
             /* read state of VBucket from db file */
             readVBState(db, id, vb_state);
             /* insert populated state to the array to return to the caller */
-            cachedVBStates[id] = vb_state;
+            states[id] = vb_state;
             /* update stat */
             ++st.numLoadedVb;
             closeDatabaseHandle(db);
         }
         db = NULL;
     }
-    return cachedVBStates;
+
+    LockHolder lh(vbStateMutex);
+    cachedVBStates = states;
+    return states;
 }
 
 void CouchKVStore::getPersistedStats(std::map<std::string, std::string> &stats)
@@ -572,6 +668,7 @@ bool CouchKVStore::snapshotVBuckets(const vbucket_map_t &vbstates)
     for (; iter != vbstates.rend(); ++iter) {
         uint16_t vbucketId = iter->first;
         vbucket_state vbstate = iter->second;
+        LockHolder lh(vbStateMutex);
         vbucket_map_t::iterator it = cachedVBStates.find(vbucketId);
         uint32_t vb_change_type = VB_NO_CHANGE;
         if (it != cachedVBStates.end()) {
@@ -592,6 +689,7 @@ bool CouchKVStore::snapshotVBuckets(const vbucket_map_t &vbstates)
             vb_change_type = VB_STATE_CHANGED;
             cachedVBStates[vbucketId] = vbstate;
         }
+        lh.unlock();
 
         success = setVBucketState(vbucketId, vbstate, vb_change_type);
         if (!success) {
@@ -677,6 +775,7 @@ bool CouchKVStore::setVBucketState(uint16_t vbucketId, vbucket_state &vbstate,
     std::string dbFileName;
     std::map<uint16_t, uint64_t>::iterator mapItr;
 
+    LockHolder flh(vbFileLocks[vbucketId]);
     id << vbucketId;
     dbFileName = dbname + "/" + id.str() + ".couch." + id.str();
     fileRev = dbFileRevMap[vbucketId];
@@ -716,6 +815,7 @@ bool CouchKVStore::setVBucketState(uint16_t vbucketId, vbucket_state &vbstate,
             closeDatabaseHandle(db);
             return false;
         } else {
+            dbFileCommits->bump(vbucketId);
             if (notify) {
                 uint64_t newHeaderPos = couchstore_get_header_position(db);
                 RememberingCallback<uint16_t> lcb;
@@ -761,10 +861,17 @@ void CouchKVStore::dump(uint16_t vb, shared_ptr<Callback<GetValue> > cb)
     loadDB(cb, false, &vbids);
 }
 
+void CouchKVStore::dump(const std::vector<uint16_t> &vbids,
+                        shared_ptr<Callback<GetValue> > cb)
+{
+    std::vector<uint16_t> ids(vbids);
+    loadDB(cb, false, &ids, COUCHSTORE_NO_DELETES);
+}
+
 void CouchKVStore::dumpKeys(const std::vector<uint16_t> &vbids,  shared_ptr<Callback<GetValue> > cb)
 {
-    (void)vbids;
-    loadDB(cb, true, NULL, COUCHSTORE_NO_DELETES);
+    std::vector<uint16_t> ids(vbids);
+    loadDB(cb, true, &ids, COUCHSTORE_NO_DELETES);
 }
 
 void CouchKVStore::dumpDeleted(uint16_t vb,  shared_ptr<Callback<GetValue> > cb)
@@ -790,6 +897,31 @@ bool CouchKVStore::commit(void)
 
 }
 
+DetachedTransaction *CouchKVStore::detach(void)
+{
+    assert(!isReadOnly());
+    assert(intransaction);
+    CouchTransaction *txn = new CouchTransaction(*this, pendingReqsQ);
+    pendingCommitCnt = 0;
+    intransaction = false;
+    return txn;
+}
+
+CouchTransaction::~CouchTransaction()
+{
+    // Requests are only left behind if the transaction was never
+    // committed.
+    std::vector<CouchRequest *>::iterator it;
+    for (it = requests.begin(); it != requests.end(); ++it) {
+        delete *it;
+    }
+}
+
+bool CouchTransaction::commit()
+{
+    return store.commitRequests(requests);
+}
+
 void CouchKVStore::addStats(const std::string &prefix,
                             ADD_STAT add_stat,
                             const void *c)
@@ -803,6 +935,13 @@ void CouchKVStore::addStats(const std::string &prefix,
     addStat(prefix_str, "readTime",       st.readTimeHisto,   add_stat, c);
     addStat(prefix_str, "readSize",       st.readSizeHisto,   add_stat, c);
     addStat(prefix_str, "numLoadedVb",    st.numLoadedVb,     add_stat, c);
+    addStat(prefix_str, "dbCacheHits",    st.numDbCacheHits,  add_stat, c);
+    addStat(prefix_str, "dbCacheMisses",  st.numDbCacheMisses, add_stat, c);
+    addStat(prefix_str, "dbCacheEvictions", st.numDbCacheEvictions,
+            add_stat, c);
+    addStat(prefix_str, "fsMergedReads", st.fsStats.mergedReads, add_stat, c);
+    addStat(prefix_str, "fsReadaheadWasted", st.fsStats.readaheadWasted,
+            add_stat, c);
 
     // failure stats
     addStat(prefix_str, "failure_open",   st.numOpenFailure, add_stat, c);
@@ -822,10 +961,19 @@ void CouchKVStore::addStats(const std::string &prefix,
 
 void CouchKVStore::addTimingStats(const std::string &prefix,
                                   ADD_STAT add_stat, const void *c) {
+    const char *prefix_str = prefix.c_str();
+
+    // Couchstore file ops stats of the reads, which the read-only
+    // stores used by background fetches and warmup do most of
+    addStat(prefix_str, "fsReadTime",  st.fsStats.readTimeHisto,  add_stat, c);
+    addStat(prefix_str, "fsReadSize",  st.fsStats.readSizeHisto,  add_stat, c);
+    addStat(prefix_str, "fsReadSeek",  st.fsStats.readSeekHisto,  add_stat, c);
+    addStat(prefix_str, "fsReadQueueDepth", st.fsStats.readQueueDepthHisto,
+            add_stat, c);
     if (isReadOnly()) {
         return;
     }
-    const char *prefix_str = prefix.c_str();
+
     addStat(prefix_str, "commit",      st.commitHisto,      add_stat, c);
     addStat(prefix_str, "commitRetry", st.commitRetryHisto, add_stat, c);
     addStat(prefix_str, "delete",      st.delTimeHisto,     add_stat, c);
@@ -835,12 +983,13 @@ void CouchKVStore::addTimingStats(const std::string &prefix,
     addStat(prefix_str, "bulkSize",    st.batchSize,        add_stat, c);
 
     // Couchstore file ops stats
-    addStat(prefix_str, "fsReadTime",  st.fsStats.readTimeHisto,  add_stat, c);
     addStat(prefix_str, "fsWriteTime", st.fsStats.writeTimeHisto, add_stat, c);
     addStat(prefix_str, "fsSyncTime",  st.fsStats.syncTimeHisto,  add_stat, c);
-    addStat(prefix_str, "fsReadSize",  st.fsStats.readSizeHisto,  add_stat, c);
     addStat(prefix_str, "fsWriteSize", st.fsStats.writeSizeHisto, add_stat, c);
-    addStat(prefix_str, "fsReadSeek",  st.fsStats.readSeekHisto,  add_stat, c);
+    addStat(prefix_str, "fsGroupSyncTime", st.fsStats.groupSyncTimeHisto,
+            add_stat, c);
+    addStat(prefix_str, "fsGroupSyncSize", st.fsStats.groupSyncSizeHisto,
+            add_stat, c);
 }
 
 template <typename T>
@@ -939,12 +1088,17 @@ void CouchKVStore::loadDB(shared_ptr<Callback<GetValue> > cb, bool keysOnly,
             remVBucketFromDbFileMap(itr->first);
         } else {
             LoadResponseCtx ctx;
+            ctx.cks = this;
             ctx.vbucketId = itr->first;
             ctx.keysonly = keysOnly;
             ctx.callback = cb;
             ctx.stats = &epStats;
             errorCode = couchstore_changes_since(db, 0, options, recordDbDumpC,
                                                  static_cast<void *>(&ctx));
+            if (errorCode == COUCHSTORE_SUCCESS && !loadBodies(db, ctx)) {
+                errorCode = COUCHSTORE_ERROR_CANCEL;
+            }
+            freeDocInfos(ctx.docinfos);
             if (errorCode != COUCHSTORE_SUCCESS) {
                 if (errorCode == COUCHSTORE_ERROR_CANCEL) {
                     LOG(EXTENSION_LOG_WARNING,
@@ -992,6 +1146,7 @@ void CouchKVStore::open()
 
 void CouchKVStore::close()
 {
+    invalidateCachedDB(0, true);
     intransaction = false;
     if (!isReadOnly()) {
         CouchNotifier::deleteNotifier();
@@ -1043,6 +1198,12 @@ void CouchKVStore::updateDbFileMap(uint16_t vbucketId, uint64_t newFileRev)
         return;
     }
 
+    if (dbFileRevMap[vbucketId] != newFileRev) {
+        // Whatever is cached was read from a file we're moving away from,
+        // here or in the other stores of this directory.
+        dbFileCommits->bump(vbucketId);
+        invalidateCachedDB(vbucketId);
+    }
     dbFileRevMap[vbucketId] = newFileRev;
 }
 
@@ -1227,36 +1388,27 @@ couchstore_error_t CouchKVStore::fetchDoc(Db *db, DocInfo *docinfo,
     return errCode;
 }
 
-int CouchKVStore::recordDbDump(Db *db, DocInfo *docinfo, void *ctx)
+/**
+ * Hand a document a dump found to its callback.
+ *
+ * @return false if warmup completed and the dump should stop
+ */
+static bool loadDoc(DocInfo *docinfo, Doc *doc, LoadResponseCtx &loadCtx)
 {
-    LoadResponseCtx *loadCtx = (LoadResponseCtx *)ctx;
-    shared_ptr<Callback<GetValue> > cb = loadCtx->callback;
+    shared_ptr<Callback<GetValue> > cb = loadCtx.callback;
 
-    EPStats *stats= loadCtx->stats;
+    EPStats *stats= loadCtx.stats;
     volatile bool warmup = !stats->warmupComplete.get();
 
-    Doc *doc = NULL;
     void *valuePtr = NULL;
     size_t valuelen = 0;
     sized_buf  metadata = docinfo->rev_meta;
-    uint16_t vbucketId = loadCtx->vbucketId;
+    uint16_t vbucketId = loadCtx.vbucketId;
     sized_buf key = docinfo->id;
     uint32_t itemflags;
     uint64_t cas;
     uint32_t exptime;
 
-    assert(key.size <= UINT16_MAX);
-    assert(metadata.size == 16);
-
-    if (warmup) {
-        // skip items already loaded during earlier warmup stage
-        LoadStorageKVPairCallback *lscb = static_cast<LoadStorageKVPairCallback *>(cb.get());
-
-        if (lscb->isLoaded(docinfo->id.buf, docinfo->id.size, vbucketId)) {
-            return 0;
-        }
-    }
-
     memcpy(&cas, metadata.buf, 8);
     memcpy(&exptime, (metadata.buf) + 8, 4);
     memcpy(&itemflags, (metadata.buf) + 12, 4);
@@ -1264,23 +1416,9 @@ int CouchKVStore::recordDbDump(Db *db, DocInfo *docinfo, void *ctx)
     exptime = ntohl(exptime);
     cas = ntohll(cas);
 
-    if (!loadCtx->keysonly && !docinfo->deleted) {
-        couchstore_error_t errCode ;
-        errCode = couchstore_open_doc_with_docinfo(db, docinfo, &doc, DECOMPRESS_DOC_BODIES);
-
-        if (errCode == COUCHSTORE_SUCCESS) {
-            if (doc->data.size) {
-                valuelen = doc->data.size;
-                valuePtr = doc->data.buf;
-            }
-        } else {
-            LOG(EXTENSION_LOG_WARNING,
-                "Warning: failed to retrieve key value from database "
-                "database, vBucket=%d key=%s error=%s [%s]\n",
-                vbucketId, key.buf, couchstore_strerror(errCode),
-                couchkvstore_strerrno(errCode).c_str());
-            return 0;
-        }
+    if (doc && doc->data.size) {
+        valuelen = doc->data.size;
+        valuePtr = doc->data.buf;
     }
 
     Item *it = new Item((void *)key.buf,
@@ -1293,43 +1431,112 @@ int CouchKVStore::recordDbDump(Db *db, DocInfo *docinfo, void *ctx)
                         vbucketId,
                         docinfo->rev_seq);
 
-    GetValue rv(it, ENGINE_SUCCESS, -1, loadCtx->keysonly);
+    GetValue rv(it, ENGINE_SUCCESS, -1, loadCtx.keysonly);
     cb->callback(rv);
 
-    couchstore_free_document(doc);
+    if (warmup && stats->warmupComplete.get()) {
+        LOG(EXTENSION_LOG_WARNING,
+            "Engine warmup is complete, request to stop "
+            "loading remaining database");
+        return false;
+    }
+    return true;
+}
+
+int CouchKVStore::recordDbDump(Db *db, DocInfo *docinfo, void *ctx)
+{
+    LoadResponseCtx *loadCtx = (LoadResponseCtx *)ctx;
+    shared_ptr<Callback<GetValue> > cb = loadCtx->callback;
+
+    EPStats *stats= loadCtx->stats;
+    volatile bool warmup = !stats->warmupComplete.get();
+
+    assert(docinfo->id.size <= UINT16_MAX);
+    assert(docinfo->rev_meta.size == 16);
 
-    int returnCode = COUCHSTORE_SUCCESS;
     if (warmup) {
-        if (stats->warmupComplete.get()) {
+        // skip items already loaded during earlier warmup stage
+        LoadStorageKVPairCallback *lscb = static_cast<LoadStorageKVPairCallback *>(cb.get());
+
+        if (lscb->isLoaded(docinfo->id.buf, docinfo->id.size, loadCtx->vbucketId)) {
+            return 0;
+        }
+    }
+
+    if (!loadCtx->keysonly && !docinfo->deleted) {
+        // Read the bodies a batch at a time, in the order they are in
+        // the file.
+        if (loadCtx->docinfos.size() >= loadBatchSize &&
+            !loadCtx->cks->loadBodies(db, *loadCtx)) {
             // warmup has completed, return COUCHSTORE_ERROR_CANCEL to
             // cancel remaining data dumps from couchstore
+            return COUCHSTORE_ERROR_CANCEL;
+        }
+        // Keep the docinfo, couchstore doesn't free it when we return
+        // non-zero.
+        loadCtx->docinfos.push_back(docinfo);
+        return 1;
+    }
+
+    if (!loadDoc(docinfo, NULL, *loadCtx)) {
+        return COUCHSTORE_ERROR_CANCEL;
+    }
+    return COUCHSTORE_SUCCESS;
+}
+
+bool CouchKVStore::loadBodies(Db *db, LoadResponseCtx &ctx)
+{
+    std::vector<DocInfo *> docinfos;
+    docinfos.swap(ctx.docinfos);
+    CouchReadAhead *readAhead = planBodyReads(docinfos);
+
+    bool rv = true;
+    std::vector<DocInfo *>::iterator it;
+    for (it = docinfos.begin(); it != docinfos.end() && rv; ++it) {
+        Doc *doc = NULL;
+        couchstore_error_t errCode;
+        errCode = couchstore_open_doc_with_docinfo(db, *it, &doc, DECOMPRESS_DOC_BODIES);
+        if (errCode == COUCHSTORE_SUCCESS) {
+            rv = loadDoc(*it, doc, ctx);
+        } else {
             LOG(EXTENSION_LOG_WARNING,
-                "Engine warmup is complete, request to stop "
-                "loading remaining database");
-            returnCode = COUCHSTORE_ERROR_CANCEL;
+                "Warning: failed to retrieve key value from database "
+                "database, vBucket=%d key=%s error=%s [%s]\n",
+                ctx.vbucketId, (*it)->id.buf, couchstore_strerror(errCode),
+                couchkvstore_strerrno(errCode).c_str());
         }
+        couchstore_free_document(doc);
     }
-    return returnCode;
+    delete readAhead;
+    freeDocInfos(docinfos);
+    return rv;
 }
 
 bool CouchKVStore::commit2couchstore(void)
+{
+    pendingCommitCnt = 0;
+    return commitRequests(pendingReqsQ);
+}
+
+bool CouchKVStore::commitRequests(std::vector<CouchRequest *> &reqs)
 {
     bool success = true;
+    size_t reqCount = reqs.size();
 
-    if (pendingCommitCnt == 0) {
+    if (reqCount == 0) {
         return success;
     }
 
-    CouchRequest **committedReqs = new CouchRequest *[pendingCommitCnt];
-    Doc **docs = new Doc *[pendingCommitCnt];
-    DocInfo **docinfos = new DocInfo *[pendingCommitCnt];
+    CouchRequest **committedReqs = new CouchRequest *[reqCount];
+    Doc **docs = new Doc *[reqCount];
+    DocInfo **docinfos = new DocInfo *[reqCount];
 
-    assert(pendingReqsQ[0]);
-    uint16_t vbucket2flush = pendingReqsQ[0]->getVBucketId();
-    uint64_t fileRev = pendingReqsQ[0]->getRevNum();
+    assert(reqs[0]);
+    uint16_t vbucket2flush = reqs[0]->getVBucketId();
+    uint64_t fileRev = reqs[0]->getRevNum();
     int reqIndex = 0;
-    for (; pendingCommitCnt > 0; ++reqIndex, --pendingCommitCnt) {
-        CouchRequest *req = pendingReqsQ[reqIndex];
+    for (; reqCount > 0; ++reqIndex, --reqCount) {
+        CouchRequest *req = reqs[reqIndex];
         assert(req);
         committedReqs[reqIndex] = req;
         docs[reqIndex] = req->getDbDoc();
@@ -1338,6 +1545,7 @@ bool CouchKVStore::commit2couchstore(void)
     }
 
     // flush all
+    LockHolder flh(vbFileLocks[vbucket2flush]);
     couchstore_error_t errCode = saveDocs(vbucket2flush, fileRev, docs, docinfos, reqIndex);
     if (errCode) {
         LOG(EXTENSION_LOG_WARNING,
@@ -1348,7 +1556,7 @@ bool CouchKVStore::commit2couchstore(void)
     commitCallback(committedReqs, reqIndex, errCode);
 
     // clean up
-    pendingReqsQ.clear();
+    reqs.clear();
     while (reqIndex--) {
         delete committedReqs[reqIndex];
     }
@@ -1379,47 +1587,14 @@ couchstore_error_t CouchKVStore::saveDocs(uint16_t vbid, uint64_t rev, Doc **doc
                 "fileRev = %llu numDocs = %d", vbid, fileRev, docCount);
             return errCode;
         } else {
-            uint64_t max = computeMaxDeletedSeqNum(docinfos, docCount);
-
-            // update max_deleted_seq in the local doc (vbstate)
-            // before save docs for the given vBucket
-            if (max > 0) {
-                vbucket_map_t::iterator it =
-                    cachedVBStates.find(vbid);
-                if (it != cachedVBStates.end() && it->second.maxDeletedSeqno < max) {
-                    it->second.maxDeletedSeqno = max;
-                    errCode = saveVBState(db, it->second);
-                    if (errCode != COUCHSTORE_SUCCESS) {
-                        LOG(EXTENSION_LOG_WARNING,
-                            "Warning: failed to save local doc for, "
-                            "vBucket = %d numDocs = %d\n", vbid, docCount);
-                        closeDatabaseHandle(db);
-                        return errCode;
-                    }
-                }
-            }
-
-            hrtime_t cs_begin = gethrtime();
-            errCode = couchstore_save_documents(db, docs, docinfos, docCount,
-                                                COMPRESS_DOC_BODIES);
-            st.saveDocsHisto.add((gethrtime() - cs_begin) / 1000);
+            errCode = writeDocs(vbid, db, docs, docinfos, docCount);
             if (errCode != COUCHSTORE_SUCCESS) {
-                LOG(EXTENSION_LOG_WARNING,
-                    "Warning: failed to save docs to database, numDocs = %d "
-                    "error=%s [%s]\n", docCount, couchstore_strerror(errCode),
-                    couchkvstore_strerrno(errCode).c_str());
                 closeDatabaseHandle(db);
                 return errCode;
             }
 
-            cs_begin = gethrtime();
-            errCode = couchstore_commit(db);
-            st.commitHisto.add((gethrtime() - cs_begin) / 1000);
+            errCode = commitDocs(vbid, db);
             if (errCode) {
-                LOG(EXTENSION_LOG_WARNING,
-                    "Warning: couchstore_commit failed, error=%s [%s]",
-                    couchstore_strerror(errCode),
-                    couchkvstore_strerrno(errCode).c_str());
                 closeDatabaseHandle(db);
                 return errCode;
             }
@@ -1457,6 +1632,7 @@ couchstore_error_t CouchKVStore::saveDocs(uint16_t vbid, uint64_t rev, Doc **doc
             if (db && !retry_save_docs) {
                 DbInfo info;
                 couchstore_db_info(db, &info);
+                LockHolder lh(vbStateMutex);
                 cachedDeleteCount[vbid] = info.deleted_count;
             }
             closeDatabaseHandle(db);
@@ -1474,6 +1650,229 @@ couchstore_error_t CouchKVStore::saveDocs(uint16_t vbid, uint64_t rev, Doc **doc
     return errCode;
 }
 
+couchstore_error_t CouchKVStore::writeDocs(uint16_t vbid, Db *db, Doc **docs,
+                                           DocInfo **docinfos, int docCount)
+{
+    couchstore_error_t errCode;
+    uint64_t max = computeMaxDeletedSeqNum(docinfos, docCount);
+
+    // update max_deleted_seq in the local doc (vbstate)
+    // before save docs for the given vBucket
+    if (max > 0) {
+        LockHolder lh(vbStateMutex);
+        vbucket_map_t::iterator it =
+            cachedVBStates.find(vbid);
+        if (it != cachedVBStates.end() && it->second.maxDeletedSeqno < max) {
+            it->second.maxDeletedSeqno = max;
+            vbucket_state vbstate = it->second;
+            lh.unlock();
+            errCode = saveVBState(db, vbstate);
+            if (errCode != COUCHSTORE_SUCCESS) {
+                LOG(EXTENSION_LOG_WARNING,
+                    "Warning: failed to save local doc for, "
+                    "vBucket = %d numDocs = %d\n", vbid, docCount);
+                return errCode;
+            }
+        }
+    }
+
+    hrtime_t cs_begin = gethrtime();
+    errCode = couchstore_save_documents(db, docs, docinfos, docCount,
+                                        COMPRESS_DOC_BODIES);
+    st.saveDocsHisto.add((gethrtime() - cs_begin) / 1000);
+    if (errCode != COUCHSTORE_SUCCESS) {
+        LOG(EXTENSION_LOG_WARNING,
+            "Warning: failed to save docs to database, numDocs = %d "
+            "error=%s [%s]\n", docCount, couchstore_strerror(errCode),
+            couchkvstore_strerrno(errCode).c_str());
+    }
+    return errCode;
+}
+
+couchstore_error_t CouchKVStore::commitDocs(uint16_t vbid, Db *db)
+{
+    hrtime_t cs_begin = gethrtime();
+    couchstore_error_t errCode = couchstore_commit(db);
+    st.commitHisto.add((gethrtime() - cs_begin) / 1000);
+    if (errCode) {
+        LOG(EXTENSION_LOG_WARNING,
+            "Warning: couchstore_commit failed, error=%s [%s]",
+            couchstore_strerror(errCode),
+            couchkvstore_strerrno(errCode).c_str());
+    } else {
+        dbFileCommits->bump(vbid);
+    }
+    return errCode;
+}
+
+/**
+ * A vbucket file written by a group commit.
+ */
+struct GroupCommitFile {
+    GroupCommitFile() : reqs(NULL), db(NULL), newFileRev(0),
+                        errCode(COUCHSTORE_SUCCESS) {}
+
+    uint16_t vbid;
+    uint64_t fileRev;
+    std::vector<CouchRequest *> *reqs;
+    std::vector<Doc *> docs;
+    std::vector<DocInfo *> docinfos;
+    Db *db;
+    uint64_t newFileRev;
+    couchstore_error_t errCode;
+};
+
+bool CouchKVStore::commitGroup(const std::vector<DetachedTransaction *> &txns)
+{
+    if (txns.size() == 1) {
+        return txns.front()->commit();
+    }
+
+    // Go through the files in vbucket order, so that their locks are
+    // always taken in the same order.
+    std::map<uint16_t, std::vector<CouchRequest *> *> byVBucket;
+    std::vector<DetachedTransaction *>::const_iterator it;
+    for (it = txns.begin(); it != txns.end(); ++it) {
+        CouchTransaction *txn = static_cast<CouchTransaction *>(*it);
+        assert(&txn->store == this);
+        if (!txn->requests.empty()) {
+            byVBucket[txn->requests.front()->getVBucketId()] = &txn->requests;
+        }
+    }
+
+    std::vector<GroupCommitFile> files(byVBucket.size());
+    std::vector<LockHolder *> locks;
+    std::vector<GroupCommitFile>::iterator fit = files.begin();
+    std::map<uint16_t, std::vector<CouchRequest *> *>::iterator vit;
+    for (vit = byVBucket.begin(); vit != byVBucket.end(); ++vit, ++fit) {
+        fit->vbid = vit->first;
+        fit->reqs = vit->second;
+        fit->fileRev = fit->reqs->front()->getRevNum();
+        std::vector<CouchRequest *>::iterator rit;
+        for (rit = fit->reqs->begin(); rit != fit->reqs->end(); ++rit) {
+            assert((*rit)->getVBucketId() == fit->vbid);
+            fit->docs.push_back((*rit)->getDbDoc());
+            fit->docinfos.push_back((*rit)->getDbDocInfo());
+        }
+        locks.push_back(new LockHolder(vbFileLocks[fit->vbid]));
+    }
+
+    {
+        CouchSyncGroup group(&st.fsStats);
+        for (fit = files.begin(); fit != files.end(); ++fit) {
+            fit->errCode = openDB(fit->vbid, fit->fileRev, &fit->db, 0,
+                                  &fit->newFileRev);
+            if (fit->errCode != COUCHSTORE_SUCCESS) {
+                LOG(EXTENSION_LOG_WARNING,
+                    "Warning: failed to open database, vbucketId = %d "
+                    "fileRev = %llu numDocs = %d", fit->vbid, fit->fileRev,
+                    static_cast<int>(fit->docs.size()));
+                fit->db = NULL;
+                continue;
+            }
+            fit->errCode = writeDocs(fit->vbid, fit->db, &fit->docs[0],
+                                     &fit->docinfos[0], fit->docs.size());
+            if (fit->errCode != COUCHSTORE_SUCCESS) {
+                closeDatabaseHandle(fit->db);
+                fit->db = NULL;
+            }
+        }
+
+        // The documents must be durable before any header referring to
+        // them is written.
+        couchstore_error_t errCode = group.sync();
+        for (fit = files.begin(); fit != files.end(); ++fit) {
+            if (fit->db) {
+                fit->errCode = errCode ? errCode :
+                               commitDocs(fit->vbid, fit->db);
+                if (fit->errCode != COUCHSTORE_SUCCESS) {
+                    closeDatabaseHandle(fit->db);
+                    fit->db = NULL;
+                }
+            }
+        }
+
+        errCode = group.sync();
+        for (fit = files.begin(); fit != files.end(); ++fit) {
+            if (fit->db && errCode) {
+                fit->errCode = errCode;
+                closeDatabaseHandle(fit->db);
+                fit->db = NULL;
+            }
+        }
+    }
+
+    for (fit = files.begin(); fit != files.end(); ++fit) {
+        if (!fit->db) {
+            continue;
+        }
+        if (epStats.shutdown.isShutdown) {
+            // shutdown is in progress, no need to notify mccouch
+            closeDatabaseHandle(fit->db);
+            continue;
+        }
+
+        RememberingCallback<uint16_t> cb;
+        uint64_t newHeaderPos = couchstore_get_header_position(fit->db);
+        couchNotifier->notify_headerpos_update(fit->vbid, fit->newFileRev,
+                                               newHeaderPos, cb);
+        if (cb.val == PROTOCOL_BINARY_RESPONSE_ETMPFAIL) {
+            // The file was compacted meanwhile, save the docs again
+            // on their own.
+            LOG(EXTENSION_LOG_WARNING,
+                "Retry notify CouchDB of update, vbucket=%d rev=%llu\n",
+                fit->vbid, fit->newFileRev);
+            closeDatabaseHandle(fit->db);
+            fit->db = NULL;
+            ++st.numCommitRetry;
+            hrtime_t retry_begin = gethrtime();
+            fit->errCode = saveDocs(fit->vbid, fit->newFileRev,
+                                    &fit->docs[0], &fit->docinfos[0],
+                                    fit->docs.size());
+            st.commitRetryHisto.add((gethrtime() - retry_begin) / 1000);
+            continue;
+        } else if (cb.val != PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+            LOG(EXTENSION_LOG_WARNING, "Warning: failed to notify "
+                "CouchDB of update for vbucket=%d, error=0x%x\n",
+                fit->vbid, cb.val);
+        }
+        st.batchSize.add(fit->docs.size());
+
+        DbInfo info;
+        couchstore_db_info(fit->db, &info);
+        {
+            LockHolder lh(vbStateMutex);
+            cachedDeleteCount[fit->vbid] = info.deleted_count;
+        }
+        closeDatabaseHandle(fit->db);
+        fit->db = NULL;
+    }
+
+    // Only now that the whole group is durable, tell everyone.
+    for (fit = files.begin(); fit != files.end(); ++fit) {
+        if (fit->errCode == COUCHSTORE_SUCCESS) {
+            st.docsCommitted = fit->docs.size();
+        } else {
+            LOG(EXTENSION_LOG_WARNING,
+                "Warning: commit failed, cannot save CouchDB docs "
+                "for vbucket = %d rev = %llu\n", fit->vbid, fit->fileRev);
+            ++epStats.commitFailed;
+        }
+        commitCallback(&(*fit->reqs)[0], fit->reqs->size(), fit->errCode);
+        std::vector<CouchRequest *>::iterator rit;
+        for (rit = fit->reqs->begin(); rit != fit->reqs->end(); ++rit) {
+            delete *rit;
+        }
+        fit->reqs->clear();
+    }
+
+    std::vector<LockHolder *>::iterator lit;
+    for (lit = locks.begin(); lit != locks.end(); ++lit) {
+        delete *lit;
+    }
+    return true;
+}
+
 void CouchKVStore::queueItem(CouchRequest *req)
 {
     if (pendingCommitCnt &&
@@ -1604,17 +2003,15 @@ couchstore_error_t CouchKVStore::saveVBState(Db *db, vbucket_state &vbState)
 
 int CouchKVStore::getMultiCb(Db *db, DocInfo *docinfo, void *ctx)
 {
+    (void)db;
     assert(docinfo);
-    std::string keyStr(docinfo->id.buf, docinfo->id.size);
     assert(ctx);
     GetMultiCbCtx *cbCtx = static_cast<GetMultiCbCtx *>(ctx);
-    CouchKVStoreStats &st = cbCtx->cks.getCKVStoreStat();
-
 
-    vb_bgfetch_queue_t::iterator qitr = cbCtx->fetches.find(docinfo->db_seq);
-    if (qitr == cbCtx->fetches.end()) {
+    if (cbCtx->fetches.find(docinfo->db_seq) == cbCtx->fetches.end()) {
         // this could be a serious race condition in couchstore,
         // log a warning message and continue
+        std::string keyStr(docinfo->id.buf, docinfo->id.size);
         LOG(EXTENSION_LOG_WARNING,
             "Warning: couchstore returned invalid docinfo, "
             "no pending bgfetch has been issued for db_seq=%lld "
@@ -1622,19 +2019,29 @@ int CouchKVStore::getMultiCb(Db *db, DocInfo *docinfo, void *ctx)
         return 0;
     }
 
-    std::list<VBucketBGFetchItem *> &fetches = (*qitr).second;
+    // Keep the docinfo (couchstore doesn't free it when we return
+    // non-zero), the bodies are read once we know where all of them are.
+    cbCtx->docinfos.push_back(docinfo);
+    return 1;
+}
+
+static void fetchMultiBody(Db *db, DocInfo *docinfo, GetMultiCbCtx &ctx)
+{
+    CouchKVStoreStats &st = ctx.cks.getCKVStoreStat();
+    std::list<VBucketBGFetchItem *> &fetches = ctx.fetches[docinfo->db_seq];
     GetValue returnVal;
-    couchstore_error_t errCode = cbCtx->cks.fetchDoc(db, docinfo, returnVal,
-                                                     cbCtx->vbId, false);
+    couchstore_error_t errCode = ctx.cks.fetchDoc(db, docinfo, returnVal,
+                                                  ctx.vbId, false);
     if (errCode != COUCHSTORE_SUCCESS) {
+        std::string keyStr(docinfo->id.buf, docinfo->id.size);
         LOG(EXTENSION_LOG_WARNING, "Warning: failed to fetch data from database, "
-            "vBucket=%d key=%s error=%s [%s]", cbCtx->vbId,
+            "vBucket=%d key=%s error=%s [%s]", ctx.vbId,
             keyStr.c_str(), couchstore_strerror(errCode),
                          couchkvstore_strerrno(errCode).c_str());
         st.numGetFailure++;
     }
 
-    returnVal.setStatus(cbCtx->cks.couchErr2EngineErr(errCode));
+    returnVal.setStatus(ctx.cks.couchErr2EngineErr(errCode));
     std::list<VBucketBGFetchItem *>::iterator itr = fetches.begin();
     for (; itr != fetches.end(); ++itr) {
         // populate return value for remaining fetch items with the
@@ -1646,7 +2053,36 @@ int CouchKVStore::getMultiCb(Db *db, DocInfo *docinfo, void *ctx)
                                  returnVal.getValue()->getNBytes());
         }
     }
-    return 0;
+}
+
+CouchReadAhead *CouchKVStore::planBodyReads(std::vector<DocInfo *> &docinfos)
+{
+    // Go through the file once instead of seeking back and forth, and
+    // read the bodies that are close together at once.
+    std::sort(docinfos.begin(), docinfos.end(), docinfoOffsetLess);
+    if (docinfos.size() < 2 || (readaheadWindow == 0 && fileReader == NULL)) {
+        return NULL;
+    }
+    CouchReadAhead *readAhead = new CouchReadAhead(&st.fsStats, readaheadWindow,
+                                                   fileReader);
+    std::vector<DocInfo *>::iterator it;
+    for (it = docinfos.begin(); it != docinfos.end(); ++it) {
+        if ((*it)->size > 0) {
+            readAhead->plan((*it)->bp, bodyExtent(*it));
+        }
+    }
+    return readAhead;
+}
+
+void CouchKVStore::fetchMultiBodies(Db *db, GetMultiCbCtx &ctx)
+{
+    CouchReadAhead *readAhead = planBodyReads(ctx.docinfos);
+    std::vector<DocInfo *>::iterator it;
+    for (it = ctx.docinfos.begin(); it != ctx.docinfos.end(); ++it) {
+        fetchMultiBody(db, *it, ctx);
+        couchstore_free_docinfo(*it);
+    }
+    delete readAhead;
 }
 
 
@@ -1660,6 +2096,105 @@ void CouchKVStore::closeDatabaseHandle(Db *db) {
     st.numClose++;
 }
 
+couchstore_error_t CouchKVStore::openCachedDB(uint16_t vbid, uint64_t fileRev,
+                                              CachedDb &handle)
+{
+    // A commit racing with the open below leaves the handle marked stale,
+    // so it's reopened next time rather than kept on an old header.
+    uint64_t commits = dbFileCommits->get(vbid);
+
+    if (dbCacheCapacity > 0) {
+        LockHolder lh(dbCacheMutex);
+        std::map<uint16_t, std::list<CachedDb>::iterator>::iterator it;
+        it = dbCacheIndex.find(vbid);
+        if (it != dbCacheIndex.end()) {
+            CachedDb cached = *it->second;
+            dbCache.erase(it->second);
+            dbCacheIndex.erase(it);
+            lh.unlock();
+
+            if (cached.fileRev == fileRev && cached.commits == commits) {
+                ++st.numDbCacheHits;
+                handle = cached;
+                return COUCHSTORE_SUCCESS;
+            }
+            ++st.numDbCacheEvictions;
+            closeDatabaseHandle(cached.db);
+        }
+    }
+
+    ++st.numDbCacheMisses;
+    uint64_t newFileRev(fileRev);
+    handle.vbid = vbid;
+    handle.db = NULL;
+    couchstore_error_t errCode = openDB(vbid, fileRev, &handle.db,
+                                        COUCHSTORE_OPEN_FLAG_RDONLY,
+                                        &newFileRev);
+    // A newer revision found while opening is picked up next time.
+    handle.reusable = newFileRev == fileRev;
+    handle.fileRev = newFileRev;
+    handle.commits = commits;
+    return errCode;
+}
+
+void CouchKVStore::releaseCachedDB(CachedDb &handle, bool reuse)
+{
+    if (handle.db == NULL) {
+        return;
+    }
+    if (!reuse || !handle.reusable || dbCacheCapacity == 0) {
+        closeDatabaseHandle(handle.db);
+        handle.db = NULL;
+        return;
+    }
+
+    Db *toClose(NULL);
+    {
+        LockHolder lh(dbCacheMutex);
+        if (dbCacheIndex.find(handle.vbid) != dbCacheIndex.end()) {
+            // Someone else cached one while we were reading.
+            toClose = handle.db;
+        } else {
+            dbCache.push_front(handle);
+            dbCacheIndex[handle.vbid] = dbCache.begin();
+            if (dbCache.size() > dbCacheCapacity) {
+                toClose = dbCache.back().db;
+                dbCacheIndex.erase(dbCache.back().vbid);
+                dbCache.pop_back();
+                ++st.numDbCacheEvictions;
+            }
+        }
+    }
+    if (toClose) {
+        closeDatabaseHandle(toClose);
+    }
+    handle.db = NULL;
+}
+
+void CouchKVStore::invalidateCachedDB(uint16_t vbid, bool all)
+{
+    std::list<CachedDb> stale;
+    {
+        LockHolder lh(dbCacheMutex);
+        if (all) {
+            stale.swap(dbCache);
+            dbCacheIndex.clear();
+        } else {
+            std::map<uint16_t, std::list<CachedDb>::iterator>::iterator it;
+            it = dbCacheIndex.find(vbid);
+            if (it != dbCacheIndex.end()) {
+                stale.splice(stale.begin(), dbCache, it->second);
+                dbCacheIndex.erase(it);
+            }
+        }
+    }
+    std::list<CachedDb>::iterator it;
+    for (it = stale.begin(); it != stale.end(); ++it) {
+        ++st.numDbCacheEvictions;
+        closeDatabaseHandle(it->db);
+    }
+}
+
 ENGINE_ERROR_CODE CouchKVStore::couchErr2EngineErr(couchstore_error_t errCode)
 {
     switch (errCode) {
@@ -1715,6 +2250,7 @@ bool CouchKVStore::getEstimatedItemCount(size_t &items)
 }
 
 size_t CouchKVStore::getNumPersistedDeletes(uint16_t vbid) {
+    LockHolder lh(vbStateMutex);
     std::map<uint16_t, size_t>::iterator itr = cachedDeleteCount.find(vbid);
     if (itr != cachedDeleteCount.end()) {
         return itr->second;
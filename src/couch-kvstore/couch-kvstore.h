@@ -22,16 +22,19 @@
 
 #include "libcouchstore/couch_db.h"
 
+#include <list>
 #include <map>
 #include <string>
 #include <vector>
 
+#include "atomic.h"
 #include "configuration.h"
 #include "couch-kvstore/couch-fs-stats.h"
 #include "couch-kvstore/couch-notifier.h"
 #include "histo.h"
 #include "item.h"
 #include "kvstore.h"
+#include "mutex.h"
 #include "stats.h"
 
 
@@ -50,6 +53,7 @@ public:
       docsCommitted(0), numOpen(0), numClose(0),
       numLoadedVb(0), numGetFailure(0), numSetFailure(0),
       numDelFailure(0), numOpenFailure(0), numVbSetFailure(0),
+      numDbCacheHits(0), numDbCacheMisses(0), numDbCacheEvictions(0),
       readSizeHisto(ExponentialGenerator<size_t>(1, 2), 25),
       writeSizeHisto(ExponentialGenerator<size_t>(1, 2), 25) {
     }
@@ -65,6 +69,9 @@ public:
         numOpenFailure.set(0);
         numVbSetFailure.set(0);
         numCommitRetry.set(0);
+        numDbCacheHits.set(0);
+        numDbCacheMisses.set(0);
+        numDbCacheEvictions.set(0);
 
         readTimeHisto.reset();
         readSizeHisto.reset();
@@ -95,6 +102,13 @@ public:
     Atomic<size_t> numVbSetFailure;
     Atomic<size_t> numCommitRetry;
 
+    // read-only database handles reused from the cache
+    Atomic<size_t> numDbCacheHits;
+    // reads that had to open the database file
+    Atomic<size_t> numDbCacheMisses;
+    // cached handles closed as stale or to make room
+    Atomic<size_t> numDbCacheEvictions;
+
     /* for flush and vb delete, no error handling in CouchKVStore, such
      * failure should be tracked in MC-engine  */
 
@@ -123,6 +137,8 @@ public:
 
 class EventuallyPersistentEngine;
 class EPStats;
+struct GetMultiCbCtx;
+struct LoadResponseCtx;
 
 typedef union {
     Callback <mutation_result> *setCb;
@@ -257,6 +273,79 @@ private :
     hrtime_t start;
 };
 
+class CouchKVStore;
+
+/**
+ * The pending requests of a CouchKVStore transaction, detached from
+ * the store so that they can be committed while the next transaction
+ * is being queued.
+ */
+class CouchTransaction : public DetachedTransaction {
+public:
+    CouchTransaction(CouchKVStore &s, std::vector<CouchRequest *> &reqs)
+        : store(s) {
+        requests.swap(reqs);
+    }
+
+    ~CouchTransaction();
+
+    bool commit();
+
+private:
+    friend class CouchKVStore;
+
+    CouchKVStore &store;
+    std::vector<CouchRequest *> requests;
+
+    DISALLOW_COPY_AND_ASSIGN(CouchTransaction);
+};
+
+/**
+ * Counts the commits made to each vbucket file of a data directory.
+ *
+ * The read-write and read-only stores of a bucket are separate objects,
+ * so all stores opened on the same directory share one instance.  This
+ * lets a store tell that a database handle it cached is stale without
+ * looking at the file.
+ */
+class DbFileCommits {
+public:
+    static DbFileCommits *acquire(const std::string &dbname,
+                                  uint16_t numFiles);
+    static void release(DbFileCommits *commits);
+
+    uint64_t get(uint16_t vbid) const {
+        return counts[vbid].get();
+    }
+
+    /**
+     * Record that the given vbucket file has a new header, or has been
+     * replaced by another revision.
+     */
+    void bump(uint16_t vbid) {
+        ++counts[vbid];
+    }
+
+private:
+    DbFileCommits(const std::string &nm, uint16_t n) :
+        dbname(nm), numFiles(n), counts(new Atomic<uint64_t>[n]),
+        refCount(0) {}
+
+    ~DbFileCommits() {
+        delete [] counts;
+    }
+
+    const std::string dbname;
+    const uint16_t numFiles;
+    Atomic<uint64_t> *counts;
+    size_t refCount;
+
+    static Mutex initMutex;
+    static std::map<std::string, DbFileCommits *> instances;
+
+    DISALLOW_COPY_AND_ASSIGN(DbFileCommits);
+};
+
 /**
  * KVStore with couchstore as the underlying storage system
  */
@@ -283,6 +372,9 @@ public:
      */
     virtual ~CouchKVStore() {
         close();
+        DbFileCommits::release(dbFileCommits);
+        delete [] vbFileLocks;
+        delete fileReader;
     }
 
     /**
@@ -308,6 +400,20 @@ public:
      */
     bool commit(void);
 
+    /**
+     * Detach the current transaction, to be committed by another thread.
+     *
+     * @return the detached transaction
+     */
+    DetachedTransaction *detach(void);
+
+    /**
+     * Commit detached transactions of different vbuckets together:
+     * the documents of all of them are written and synced first, then
+     * their headers, and only then are their callbacks invoked.
+     */
+    bool commitGroup(const std::vector<DetachedTransaction *> &txns);
+
     /**
      * Rollback a transaction (unless not currently in one).
      */
@@ -417,6 +523,16 @@ public:
      */
     void dump(uint16_t vb, shared_ptr<Callback<GetValue> > cb);
 
+    /**
+     * Retrieve all the live documents for the given vbuckets, in the
+     * given order.
+     *
+     * @param vbids list of vbucket ids whose documents are going to be retrieved
+     * @param cb callback instance to process each document retrieved
+     */
+    void dump(const std::vector<uint16_t> &vbids,
+              shared_ptr<Callback<GetValue> > cb);
+
     /**
      * Retrieve all the keys from the underlying storage system.
      *
@@ -517,11 +633,28 @@ protected:
                  ADD_STAT add_stat, const void *c);
 
 private:
+    /**
+     * A read-only database handle, and how many commits its file had
+     * seen just before it was opened.
+     */
+    struct CachedDb {
+        CachedDb() : db(NULL), vbid(0), fileRev(0), commits(0),
+                     reusable(false) {}
+
+        Db      *db;
+        uint16_t vbid;
+        uint64_t fileRev;
+        uint64_t commits;
+        //! False if the file moved to another revision while it was opened.
+        bool     reusable;
+    };
+
     void operator=(const CouchKVStore &from);
 
     void open();
     void close();
     bool commit2couchstore(void);
+    bool commitRequests(std::vector<CouchRequest *> &reqs);
     void queueItem(CouchRequest *req);
 
     uint64_t checkNewRevNum(std::string &dbname, bool newFile = false);
@@ -535,12 +668,55 @@ private:
                                     Db **db, uint64_t *newFileRev);
     couchstore_error_t saveDocs(uint16_t vbid, uint64_t rev, Doc **docs,
                                 DocInfo **docinfos, int docCount);
+    couchstore_error_t writeDocs(uint16_t vbid, Db *db, Doc **docs,
+                                 DocInfo **docinfos, int docCount);
+    couchstore_error_t commitDocs(uint16_t vbid, Db *db);
     void commitCallback(CouchRequest **committedReqs, int numReqs,
                         couchstore_error_t errCode);
     couchstore_error_t saveVBState(Db *db, vbucket_state &vbState);
     void setDocsCommitted(uint16_t docs);
     void closeDatabaseHandle(Db *db);
 
+    /**
+     * Sort the given docinfos by the offsets of their bodies, and get a
+     * read-ahead for reading them in that order (NULL if not needed).
+     */
+    CouchReadAhead *planBodyReads(std::vector<DocInfo *> &docinfos);
+
+    /**
+     * Read the bodies of the documents a getMulti() found, in the order
+     * they are in the file, and hand them to the fetches waiting for them.
+     */
+    void fetchMultiBodies(Db *db, GetMultiCbCtx &ctx);
+
+    /**
+     * Read the bodies of the documents a dump collected so far, in the
+     * order they are in the file, and hand them to its callback.
+     *
+     * @return false if warmup completed and the dump should stop
+     */
+    bool loadBodies(Db *db, LoadResponseCtx &ctx);
+
+    /**
+     * Get a read-only handle for the given vbucket file, reusing a
+     * cached one if no store of this data directory has committed to
+     * the file since it was opened.  The handle is the caller's until it's given back with
+     * releaseCachedDB().
+     */
+    couchstore_error_t openCachedDB(uint16_t vbid, uint64_t fileRev,
+                                    CachedDb &handle);
+
+    /**
+     * Give back a handle from openCachedDB(), keeping it for later
+     * reads unless reuse is false.
+     */
+    void releaseCachedDB(CachedDb &handle, bool reuse);
+
+    /**
+     * Close all cached handles of the given vbucket (or all vbuckets).
+     */
+    void invalidateCachedDB(uint16_t vbid, bool all = false);
+
     EPStats &epStats;
     Configuration &configuration;
     const std::string dbname;
@@ -552,6 +728,12 @@ private:
     bool intransaction;
     bool dbFileRevMapPopulated;
 
+    /* serializes writers of the same vbucket file, as transactions
+       detached from this store may be committed concurrently */
+    Mutex *vbFileLocks;
+    /* guards cachedVBStates and cachedDeleteCount */
+    Mutex vbStateMutex;
+
     /* all stats */
     CouchKVStoreStats   st;
     couch_file_ops statCollectingFileOps;
@@ -559,6 +741,21 @@ private:
     vbucket_map_t cachedVBStates;
     /* deleted docs in each file*/
     std::map<uint16_t, size_t> cachedDeleteCount;
+
+    /* read-only handles, most recently used first */
+    std::list<CachedDb> dbCache;
+    std::map<uint16_t, std::list<CachedDb>::iterator> dbCacheIndex;
+    size_t dbCacheCapacity;
+    Mutex dbCacheMutex;
+    /* commits to each vbucket file, shared with the other stores */
+    DbFileCommits *dbFileCommits;
+
+    /* most bytes read at once to get the bodies of several documents */
+    size_t readaheadWindow;
+    /* keeps body reads in flight for fetches and dumps (read-only only) */
+    CouchFileReader *fileReader;
+
+    friend class CouchTransaction;
 };
 
 #endif  // SRC_COUCH_KVSTORE_COUCH_KVSTORE_H_
@@ -31,7 +31,6 @@
 
 #include "access_scanner.h"
 #include "checkpoint_remover.h"
-#include "dispatcher.h"
 #include "ep.h"
 #include "ep_engine.h"
 #include "flusher.h"
@@ -89,6 +88,8 @@ public:
     virtual void sizeValueChanged(const std::string &key, size_t value) {
         if (key.compare("bg_fetch_delay") == 0) {
             store.setBGFetchDelay(static_cast<uint32_t>(value));
+        } else if (key.compare("bg_fetch_latency_target") == 0) {
+            store.setBGFetchLatencyTarget(value);
         } else if (key.compare("expiry_window") == 0) {
             store.setItemExpiryWindow(value);
         } else if (key.compare("max_txn_size") == 0) {
@@ -117,26 +118,29 @@ private:
     EventuallyPersistentStore &store;
 };
 
-class VBucketMemoryDeletionCallback : public DispatcherCallback {
+class VBucketMemoryDeletionTask : public GlobalTask {
 public:
-    VBucketMemoryDeletionCallback(EventuallyPersistentStore *e, RCPtr<VBucket> &vb) :
-    ep(e), vbucket(vb) {}
+    VBucketMemoryDeletionTask(EventuallyPersistentEngine *e,
+                              RCPtr<VBucket> &vb, double delay) :
+        GlobalTask(e, Priority::VBMemoryDeletionPriority, delay,
+                   NO_START_TIME, false),
+        vbucket(vb), vbid(vb->getId()) {}
 
-    bool callback(Dispatcher &, TaskId &) {
+    bool run() {
         vbucket->ht.clear();
         vbucket.reset();
         return false;
     }
 
-    std::string description() {
+    std::string getDescription() {
         std::stringstream ss;
-        ss << "Removing (dead) vbucket " << vbucket->getId() << " from memory";
+        ss << "Removing (dead) vbucket " << vbid << " from memory";
         return ss.str();
     }
 
 private:
-    EventuallyPersistentStore *ep;
     RCPtr<VBucket> vbucket;
+    uint16_t vbid;
 };
 
 EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine &theEngine) :
@@ -144,7 +148,8 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
     vbMap(theEngine.getConfiguration(), *this),
     accessLog(engine.getConfiguration().getAlogPath(),
               engine.getConfiguration().getAlogBlockSize()),
-    diskFlushAll(false), bgFetchDelay(0), statsSnapshotTaskId(0),
+    diskFlushAll(false), bgFetchDelay(0), bgFetchLatencyTarget(0),
+    statsSnapshotTaskId(0),
     lastTransTimePerItem(0),snapshotVBState(false)
 {
     Configuration &config = engine.getConfiguration();
@@ -154,8 +159,6 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
 
     auxUnderlying = KVStoreFactory::create(stats, config, true);
     assert(auxUnderlying);
-    auxIODispatcher = new Dispatcher(theEngine, "AUXIO_Dispatcher");
-    nonIODispatcher = new Dispatcher(theEngine, "NONIO_Dispatcher");
 
     stats.memOverhead = sizeof(EventuallyPersistentStore);
 
@@ -197,6 +200,9 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
     setBGFetchDelay(config.getBgFetchDelay());
     config.addValueChangedListener("bg_fetch_delay",
                                    new EPStoreValueChangeListener(*this));
+    setBGFetchLatencyTarget(config.getBgFetchLatencyTarget());
+    config.addValueChangedListener("bg_fetch_latency_target",
+                                   new EPStoreValueChangeListener(*this));
 
     stats.warmupMemUsedCap.set(static_cast<double>(config.getWarmupMinMemoryThreshold()) / 100.0);
     config.addValueChangedListener("warmup_min_memory_threshold",
@@ -216,11 +222,7 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
         vbMap.addBucket(vb);
     }
 
-    // @todo - Ideally we should run the warmup thread in it's own
-    //         thread so that it won't block the flusher (in the write
-    //         thread), but we can't put it in the RO dispatcher either,
-    //         because that would block the background fetches..
-    warmupTask = new Warmup(this, auxIODispatcher);
+    warmupTask = new Warmup(this);
 }
 
 class WarmupWaitListener : public WarmupStateListener {
@@ -269,7 +271,6 @@ bool EventuallyPersistentStore::initialize() {
         reset();
     }
 
-    startDispatcher();
     if (!startFlusher()) {
         LOG(EXTENSION_LOG_WARNING,
             "FATAL: Failed to create and start flushers");
@@ -280,7 +281,6 @@ bool EventuallyPersistentStore::initialize() {
            "FATAL: Failed to create and start bgfetchers");
         return false;
     }
-    startNonIODispatcher();
 
     WarmupWaitListener warmupListener(*warmupTask, config.isWaitforwarmup());
     warmupTask->addWarmupStateListener(&warmupListener);
@@ -297,23 +297,20 @@ bool EventuallyPersistentStore::initialize() {
 
     size_t expiryPagerSleeptime = config.getExpPagerStime();
 
-    shared_ptr<DispatcherCallback> cb(new ItemPager(this, stats));
-    nonIODispatcher->schedule(cb, NULL, Priority::ItemPagerPriority, 10);
+    ExTask pager = new ItemPager(&engine, this, stats, 10);
+    IOManager::get()->scheduleTask(pager, NONIO_TASK_IDX);
 
     setExpiryPagerSleeptime(expiryPagerSleeptime);
     config.addValueChangedListener("exp_pager_stime",
                                     new EPStoreValueChangeListener(*this));
 
-    shared_ptr<DispatcherCallback> htr(new HashtableResizer(this));
-    nonIODispatcher->schedule(htr, NULL, Priority::HTResizePriority, 10);
+    ExTask htr = new HashtableResizer(&engine, this, 10);
+    IOManager::get()->scheduleTask(htr, NONIO_TASK_IDX);
 
     size_t checkpointRemoverInterval = config.getChkRemoverStime();
-    shared_ptr<DispatcherCallback> chk_cb(new ClosedUnrefCheckpointRemover(this,
-                                                                           stats,
-                                                                           checkpointRemoverInterval));
-    nonIODispatcher->schedule(chk_cb, NULL,
-                              Priority::CheckpointRemoverPriority,
-                              checkpointRemoverInterval);
+    ExTask chkTask = new ClosedUnrefCheckpointRemover(&engine, this, stats,
+                                                      checkpointRemoverInterval);
+    IOManager::get()->scheduleTask(chkTask, NONIO_TASK_IDX);
     return true;
 }
 
@@ -326,25 +323,12 @@ EventuallyPersistentStore::~EventuallyPersistentStore() {
     IOManager::get()->cancel(mLogCompactorTaskId);
     IOManager::get()->unregisterBucket(ObjectRegistry::getCurrentEngine());
 
-    auxIODispatcher->stop(stats.forceShutdown);
-    nonIODispatcher->stop(stats.forceShutdown);
-
     delete conflictResolver;
     delete warmupTask;
-    delete auxIODispatcher;
-    delete nonIODispatcher;
     delete auxUnderlying;
     delete storageProperties;
 }
 
-void EventuallyPersistentStore::startDispatcher() {
-    auxIODispatcher->start();
-}
-
-void EventuallyPersistentStore::startNonIODispatcher() {
-    nonIODispatcher->start();
-}
-
 const Flusher* EventuallyPersistentStore::getFlusher(uint16_t shardId) {
     return vbMap.getShard(shardId)->getFlusher();
 }
@@ -448,9 +432,12 @@ RCPtr<VBucket> EventuallyPersistentStore::getVBucket(uint16_t vbid,
 void EventuallyPersistentStore::firePendingVBucketOps() {
     uint16_t i;
     for (i = 0; i < vbMap.getSize(); i++) {
-        RCPtr<VBucket> vb = getVBucket(i, vbucket_state_active);
+        RCPtr<VBucket> vb = vbMap.getBucket(i);
         if (vb) {
-            vb->fireAllOps(engine);
+            if (vb->getState() == vbucket_state_active) {
+                vb->fireAllOps(engine);
+            }
+            vb->fireDurabilityWaiters(engine);
         }
     }
 }
@@ -851,8 +838,8 @@ void EventuallyPersistentStore::scheduleVBDeletion(RCPtr<VBucket> &vb,
                                                    const void* cookie,
                                                    double delay,
                                                    bool recreate) {
-    shared_ptr<DispatcherCallback> mem_cb(new VBucketMemoryDeletionCallback(this, vb));
-    nonIODispatcher->schedule(mem_cb, NULL, Priority::VBMemoryDeletionPriority, delay, false);
+    ExTask delTask = new VBucketMemoryDeletionTask(&engine, vb, delay);
+    IOManager::get()->scheduleTask(delTask, NONIO_TASK_IDX);
 
     uint16_t vbid = vb->getId();
     if (vbMap.setBucketDeletion(vbid, true)) {
@@ -874,6 +861,7 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::deleteVBucket(uint16_t vbid, const
 
     vbMap.removeBucket(vbid);
     lh.unlock();
+    vb->fireDurabilityWaiters(engine, true);
     scheduleVBDeletion(vb, c);
     scheduleVBSnapshot(Priority::VBucketPersistHighPriority,
                        vbMap.getShard(vbid)->getId());
@@ -895,6 +883,7 @@ bool EventuallyPersistentStore::resetVBucket(uint16_t vbid) {
 
         vbMap.removeBucket(vbid);
         lh.unlock();
+        vb->fireDurabilityWaiters(engine, true);
 
         vbucket_state_t vbstate = vb->getState();
         std::list<std::string> tap_cursors = vb->checkpointManager.getTAPCursorNames();
@@ -1049,6 +1038,12 @@ void EventuallyPersistentStore::completeBGFetchMulti(uint16_t vbId,
             "EP Store completes %d of batched background fetch for "
             "for vBucket = %d that is already deleted\n",
             (int)fetchedItems.size(), vbId);
+        std::vector<VBucketBGFetchItem *>::iterator it = fetchedItems.begin();
+        for (; it != fetchedItems.end(); ++it) {
+            if ((*it)->batch) {
+                completeMultiGetFetch(**it, NULL, ENGINE_NOT_MY_VBUCKET);
+            }
+        }
         return;
     }
 
@@ -1058,6 +1053,8 @@ void EventuallyPersistentStore::completeBGFetchMulti(uint16_t vbId,
         ENGINE_ERROR_CODE status = value.getStatus();
         Item *fetchedValue = value.getValue();
         const std::string &key = (*itemItr)->key;
+        bool forBatch = (*itemItr)->batch != NULL;
+        Item *batchItem(NULL);
 
         if (vb->getState() == vbucket_state_active ||
             vb->getState() == vbucket_state_replica) {
@@ -1068,6 +1065,10 @@ void EventuallyPersistentStore::completeBGFetchMulti(uint16_t vbId,
                 if (status == ENGINE_SUCCESS) {
                     v->unlocked_restoreValue(fetchedValue, vb->ht);
                     assert(v->isResident());
+                    if (forBatch && !v->isDeleted()) {
+                        batchItem = v->toItem(v->isLocked(ep_current_time()),
+                                              vbId, engine.getItemPool());
+                    }
                     if (v->getExptime() != fetchedValue->getExptime()) {
                         assert(v->isDirty());
                         // exptime mutated, schedule it into new checkpoint
@@ -1083,12 +1084,26 @@ void EventuallyPersistentStore::completeBGFetchMulti(uint16_t vbId,
                         "key=%s", vbId, v->getBySeqno(), key.c_str());
                     status = ENGINE_TMPFAIL;
                 }
+            } else if (forBatch && v && v->isResident() && !v->isDeleted()) {
+                // Somebody else brought it back meanwhile.
+                batchItem = v->toItem(v->isLocked(ep_current_time()),
+                                      vbId, engine.getItemPool());
+                status = ENGINE_SUCCESS;
             }
+        } else if (forBatch) {
+            status = ENGINE_NOT_MY_VBUCKET;
         }
 
         hrtime_t endTime = gethrtime();
         updateBGStats((*itemItr)->initTime, startTime, endTime);
-        engine.notifyIOComplete((*itemItr)->cookie, status);
+        if (forBatch) {
+            if (batchItem == NULL && status == ENGINE_SUCCESS) {
+                status = ENGINE_KEY_ENOENT;
+            }
+            completeMultiGetFetch(**itemItr, batchItem, status);
+        } else {
+            engine.notifyIOComplete((*itemItr)->cookie, status);
+        }
         std::stringstream ss;
         ss << "Completed a background fetch, now at "
            << vb->numPendingBGFetchItems() << std::endl;
@@ -1135,6 +1150,103 @@ void EventuallyPersistentStore::bgFetch(const std::string &key,
     }
 }
 
+/// @cond DETAILS
+/**
+ * Copies a resident item out of the hash table for a get that doesn't
+ * take the bucket lock.
+ */
+class GetReader : public HashTableReader {
+public:
+    GetReader(uint16_t vb, ItemPool &p) :
+        vbucket(vb), pool(p), item(NULL), bySeqno(0), nru(0) {}
+
+    bool read(StoredValue *v) {
+        if (v == NULL) {
+            return true;
+        }
+        // Expiring the item, fetching it from disk or dealing with a
+        // getl lock all need the bucket lock.
+        if (v->isTempItem() || v->hasLock() || v->isExpired(ep_real_time())) {
+            return false;
+        }
+        value_t value(v->getValue().get());
+        if (!value) {
+            return false;
+        }
+        bySeqno = v->getBySeqno();
+        nru = v->getNRUValue();
+        item = pool.newItem(v->getKeyBytes(), v->getKeyLen(), v->getFlags(),
+                            v->getExptime(), value, v->getCas(), bySeqno,
+                            vbucket, v->getRevSeqno());
+        return true;
+    }
+
+    void discard() {
+        pool.release(item);
+        item = NULL;
+    }
+
+    uint16_t vbucket;
+    ItemPool &pool;
+    //! The item found, NULL if there is none.
+    Item    *item;
+    int64_t  bySeqno;
+    uint8_t  nru;
+};
+
+/**
+ * Copies the metadata of an item out of the hash table for a getMeta
+ * that doesn't take the bucket lock.
+ */
+class GetMetaReader : public HashTableReader {
+public:
+    GetMetaReader() : nonExistent(false), deleted(false) {}
+
+    bool read(StoredValue *v) {
+        if (v == NULL) {
+            // A temporary item has to be added to fetch the metadata.
+            return false;
+        }
+        metadata.cas = v->getCas();
+        nonExistent = v->isTempNonExistentItem();
+        if (!nonExistent) {
+            deleted = v->isDeleted() || v->isExpired(ep_real_time());
+            metadata.flags = v->getFlags();
+            metadata.exptime = v->getExptime();
+            metadata.revSeqno = v->getRevSeqno();
+        }
+        return true;
+    }
+
+    ItemMetaData metadata;
+    //! True if the key is known not to exist.
+    bool         nonExistent;
+    bool         deleted;
+};
+/// @endcond
+
+/**
+ * Count a get towards the hit rate of its vbucket, and towards the
+ * warmup hit rate if that's still being measured.  A get that has to
+ * wait for its value is counted as a background fetch, and as a get
+ * once it's served.
+ */
+static void countGet(EPStats &stats, RCPtr<VBucket> &vb, bool bgFetch) {
+    if (bgFetch) {
+        ++vb->opsBgFetch;
+    } else {
+        ++vb->opsGet;
+    }
+    rel_time_t end = stats.warmupHitWindowEnd.get();
+    if (end != 0 && ep_current_time() < end) {
+        if (bgFetch) {
+            ++stats.warmupWindowBgFetches;
+        } else {
+            ++stats.warmupWindowGets;
+        }
+    }
+}
+
 GetValue EventuallyPersistentStore::getInternal(const std::string &key,
                                                 uint16_t vbucket,
                                                 const void *cookie,
@@ -1161,6 +1273,18 @@ GetValue EventuallyPersistentStore::getInternal(const std::string &key,
         }
     }
 
+    GetReader reader(vbucket, engine.getItemPool());
+    if (vb->ht.optimisticFind(key, reader, false, trackReference)) {
+        if (reader.item == NULL) {
+            return GetValue();
+        }
+        if (trackReference) {
+            countGet(stats, vb, false);
+        }
+        return GetValue(reader.item, ENGINE_SUCCESS, reader.bySeqno, false,
+                        reader.nru);
+    }
+
     int bucket_num(0);
     LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
     StoredValue *v = fetchValidValue(vb, key, bucket_num, false, trackReference);
@@ -1170,12 +1294,19 @@ GetValue EventuallyPersistentStore::getInternal(const std::string &key,
         if (!v->isResident()) {
             if (queueBG) {
                 bgFetch(key, vbucket, v->getBySeqno(), cookie);
+                if (trackReference) {
+                    countGet(stats, vb, true);
+                }
             }
             return GetValue(NULL, ENGINE_EWOULDBLOCK, v->getBySeqno(), true,
                             v->getNRUValue());
         }
 
-        GetValue rv(v->toItem(v->isLocked(ep_current_time()), vbucket),
+        if (trackReference) {
+            countGet(stats, vb, false);
+        }
+        GetValue rv(v->toItem(v->isLocked(ep_current_time()), vbucket,
+                              engine.getItemPool()),
                     ENGINE_SUCCESS, v->getBySeqno(), false, v->getNRUValue());
         return rv;
     } else {
@@ -1184,6 +1315,116 @@ GetValue EventuallyPersistentStore::getInternal(const std::string &key,
     }
 }
 
+/// @cond DETAILS
+/**
+ * Resolves the keys a batch get has in one vbucket, noting the ones
+ * that have to be fetched from disk.
+ */
+class MultiGetVisitor : public HashTableKeyVisitor {
+public:
+    MultiGetVisitor(EventuallyPersistentStore &s, RCPtr<VBucket> &v,
+                    MultiGetBatch &b, const std::vector<size_t> &p) :
+        store(s), vb(v), batch(b), positions(p) {}
+
+    void visit(size_t pos, int bucket_num) {
+        size_t entryPos = positions[pos];
+        MultiGetBatch::Entry &entry = batch.entries[entryPos];
+        StoredValue *v = store.fetchValidValue(vb, entry.key, bucket_num);
+        if (v == NULL) {
+            entry.status = ENGINE_KEY_ENOENT;
+        } else if (!v->isResident()) {
+            misses.push_back(std::make_pair(entryPos, v->getBySeqno()));
+        } else {
+            entry.item = v->toItem(v->isLocked(ep_current_time()),
+                                   vb->getId(),
+                                   store.getEPEngine().getItemPool());
+            entry.status = ENGINE_SUCCESS;
+        }
+    }
+
+    //! Positions in the batch and row ids of the keys to fetch.
+    std::vector<std::pair<size_t, int64_t> > misses;
+
+private:
+    EventuallyPersistentStore &store;
+    RCPtr<VBucket> &vb;
+    MultiGetBatch &batch;
+    const std::vector<size_t> &positions;
+};
+/// @endcond
+
+bool EventuallyPersistentStore::getMulti(MultiGetBatch &batch) {
+    std::map<uint16_t, std::vector<size_t> > byVBucket;
+    for (size_t i = 0; i < batch.entries.size(); ++i) {
+        byVBucket[batch.entries[i].vbucket].push_back(i);
+    }
+
+    std::set<BgFetcher*> fetchers;
+    std::map<uint16_t, std::vector<size_t> >::iterator it;
+    for (it = byVBucket.begin(); it != byVBucket.end(); ++it) {
+        std::vector<size_t> &positions = it->second;
+        RCPtr<VBucket> vb = getVBucket(it->first);
+        ENGINE_ERROR_CODE status(ENGINE_SUCCESS);
+        if (!vb || vb->getState() != vbucket_state_active) {
+            status = vb && vb->getState() == vbucket_state_pending ?
+                ENGINE_TMPFAIL : ENGINE_NOT_MY_VBUCKET;
+        }
+        if (status != ENGINE_SUCCESS) {
+            std::vector<size_t>::iterator pit;
+            for (pit = positions.begin(); pit != positions.end(); ++pit) {
+                batch.entries[*pit].status = status;
+            }
+            if (status == ENGINE_NOT_MY_VBUCKET) {
+                stats.numNotMyVBuckets.incr(positions.size());
+            }
+            continue;
+        }
+
+        std::vector<std::string> keys;
+        keys.reserve(positions.size());
+        std::vector<size_t>::iterator pit;
+        for (pit = positions.begin(); pit != positions.end(); ++pit) {
+            keys.push_back(batch.entries[*pit].key);
+        }
+        MultiGetVisitor visitor(*this, vb, batch, positions);
+        vb->ht.visitKeys(keys, visitor);
+        if (visitor.misses.empty()) {
+            continue;
+        }
+
+        // Queue all of the vbucket's misses before waking the fetcher,
+        // so they go to disk as one batch.
+        BgFetcher *fetcher = vbMap.getShard(it->first)->getBgFetcher();
+        std::vector<std::pair<size_t, int64_t> >::iterator mit;
+        for (mit = visitor.misses.begin(); mit != visitor.misses.end(); ++mit) {
+            batch.addPending();
+            vb->queueBGFetchItem(new VBucketBGFetchItem(&batch, mit->first,
+                                                        mit->second),
+                                 fetcher, false);
+        }
+        stats.numRemainingBgJobs.incr(visitor.misses.size());
+        stats.numGetMultiBgFetches.incr(visitor.misses.size());
+        fetchers.insert(fetcher);
+    }
+
+    std::set<BgFetcher*>::iterator fit;
+    for (fit = fetchers.begin(); fit != fetchers.end(); ++fit) {
+        (*fit)->wakeUp();
+    }
+    return batch.completed();
+}
+
+void EventuallyPersistentStore::completeMultiGetFetch(VBucketBGFetchItem &fetch,
+                                                      Item *itm,
+                                                      ENGINE_ERROR_CODE status) {
+    MultiGetBatch::Entry &entry = fetch.batch->entries[fetch.batchPos];
+    entry.item = itm;
+    entry.status = status;
+    if (fetch.batch->completed()) {
+        engine.notifyIOComplete(fetch.batch->cookie, ENGINE_SUCCESS);
+    }
+}
+
 ENGINE_ERROR_CODE EventuallyPersistentStore::getMetaData(const std::string &key,
                                                          uint16_t vbucket,
                                                          const void *cookie,
@@ -1199,8 +1440,22 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::getMetaData(const std::string &key,
         return ENGINE_NOT_MY_VBUCKET;
     }
 
-    int bucket_num(0);
     deleted = 0;
+    GetMetaReader reader;
+    if (vb->ht.optimisticFind(key, reader, true, trackReferenced)) {
+        stats.numOpsGetMeta++;
+        metadata.cas = reader.metadata.cas;
+        if (reader.nonExistent) {
+            return ENGINE_KEY_ENOENT;
+        }
+        if (reader.deleted) {
+            deleted |= GET_META_ITEM_DELETED_FLAG;
+        }
+        metadata = reader.metadata;
+        return ENGINE_SUCCESS;
+    }
+
+    int bucket_num(0);
     LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
     StoredValue *v = vb->ht.unlocked_find(key, bucket_num, true, trackReferenced);
 
@@ -1354,7 +1609,8 @@ GetValue EventuallyPersistentStore::getAndUpdateTtl(const std::string &key,
         }
         v->setExptime(exptime);
 
-        GetValue rv(v->toItem(v->isLocked(ep_current_time()), vbucket),
+        GetValue rv(v->toItem(v->isLocked(ep_current_time()), vbucket,
+                              engine.getItemPool()),
                     ENGINE_SUCCESS, v->getBySeqno());
 
         if (v->isResident()) {
@@ -1472,7 +1728,7 @@ bool EventuallyPersistentStore::getLocked(const std::string &key,
         // acquire lock and increment cas value
         v->lock(currentTime + lockTimeout);
 
-        Item *it = v->toItem(false, vbucket);
+        Item *it = v->toItem(false, vbucket, engine.getItemPool());
         it->setCas();
         v->setCas(it->getCas());
 
@@ -1850,20 +2106,33 @@ void EventuallyPersistentStore::flushOneDeleteAll() {
 }
 
 int EventuallyPersistentStore::flushVBucket(uint16_t vbid) {
+    FlushBatch *batch = collectFlush(vbid, false);
+    if (!batch) {
+        // disk flush is pending just return
+        return 0;
+    }
+    return commitFlush(batch);
+}
+
+FlushBatch *EventuallyPersistentStore::collectFlush(uint16_t vbid,
+                                                    bool detach) {
     if (diskFlushAll) {
         if (vbMap.getShard(vbid)->getId() == EP_PRIMARY_SHARD) {
             flushOneDeleteAll();
         } else {
-            // disk flush is pending just return
-            return 0;
+            return NULL;
         }
     }
 
-    int items_flushed = 0;
-    bool schedule_vb_snapshot = false;
-    rel_time_t flush_start = ep_current_time();
-    RCPtr<VBucket> vb = vbMap.getBucket(vbid);
-    if (vb && !vbMap.isBucketCreation(vbid)) {
+    hrtime_t start = gethrtime();
+    RCPtr<VBucket> v = vbMap.getBucket(vbid);
+    if (v && vbMap.isBucketCreation(vbid)) {
+        v.reset();
+    }
+    FlushBatch *batch = new FlushBatch(vbid, v);
+    // The persistence callbacks keep a reference to the batch's vbucket.
+    RCPtr<VBucket> &vb = batch->vb;
+    if (vb) {
         std::vector<queued_item> items;
         KVStore *rwUnderlying = getRWUnderlying(vbid);
 
@@ -1873,7 +2142,7 @@ int EventuallyPersistentStore::flushVBucket(uint16_t vbid) {
         }
 
         vb->getBackfillItems(items);
-        vb->checkpointManager.getAllItemsForPersistence(items);
+        batch->mutationId = vb->checkpointManager.getAllItemsForPersistence(items);
 
         if (!items.empty()) {
             while (!rwUnderlying->begin()) {
@@ -1885,7 +2154,6 @@ int EventuallyPersistentStore::flushVBucket(uint16_t vbid) {
             rwUnderlying->optimizeWrites(items);
 
             QueuedItem *prev = NULL;
-            std::list<PersistenceCallback*> pcbs;
             std::vector<queued_item>::iterator it = items.begin();
             for(; it != items.end(); ++it) {
                 if ((*it)->getOperation() != queue_op_set &&
@@ -1893,10 +2161,10 @@ int EventuallyPersistentStore::flushVBucket(uint16_t vbid) {
                     continue;
                 } else if (!prev || prev->getKey() != (*it)->getKey()) {
                     prev = (*it).get();
-                    ++items_flushed;
+                    ++batch->itemsFlushed;
                     PersistenceCallback *cb = flushOneDelOrSet(*it, vb);
                     if (cb) {
-                        pcbs.push_back(cb);
+                        batch->pcbs.push_back(cb);
                     }
                     ++stats.flusher_todo;
                 } else {
@@ -1905,52 +2173,112 @@ int EventuallyPersistentStore::flushVBucket(uint16_t vbid) {
                 }
             }
 
-            BlockTimer timer(&stats.diskCommitHisto, "disk_commit",
-                             stats.timingLog);
-            hrtime_t start = gethrtime();
+            batch->needsCommit = true;
+            if (detach) {
+                batch->txn = rwUnderlying->detach();
+            }
+        }
+    }
 
-            while (!rwUnderlying->commit()) {
-                ++stats.commitFailed;
-                LOG(EXTENSION_LOG_WARNING, "Flusher commit failed!!! Retry in "
-                    "1 sec...\n");
-                sleep(1);
+    batch->collected = gethrtime();
+    stats.flushCollectHisto.add((batch->collected - start) / 1000);
+    return batch;
+}
+
+int EventuallyPersistentStore::commitFlush(FlushBatch *batch) {
+    std::vector<FlushBatch*> batches(1, batch);
+    return commitFlush(batches);
+}
+
+int EventuallyPersistentStore::commitFlush(std::vector<FlushBatch*> &batches) {
+    assert(!batches.empty());
+    int items_flushed = 0;
+    rel_time_t flush_start = batches.front()->flushStart;
+    std::vector<DetachedTransaction*> txns;
+    bool needsCommit = false;
+    hrtime_t now = gethrtime();
+    std::vector<FlushBatch*>::iterator it;
+    for (it = batches.begin(); it != batches.end(); ++it) {
+        FlushBatch *batch = *it;
+        if (batch->vb && batch->needsCommit) {
+            needsCommit = true;
+            items_flushed += batch->itemsFlushed;
+            flush_start = std::min(flush_start, batch->flushStart);
+            stats.flushQueueHisto.add((now - batch->collected) / 1000);
+            if (batch->txn) {
+                txns.push_back(batch->txn);
             }
+        }
+    }
+
+    if (needsCommit) {
+        // All of them were taken from the same store.
+        KVStore *rwUnderlying = getRWUnderlying(batches.front()->vbid);
+        assert(txns.empty() || batches.size() == txns.size());
+
+        BlockTimer timer(&stats.diskCommitHisto, "disk_commit",
+                         stats.timingLog);
+        hrtime_t start = gethrtime();
+
+        while (txns.empty() ? !rwUnderlying->commit() :
+                              !rwUnderlying->commitGroup(txns)) {
+            ++stats.commitFailed;
+            LOG(EXTENSION_LOG_WARNING, "Flusher commit failed!!! Retry in "
+                "1 sec...\n");
+            sleep(1);
+        }
 
+        for (it = batches.begin(); it != batches.end(); ++it) {
+            std::list<PersistenceCallback*> &pcbs = (*it)->pcbs;
             while (!pcbs.empty()) {
                 delete pcbs.front();
                 pcbs.pop_front();
             }
+        }
 
-            ++stats.flusherCommits;
-            hrtime_t end = gethrtime();
-            uint64_t commit_time = (end - start) / 1000000;
-            uint64_t trans_time = (end - flush_start) / 1000000;
+        ++stats.flusherCommits;
+        hrtime_t end = gethrtime();
+        uint64_t commit_time = (end - start) / 1000000;
+        uint64_t trans_time = (end - flush_start) / 1000000;
 
-            lastTransTimePerItem = (items_flushed == 0) ? 0 :
-                static_cast<double>(trans_time) /
-                static_cast<double>(items_flushed);
-            stats.commit_time.set(commit_time);
-            stats.cumulativeCommitTime.incr(commit_time);
-            stats.cumulativeFlushTime.incr(ep_current_time() - flush_start);
-            stats.flusher_todo.set(0);
-        }
+        lastTransTimePerItem.set((items_flushed == 0) ? 0 :
+            static_cast<double>(trans_time) /
+            static_cast<double>(items_flushed));
+        stats.commit_time.set(commit_time);
+        stats.cumulativeCommitTime.incr(commit_time);
+        stats.cumulativeFlushTime.incr(ep_current_time() - flush_start);
+        stats.flusher_todo.set(0);
+    }
 
-        uint64_t chkid = vb->checkpointManager.getPersistenceCursorPreChkId();
-        if (vb->rejectQueue.empty()) {
-            vb->notifyCheckpointPersisted(engine, chkid);
-        }
+    bool schedule_vb_snapshot = false;
+    for (it = batches.begin(); it != batches.end(); ++it) {
+        FlushBatch *batch = *it;
+        RCPtr<VBucket> &vb = batch->vb;
+        if (vb) {
+            uint64_t chkid = vb->checkpointManager.getPersistenceCursorPreChkId();
+            if (vb->rejectQueue.empty()) {
+                vb->notifyCheckpointPersisted(engine, chkid);
+                vb->notifyPersisted(engine, batch->mutationId);
+            }
 
-        if (chkid > 0 && chkid != vbMap.getPersistenceCheckpointId(vbid)) {
-            vbMap.setPersistenceCheckpointId(vbid, chkid);
-            schedule_vb_snapshot = true;
+            if (chkid > 0 &&
+                chkid != vbMap.getPersistenceCheckpointId(batch->vbid)) {
+                vbMap.setPersistenceCheckpointId(batch->vbid, chkid);
+                schedule_vb_snapshot = true;
+            }
         }
     }
 
     if (schedule_vb_snapshot || snapshotVBState) {
         scheduleVBSnapshot(Priority::VBucketPersistHighPriority,
-                           vbMap.getShard(vbid)->getId());
+                           vbMap.getShard(batches.front()->vbid)->getId());
     }
 
+    for (it = batches.begin(); it != batches.end(); ++it) {
+        delete (*it)->txn;
+        delete *it;
+    }
+    batches.clear();
     return items_flushed;
 }
 
@@ -2117,6 +2445,10 @@ void EventuallyPersistentStore::loadSessionStats() {
 
 void EventuallyPersistentStore::warmupCompleted() {
     stats.warmupComplete.set(true);
+    // How many of the gets right after warmup find their value in
+    // memory tells how well warmup chose what to load.
+    stats.warmupHitWindowEnd.set(ep_current_time() +
+                                 engine.getConfiguration().getWarmupHitWindow() * 60);
 
     // Run the vbucket state snapshot job once after the warmup
     scheduleVBSnapshot(Priority::VBucketPersistHighPriority);
@@ -2178,17 +2510,15 @@ void EventuallyPersistentStore::setExpiryPagerSleeptime(size_t val) {
     LockHolder lh(expiryPager.mutex);
 
     if (expiryPager.sleeptime != 0) {
-        getNonIODispatcher()->cancel(expiryPager.task);
+        IOManager::get()->cancel(expiryPager.task);
     }
 
     expiryPager.sleeptime = val;
     if (val != 0) {
-        shared_ptr<DispatcherCallback> exp_cb(new ExpiredItemPager(this, stats,
-                                                                   expiryPager.sleeptime));
-
-        getNonIODispatcher()->schedule(exp_cb, &expiryPager.task,
-                                       Priority::ItemPagerPriority,
-                                       expiryPager.sleeptime);
+        ExTask expTask = new ExpiredItemPager(&engine, this, stats,
+                                              expiryPager.sleeptime);
+        expiryPager.task = IOManager::get()->scheduleTask(expTask,
+                                                          NONIO_TASK_IDX);
     }
 }
 
@@ -2196,18 +2526,16 @@ void EventuallyPersistentStore::setAccessScannerSleeptime(size_t val) {
     LockHolder lh(accessScanner.mutex);
 
     if (accessScanner.sleeptime != 0) {
-        auxIODispatcher->cancel(accessScanner.task);
+        IOManager::get()->cancel(accessScanner.task);
     }
 
     // store sleeptime in seconds
     accessScanner.sleeptime = val * 60;
     if (accessScanner.sleeptime != 0) {
-        AccessScanner *as = new AccessScanner(*this, stats, accessScanner.sleeptime);
-        shared_ptr<DispatcherCallback> cb(as);
-        auxIODispatcher->schedule(cb, &accessScanner.task,
-                                  Priority::AccessScannerPriority,
-                                  accessScanner.sleeptime);
-        stats.alogTime.set(accessScanner.task->getWaketime().tv_sec);
+        ExTask task = new AccessScanner(*this, stats, accessScanner.sleeptime);
+        accessScanner.task = IOManager::get()->scheduleTask(task,
+                                                            AUXIO_TASK_IDX);
+        stats.alogTime.set(task->getWaketime().tv_sec);
     }
 }
 
@@ -2215,14 +2543,12 @@ void EventuallyPersistentStore::resetAccessScannerStartTime() {
     LockHolder lh(accessScanner.mutex);
 
     if (accessScanner.sleeptime != 0) {
-        auxIODispatcher->cancel(accessScanner.task);
+        IOManager::get()->cancel(accessScanner.task);
         // re-schedule task according to the new task start hour
-        AccessScanner *as = new AccessScanner(*this, stats, accessScanner.sleeptime);
-        shared_ptr<DispatcherCallback> cb(as);
-        auxIODispatcher->schedule(cb, &accessScanner.task,
-                                  Priority::AccessScannerPriority,
-                                  accessScanner.sleeptime);
-        stats.alogTime.set(accessScanner.task->getWaketime().tv_sec);
+        ExTask task = new AccessScanner(*this, stats, accessScanner.sleeptime);
+        accessScanner.task = IOManager::get()->scheduleTask(task,
+                                                            AUXIO_TASK_IDX);
+        stats.alogTime.set(task->getWaketime().tv_sec);
     }
 }
 
@@ -2244,9 +2570,17 @@ void EventuallyPersistentStore::visit(VBucketVisitor &visitor)
     visitor.complete();
 }
 
+void EventuallyPersistentStore::visit(shared_ptr<VBucketVisitor> visitor,
+                                      const char *lbl, task_type_t taskGroup,
+                                      const Priority &prio, double sleepTime) {
+    ExTask task = new VBCBAdaptor(this, visitor, lbl, prio, sleepTime);
+    IOManager::get()->scheduleTask(task, taskGroup);
+}
+
 VBCBAdaptor::VBCBAdaptor(EventuallyPersistentStore *s,
                          shared_ptr<VBucketVisitor> v,
-                         const char *l, double sleep) :
+                         const char *l, const Priority &p, double sleep) :
+    GlobalTask(&s->getEPEngine(), p, 0, NO_START_TIME, false),
     store(s), visitor(v), label(l), sleepTime(sleep), currentvb(0)
 {
     const VBucketFilter &vbFilter = visitor->getVBucketFilter();
@@ -2261,13 +2595,13 @@ VBCBAdaptor::VBCBAdaptor(EventuallyPersistentStore *s,
     }
 }
 
-bool VBCBAdaptor::callback(Dispatcher & d, TaskId &t) {
+bool VBCBAdaptor::run() {
     if (!vbList.empty()) {
         currentvb = vbList.front();
         RCPtr<VBucket> vb = store->vbMap.getBucket(currentvb);
         if (vb) {
             if (visitor->pauseVisitor()) {
-                d.snooze(t, sleepTime);
+                snooze(sleepTime, false);
                 return true;
             }
             if (visitor->visitBucket(vb)) {
@@ -43,12 +43,12 @@
 #include "atomic.h"
 #include "bgfetcher.h"
 #include "conflict_resolution.h"
-#include "dispatcher.h"
 #include "item_pager.h"
 #include "kvstore.h"
 #include "locks.h"
 #include "mutation_log.h"
 #include "queueditem.h"
+#include "scheduler.h"
 #include "stats.h"
 #include "stored-value.h"
 #include "vbucket.h"
@@ -117,22 +117,46 @@ class EventuallyPersistentStore;
 
 class PersistenceCallback;
 
+/**
+ * The items of a vbucket collected for persistence by
+ * EventuallyPersistentStore::collectFlush(), waiting to be committed
+ * by EventuallyPersistentStore::commitFlush().
+ */
+struct FlushBatch {
+    FlushBatch(uint16_t id, const RCPtr<VBucket> &v)
+        : vbid(id), vb(v), txn(NULL), itemsFlushed(0), needsCommit(false),
+          flushStart(ep_current_time()), collected(0), mutationId(0) {}
+
+    uint16_t vbid;
+    RCPtr<VBucket> vb;
+    std::list<PersistenceCallback*> pcbs;
+    //! The transaction detached from the underlying store, if any.
+    DetachedTransaction *txn;
+    int itemsFlushed;
+    bool needsCommit;
+    rel_time_t flushStart;
+    //! When collecting the items completed.
+    hrtime_t collected;
+    //! Mutation id everything up to which is persisted by this batch.
+    uint64_t mutationId;
+};
+
 /**
  * VBucket visitor callback adaptor.
  */
-class VBCBAdaptor : public DispatcherCallback {
+class VBCBAdaptor : public GlobalTask {
 public:
 
-    VBCBAdaptor(EventuallyPersistentStore *s,
-                shared_ptr<VBucketVisitor> v, const char *l, double sleep=0);
+    VBCBAdaptor(EventuallyPersistentStore *s, shared_ptr<VBucketVisitor> v,
+                const char *l, const Priority &p, double sleep=0);
 
-    std::string description() {
+    std::string getDescription() {
         std::stringstream rv;
         rv << label << " on vb " << currentvb;
         return rv.str();
     }
 
-    bool callback(Dispatcher &d, TaskId &t);
+    bool run();
 
 private:
     std::queue<uint16_t>        vbList;
@@ -220,6 +244,20 @@ public:
                            vbucket_state_replica);
     }
 
+    /**
+     * Retrieve the values of a batch of keys from active vbuckets.
+     *
+     * The keys are grouped by vbucket and looked up taking each hash
+     * table lock once.  The ones that have to come from disk are
+     * handed to the background fetcher together, which notifies the
+     * batch's connection once the last of them is in.
+     *
+     * @param batch the keys, receiving what was found for each
+     * @return true if the batch is complete, false if the connection
+     *         will be notified once it is
+     */
+    bool getMulti(MultiGetBatch &batch);
+
 
     /**
      * Retrieve the meta data for an item
@@ -336,26 +374,18 @@ public:
 
     double getBGFetchDelay(void) { return (double)bgFetchDelay; }
 
-    void startDispatcher(void);
-
-    void startNonIODispatcher(void);
-
     /**
-     * Get the auxiliary IO dispatcher.
+     * Set how long (µs) the oldest item of a batched background fetch
+     * may wait in all, holding the fetch to batch up included.  The
+     * BG fetchers hold their fetches for no more than that, and not
+     * at all while few fetches come in (0 never holds them).
      */
-    Dispatcher* getAuxIODispatcher(void) {
-        assert(auxIODispatcher);
-        return auxIODispatcher;
+    void setBGFetchLatencyTarget(size_t to) {
+        bgFetchLatencyTarget.set(to);
     }
 
-    /**
-     * Get the current non-io dispatcher.
-     *
-     * Use this dispatcher to queue non-io jobs.
-     */
-    Dispatcher* getNonIODispatcher(void) {
-        assert(nonIODispatcher);
-        return nonIODispatcher;
+    hrtime_t getBGFetchLatencyTarget(void) {
+        return bgFetchLatencyTarget.get();
     }
 
     void stopFlusher(void);
@@ -463,6 +493,10 @@ public:
      */
     ENGINE_ERROR_CODE deleteVBucket(uint16_t vbid, const void* c = NULL);
 
+    /**
+     * Wake the ops blocked on vbuckets that became active, and the
+     * durability waits that timed out.
+     */
     void firePendingVBucketOps();
 
     /**
@@ -479,10 +513,8 @@ public:
      * Note that this is asynchronous.
      */
     void visit(shared_ptr<VBucketVisitor> visitor, const char *lbl,
-               Dispatcher *d, const Priority &prio, bool isDaemon=true, double sleepTime=0) {
-        d->schedule(shared_ptr<DispatcherCallback>(new VBCBAdaptor(this, visitor, lbl, sleepTime)),
-                    NULL, prio, 0, isDaemon);
-    }
+               task_type_t taskGroup, const Priority &prio,
+               double sleepTime=0);
 
     const Flusher* getFlusher(uint16_t shardId);
     Warmup* getWarmup(void) const;
@@ -564,7 +596,7 @@ public:
     }
 
     size_t getTransactionTimePerItem() {
-        return lastTransTimePerItem;
+        return lastTransTimePerItem.get();
     }
 
     bool isFlushAllScheduled() {
@@ -612,6 +644,34 @@ public:
      */
     int flushVBucket(uint16_t vbid);
 
+    /**
+     * Collect and deduplicate the items waiting for persistence in a
+     * given vbucket, and hand them to the underlying store.
+     *
+     * @param vbid The id of the vbucket to flush
+     * @param detach true if the transaction should be detached from
+     *               the store, so that it may be committed by another
+     *               thread while the next batch is being collected
+     * @return the batch to give to commitFlush(), or NULL if nothing
+     *         can be flushed now
+     */
+    FlushBatch *collectFlush(uint16_t vbid, bool detach);
+
+    /**
+     * Commit a batch returned by collectFlush() and release it.
+     *
+     * @return The amount of items flushed
+     */
+    int commitFlush(FlushBatch *batch);
+
+    /**
+     * Commit batches of different vbuckets of the same shard returned
+     * by collectFlush() together, and release them.
+     *
+     * @return The amount of items flushed
+     */
+    int commitFlush(std::vector<FlushBatch*> &batches);
+
     void addKVStoreStats(ADD_STAT add_stat, const void* cookie);
 
     void addKVStoreTimingStats(ADD_STAT add_stat, const void* cookie);
@@ -696,11 +756,19 @@ private:
                          vbucket_state_t allowedState,
                          bool trackReference=true);
 
+    /**
+     * Hand what a background fetch for a batch get found to the batch,
+     * notifying its connection if it was the last key outstanding.
+     */
+    void completeMultiGetFetch(VBucketBGFetchItem &fetch, Item *itm,
+                               ENGINE_ERROR_CODE status);
+
     friend class Warmup;
     friend class Flusher;
     friend class BGFetchCallback;
+    friend class MultiGetVisitor;
     friend class VKeyStatBGFetchCallback;
-    friend class TapBGFetchCallback;
+    friend class TapBGFetchTask;
     friend class TapConnection;
     friend class PersistenceCallback;
     friend class Deleter;
@@ -712,8 +780,6 @@ private:
     EPStats                        &stats;
     KVStore                        *auxUnderlying;
     StorageProperties              *storageProperties;
-    Dispatcher                     *auxIODispatcher;
-    Dispatcher                     *nonIODispatcher;
     Warmup                         *warmupTask;
     ConflictResolution             *conflictResolver;
     VBucketMap                      vbMap;
@@ -724,17 +790,19 @@ private:
     Atomic<bool> diskFlushAll;
     Mutex vbsetMutex;
     uint32_t bgFetchDelay;
+    //! Set by the config listener, read by every shard's BG fetcher.
+    Atomic<hrtime_t> bgFetchLatencyTarget;
     struct ExpiryPagerDelta {
-        ExpiryPagerDelta() : sleeptime(0) {}
+        ExpiryPagerDelta() : sleeptime(0), task(0) {}
         Mutex mutex;
         size_t sleeptime;
-        TaskId task;
+        size_t task;
     } expiryPager;
     struct ALogTask {
-        ALogTask() : sleeptime(0), lastTaskRuntime(gethrtime()) {}
+        ALogTask() : sleeptime(0), task(0), lastTaskRuntime(gethrtime()) {}
         Mutex mutex;
         size_t sleeptime;
-        TaskId task;
+        size_t task;
         hrtime_t lastTaskRuntime;
     } accessScanner;
     struct ResidentRatio {
@@ -744,7 +812,8 @@ private:
     size_t statsSnapshotTaskId;
     size_t mLogCompactorTaskId;
     size_t transactionSize;
-    size_t lastTransTimePerItem;
+    //! Written by whichever thread commits a flush batch.
+    Atomic<size_t> lastTransTimePerItem;
     size_t itemExpiryWindow;
     Atomic<bool> snapshotVBState;
 
@@ -275,6 +275,12 @@ extern "C" {
             } else if (strcmp(keyz, "tap_throttle_cap_pcnt") == 0) {
                 checkNumeric(valz);
                 e->getConfiguration().setTapThrottleCapPcnt(v);
+            } else if (strcmp(keyz, "tap_queue_mem_limit") == 0) {
+                checkNumeric(valz);
+                e->getConfiguration().setTapQueueMemLimit(strtoull(valz, NULL, 10));
+            } else if (strcmp(keyz, "tap_send_batch_bytes") == 0) {
+                checkNumeric(valz);
+                e->getConfiguration().setTapSendBatchBytes(strtoull(valz, NULL, 10));
             } else {
                 *msg = "Unknown config param";
                 rv = PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
@@ -347,6 +353,9 @@ extern "C" {
             } else if (strcmp(keyz, "bg_fetch_delay") == 0) {
                 checkNumeric(valz);
                 e->getConfiguration().setBgFetchDelay(v);
+            } else if (strcmp(keyz, "bg_fetch_latency_target") == 0) {
+                checkNumeric(valz);
+                e->getConfiguration().setBgFetchLatencyTarget(v);
             } else if (strcmp(keyz, "flushall_enabled") == 0) {
                 if (strcmp(valz, "true") == 0) {
                     e->getConfiguration().setFlushallEnabled(true);
@@ -412,15 +421,26 @@ extern "C" {
             } else if (strcmp(keyz, "couch_response_timeout") == 0) {
                 checkNumeric(valz);
                 e->getConfiguration().setCouchResponseTimeout(v);
+            } else if (strcmp(keyz, "durability_wait_timeout") == 0) {
+                checkNumeric(valz);
+                e->getConfiguration().setDurabilityWaitTimeout(v);
             } else if (strcmp(keyz, "alog_sleep_time") == 0) {
                 checkNumeric(valz);
                 e->getConfiguration().setAlogSleepTime(v);
             } else if (strcmp(keyz, "alog_task_time") == 0) {
                 checkNumeric(valz);
                 e->getConfiguration().setAlogTaskTime(v);
+            } else if (strcmp(keyz, "alog_delta_ratio") == 0) {
+                checkNumeric(valz);
+                e->getConfiguration().setAlogDeltaRatio(v);
             } else if (strcmp(keyz, "pager_active_vb_pcnt") == 0) {
                 checkNumeric(valz);
                 e->getConfiguration().setPagerActiveVbPcnt(v);
+            } else if (strcmp(keyz, "eviction_policy") == 0) {
+                e->getConfiguration().setEvictionPolicy(valz);
+            } else if (strcmp(keyz, "eviction_sample_size") == 0) {
+                checkNumeric(valz);
+                e->getConfiguration().setEvictionSampleSize(v);
             } else if (strcmp(keyz, "warmup_min_memory_threshold") == 0) {
                 checkNumeric(valz);
                 validate(v, 0, std::numeric_limits<int>::max());
@@ -951,6 +971,14 @@ extern "C" {
                                      reinterpret_cast<protocol_binary_request_return_meta*>(request),
                                      response);
             }
+        case CMD_GET_MULTI:
+            return h->getMulti(cookie, request, response);
+        case CMD_WAIT_DURABILITY:
+            {
+                return h->waitDurability(cookie,
+                                         reinterpret_cast<protocol_binary_request_wait_durability*>(request),
+                                         response);
+            }
         case CMD_GET_REPLICA:
             rv = getReplicaCmd(h, request, cookie, &itm, &msg, &res);
             if (rv != ENGINE_SUCCESS) {
@@ -1191,6 +1219,7 @@ EventuallyPersistentEngine::EventuallyPersistentEngine(GET_SERVER_API get_server
     epstore(NULL), workload(NULL), tapThrottle(NULL),
     startedEngineThreads(false), getServerApiFunc(get_server_api),
     tapConnMap(NULL), tapConfig(NULL), checkpointConfig(NULL),
+    blobAllocator(Blob::slabSize, Blob::maxChunkSize, &stats.memOverhead),
     flushAllEnabled(false), startupTime(0)
 {
     interface.interface = 1;
@@ -1279,6 +1308,8 @@ public:
             engine.setGetlDefaultTimeout(value);
         } else if (key.compare("max_item_size") == 0) {
             engine.setMaxItemSize(value);
+        } else if (key.compare("durability_wait_timeout") == 0) {
+            engine.setDurabilityWaitTimeout(value);
         }
     }
 
@@ -1306,6 +1337,12 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::initialize(const char* config) {
     // Start updating the variables from the config!
     HashTable::setDefaultNumBuckets(configuration.getHtSize());
     HashTable::setDefaultNumLocks(configuration.getHtLocks());
+    HashTable::setBucketsPerLock(configuration.getHtBucketsPerLock());
+    HashTable::setMaxLocks(configuration.getHtMaxLocks());
+    HashTable::setIncrementalResize(configuration.isHtIncrementalResize());
+    HashTable::setOptimisticReads(configuration.isHtOptimisticReads());
+    HashTable::setDefaultHashFunction(configuration.getHtHashFunction() == "word"
+                                      ? WORD_HASH : DJB_HASH);
     StoredValue::setMutationMemoryThreshold(configuration.getMutationMemThreshold());
 
     if (configuration.getMaxSize() == 0) {
@@ -1330,13 +1367,19 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::initialize(const char* config) {
     getlMaxTimeout = configuration.getGetlMaxTimeout();
     configuration.addValueChangedListener("getl_max_timeout",
                                           new EpEngineValueChangeListener(*this));
+    durabilityWaitTimeout = configuration.getDurabilityWaitTimeout();
+    configuration.addValueChangedListener("durability_wait_timeout",
+                                          new EpEngineValueChangeListener(*this));
 
     flushAllEnabled = configuration.isFlushallEnabled();
     configuration.addValueChangedListener("flushall_enabled",
                                           new EpEngineValueChangeListener(*this));
 
     workload = new WorkLoadPolicy(configuration.getMaxNumWorkers(),
-                                  configuration.getWorkloadOptimization());
+                                  configuration.getWorkloadOptimization(),
+                                  configuration.getNumReaderThreads(),
+                                  configuration.getNumWriterThreads(),
+                                  configuration.getNumNonioThreads());
     if ((unsigned int)workload->getNumShards() > configuration.getMaxVbuckets()) {
         LOG(EXTENSION_LOG_WARNING, "Invalid configuration: Shards must be "
             "equal or less than max number of vbuckets");
@@ -1391,11 +1434,14 @@ void EventuallyPersistentEngine::destroy(bool force) {
 }
 
 /// @cond DETAILS
-class AllFlusher : public DispatcherCallback {
+class AllFlusher : public GlobalTask {
 public:
-    AllFlusher(EventuallyPersistentStore *st, TapConnMap &tcm)
-        : epstore(st), tapConnMap(tcm) { }
-    bool callback(Dispatcher &, TaskId &) {
+    AllFlusher(EventuallyPersistentEngine *e, EventuallyPersistentStore *st,
+               TapConnMap &tcm, double when)
+        : GlobalTask(e, Priority::FlushAllPriority, when, NO_START_TIME,
+                     false),
+          epstore(st), tapConnMap(tcm) { }
+    bool run() {
         doFlush();
         return false;
     }
@@ -1405,7 +1451,7 @@ public:
         tapConnMap.addFlushEvent();
     }
 
-    std::string description() {
+    std::string getDescription() {
         return std::string("Performing flush.");
     }
 
@@ -1416,8 +1462,6 @@ private:
 /// @endcond
 
 ENGINE_ERROR_CODE EventuallyPersistentEngine::flush(const void *, time_t when) {
-    shared_ptr<AllFlusher> cb(new AllFlusher(epstore, *tapConnMap));
-
     if (!flushAllEnabled) {
         return ENGINE_ENOTSUP;
     }
@@ -1426,12 +1470,13 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::flush(const void *, time_t when) {
         return ENGINE_TMPFAIL;
     }
 
+    AllFlusher *flusher = new AllFlusher(this, epstore, *tapConnMap,
+                                         static_cast<double>(when));
+    ExTask task(flusher);
     if (when == 0) {
-        cb->doFlush();
+        flusher->doFlush();
     } else {
-        epstore->getNonIODispatcher()->schedule(cb, NULL, Priority::FlushAllPriority,
-                                                static_cast<double>(when),
-                                                false);
+        IOManager::get()->scheduleTask(task, NONIO_TASK_IDX);
     }
 
     return ENGINE_SUCCESS;
@@ -2246,11 +2291,8 @@ void EventuallyPersistentEngine::startEngineThreads(void)
 
 void EventuallyPersistentEngine::queueBackfill(const VBucketFilter &backfillVBFilter,
                                                TapProducer *tc) {
-    shared_ptr<DispatcherCallback> backfill_cb(new BackfillTask(this, tc,
-                                                                backfillVBFilter));
-    epstore->getNonIODispatcher()->schedule(backfill_cb, NULL,
-                                            Priority::BackfillTaskPriority,
-                                            0, false, false);
+    ExTask task = new BackfillTask(this, tc, backfillVBFilter);
+    IOManager::get()->scheduleTask(task, NONIO_TASK_IDX);
 }
 
 bool VBucketCountVisitor::visitBucket(RCPtr<VBucket> &vb) {
@@ -2534,6 +2576,15 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     add_stat, cookie);
     add_casted_stat("ep_max_bg_remaining_jobs", epstats.maxRemainingBgJobs,
                     add_stat, cookie);
+    const VBucketMap &vbMap = epstore->getVBuckets();
+    for (size_t i = 0; i < workload->getNumShards(); ++i) {
+        char statname[80] = {0};
+        snprintf(statname, sizeof(statname), "ep_bg_fetch_window:shard_%d",
+                 static_cast<int>(i));
+        add_casted_stat(statname,
+                        vbMap.getShard(i)->getBgFetcher()->getWindow(),
+                        add_stat, cookie);
+    }
     add_casted_stat("ep_tap_bg_fetched", stats.numTapBGFetched, add_stat, cookie);
     add_casted_stat("ep_tap_bg_fetch_requeued", stats.numTapBGFetchRequeued,
                     add_stat, cookie);
@@ -2547,8 +2598,39 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     cookie);
     add_casted_stat("ep_num_eject_failures", epstats.numFailedEjects, add_stat,
                     cookie);
+
+    for (int i = 0; i < EVICTION_POLICY_COUNT; ++i) {
+        EPStats::EvictionStats &es = epstats.evictionStats[i];
+        size_t gets = es.gets.get();
+        size_t fetches = std::min(es.bgFetches.get(), gets);
+        hrtime_t evictTime = es.evictTime.get();
+        if (gets == 0 && evictTime == 0 && es.bytesFreed.get() == 0) {
+            // The policy hasn't been used.
+            continue;
+        }
+        const char *policyName =
+            EvictionPolicy::getName(static_cast<eviction_policy_t>(i));
+        char buf[64];
+        snprintf(buf, sizeof(buf), "ep_eviction_%s_gets", policyName);
+        add_casted_stat(buf, gets, add_stat, cookie);
+        snprintf(buf, sizeof(buf), "ep_eviction_%s_bg_fetches", policyName);
+        add_casted_stat(buf, fetches, add_stat, cookie);
+        snprintf(buf, sizeof(buf), "ep_eviction_%s_hit_ratio", policyName);
+        add_casted_stat(buf, gets == 0 ? 0 : (gets - fetches) * 100.0 / gets,
+                        add_stat, cookie);
+        snprintf(buf, sizeof(buf), "ep_eviction_%s_bytes_freed", policyName);
+        add_casted_stat(buf, es.bytesFreed, add_stat, cookie);
+        snprintf(buf, sizeof(buf), "ep_eviction_%s_evict_time", policyName);
+        add_casted_stat(buf, evictTime, add_stat, cookie);
+        snprintf(buf, sizeof(buf), "ep_eviction_%s_freed_per_sec", policyName);
+        add_casted_stat(buf, evictTime == 0 ? 0 :
+                        es.bytesFreed.get() * static_cast<double>(ONE_SECOND) /
+                        evictTime, add_stat, cookie);
+    }
     add_casted_stat("ep_num_not_my_vbuckets", epstats.numNotMyVBuckets, add_stat,
                     cookie);
+    add_casted_stat("ep_num_optimistic_read_fallbacks",
+                    epstats.numOptimisticReadFallbacks, add_stat, cookie);
 
     add_casted_stat("ep_io_num_read", epstats.io_num_read, add_stat, cookie);
     add_casted_stat("ep_io_num_write", epstats.io_num_write, add_stat, cookie);
@@ -2562,6 +2644,14 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
     add_casted_stat("ep_pending_ops_max_duration",
                     epstats.pendingOpsMaxDuration,
                     add_stat, cookie);
+    add_casted_stat("ep_durability_waits", epstats.durabilityWaits,
+                    add_stat, cookie);
+    add_casted_stat("ep_durability_timeouts", epstats.durabilityTimeouts,
+                    add_stat, cookie);
+    add_casted_stat("ep_get_multis", epstats.numGetMultis,
+                    add_stat, cookie);
+    add_casted_stat("ep_get_multi_bg_fetches", epstats.numGetMultiBgFetches,
+                    add_stat, cookie);
 
     size_t vbDeletions = epstats.vbucketDeletions.get();
     if (vbDeletions > 0) {
@@ -2620,6 +2710,14 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     add_stat, cookie);
     add_casted_stat("ep_access_scanner_num_items", epstats.alogNumItems,
                     add_stat, cookie);
+    add_casted_stat("ep_access_scanner_base_items", epstats.alogBaseItems,
+                    add_stat, cookie);
+    add_casted_stat("ep_access_scanner_delta_items", epstats.alogDeltaItems,
+                    add_stat, cookie);
+    add_casted_stat("ep_access_scanner_last_bytes",
+                    epstats.alogBytesWritten, add_stat, cookie);
+    add_casted_stat("ep_access_scanner_bytes_written",
+                    epstats.alogTotalBytesWritten, add_stat, cookie);
 
     char timestr[20];
     struct tm alogTim = *gmtime((time_t *)&epstats.alogTime);
@@ -2670,8 +2768,48 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
     return ENGINE_SUCCESS;
 }
 
+/**
+ * Add the bytes each slab class in use wastes at the end of its chunks,
+ * and their total.
+ */
+static void addSlabWasteStats(const char *prefix,
+                              const std::vector<SlabAllocator::ClassStats> &cs,
+                              ADD_STAT add_stat, const void *cookie) {
+    char buf[64];
+    size_t total(0);
+    std::vector<SlabAllocator::ClassStats>::const_iterator it;
+    for (it = cs.begin(); it != cs.end(); ++it) {
+        if (it->chunks == 0) {
+            continue;
+        }
+        snprintf(buf, sizeof(buf), "%s_%lu_waste", prefix,
+                 static_cast<unsigned long>(it->chunkSize));
+        add_casted_stat(buf, it->getWaste(), add_stat, cookie);
+        total += it->getWaste();
+    }
+    snprintf(buf, sizeof(buf), "%s_waste", prefix);
+    add_casted_stat(buf, total, add_stat, cookie);
+}
+
 ENGINE_ERROR_CODE EventuallyPersistentEngine::doMemoryStats(const void *cookie,
                                                            ADD_STAT add_stat) {
+
+    class SlabVBucketVisitor : public VBucketVisitor {
+    public:
+        SlabVBucketVisitor() : slabBytes(0), usedBytes(0) {}
+
+        bool visitBucket(RCPtr<VBucket> &vb) {
+            slabBytes += vb->ht.getSlabBytes();
+            usedBytes += vb->ht.getSlabUsedBytes();
+            vb->ht.addSlabClassStats(classes);
+            return false;
+        }
+
+        size_t slabBytes;
+        size_t usedBytes;
+        std::vector<SlabAllocator::ClassStats> classes;
+    };
+
     add_casted_stat("bytes", stats.getTotalMemoryUsed(), add_stat, cookie);
     add_casted_stat("mem_used", stats.getTotalMemoryUsed(), add_stat, cookie);
     add_casted_stat("ep_kv_size", stats.currentSize, add_stat, cookie);
@@ -2686,6 +2824,29 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doMemoryStats(const void *cookie,
                     stats.memoryTrackerEnabled ? "true" : "false",
                     add_stat, cookie);
 
+    SlabVBucketVisitor svbv;
+    epstore->visit(svbv);
+    size_t slabBytes = svbv.slabBytes + blobAllocator.getSlabBytes();
+    size_t usedBytes = svbv.usedBytes + blobAllocator.getUsedBytes();
+    add_casted_stat("ep_sv_slab_bytes", svbv.slabBytes, add_stat, cookie);
+    add_casted_stat("ep_sv_slab_used", svbv.usedBytes, add_stat, cookie);
+    add_casted_stat("ep_blob_slab_bytes", blobAllocator.getSlabBytes(),
+                    add_stat, cookie);
+    add_casted_stat("ep_blob_slab_used", blobAllocator.getUsedBytes(),
+                    add_stat, cookie);
+    add_casted_stat("ep_slab_fragmentation",
+                    slabBytes > usedBytes ?
+                    (slabBytes - usedBytes) * 100 / slabBytes : 0,
+                    add_stat, cookie);
+    addSlabWasteStats("ep_sv_slab", svbv.classes, add_stat, cookie);
+    std::vector<SlabAllocator::ClassStats> blobClasses;
+    blobAllocator.addClassStats(blobClasses);
+    addSlabWasteStats("ep_blob_slab", blobClasses, add_stat, cookie);
+    add_casted_stat("ep_item_pool_idle", itemPool.getNumIdle(),
+                    add_stat, cookie);
+    add_casted_stat("ep_item_pool_reused", itemPool.getNumReused(),
+                    add_stat, cookie);
+
     std::map<std::string, size_t> alloc_stats;
     MemoryTracker::getInstance()->getAllocatorStats(alloc_stats);
     std::map<std::string, size_t>::iterator it = alloc_stats.begin();
@@ -2749,8 +2910,22 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doHashStats(const void *cookie,
 
             snprintf(buf, sizeof(buf), "vb_%d:size", vbid);
             add_casted_stat(buf, vb->ht.getSize(), add_stat, cookie);
+            HashTableLockStats lockStats;
+            vb->ht.getLockStats(lockStats);
             snprintf(buf, sizeof(buf), "vb_%d:locks", vbid);
-            add_casted_stat(buf, vb->ht.getNumLocks(), add_stat, cookie);
+            add_casted_stat(buf, lockStats.locks, add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:lock_acquisitions", vbid);
+            add_casted_stat(buf, lockStats.acquisitions, add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:lock_contentions", vbid);
+            add_casted_stat(buf, lockStats.contentions, add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:lock_contention_histo", vbid);
+            add_casted_stat(buf, lockStats.contentionHisto, add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:lock_hottest", vbid);
+            add_casted_stat(buf, lockStats.hottest, add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:lock_hottest_contentions", vbid);
+            add_casted_stat(buf, lockStats.hottestContentions, add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:lock_restripes", vbid);
+            add_casted_stat(buf, lockStats.restripes, add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:min_depth", vbid);
             add_casted_stat(buf, depthVisitor.min == -1 ? 0 : depthVisitor.min,
                             add_stat, cookie);
@@ -2758,6 +2933,14 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doHashStats(const void *cookie,
             add_casted_stat(buf, depthVisitor.max, add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:histo", vbid);
             add_casted_stat(buf, depthVisitor.depthHisto, add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:empty_buckets", vbid);
+            add_casted_stat(buf, depthVisitor.emptyBuckets(), add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:chain_len_50pct", vbid);
+            add_casted_stat(buf, depthVisitor.chainLengthPercentile(50),
+                            add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:chain_len_99pct", vbid);
+            add_casted_stat(buf, depthVisitor.chainLengthPercentile(99),
+                            add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:reported", vbid);
             add_casted_stat(buf, vb->ht.getNumItems(), add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:counted", vbid);
@@ -2768,6 +2951,10 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doHashStats(const void *cookie,
             add_casted_stat(buf, vb->ht.memSize, add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:mem_size_counted", vbid);
             add_casted_stat(buf, depthVisitor.memUsed, add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:resize_target", vbid);
+            add_casted_stat(buf, vb->ht.getResizeTarget(), add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:resize_migrated", vbid);
+            add_casted_stat(buf, vb->ht.getResizeMigrated(), add_stat, cookie);
 
             return false;
         }
@@ -2812,19 +2999,22 @@ public:
     ADD_STAT add_stat;
 };
 
-class StatCheckpointCallback : public DispatcherCallback {
+class StatCheckpointTask : public GlobalTask {
 public:
-    StatCheckpointCallback(EventuallyPersistentEngine *e, const void *c,
-                           ADD_STAT a) : ep(e), cookie(c), add_stat(a) { }
+    StatCheckpointTask(EventuallyPersistentEngine *e, const void *c,
+                       ADD_STAT a) :
+        GlobalTask(e, Priority::CheckpointStatsPriority, 0, NO_START_TIME,
+                   false),
+        ep(e), cookie(c), add_stat(a) { }
 
-    bool callback(Dispatcher &, TaskId &) {
+    bool run() {
         StatCheckpointVisitor scv(ep->getEpStore(), cookie, add_stat);
         ep->getEpStore()->visit(scv);
         ep->notifyIOComplete(cookie, ENGINE_SUCCESS);
         return false;
     }
 
-    std::string description() {
+    std::string getDescription() {
         return "checkpoint stats for all vbuckets";
     }
 
@@ -2842,11 +3032,8 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doCheckpointStats(const void *cook
     if (nkey == 10) {
         void* es = getEngineSpecific(cookie);
         if (es == NULL) {
-            shared_ptr<DispatcherCallback> cb(new StatCheckpointCallback(this, cookie,
-                                                                         add_stat));
-            epstore->getNonIODispatcher()->schedule(cb, NULL,
-                                                    Priority::CheckpointStatsPriority,
-                                                    0, false, false);
+            ExTask task = new StatCheckpointTask(this, cookie, add_stat);
+            IOManager::get()->scheduleTask(task, NONIO_TASK_IDX);
             storeEngineSpecific(cookie, this);
             return ENGINE_EWOULDBLOCK;
         } else {
@@ -3165,6 +3352,13 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doTimingStats(const void *cookie,
     add_casted_stat("del_vb_cmd", stats.delVbucketCmdHisto, add_stat, cookie);
     add_casted_stat("chk_persistence_cmd", stats.chkPersistenceHisto,
                     add_stat, cookie);
+    add_casted_stat("durability_persist", stats.durabilityPersistHisto,
+                    add_stat, cookie);
+    add_casted_stat("durability_replicate", stats.durabilityReplicateHisto,
+                    add_stat, cookie);
+    add_casted_stat("get_multi_cmd", stats.getMultiCmdHisto, add_stat, cookie);
+    add_casted_stat("get_multi_size", stats.getMultiSizeHisto,
+                    add_stat, cookie);
     // Tap commands
     add_casted_stat("tap_vb_set", stats.tapVbucketSetHisto, add_stat, cookie);
     add_casted_stat("tap_vb_reset", stats.tapVbucketResetHisto, add_stat, cookie);
@@ -3172,6 +3366,8 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doTimingStats(const void *cookie,
     // Misc
     add_casted_stat("notify_io", stats.notifyIOHisto, add_stat, cookie);
     add_casted_stat("batch_read", stats.getMultiHisto, add_stat, cookie);
+    add_casted_stat("batch_read_size", stats.getMultiBatchSizeHisto,
+                    add_stat, cookie);
 
     // Disk stats
     add_casted_stat("disk_insert", stats.diskInsertHisto, add_stat, cookie);
@@ -3179,6 +3375,10 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doTimingStats(const void *cookie,
     add_casted_stat("disk_del", stats.diskDelHisto, add_stat, cookie);
     add_casted_stat("disk_vb_del", stats.diskVBDelHisto, add_stat, cookie);
     add_casted_stat("disk_commit", stats.diskCommitHisto, add_stat, cookie);
+    add_casted_stat("flush_collect", stats.flushCollectHisto,
+                    add_stat, cookie);
+    add_casted_stat("flush_queue_wait", stats.flushQueueHisto,
+                    add_stat, cookie);
     add_casted_stat("disk_vbstate_snapshot", stats.snapshotVbucketHisto,
                     add_stat, cookie);
 
@@ -3188,58 +3388,8 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doTimingStats(const void *cookie,
     return ENGINE_SUCCESS;
 }
 
-static void showJobLog(const char *prefix, const char *logname,
-                       const std::vector<JobLogEntry> &log,
-                       const void *cookie, ADD_STAT add_stat) {
-    char statname[80] = {0};
-    for (size_t i = 0; i < log.size(); ++i) {
-        snprintf(statname, sizeof(statname), "%s:%s:%d:task",
-                 prefix, logname, static_cast<int>(i));
-        add_casted_stat(statname, log[i].getName().c_str(),
-                        add_stat, cookie);
-        snprintf(statname, sizeof(statname), "%s:%s:%d:starttime",
-                 prefix, logname, static_cast<int>(i));
-        add_casted_stat(statname, log[i].getTimestamp(),
-                        add_stat, cookie);
-        snprintf(statname, sizeof(statname), "%s:%s:%d:runtime",
-                 prefix, logname, static_cast<int>(i));
-        add_casted_stat(statname, log[i].getDuration(),
-                        add_stat, cookie);
-    }
-}
-
-static void doDispatcherStat(const char *prefix, const DispatcherState &ds,
-                             const void *cookie, ADD_STAT add_stat) {
-    char statname[80] = {0};
-    snprintf(statname, sizeof(statname), "%s:state", prefix);
-    add_casted_stat(statname, ds.getStateName(), add_stat, cookie);
-
-    snprintf(statname, sizeof(statname), "%s:status", prefix);
-    add_casted_stat(statname, ds.isRunningTask() ? "running" : "idle",
-                    add_stat, cookie);
-
-    if (ds.isRunningTask()) {
-        snprintf(statname, sizeof(statname), "%s:task", prefix);
-        add_casted_stat(statname, ds.getTaskName().c_str(),
-                        add_stat, cookie);
-
-        snprintf(statname, sizeof(statname), "%s:runtime", prefix);
-        add_casted_stat(statname, (gethrtime() - ds.getTaskStart()) / 1000,
-                        add_stat, cookie);
-    }
-
-    showJobLog(prefix, "log", ds.getLog(), cookie, add_stat);
-    showJobLog(prefix, "slow", ds.getSlowLog(), cookie, add_stat);
-}
-
 ENGINE_ERROR_CODE EventuallyPersistentEngine::doDispatcherStats(const void *cookie,
                                                                 ADD_STAT add_stat) {
-    DispatcherState tapds(epstore->getAuxIODispatcher()->getDispatcherState());
-    doDispatcherStat("auxio_dispatcher", tapds, cookie, add_stat);
-
-    DispatcherState nds(epstore->getNonIODispatcher()->getDispatcherState());
-    doDispatcherStat("nio_dispatcher", nds, cookie, add_stat);
-
     IOManager::get()->doWorkerStat(ObjectRegistry::getCurrentEngine(), cookie,
                                    add_stat);
     return ENGINE_SUCCESS;
@@ -3259,6 +3409,10 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doWorkloadStats(const void *cookie
     snprintf(statname, sizeof(statname), "ep_workload:num_writers");
     add_casted_stat(statname, writers, add_stat, cookie);
 
+    int nonio = workload->getNumNonIO();
+    snprintf(statname, sizeof(statname), "ep_workload:num_nonio");
+    add_casted_stat(statname, nonio, add_stat, cookie);
+
     int shards = workload->getNumShards();
     snprintf(statname, sizeof(statname), "ep_workload:num_shards");
     add_casted_stat(statname, shards, add_stat, cookie);
@@ -3496,6 +3650,63 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::observe(const void* cookie,
                                 cookie);
 }
 
+ENGINE_ERROR_CODE
+EventuallyPersistentEngine::waitDurability(const void* cookie,
+                                           protocol_binary_request_wait_durability *request,
+                                           ADD_RESPONSE response) {
+    DurabilityWaiter *waiter =
+        static_cast<DurabilityWaiter*>(getEngineSpecific(cookie));
+    if (waiter == NULL) {
+        uint8_t extlen = request->message.header.request.extlen;
+        uint16_t keylen = ntohs(request->message.header.request.keylen);
+        if (extlen != 8 || keylen == 0) {
+            return sendResponse(response, NULL, 0, NULL, 0, NULL, 0,
+                                PROTOCOL_BINARY_RAW_BYTES,
+                                PROTOCOL_BINARY_RESPONSE_EINVAL, 0, cookie);
+        }
+
+        uint16_t vbucket = ntohs(request->message.header.request.vbucket);
+        RCPtr<VBucket> vb = epstore->getVBucket(vbucket);
+        if (!vb || vb->getState() != vbucket_state_active) {
+            ++stats.numNotMyVBuckets;
+            return sendResponse(response, NULL, 0, NULL, 0, NULL, 0,
+                                PROTOCOL_BINARY_RAW_BYTES,
+                                PROTOCOL_BINARY_RESPONSE_NOT_MY_VBUCKET, 0,
+                                cookie);
+        }
+
+        const char *key = reinterpret_cast<const char*>(request->bytes) +
+            sizeof(request->bytes);
+        uint64_t mid = vb->checkpointManager.getLastMutationIdForKey(
+                                                       std::string(key, keylen));
+        hrtime_t timeout = ntohl(request->message.body.timeout);
+        if (timeout == 0) {
+            timeout = durabilityWaitTimeout;
+        }
+        waiter = new DurabilityWaiter(cookie, mid,
+                                      request->message.body.persist != 0,
+                                      request->message.body.replicas,
+                                      timeout * 1000000);
+        ++stats.durabilityWaits;
+
+        // The vbucket may wake the connection before we get to return.
+        storeEngineSpecific(cookie, waiter);
+        if (vb->addDurabilityWaiter(waiter)) {
+            return ENGINE_EWOULDBLOCK;
+        }
+    }
+    storeEngineSpecific(cookie, NULL);
+
+    uint8_t body[2];
+    body[0] = waiter->persisted ? 1 : 0;
+    body[1] = waiter->replicated;
+    uint16_t status = waiter->timedOut ? PROTOCOL_BINARY_RESPONSE_ETMPFAIL :
+        PROTOCOL_BINARY_RESPONSE_SUCCESS;
+    delete waiter;
+    return sendResponse(response, NULL, 0, NULL, 0, body, sizeof(body),
+                        PROTOCOL_BINARY_RAW_BYTES, status, 0, cookie);
+}
+
 ENGINE_ERROR_CODE EventuallyPersistentEngine::touch(const void *cookie,
                                                     protocol_binary_request_header *request,
                                                     ADD_RESPONSE response)
@@ -3766,6 +3977,94 @@ static protocol_binary_response_status engine_error_2_protocol_error(ENGINE_ERRO
     return ret;
 }
 
+ENGINE_ERROR_CODE EventuallyPersistentEngine::getMulti(const void* cookie,
+                                                       protocol_binary_request_header *request,
+                                                       ADD_RESPONSE response) {
+    MultiGetBatch *batch = static_cast<MultiGetBatch*>(getEngineSpecific(cookie));
+    if (batch == NULL) {
+        protocol_binary_request_no_extras *req =
+            (protocol_binary_request_no_extras*)request;
+        const char *data = reinterpret_cast<const char*>(req->bytes) +
+            sizeof(req->bytes);
+        uint32_t data_len = ntohl(req->message.header.request.bodylen);
+
+        std::vector<MultiGetBatch::Entry> entries;
+        size_t offset = 0;
+        while (offset < data_len) {
+            uint16_t vb_id;
+            uint16_t keylen;
+            if (data_len - offset < 4) {
+                break;
+            }
+            memcpy(&vb_id, data + offset, sizeof(uint16_t));
+            offset += sizeof(uint16_t);
+            memcpy(&keylen, data + offset, sizeof(uint16_t));
+            offset += sizeof(uint16_t);
+            keylen = ntohs(keylen);
+            if (keylen == 0 || data_len - offset < keylen) {
+                break;
+            }
+            entries.push_back(MultiGetBatch::Entry(std::string(data + offset,
+                                                               keylen),
+                                                   ntohs(vb_id)));
+            offset += keylen;
+        }
+        if (offset != data_len || entries.empty()) {
+            std::string msg("Invalid packet structure");
+            return sendResponse(response, NULL, 0, 0, 0, msg.c_str(),
+                                msg.length(), PROTOCOL_BINARY_RAW_BYTES,
+                                PROTOCOL_BINARY_RESPONSE_EINVAL, 0, cookie);
+        }
+
+        batch = new MultiGetBatch(cookie);
+        batch->entries.swap(entries);
+        ++stats.numGetMultis;
+        stats.getMultiSizeHisto.add(batch->entries.size());
+
+        // The fetcher may wake the connection before we get to return.
+        storeEngineSpecific(cookie, batch);
+        if (!epstore->getMulti(*batch)) {
+            return ENGINE_EWOULDBLOCK;
+        }
+    }
+    storeEngineSpecific(cookie, NULL);
+
+    std::stringstream result;
+    bool degraded = isDegradedMode();
+    std::vector<MultiGetBatch::Entry>::iterator it;
+    for (it = batch->entries.begin(); it != batch->entries.end(); ++it) {
+        ENGINE_ERROR_CODE status = it->status;
+        if (degraded && (status == ENGINE_KEY_ENOENT ||
+                         status == ENGINE_NOT_MY_VBUCKET)) {
+            status = ENGINE_TMPFAIL;
+        }
+        Item *itm = it->item;
+        uint16_t vb_id = htons(it->vbucket);
+        uint16_t keylen = htons(static_cast<uint16_t>(it->key.length()));
+        uint16_t rc = htons(engine_error_2_protocol_error(status));
+        uint32_t flags = itm ? itm->getFlags() : 0;
+        uint64_t cas = htonll(itm ? itm->getCas() : 0);
+        uint32_t nbytes = htonl(itm ? itm->getNBytes() : 0);
+        result.write((char*) &vb_id, sizeof(uint16_t));
+        result.write((char*) &keylen, sizeof(uint16_t));
+        result.write((char*) &rc, sizeof(uint16_t));
+        result.write((char*) &flags, sizeof(uint32_t));
+        result.write((char*) &cas, sizeof(uint64_t));
+        result.write((char*) &nbytes, sizeof(uint32_t));
+        result.write(it->key.data(), it->key.length());
+        if (itm) {
+            result.write(itm->getData(), itm->getNBytes());
+            itemPool.release(itm);
+        }
+    }
+    stats.getMultiCmdHisto.add((gethrtime() - batch->start) / 1000);
+    delete batch;
+
+    return sendResponse(response, NULL, 0, NULL, 0, result.str().data(),
+                        result.str().length(), PROTOCOL_BINARY_RAW_BYTES,
+                        PROTOCOL_BINARY_RESPONSE_SUCCESS, 0, cookie);
+}
+
 ENGINE_ERROR_CODE EventuallyPersistentEngine::getMeta(const void* cookie,
                                                       protocol_binary_request_get_meta *request,
                                                       ADD_RESPONSE response)
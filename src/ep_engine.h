@@ -31,7 +31,6 @@
 #include <string>
 
 #include "configuration.h"
-#include "dispatcher.h"
 #include "ep.h"
 #include "ep-engine/command_ids.h"
 #include "flusher.h"
@@ -224,7 +223,7 @@ public:
     void itemRelease(const void* cookie, item *itm)
     {
         (void)cookie;
-        delete (Item*)itm;
+        itemPool.release((Item*)itm);
     }
 
     ENGINE_ERROR_CODE get(const void* cookie,
@@ -513,6 +512,22 @@ public:
                               protocol_binary_request_header *request,
                               ADD_RESPONSE response);
 
+    /**
+     * Block until the last mutation of a key is persisted and/or acked
+     * by enough TAP connections, or the timeout passes.
+     */
+    ENGINE_ERROR_CODE waitDurability(const void* cookie,
+                                     protocol_binary_request_wait_durability *request,
+                                     ADD_RESPONSE response);
+
+    /**
+     * Get the values of a batch of keys, answering with all of them
+     * once the ones not resident are fetched from disk.
+     */
+    ENGINE_ERROR_CODE getMulti(const void* cookie,
+                               protocol_binary_request_header *request,
+                               ADD_RESPONSE response);
+
     RCPtr<VBucket> getVBucket(uint16_t vbucket) {
         return epstore->getVBucket(vbucket);
     }
@@ -538,6 +553,14 @@ public:
         return stats;
     }
 
+    SlabAllocator &getBlobAllocator() {
+        return blobAllocator;
+    }
+
+    ItemPool &getItemPool() {
+        return itemPool;
+    }
+
     EventuallyPersistentStore* getEpStore() { return epstore; }
 
     TapConnMap &getTapConnMap() { return *tapConnMap; }
@@ -611,6 +634,10 @@ protected:
         getlMaxTimeout = value;
     }
 
+    void setDurabilityWaitTimeout(size_t value) {
+        durabilityWaitTimeout = value;
+    }
+
 private:
     EventuallyPersistentEngine(GET_SERVER_API get_server_api);
     friend ENGINE_ERROR_CODE create_instance(uint64_t interface,
@@ -755,7 +782,10 @@ private:
     size_t maxItemSize;
     size_t getlDefaultTimeout;
     size_t getlMaxTimeout;
+    size_t durabilityWaitTimeout;
     EPStats stats;
+    SlabAllocator blobAllocator;
+    ItemPool itemPool;
     Configuration configuration;
     Atomic<bool> trafficEnabled;
 
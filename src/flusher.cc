@@ -145,6 +145,10 @@ void Flusher::wake(void) {
 
 bool Flusher::step(size_t tid) {
     try {
+        if (_state != running) {
+            // Don't leave a group behind while not collecting.
+            scheduleCommit(true);
+        }
         switch (_state) {
         case initializing:
             initialize(tid);
@@ -156,11 +160,18 @@ bool Flusher::step(size_t tid) {
             return false;
         case running:
             {
-                doFlush();
+                size_t done = commitsDone.get();
+                bool waitCommit = doFlush();
                 if (_state == running) {
-                    double tosleep = computeMinSleepTime();
+                    double tosleep = waitCommit ? COMMIT_WAIT_TIME :
+                                                  computeMinSleepTime();
                     if (tosleep > 0) {
                         IOManager::get()->snooze(tid, tosleep);
+                        // A commit completing before the snooze above
+                        // couldn't wake us up.
+                        if (waitCommit && commitsDone.get() != done) {
+                            IOManager::get()->snooze(tid, 0);
+                        }
                     }
                     return true;
                 } else {
@@ -168,6 +179,10 @@ bool Flusher::step(size_t tid) {
                 }
             }
         case stopping:
+            if (inflightCommits.get() > 0) {
+                IOManager::get()->snooze(tid, DEFAULT_MIN_SLEEP_TIME);
+                return true;
+            }
             {
                 std::stringstream ss;
                 ss << "Shutting down flusher (Write of all dirty items)"
@@ -214,20 +229,115 @@ double Flusher::computeMinSleepTime() {
     return std::min(minSleepTime, 1.0);
 }
 
-void Flusher::doFlush() {
+/**
+ * Flush the next vbucket.
+ *
+ * @return true if the flusher should wait for one of its commits to
+ *         complete before going on
+ */
+bool Flusher::doFlush() {
+    bool pipelined = _state == running && maxCommits > 0;
+    if (pipelined && inflightCommits.get() >= maxCommits) {
+        return true;
+    }
+
     uint16_t nextVb = getNextVb();
     if (store->diskFlushAll) {
         if (shard->getId() == EP_PRIMARY_SHARD) {
+            scheduleCommit(true);
+            if (inflightCommits.get() > 0) {
+                // Reset the database once our commits are done.
+                pendingMutation.cas(false, true);
+                return true;
+            }
             store->flushVBucket(nextVb);
         } else {
             // another shard is doing disk flush
             pendingMutation.cas(false, true);
         }
-        return;
+        return false;
     }
     if (nextVb != NO_VBUCKETS_INSTANTIATED) {
+        if (pipelined) {
+            return flushPipelined(nextVb);
+        }
         store->flushVBucket(nextVb);
     }
+    return false;
+}
+
+bool Flusher::flushPipelined(uint16_t vbid) {
+    bool waitCommit = false;
+    bool committing;
+    {
+        LockHolder lh(commitMutex);
+        committing = committingVbs.find(vbid) != committingVbs.end();
+    }
+
+    if (committing) {
+        // It's flushed again once its commit completes, so only wait
+        // for that if there's nothing else to do.
+        waitCommit = lpVbs.empty() && hpVbs.empty();
+    } else {
+        FlushBatch *batch = store->collectFlush(vbid, true);
+        if (batch && !batch->txn) {
+            store->commitFlush(batch);
+        } else if (batch) {
+            {
+                LockHolder lh(commitMutex);
+                committingVbs.insert(vbid);
+            }
+            if (group.empty()) {
+                groupStart = gethrtime();
+            }
+            group.push_back(batch);
+        }
+    }
+
+    scheduleCommit(false);
+    return waitCommit;
+}
+
+/**
+ * Hand the batches collected so far to a FlushCommitTask, if their
+ * group commit window is over or there's nothing more to collect.
+ */
+void Flusher::scheduleCommit(bool force) {
+    if (group.empty()) {
+        return;
+    }
+    if (!force && !(lpVbs.empty() && hpVbs.empty()) &&
+        gethrtime() - groupStart < groupWindow) {
+        return;
+    }
+
+    inflightCommits.incr(1);
+    IOManager::get()->scheduleFlushCommit(ObjectRegistry::getCurrentEngine(),
+                                          this, group,
+                                          Priority::FlusherCommitPriority,
+                                          shard->getId(), commitRound++);
+    group.clear();
+}
+
+void Flusher::commit(std::vector<FlushBatch*> &batches) {
+    std::vector<uint16_t> vbids;
+    std::vector<FlushBatch*>::iterator it;
+    for (it = batches.begin(); it != batches.end(); ++it) {
+        vbids.push_back((*it)->vbid);
+    }
+    store->commitFlush(batches);
+    {
+        LockHolder lh(commitMutex);
+        std::vector<uint16_t>::iterator vit;
+        for (vit = vbids.begin(); vit != vbids.end(); ++vit) {
+            committingVbs.erase(*vit);
+        }
+    }
+    inflightCommits.decr(1);
+    commitsDone.incr(1);
+    // Items queued for the vbucket meanwhile are still to be flushed.
+    pendingMutation.set(true);
+    wake();
 }
 
 uint16_t Flusher::getNextVb() {
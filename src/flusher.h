@@ -23,11 +23,11 @@
 #include <list>
 #include <map>
 #include <queue>
+#include <set>
 #include <string>
 #include <vector>
 
 #include "common.h"
-#include "dispatcher.h"
 #include "ep.h"
 #include "mutation_log.h"
 
@@ -45,18 +45,30 @@ enum flusher_state {
 class Flusher;
 
 const double DEFAULT_MIN_SLEEP_TIME = 0.1;
+//! Longest a flusher waits for one of its commits before looking again.
+const double COMMIT_WAIT_TIME = 1.0;
 
 class KVShard;
 /**
  * Manage persistence of data for an EventuallyPersistentStore.
+ *
+ * While running, a flusher collects the items of one vbucket at a
+ * time and hands the batches to FlushCommitTasks on other writer
+ * threads, so that up to maxCommits of them are being committed while
+ * the next ones are collected.  The batches collected within a group
+ * commit window are committed together.
  */
 class Flusher {
 public:
 
-    Flusher(EventuallyPersistentStore *st, KVShard *k) :
+    Flusher(EventuallyPersistentStore *st, KVShard *k, size_t commits = 0,
+            size_t groupWindowMs = 0) :
         store(st), _state(initializing), taskId(0), minSleepTime(0.1),
         forceShutdownReceived(false), doHighPriority(false),
-        numHighPriority(0), shard(k) { }
+        numHighPriority(0), shard(k), maxCommits(commits),
+        inflightCommits(0), commitsDone(0), commitRound(0),
+        groupWindow(static_cast<hrtime_t>(groupWindowMs) * 1000000),
+        groupStart(0) { }
 
     ~Flusher() {
         if (_state != stopped) {
@@ -75,6 +87,12 @@ public:
     void wake(void);
     bool step(size_t tid);
 
+    /**
+     * Commit a group of batches collected by this flusher (called by
+     * the FlushCommitTask it was handed to).
+     */
+    void commit(std::vector<FlushBatch*> &batches);
+
     enum flusher_state state() const;
     const char * stateName() const;
 
@@ -90,7 +108,9 @@ public:
 
 private:
     bool transition_state(enum flusher_state to);
-    void doFlush();
+    bool doFlush();
+    bool flushPipelined(uint16_t vbid);
+    void scheduleCommit(bool force);
     void completeFlush();
     void schedule_UNLOCKED();
     double computeMinSleepTime();
@@ -118,6 +138,18 @@ private:
 
     KVShard *shard;
 
+    size_t maxCommits;
+    Atomic<size_t> inflightCommits;
+    Atomic<size_t> commitsDone;
+    int commitRound;
+    Mutex commitMutex;
+    //! Vbuckets with a batch being committed.
+    std::set<uint16_t> committingVbs;
+    //! Batches collected for the next group commit.
+    std::vector<FlushBatch*> group;
+    hrtime_t groupWindow;
+    hrtime_t groupStart;
+
     DISALLOW_COPY_AND_ASSIGN(Flusher);
 };
 
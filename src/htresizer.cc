@@ -19,9 +19,13 @@
 
 #include "ep.h"
 #include "htresizer.h"
+#include "iomanager/iomanager.h"
 #include "stored-value.h"
 
 static const double FREQUENCY(60.0);
+static const double MIGRATION_FREQUENCY(0.1);
+//! Time (in ns) spent moving hash table chains per run.
+static const hrtime_t MIGRATION_BUDGET(10 * 1000 * 1000);
 
 /**
  * Look at all the hash tables and make sure they're sized appropriately.
@@ -29,19 +33,61 @@ static const double FREQUENCY(60.0);
 class ResizingVisitor : public VBucketVisitor {
 public:
 
-    ResizingVisitor() { }
+    ResizingVisitor(size_t t) : task(t), started(false) { }
 
     bool visitBucket(RCPtr<VBucket> &vb) {
         vb->ht.resize();
+        started = started || vb->ht.isResizing();
         return false;
     }
 
+    void complete() {
+        // Start moving chains right away rather than at the next sweep.
+        if (started) {
+            IOManager::get()->wake(task);
+        }
+    }
+
+private:
+    size_t task;
+    bool   started;
+};
+
+/**
+ * Move chains of incrementally resizing hash tables within a time budget.
+ */
+class MigratingVisitor : public VBucketVisitor {
+public:
+
+    MigratingVisitor() : deadline(gethrtime() + MIGRATION_BUDGET),
+                         pending(false) { }
+
+    bool visitBucket(RCPtr<VBucket> &vb) {
+        if (vb->ht.isResizing()) {
+            hrtime_t now = gethrtime();
+            if (now >= deadline || vb->ht.resizeStep(deadline - now)) {
+                pending = true;
+            }
+        }
+        return false;
+    }
+
+    hrtime_t deadline;
+    bool     pending;
 };
 
-bool HashtableResizer::callback(Dispatcher &d, TaskId &t) {
-    shared_ptr<ResizingVisitor> pv(new ResizingVisitor);
-    store->visit(pv, "Hashtable resizer", &d, Priority::ItemPagerPriority);
+bool HashtableResizer::run() {
+    MigratingVisitor mv;
+    store->visit(mv);
+    if (mv.pending) {
+        snooze(MIGRATION_FREQUENCY, false);
+        return true;
+    }
 
-    d.snooze(t, FREQUENCY);
+    // Snooze first, so that the visitor may wake us up as soon as it's done.
+    snooze(FREQUENCY, false);
+    shared_ptr<ResizingVisitor> pv(new ResizingVisitor(taskId));
+    store->visit(pv, "Hashtable resizer", NONIO_TASK_IDX,
+                 Priority::ItemPagerPriority);
     return true;
 }
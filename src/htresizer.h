@@ -22,22 +22,27 @@
 
 #include <string>
 
-#include "dispatcher.h"
+#include "tasks.h"
 
+class EventuallyPersistentEngine;
 class EventuallyPersistentStore;
 
 /**
  * Look around at hash tables and verify they're all sized
  * appropriately.
  */
-class HashtableResizer : public DispatcherCallback {
+class HashtableResizer : public GlobalTask {
 public:
 
-    HashtableResizer(EventuallyPersistentStore *s) : store(s) {}
+    HashtableResizer(EventuallyPersistentEngine *e,
+                     EventuallyPersistentStore *s, double sleeptime = 0) :
+        GlobalTask(e, Priority::HTResizePriority, sleeptime, NO_START_TIME,
+                   false),
+        store(s) {}
 
-    bool callback(Dispatcher &d, TaskId &t);
+    bool run();
 
-    std::string description() {
+    std::string getDescription() {
         return std::string("Adjusting hash table sizes.");
     }
 
@@ -43,7 +43,24 @@ size_t IOManager::scheduleFlusherTask(EventuallyPersistentEngine *engine,
     int writers = engine->getWorkLoadPolicy().calculateNumWriters();
     ExTask task = new FlusherTask(engine, flusher, priority);
     flusher->setTaskId(task->getId());
-    return schedule(task, (sid % writers));
+    return schedule(task, (sid % writers), sid);
+}
+
+size_t IOManager::scheduleFlushCommit(EventuallyPersistentEngine *engine,
+                                      Flusher* flusher,
+                                      const std::vector<FlushBatch*> &batches,
+                                      const Priority &priority, int sid,
+                                      int round) {
+    int writers = engine->getWorkLoadPolicy().calculateNumWriters();
+    ExTask task = new FlushCommitTask(engine, flusher, batches, priority);
+    // Keep the commits off the flusher's own thread, so that it can
+    // collect the next batch meanwhile.  They already run alongside the
+    // shard's other tasks, so they get no serial.
+    int tidx = sid % writers;
+    if (writers > 1) {
+        tidx = (tidx + 1 + round % (writers - 1)) % writers;
+    }
+    return schedule(task, tidx);
 }
 
 size_t IOManager::scheduleVBSnapshot(EventuallyPersistentEngine *engine,
@@ -51,7 +68,7 @@ size_t IOManager::scheduleVBSnapshot(EventuallyPersistentEngine *engine,
                                      int, bool isDaemon) {
     int writers = engine->getWorkLoadPolicy().calculateNumWriters();
     ExTask task = new VBSnapshotTask(engine, priority, sid, isDaemon);
-    return schedule(task, (sid % writers));
+    return schedule(task, (sid % writers), sid);
 }
 
 size_t IOManager::scheduleVBDelete(EventuallyPersistentEngine *engine,
@@ -62,7 +79,7 @@ size_t IOManager::scheduleVBDelete(EventuallyPersistentEngine *engine,
     int writers = engine->getWorkLoadPolicy().calculateNumWriters();
     ExTask task = new VBDeleteTask(engine, vbucket, cookie, priority, recreate,
                                    sleeptime, isDaemon);
-    return schedule(task, (sid % writers));
+    return schedule(task, (sid % writers), sid);
 }
 
 size_t IOManager::scheduleStatsSnapshot(EventuallyPersistentEngine *engine,
@@ -72,7 +89,7 @@ size_t IOManager::scheduleStatsSnapshot(EventuallyPersistentEngine *engine,
     int writers = engine->getWorkLoadPolicy().calculateNumWriters();
     ExTask task = new StatSnap(engine, priority, runOnce, sleeptime,
                                isDaemon, blockShutdown);
-    return schedule(task, (sid % writers));
+    return schedule(task, (sid % writers), sid);
 }
 
 size_t IOManager::scheduleMultiBGFetcher(EventuallyPersistentEngine *engine,
@@ -84,7 +101,7 @@ size_t IOManager::scheduleMultiBGFetcher(EventuallyPersistentEngine *engine,
     ExTask task = new BgFetcherTask(engine, b, priority, sleeptime,
                                     isDaemon, blockShutdown);
     b->setTaskId(task->getId());
-    return schedule(task, writers + (sid % readers));
+    return schedule(task, writers + (sid % readers), sid);
 }
 
 size_t IOManager::scheduleVKeyFetch(EventuallyPersistentEngine *engine,
@@ -98,7 +115,7 @@ size_t IOManager::scheduleVKeyFetch(EventuallyPersistentEngine *engine,
     ExTask task = new VKeyStatBGFetchTask(engine, key, vbid, seqNum, cookie,
                                           priority, sleeptime, delay, isDaemon,
                                           blockShutdown);
-    return schedule(task, writers + (sid % readers));
+    return schedule(task, writers + (sid % readers), sid);
 }
 
 size_t IOManager::scheduleBGFetch(EventuallyPersistentEngine *engine,
@@ -112,5 +129,29 @@ size_t IOManager::scheduleBGFetch(EventuallyPersistentEngine *engine,
     ExTask task = new BGFetchTask(engine, key, vbid, seqNum, cookie, isMeta,
                                   priority, sleeptime, delay, isDaemon,
                                   blockShutdown);
-    return schedule(task, writers + (sid % readers));
+    return schedule(task, writers + (sid % readers), sid);
+}
+
+size_t IOManager::scheduleWarmupShard(EventuallyPersistentEngine *engine,
+                                      Warmup *warmup,
+                                      const Priority &priority, int sid) {
+    int writers = engine->getWorkLoadPolicy().calculateNumWriters();
+    int readers = engine->getWorkLoadPolicy().calculateNumReaders();
+    ExTask task = new WarmupShardTask(engine, warmup, sid, priority);
+    return schedule(task, writers + (sid % readers), sid);
+}
+
+size_t IOManager::scheduleTask(ExTask task, task_type_t type) {
+    WorkLoadPolicy &workload = task->getEngine()->getWorkLoadPolicy();
+    int writers = workload.calculateNumWriters();
+    int readers = workload.calculateNumReaders();
+    switch (type) {
+    case WRITER_TASK_IDX:
+        return schedule(task, nextThread.incr(1) % writers);
+    case AUXIO_TASK_IDX:
+        return schedule(task, writers + readers);
+    default: // NONIO_TASK_IDX
+        return schedule(task, writers + readers + 1 +
+                        nextThread.incr(1) % workload.getNumNonIO());
+    }
 }
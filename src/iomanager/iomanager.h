@@ -33,6 +33,11 @@ public:
                                Flusher* flusher, const Priority &priority,
                                int sid);
 
+    size_t scheduleFlushCommit(EventuallyPersistentEngine *engine,
+                               Flusher* flusher,
+                               const std::vector<FlushBatch*> &batches,
+                               const Priority &priority, int sid, int round);
+
     size_t scheduleVBSnapshot(EventuallyPersistentEngine *engine,
                               const Priority &priority, int sid,
                               int sleeptime = 0, bool isDaemon = false);
@@ -69,10 +74,28 @@ public:
                            size_t delay = 0, bool isDaemon = false,
                            bool blockShutdown = false);
 
+    size_t scheduleWarmupShard(EventuallyPersistentEngine *engine,
+                               Warmup *warmup, const Priority &priority,
+                               int sid);
+
+    /**
+     * Schedule a task that belongs to no shard on a thread of the
+     * given kind.
+     *
+     * Auxiliary IO tasks all run on one thread of their own, as they
+     * share the bucket's auxiliary store; they never hold up the shard
+     * readers.  Writer tasks must not write to the shard stores; those
+     * go through the shard's own calls above.
+     */
+    size_t scheduleTask(ExTask task, task_type_t type);
+
     IOManager(int ro = 0, int wo = 0)
         : ExecutorPool(ro, wo) {}
 
 private:
+    //! Thread of its kind to put the next task without a shard on.
+    Atomic<size_t> nextThread;
+
     static Mutex initGuard;
     static IOManager *instance;
 };
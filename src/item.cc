@@ -52,3 +52,66 @@ bool Item::prepend(const Item &i) {
     value.reset(newData);
     return true;
 }
+
+ItemPool::~ItemPool() {
+    for (size_t i = 0; i < numLists; ++i) {
+        std::vector<Item*>::iterator it;
+        for (it = lists[i].items.begin(); it != lists[i].items.end(); ++it) {
+            // Idle items were taken off the books when they were
+            // released, and deleting them takes them off again.
+            ObjectRegistry::onCreateItem(*it);
+            delete *it;
+        }
+    }
+}
+
+ItemPool::FreeList &ItemPool::listForThread() {
+    // Thread descriptors sit at least a page apart; mix the bits above
+    // that so neighbouring threads spread over the lists.
+    uint64_t id = static_cast<uint64_t>((uintptr_t)pthread_self()) >> 12;
+    id *= 0x9E3779B97F4A7C15ULL;
+    return lists[(id >> 32) % numLists];
+}
+
+Item *ItemPool::newItem(const char *k, size_t nk, uint32_t fl, time_t exp,
+                        const value_t &val, uint64_t theCas, int64_t i,
+                        uint16_t vbid, uint64_t sno) {
+    Item *itm(NULL);
+    FreeList &list = listForThread();
+    {
+        LockHolder lh(list.mutex);
+        if (!list.items.empty()) {
+            itm = list.items.back();
+            list.items.pop_back();
+        }
+    }
+    if (itm == NULL) {
+        return new Item(std::string(k, nk), fl, exp, val, theCas, i, vbid, sno);
+    }
+    --numIdle;
+    ++numReused;
+    itm->reuse(k, nk, fl, exp, val, theCas, i, vbid, sno);
+    ObjectRegistry::onCreateItem(itm);
+    return itm;
+}
+
+void ItemPool::release(Item *itm) {
+    if (itm == NULL) {
+        return;
+    }
+    FreeList &list = listForThread();
+    LockHolder lh(list.mutex);
+    if (list.items.size() >= maxIdlePerList) {
+        lh.unlock();
+        delete itm;
+        return;
+    }
+    ObjectRegistry::onDeleteItem(itm);
+    // Don't keep the value (and its memory) alive while idle.
+    itm->value.reset();
+    if (list.items.capacity() == 0) {
+        list.items.reserve(maxIdlePerList);
+    }
+    list.items.push_back(itm);
+    ++numIdle;
+}
@@ -25,11 +25,13 @@
 #include <string.h>
 
 #include <string>
+#include <vector>
 
 #include "atomic.h"
 #include "locks.h"
 #include "mutex.h"
 #include "objectregistry.h"
+#include "slab_allocator.h"
 #include "stats.h"
 
 /**
@@ -38,6 +40,11 @@
 class Blob : public RCValue {
 public:
 
+    //! Size of the slabs Blob instances are carved from.
+    static const size_t slabSize = 65536;
+    //! Blobs bigger than this are allocated with malloc.
+    static const size_t maxChunkSize = 8192;
+
     // Constructors.
 
     /**
@@ -50,7 +57,7 @@ public:
      */
     static Blob* New(const char *start, const size_t len) {
         size_t total_len = len + sizeof(Blob);
-        Blob *t = new (::operator new(total_len)) Blob(start, len);
+        Blob *t = new (ObjectRegistry::allocateBlob(total_len)) Blob(start, len);
         assert(t->length() == len);
         return t;
     }
@@ -75,7 +82,7 @@ public:
      */
     static Blob* New(const size_t len) {
         size_t total_len = len + sizeof(Blob);
-        Blob *t = new (::operator new(total_len)) Blob(len);
+        Blob *t = new (ObjectRegistry::allocateBlob(total_len)) Blob(len);
         assert(t->length() == len);
         return t;
     }
@@ -111,12 +118,13 @@ public:
     }
 
     // This is necessary for making C++ happy when I'm doing a
-    // placement new on fairly "normal" c++ heap allocations, just
-    // with variable-sized objects.
-    void operator delete(void* p) { ::operator delete(p); }
+    // placement new on slab allocations, just with variable-sized
+    // objects.
+    void operator delete(void* p) { SlabAllocator::deallocate(p, slabSize); }
 
     ~Blob() {
         ObjectRegistry::onDeleteBlob(this);
+        SlabAllocator::forget(this, slabSize, getSize());
     }
 
 private:
@@ -360,6 +368,22 @@ public:
     }
 
 private:
+    friend class ItemPool;
+
+    /**
+     * Turn an idle item of an ItemPool into a copy of another one,
+     * sharing its value.  The key reuses the storage of the old one.
+     */
+    void reuse(const char *k, size_t nk, uint32_t fl, time_t exp,
+               const value_t &val, uint64_t theCas, int64_t i,
+               uint16_t vbid, uint64_t sno) {
+        metaData = ItemMetaData(theCas, sno, fl, exp);
+        value.reset(val);
+        key.assign(k, nk);
+        bySeqno = i;
+        vbucketId = vbid;
+    }
+
     /**
      * Set the item's data. This is only used by constructors, so we
      * make it private.
@@ -387,4 +411,67 @@ private:
     DISALLOW_COPY_AND_ASSIGN(Item);
 };
 
+/**
+ * Recycles the items handed out to the network layer.
+ *
+ * Every get (and every mutation a TAP producer sends) used to allocate
+ * an Item and a copy of its key, only for memcached to release both
+ * once the response was written.  An ItemPool keeps released items
+ * around instead, so a get takes one that shares the value of the
+ * stored value and copies the key into storage it already owns.
+ *
+ * Items in use are accounted for like any other; idle ones are not,
+ * and don't hold on to a value.
+ */
+class ItemPool {
+public:
+
+    //! Number of free lists, picked by the calling thread.
+    static const size_t numLists = 8;
+    //! Most idle items kept on a free list.
+    static const size_t maxIdlePerList = 64;
+
+    ItemPool() {}
+
+    ~ItemPool();
+
+    /**
+     * Get an item holding the given key and metadata, sharing the
+     * given value.
+     */
+    Item *newItem(const char *k, size_t nk, uint32_t fl, time_t exp,
+                  const value_t &val, uint64_t theCas, int64_t i,
+                  uint16_t vbid, uint64_t sno);
+
+    /**
+     * Release an item, wherever it was allocated.
+     */
+    void release(Item *itm);
+
+    /**
+     * Get the number of idle items.
+     */
+    size_t getNumIdle() const { return numIdle.get(); }
+
+    /**
+     * Get the number of items handed out without allocating one.
+     */
+    size_t getNumReused() const { return numReused.get(); }
+
+private:
+
+    struct FreeList {
+        Mutex              mutex;
+        std::vector<Item*> items;
+    };
+
+    FreeList &listForThread();
+
+    FreeList       lists[numLists];
+    Atomic<size_t> numIdle;
+    Atomic<size_t> numReused;
+
+    DISALLOW_COPY_AND_ASSIGN(ItemPool);
+};
+
 #endif  // SRC_ITEM_H_
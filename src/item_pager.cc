@@ -17,12 +17,15 @@
 
 #include "config.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
 #include <limits>
 #include <list>
+#include <map>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "common.h"
 #include "ep.h"
@@ -31,6 +34,250 @@
 
 static const size_t MAX_PERSISTENCE_QUEUE_SIZE = 1000000;
 
+// Rounds of sampling in a row that may eject nothing before giving up.
+static const size_t MAX_FRUITLESS_SAMPLES = 10;
+
+static const char *evictionPolicyNames[EVICTION_POLICY_COUNT] = {
+    "nru", "clock", "sampled_lfu"
+};
+
+/**
+ * Eject the value of an item if it is clean and all of the cursors
+ * are past it, adding the bytes it held to freed.
+ */
+static bool ejectValue(EPStats &stats, RCPtr<VBucket> &vb, StoredValue *v,
+                       size_t &freed) {
+    if (!v->eligibleForEviction()) {
+        ++stats.numFailedEjects;
+        return false;
+    }
+    // Check if the key was already visited by all the cursors.
+    if (!vb->checkpointManager.eligibleForEviction(v->getKey())) {
+        return false;
+    }
+    size_t bytes = v->valuelen();
+    if (!v->ejectValue(stats, vb->ht)) {
+        return false;
+    }
+    freed += bytes;
+    return true;
+}
+
+/**
+ * Moves a clock hand over the items of a vbucket, ejecting the values
+ * it finds in the coldest NRU class and aging the others by one class.
+ */
+class ClockVisitor : public HashTableVisitor {
+public:
+    ClockVisitor(EPStats &st, RCPtr<VBucket> &v, size_t bytes)
+        : stats(st), vb(v), target(bytes), freed(0) {}
+
+    void visit(StoredValue *v) {
+        if (freed >= target || !v->eligibleForEviction() || v->isTempItem()) {
+            return;
+        }
+        if (v->getNRUValue() < MAX_NRU_VALUE) {
+            v->incrNRUValue();
+        } else {
+            ejectValue(stats, vb, v, freed);
+        }
+    }
+
+    bool shouldContinue() {
+        return freed < target;
+    }
+
+    size_t getFreed() const {
+        return freed;
+    }
+
+private:
+    EPStats &stats;
+    RCPtr<VBucket> &vb;
+    size_t target;
+    size_t freed;
+};
+
+/**
+ * CLOCK: a hand per vbucket that resumes where it stopped the last time.
+ * Each lap ages the values it passes, so no more than MAX_NRU_VALUE + 1
+ * laps are needed to find whatever can be ejected.
+ */
+class ClockEvictionPolicy : public EvictionPolicy {
+public:
+    ClockEvictionPolicy(EPStats &st) : stats(st) {}
+
+    size_t evict(RCPtr<VBucket> &vb, size_t bytes) {
+        ClockVisitor cv(stats, vb, bytes);
+        size_t &hand = hands[vb->getId()];
+        for (int lap = 0; lap <= MAX_NRU_VALUE && cv.shouldContinue(); ++lap) {
+            hand = vb->ht.visitLocks(cv, hand, 0);
+        }
+        return cv.getFreed();
+    }
+
+private:
+    EPStats &stats;
+    std::map<uint16_t, size_t> hands;
+};
+
+/**
+ * An item the sampled LFU policy may eject.
+ */
+struct EvictionCandidate {
+    EvictionCandidate(const std::string &k, uint8_t n, size_t s)
+        : key(k), nru(n), size(s) {}
+
+    // Coldest first, and the biggest of those.
+    bool operator<(const EvictionCandidate &other) const {
+        if (nru != other.nru) {
+            return nru > other.nru;
+        }
+        return size > other.size;
+    }
+
+    std::string key;
+    uint8_t nru;
+    size_t size;
+};
+
+/**
+ * Pick a uniform sample of the values that can be ejected in the
+ * chains it visits, aging every value it looks at by one NRU class.
+ */
+class EvictionSampler : public HashTableVisitor {
+public:
+    EvictionSampler(size_t n) : sampleSize(n), seen(0) {}
+
+    void visit(StoredValue *v) {
+        if (!v->eligibleForEviction() || v->isTempItem()) {
+            return;
+        }
+        ++seen;
+        if (candidates.size() < sampleSize) {
+            candidates.push_back(EvictionCandidate(v->getKey(),
+                                                   v->getNRUValue(),
+                                                   v->valuelen()));
+        } else {
+            size_t i = static_cast<size_t>(std::rand()) % seen;
+            if (i < sampleSize) {
+                candidates[i] = EvictionCandidate(v->getKey(),
+                                                  v->getNRUValue(),
+                                                  v->valuelen());
+            }
+        }
+        v->incrNRUValue();
+    }
+
+    bool isFull() const {
+        return candidates.size() >= sampleSize;
+    }
+
+    std::vector<EvictionCandidate> &getCandidates() {
+        return candidates;
+    }
+
+private:
+    size_t sampleSize;
+    size_t seen;
+    std::vector<EvictionCandidate> candidates;
+};
+
+/**
+ * Sampled LFU: eject the least frequently used of a few values in
+ * random chains.  The 2-bit NRU class stands in for a use count; gets
+ * bring it down and sampling ages it, so it tracks recent frequency.
+ * Every sampled value in the coldest class goes in the same round, or
+ * the coldest one if none is.
+ */
+class SampledLFUEvictionPolicy : public EvictionPolicy {
+public:
+    SampledLFUEvictionPolicy(EPStats &st, Configuration &c)
+        : stats(st), config(c) {}
+
+    size_t evict(RCPtr<VBucket> &vb, size_t bytes) {
+        size_t sampleSize = config.getEvictionSampleSize();
+        size_t freed = 0;
+        size_t fruitless = 0;
+        while (freed < bytes && fruitless < MAX_FRUITLESS_SAMPLES) {
+            EvictionSampler sampler(sampleSize);
+            // Chains are mostly short and some are empty, so look at a
+            // few more of them than values are wanted.
+            for (size_t i = 0; i < 2 * sampleSize && !sampler.isFull(); ++i) {
+                vb->ht.visitChain(sampler, static_cast<size_t>(std::rand()));
+            }
+            std::vector<EvictionCandidate> &candidates(sampler.getCandidates());
+            if (candidates.empty()) {
+                break;
+            }
+            std::sort(candidates.begin(), candidates.end());
+            if (evictCold(vb, candidates, bytes, freed) > 0) {
+                fruitless = 0;
+            } else {
+                ++fruitless;
+            }
+        }
+        return freed;
+    }
+
+private:
+    /**
+     * Eject the candidates in the coldest NRU class until enough is
+     * freed, or the coldest one that can be if none of them could.
+     *
+     * @return the number of values ejected
+     */
+    size_t evictCold(RCPtr<VBucket> &vb,
+                     const std::vector<EvictionCandidate> &candidates,
+                     size_t bytes, size_t &freed) {
+        size_t ejected = 0;
+        std::vector<EvictionCandidate>::const_iterator it;
+        for (it = candidates.begin(); it != candidates.end() && freed < bytes;
+             ++it) {
+            if (it->nru < MAX_NRU_VALUE && ejected > 0) {
+                break;
+            }
+            int bucket_num(0);
+            LockHolder lh = vb->ht.getLockedBucket(it->key, &bucket_num);
+            StoredValue *v = vb->ht.unlocked_find(it->key, bucket_num,
+                                                  false, false);
+            if (v && ejectValue(stats, vb, v, freed)) {
+                ++ejected;
+            }
+        }
+        return ejected;
+    }
+
+    EPStats &stats;
+    Configuration &config;
+};
+
+const char *EvictionPolicy::getName(eviction_policy_t policy) {
+    assert(policy >= 0 && policy < EVICTION_POLICY_COUNT);
+    return evictionPolicyNames[policy];
+}
+
+eviction_policy_t EvictionPolicy::getPolicy(const std::string &name) {
+    for (int i = 0; i < EVICTION_POLICY_COUNT; ++i) {
+        if (name == evictionPolicyNames[i]) {
+            return static_cast<eviction_policy_t>(i);
+        }
+    }
+    return EVICTION_NRU;
+}
+
+EvictionPolicy *EvictionPolicy::create(eviction_policy_t policy, EPStats &st,
+                                       Configuration &config) {
+    switch (policy) {
+    case EVICTION_CLOCK:
+        return new ClockEvictionPolicy(st);
+    case EVICTION_SAMPLED_LFU:
+        return new SampledLFUEvictionPolicy(st, config);
+    default:
+        return NULL;
+    }
+}
+
 /**
  * As part of the ItemPager, visit all of the objects in memory and
  * eject some within a constrained probability
@@ -49,14 +296,19 @@ public:
      * @param pause flag indicating if PagingVisitor can pause between vbucket visits
      * @param bias active vbuckets eviction probability bias multiplier (0-1)
      * @param phase pointer to an item_pager_phase to be set
+     * @param resume where the sweep of each vbucket resumes, kept from
+     *               one visit to the next (NULL to sweep from the start)
      */
     PagingVisitor(EventuallyPersistentStore &s, EPStats &st, double pcnt,
                   bool *sfin, bool pause = false,
-                  double bias = 1, item_pager_phase *phase = NULL)
+                  double bias = 1, item_pager_phase *phase = NULL,
+                  std::map<uint16_t, size_t> *resume = NULL)
       : store(s), stats(st), percent(pcnt),
-        activeBias(bias), ejected(0), totalEjected(0), totalEjectionAttempts(0),
-        startTime(ep_real_time()), stateFinalizer(sfin), canPause(pause),
-        completePhase(true), pager_phase(phase) {}
+        activeBias(bias), quota(0), bucketFreed(0), carried(0),
+        ejected(0), totalEjected(0), totalEjectionAttempts(0),
+        startTime(ep_real_time()), startHrTime(gethrtime()),
+        stateFinalizer(sfin), canPause(pause),
+        completePhase(true), pager_phase(phase), resumeAt(resume) {}
 
     void visit(StoredValue *v) {
         // Remember expired objects -- we're going to delete them.
@@ -65,8 +317,9 @@ public:
             return;
         }
 
-        // return if not ItemPager, which uses valid eviction percentage
-        if (percent <= 0 || !pager_phase) {
+        // return if not ItemPager, which uses valid eviction percentage,
+        // or once the vbucket gave up its share
+        if (percent <= 0 || !pager_phase || bucketFreed >= quota) {
             return;
         }
 
@@ -90,20 +343,41 @@ public:
             return VBucketVisitor::visitBucket(vb);
         }
 
-        // skip active vbuckets if active resident ratio is lower than replica
+        // skip active vbuckets if active resident ratio is lower than
+        // replica, leaving their share to the vbuckets visited after them
         double current = static_cast<double>(stats.getTotalMemoryUsed());
         double lower = static_cast<double>(stats.mem_low_wat);
         double high = static_cast<double>(stats.mem_high_wat);
         if (vb->getState() == vbucket_state_active && current < high &&
             store.cachedResidentRatio.activeRatio < store.cachedResidentRatio.replicaRatio)
         {
+            carried += vb->evictionQuota.get();
             return false;
         }
 
         if (current > lower) {
+            // Only sweep the vbucket until it gave up its share, and
+            // whatever the ones before it couldn't.
+            quota = vb->evictionQuota.get();
+            bucketFreed = 0;
+            if (quota == 0 || !VBucketVisitor::visitBucket(vb)) {
+                return false;
+            }
+            quota += carried;
             double p = (current - static_cast<double>(lower)) / current;
             adjustPercent(p, vb->getState());
-            return VBucketVisitor::visitBucket(vb);
+            if (!resumeAt) {
+                return true;
+            }
+
+            size_t &hand = (*resumeAt)[vb->getId()];
+            hand = vb->ht.visitLocks(*this, hand, 0);
+            if (bucketFreed >= quota) {
+                // The rest of the vbucket wasn't looked at in this phase.
+                completePhase = false;
+            }
+            carried = quota - std::min(quota, bucketFreed);
+            return false;
         } else { // stop eviction whenever memory usage is below low watermark
             completePhase = false;
             return false;
@@ -127,6 +401,10 @@ public:
         expired.clear();
     }
 
+    bool shouldContinue() {
+        return percent <= 0 || !pager_phase || bucketFreed < quota;
+    }
+
     bool pauseVisitor() {
         size_t queueSize = stats.diskQueueSize.get();
         return canPause && queueSize >= MAX_PERSISTENCE_QUEUE_SIZE;
@@ -134,6 +412,10 @@ public:
 
     void complete() {
         update();
+        if (pager_phase) {
+            hrtime_t spent = (gethrtime() - startHrTime) / 1000;
+            stats.evictionStats[EVICTION_NRU].evictTime.incr(spent);
+        }
         if (stateFinalizer) {
             *stateFinalizer = true;
         }
@@ -179,14 +461,11 @@ private:
 
     void doEviction(StoredValue *v) {
         ++totalEjectionAttempts;
-        if (!v->eligibleForEviction()) {
-            ++stats.numFailedEjects;
-            return;
-        }
-        // Check if the key was already visited by all the cursors.
-        bool can_evict = currentBucket->checkpointManager.eligibleForEviction(v->getKey());
-        if (can_evict && v->ejectValue(stats, currentBucket->ht)) {
+        size_t freed = 0;
+        if (ejectValue(stats, currentBucket, v, freed)) {
             ++ejected;
+            bucketFreed += freed;
+            stats.evictionStats[EVICTION_NRU].bytesFreed.incr(freed);
         }
     }
 
@@ -196,17 +475,32 @@ private:
     EPStats &stats;
     double percent;
     double activeBias;
+    size_t quota;
+    size_t bucketFreed;
+    //! Quota the vbuckets visited so far left to the next ones.
+    size_t carried;
     size_t ejected;
     size_t totalEjected;
     size_t totalEjectionAttempts;
     time_t startTime;
+    hrtime_t startHrTime;
     bool *stateFinalizer;
     bool canPause;
     bool completePhase;
     item_pager_phase *pager_phase;
+    std::map<uint16_t, size_t> *resumeAt;
 };
 
-bool ItemPager::callback(Dispatcher &d, TaskId &t) {
+bool ItemPager::run() {
+    Configuration &cfg = store.getEPEngine().getConfiguration();
+    countGets();
+    eviction_policy_t type = EvictionPolicy::getPolicy(cfg.getEvictionPolicy());
+    if (type != policyType) {
+        delete policy;
+        policy = EvictionPolicy::create(type, stats, cfg);
+        policyType = type;
+    }
+
     double current = static_cast<double>(stats.getTotalMemoryUsed());
     double upper = static_cast<double>(stats.mem_high_wat);
     double lower = static_cast<double>(stats.mem_low_wat);
@@ -222,22 +516,103 @@ bool ItemPager::callback(Dispatcher &d, TaskId &t) {
         LOG(EXTENSION_LOG_INFO, ss.str().c_str(), (toKill*100.0));
 
         // compute active vbuckets evicition bias factor
-        Configuration &cfg = store.getEPEngine().getConfiguration();
         size_t activeEvictPerc = cfg.getPagerActiveVbPcnt();
         double bias = static_cast<double>(activeEvictPerc) / 50;
 
-        available = false;
-        shared_ptr<PagingVisitor> pv(new PagingVisitor(store, stats, toKill,
-                                                       &available,
-                                                       false, bias, &phase));
-        store.visit(pv, "Item pager", &d, Priority::ItemPagerPriority);
+        setQuotas(static_cast<size_t>(current - lower), bias);
+        if (policy) {
+            evict();
+        } else {
+            available = false;
+            shared_ptr<PagingVisitor> pv(new PagingVisitor(store, stats, toKill,
+                                                           &available,
+                                                           false, bias, &phase,
+                                                           &resumeAt));
+            store.visit(pv, "Item pager", NONIO_TASK_IDX,
+                        Priority::ItemPagerPriority);
+        }
     }
 
-    d.snooze(t, sleepTime);
+    snooze(sleepTime, false);
     return true;
 }
 
-bool ExpiredItemPager::callback(Dispatcher &d, TaskId &t) {
+void ItemPager::countGets() {
+    size_t gets = stats.getCmdHisto.total();
+    size_t fetches = stats.bg_fetched.get();
+    // Either may have been reset since the last run.
+    size_t newGets = gets >= lastGets ? gets - lastGets : gets;
+    size_t newFetches = fetches >= lastBgFetches ? fetches - lastBgFetches
+                                                 : fetches;
+    lastGets = gets;
+    lastBgFetches = fetches;
+
+    // A get that has to fetch its value is tried again once it's in.
+    newGets = newGets > newFetches ? newGets - newFetches : 0;
+    EPStats::EvictionStats &es = stats.evictionStats[policyType];
+    es.gets.incr(newGets);
+    es.bgFetches.incr(std::min(newFetches, newGets));
+}
+
+void ItemPager::setQuotas(size_t bytes, double bias) {
+    const VBucketMap &vbMap = store.getVBuckets();
+    std::vector<std::pair<RCPtr<VBucket>, double> > vbs;
+    double total = 0;
+    for (size_t i = 0; i < vbMap.getSize(); ++i) {
+        RCPtr<VBucket> vb = vbMap.getBucket(i);
+        if (!vb) {
+            continue;
+        }
+        vbucket_state_t vbState = vb->getState();
+        if (vbState == vbucket_state_pending) {
+            // Still being filled in by a takeover.
+            vb->evictionQuota.set(0);
+            continue;
+        }
+        // A vbucket gives up more the more of its values are in memory...
+        double weight = static_cast<double>(vb->ht.cacheSize.get());
+        // ...up to half less if its gets are served from memory...
+        weight *= 2 - vb->updateEvictionHitRate() / 100.0;
+        // ...and replica values are ejected ahead of active ones.
+        if (vbState == vbucket_state_replica || vbState == vbucket_state_dead) {
+            weight *= 2 - bias;
+        } else {
+            weight *= bias;
+        }
+        vbs.push_back(std::make_pair(vb, weight));
+        total += weight;
+    }
+
+    std::vector<std::pair<RCPtr<VBucket>, double> >::iterator it;
+    for (it = vbs.begin(); it != vbs.end(); ++it) {
+        size_t quota(0);
+        if (total > 0) {
+            quota = static_cast<size_t>(bytes * it->second / total);
+            quota = std::min(quota, it->first->ht.cacheSize.get());
+        }
+        it->first->evictionQuota.set(quota);
+    }
+}
+
+void ItemPager::evict() {
+    hrtime_t start = gethrtime();
+    const VBucketMap &vbMap = store.getVBuckets();
+    size_t freed = 0;
+    for (size_t i = 0; i < vbMap.getSize(); ++i) {
+        RCPtr<VBucket> vb = vbMap.getBucket(i);
+        if (vb && vb->evictionQuota.get() > 0) {
+            freed += policy->evict(vb, vb->evictionQuota.get());
+        }
+    }
+
+    EPStats::EvictionStats &es = stats.evictionStats[policyType];
+    es.bytesFreed.incr(freed);
+    es.evictTime.incr((gethrtime() - start) / 1000);
+    LOG(EXTENSION_LOG_INFO, "Ejected %ld bytes of values using the %s policy",
+        freed, EvictionPolicy::getName(policyType));
+}
+
+bool ExpiredItemPager::run() {
     if (available) {
         ++stats.expiryPagerRuns;
 
@@ -245,9 +620,9 @@ bool ExpiredItemPager::callback(Dispatcher &d, TaskId &t) {
         shared_ptr<PagingVisitor> pv(new PagingVisitor(store, stats, -1,
                                                        &available,
                                                        true, 1, NULL));
-        store.visit(pv, "Expired item remover", &d, Priority::ItemPagerPriority,
-                    true, 10);
+        store.visit(pv, "Expired item remover", NONIO_TASK_IDX,
+                    Priority::ItemPagerPriority, 10);
     }
-    d.snooze(t, sleepTime);
+    snooze(sleepTime, false);
     return true;
 }
@@ -27,13 +27,16 @@
 #include <vector>
 
 #include "common.h"
-#include "dispatcher.h"
 #include "stats.h"
+#include "tasks.h"
 
 typedef std::pair<int64_t, int64_t> row_range_t;
 
 // Forward declaration.
+class Configuration;
+class EventuallyPersistentEngine;
 class EventuallyPersistentStore;
+class VBucket;
 
 /**
  * The item pager phase
@@ -44,22 +47,69 @@ typedef enum {
 } item_pager_phase;
 
 /**
- * Dispatcher job responsible for periodically pushing data out of
- * memory.
+ * Picks the values the item pager ejects from a vbucket without
+ * sweeping all of it.
  */
-class ItemPager : public DispatcherCallback {
+class EvictionPolicy {
+public:
+    virtual ~EvictionPolicy() {}
+
+    /**
+     * Eject values from a vbucket until the given number of bytes is
+     * freed or nothing more can be.
+     *
+     * @param vb the vbucket to eject values from
+     * @param bytes the number of bytes to free
+     * @return the number of bytes of values ejected
+     */
+    virtual size_t evict(RCPtr<VBucket> &vb, size_t bytes) = 0;
+
+    /**
+     * Get the name a policy is configured by.
+     */
+    static const char *getName(eviction_policy_t policy);
+
+    /**
+     * Get the policy of the given name (EVICTION_NRU if unknown).
+     */
+    static eviction_policy_t getPolicy(const std::string &name);
+
+    /**
+     * Create a policy.
+     *
+     * @return the policy, or NULL for EVICTION_NRU, which is the item
+     *         pager's own sweep
+     */
+    static EvictionPolicy *create(eviction_policy_t policy, EPStats &st,
+                                  Configuration &config);
+};
+
+/**
+ * Task responsible for periodically pushing data out of memory.
+ */
+class ItemPager : public GlobalTask {
 public:
 
     /**
      * Construct an ItemPager.
      *
+     * @param e the engine
      * @param s the store (where we'll visit)
      * @param st the stats
+     * @param sleeptime number of seconds to wait before the first run
      */
-    ItemPager(EventuallyPersistentStore *s, EPStats &st) :
-        store(*s), stats(st), available(true), phase(PAGING_UNREFERENCED) {}
+    ItemPager(EventuallyPersistentEngine *e, EventuallyPersistentStore *s,
+              EPStats &st, double sleeptime = 0) :
+        GlobalTask(e, Priority::ItemPagerPriority, sleeptime, NO_START_TIME,
+                   false),
+        store(*s), stats(st), available(true), phase(PAGING_UNREFERENCED),
+        policy(NULL), policyType(EVICTION_NRU), lastGets(0), lastBgFetches(0) {}
+
+    ~ItemPager() {
+        delete policy;
+    }
 
-    bool callback(Dispatcher &d, TaskId &t);
+    bool run();
 
     item_pager_phase getPhase() const {
         return phase;
@@ -69,38 +119,59 @@ public:
         phase = item_phase;
     }
 
-    std::string description() { return std::string("Paging out items."); }
+    std::string getDescription() { return std::string("Paging out items."); }
 
 private:
 
+    // Count the gets since the last run against the current policy.
+    void countGets();
+
+    // Split the bytes to free into eviction quotas of the vbuckets by
+    // their resident bytes, hit rate and state.
+    void setQuotas(size_t bytes, double bias);
+
+    // Have the policy eject the quota of each vbucket.
+    void evict();
+
     EventuallyPersistentStore &store;
     EPStats &stats;
     bool available;
     item_pager_phase phase;
+    // Lock each vbucket's sweep resumes at, like a clock hand.
+    std::map<uint16_t, size_t> resumeAt;
+    EvictionPolicy *policy;
+    eviction_policy_t policyType;
+    size_t lastGets;
+    size_t lastBgFetches;
 };
 
 /**
- * Dispatcher job responsible for purging expired items from
- * memory and disk.
+ * Task responsible for purging expired items from memory and disk.
  */
-class ExpiredItemPager : public DispatcherCallback {
+class ExpiredItemPager : public GlobalTask {
 public:
 
     /**
      * Construct an ExpiredItemPager.
      *
+     * @param e the engine
      * @param s the store (where we'll visit)
      * @param st the stats
      * @param stime number of seconds to wait between runs
      */
-    ExpiredItemPager(EventuallyPersistentStore *s, EPStats &st,
+    ExpiredItemPager(EventuallyPersistentEngine *e,
+                     EventuallyPersistentStore *s, EPStats &st,
                      size_t stime) :
+        GlobalTask(e, Priority::ItemPagerPriority,
+                   static_cast<double>(stime), NO_START_TIME, false),
         store(*s), stats(st), sleepTime(static_cast<double>(stime)),
         available(true) {}
 
-    bool callback(Dispatcher &d, TaskId &t);
+    bool run();
 
-    std::string description() { return std::string("Paging expired items."); }
+    std::string getDescription() {
+        return std::string("Paging expired items.");
+    }
 
 private:
     EventuallyPersistentStore &store;
@@ -36,7 +36,8 @@ KVShard::KVShard(uint16_t id, EventuallyPersistentStore &store) :
     rwUnderlying = KVStoreFactory::create(stats, config, false);
     roUnderlying = KVStoreFactory::create(stats, config, true);
 
-    flusher = new Flusher(&store, this);
+    flusher = new Flusher(&store, this, config.getFlusherCommitConcurrency(),
+                          config.getFlusherGroupCommitWindow());
     bgFetcher = new BgFetcher(&store, this, stats);
 }
 
@@ -108,6 +108,24 @@ enum db_type {
     multi_mt_vb_db       //!< multi-db, multi-table strategy sharded by vbucket
 };
 
+/**
+ * The writes of a transaction, taken out of the KVStore that queued
+ * them by KVStore::detach() so that they can be committed elsewhere.
+ */
+class DetachedTransaction {
+public:
+    virtual ~DetachedTransaction() {}
+
+    /**
+     * Commit the writes, invoking their callbacks.  Transactions of
+     * different vbuckets may be committed at the same time, from
+     * different threads.
+     *
+     * @return false if the commit fails
+     */
+    virtual bool commit() = 0;
+};
+
 /**
  * Base class representing kvstore operations.
  */
@@ -168,6 +186,32 @@ public:
      */
     virtual bool commit() = 0;
 
+    /**
+     * End the current transaction without committing it, so that the
+     * next one can begin while this one is being committed.
+     *
+     * @return the transaction, or NULL if the store can't do that (in
+     *         which case the transaction is still open)
+     */
+    virtual DetachedTransaction *detach() {
+        return NULL;
+    }
+
+    /**
+     * Commit several transactions detached from this store, at once if
+     * the store can make that cheaper than committing them one by one.
+     *
+     * @return false if the commit fails
+     */
+    virtual bool commitGroup(const std::vector<DetachedTransaction*> &txns) {
+        bool rv = true;
+        std::vector<DetachedTransaction*>::const_iterator it;
+        for (it = txns.begin(); it != txns.end(); ++it) {
+            rv = (*it)->commit() && rv;
+        }
+        return rv;
+    }
+
     /**
      * Rollback the current transaction.
      */
@@ -247,6 +291,14 @@ public:
      */
     virtual void dump(uint16_t vbid, shared_ptr<Callback<GetValue> > cb) = 0;
 
+    /**
+     * Pass all live (not deleted) data for the given vbuckets through
+     * the given callback, one vbucket after the other in the given
+     * order.
+     */
+    virtual void dump(const std::vector<uint16_t> &vbids,
+                      shared_ptr<Callback<GetValue> > cb) = 0;
+
     /**
      * Check if the kv-store supports a dumping all of the keys
      * @return true you may call dumpKeys() to do a prefetch
@@ -26,7 +26,6 @@
 extern "C" {
 #include "crc32.h"
 }
-#include "ep_engine.h"
 #include "mutation_log.h"
 
 const char *mutation_log_type_names[] = {
@@ -105,10 +104,12 @@ void MutationLog::disable() {
     }
 }
 
-void MutationLog::newItem(uint16_t vbucket, const std::string &key, uint64_t rowid) {
+void MutationLog::newItem(uint16_t vbucket, const std::string &key,
+                          uint64_t rowid, uint8_t nru) {
     if (isEnabled()) {
         MutationLogEntry *mle = MutationLogEntry::newEntry(entryBuffer,
-                                                           rowid, ML_NEW, vbucket, key);
+                                                           rowid, ML_NEW, vbucket, key,
+                                                           nru);
         writeEntry(mle);
     }
 }
@@ -191,8 +192,12 @@ void MutationLog::readInitialBlock() {
 
     headerBlock.set(buf, sizeof(buf));
 
-    // These are reserved for future use.
-    assert(headerBlock.version() == LOG_VERSION);
+    if (headerBlock.version() < 1 || headerBlock.version() > LOG_VERSION) {
+        std::stringstream ss;
+        ss << "Unsupported log version " << headerBlock.version();
+        throw ReadException(ss.str());
+    }
+    // This is reserved for future use.
     assert(headerBlock.blockCount() == 1);
 
     blockSize = headerBlock.blockSize();
@@ -291,13 +296,15 @@ void MutationLog::open(bool _readOnly) {
     } else {
         try {
             readInitialBlock();
-        } catch (ShortReadException &e) {
+        } catch (ReadException &e) {
             close();
             file = DISABLED_FD;
-            throw ShortReadException();
+            throw;
         }
 
         if (!readOnly) {
+            // What gets appended may have NRU classes.
+            headerBlock.setVersion(LOG_VERSION);
             headerBlock.setRdwr(1);
             updateInitialBlock();
         }
@@ -528,6 +535,11 @@ const MutationLogEntry* MutationLog::iterator::operator*() {
     return MutationLogEntry::newEntry(entryBuf, LOG_ENTRY_BUF_SIZE);
 }
 
+size_t MutationLog::iterator::block() const {
+    off_t first = log->header().blockSize() * log->header().blockCount();
+    return (offset - first) / log->header().blockSize() - 1;
+}
+
 size_t MutationLog::iterator::bufferBytesRemaining() {
     return log->header().blockSize() - (p - buf);
 }
@@ -577,9 +589,13 @@ void MutationLog::resetCounts(size_t *items) {
 // Reading entries
 // ----------------------------------------------------------------------
 
+//! Delta class of a key that was deleted from the access log.
+static const uint8_t DELETED_NRU_VALUE(0xfe);
+
 bool MutationLogHarvester::load() {
     bool clean(false);
     std::set<uint16_t> shouldClear;
+    memset(itemsSeen, 0, sizeof(itemsSeen));
     for (MutationLog::iterator it(mlog.begin()); it != mlog.end(); ++it) {
         const MutationLogEntry *le = *it;
         ++itemsSeen[le->type()];
@@ -590,12 +606,25 @@ bool MutationLogHarvester::load() {
             // FALLTHROUGH
         case ML_NEW:
             if (vbid_set.find(le->vbucket()) != vbid_set.end()) {
-                loading[le->vbucket()][le->key()] = std::make_pair(le->rowid(), le->type());
+                const std::string key(le->key());
+                mutation_log_event_t ev(le->rowid(), le->type());
+                std::pair<unordered_map<std::string, mutation_log_event_t>::iterator,
+                          bool> inserted =
+                    loading[le->vbucket()].insert(std::make_pair(key, ev));
+                if (inserted.second) {
+                    addMemory(harvestedMemory(key));
+                } else {
+                    inserted.first->second = ev;
+                }
             }
             break;
         case ML_COMMIT2: {
             clean = true;
             for (std::set<uint16_t>::iterator vit(shouldClear.begin()); vit != shouldClear.end(); ++vit) {
+                unordered_map<std::string, uint64_t>::iterator cit;
+                for (cit = committed[*vit].begin(); cit != committed[*vit].end(); ++cit) {
+                    releaseMemory(harvestedMemory(cit->first));
+                }
                 committed[*vit].clear();
             }
             shouldClear.clear();
@@ -609,17 +638,31 @@ bool MutationLogHarvester::load() {
                      ++copyit2) {
 
                     mutation_log_event_t t = copyit2->second;
+                    size_t mem = harvestedMemory(copyit2->first);
 
                     switch (t.second) {
                     case ML_NEW:
-                        committed[vb][copyit2->first] = t.first;
+                        {
+                            std::pair<unordered_map<std::string, uint64_t>::iterator,
+                                      bool> inserted =
+                                committed[vb].insert(std::make_pair(copyit2->first,
+                                                                   t.first));
+                            if (inserted.second) {
+                                addMemory(mem);
+                            } else {
+                                inserted.first->second = t.first;
+                            }
+                        }
                         break;
                     case ML_DEL:
-                        committed[vb].erase(copyit2->first);
+                        if (committed[vb].erase(copyit2->first) > 0) {
+                            releaseMemory(mem);
+                        }
                         break;
                     default:
                         abort();
                     }
+                    releaseMemory(mem);
                 }
             }
         }
@@ -630,7 +673,13 @@ bool MutationLogHarvester::load() {
             break;
         case ML_DEL_ALL:
             if (vbid_set.find(le->vbucket()) != vbid_set.end()) {
-                loading[le->vbucket()].clear();
+                unordered_map<std::string, mutation_log_event_t> &l =
+                    loading[le->vbucket()];
+                unordered_map<std::string, mutation_log_event_t>::iterator lit;
+                for (lit = l.begin(); lit != l.end(); ++lit) {
+                    releaseMemory(harvestedMemory(lit->first));
+                }
+                l.clear();
                 shouldClear.insert(le->vbucket());
             }
             break;
@@ -641,42 +690,212 @@ bool MutationLogHarvester::load() {
     return clean;
 }
 
-void MutationLogHarvester::apply(void *arg, mlCallback mlc) {
-    for (std::set<uint16_t>::const_iterator it = vbid_set.begin();
-         it != vbid_set.end(); ++it) {
-        uint16_t vb(*it);
+bool MutationLogHarvester::scan() {
+    bool clean(false);
+    memset(itemsSeen, 0, sizeof(itemsSeen));
+    streamable = true;
+    nruClasses.clear();
+    blocks.clear();
+    size_t committedBlocks(0);
+    uint16_t committedInLast(0);
+    std::set<uint8_t> classes;
+    for (MutationLog::iterator it(mlog.begin()); it != mlog.end(); ++it) {
+        const MutationLogEntry *le = *it;
+        ++itemsSeen[le->type()];
+        clean = false;
 
-        for (unordered_map<std::string, uint64_t>::iterator it2 = committed[vb].begin();
-             it2 != committed[vb].end(); ++it2) {
-            const std::string key(it2->first);
-            uint64_t rowid(it2->second);
+        if (it.block() >= blocks.size()) {
+            blocks.resize(it.block() + 1);
+        }
+        BlockSummary &block = blocks.back();
+        ++block.entries;
 
-            mlc(arg, vb, key, rowid);
+        switch (le->type()) {
+        case ML_NEW:
+            classes.insert(le->nru());
+            block.minVBucket = std::min(block.minVBucket, le->vbucket());
+            block.maxVBucket = std::max(block.maxVBucket, le->vbucket());
+            block.classes |= classBit(le->nru());
+            break;
+        case ML_COMMIT1:
+            break;
+        case ML_COMMIT2:
+            clean = true;
+            committedBlocks = blocks.size();
+            committedInLast = block.entries;
+            nruClasses.insert(classes.begin(), classes.end());
+            break;
+        case ML_DEL:
+        case ML_DEL_ALL:
+            // Streaming only ever adds keys.
+            if (vbid_set.find(le->vbucket()) != vbid_set.end()) {
+                streamable = false;
+            }
+            break;
+        default:
+            abort();
         }
     }
+
+    // Streaming never goes past the last commit.
+    blocks.resize(committedBlocks);
+    if (!blocks.empty()) {
+        blocks.back().entries = committedInLast;
+    }
+    return clean;
 }
 
-void MutationLogHarvester::apply(void *arg, mlCallbackWithQueue mlc) {
-    assert(engine);
-    std::vector<std::pair<std::string, uint64_t> > fetches;
-    std::set<uint16_t>::const_iterator it = vbid_set.begin();
-    for (; it != vbid_set.end(); ++it) {
-        uint16_t vb(*it);
-        RCPtr<VBucket> vbucket = engine->getEpStore()->getVBucket(vb);
-        if (!vbucket) {
+bool MutationLogHarvester::merge(MutationLog &delta) {
+    bool clean(false);
+    unordered_map<uint16_t, unordered_map<std::string, uint8_t> > pending;
+    for (MutationLog::iterator it(delta.begin()); it != delta.end(); ++it) {
+        const MutationLogEntry *le = *it;
+        ++itemsSeen[le->type()];
+        clean = false;
+
+        switch (le->type()) {
+        case ML_NEW:
+        case ML_DEL:
+            if (vbid_set.find(le->vbucket()) != vbid_set.end()) {
+                const std::string key(le->key());
+                uint8_t nru = le->type() == ML_NEW ? le->nru() : DELETED_NRU_VALUE;
+                std::pair<unordered_map<std::string, uint8_t>::iterator, bool>
+                    inserted = pending[le->vbucket()].insert(std::make_pair(key, nru));
+                if (inserted.second) {
+                    addMemory(harvestedMemory(key));
+                } else {
+                    inserted.first->second = nru;
+                }
+            }
+            break;
+        case ML_COMMIT2: {
+            clean = true;
+            unordered_map<uint16_t, unordered_map<std::string, uint8_t> >::iterator vit;
+            for (vit = pending.begin(); vit != pending.end(); ++vit) {
+                unordered_map<std::string, uint8_t> &d = deltas[vit->first];
+                unordered_map<std::string, uint8_t>::iterator pit;
+                for (pit = vit->second.begin(); pit != vit->second.end(); ++pit) {
+                    std::pair<unordered_map<std::string, uint8_t>::iterator, bool>
+                        inserted = d.insert(*pit);
+                    if (!inserted.second) {
+                        inserted.first->second = pit->second;
+                        releaseMemory(harvestedMemory(pit->first));
+                    }
+                    if (pit->second != DELETED_NRU_VALUE) {
+                        nruClasses.insert(pit->second);
+                    }
+                }
+            }
+            pending.clear();
+        }
+            break;
+        case ML_COMMIT1:
+            break;
+        case ML_DEL_ALL:
+            // Not something a delta of an access log has.
+            if (vbid_set.find(le->vbucket()) != vbid_set.end()) {
+                streamable = false;
+            }
+            break;
+        default:
+            abort();
+        }
+    }
+
+    unordered_map<uint16_t, unordered_map<std::string, uint8_t> >::iterator vit;
+    for (vit = pending.begin(); vit != pending.end(); ++vit) {
+        unordered_map<std::string, uint8_t>::iterator pit;
+        for (pit = vit->second.begin(); pit != vit->second.end(); ++pit) {
+            releaseMemory(harvestedMemory(pit->first));
+        }
+    }
+    return clean;
+}
+
+bool MutationLogHarvester::inDelta(uint16_t vb, const std::string &key) const {
+    unordered_map<uint16_t, unordered_map<std::string, uint8_t> >::const_iterator
+        found = deltas.find(vb);
+    return found != deltas.end() && found->second.find(key) != found->second.end();
+}
+
+bool MutationLogHarvester::streamClass(void *arg, mlStreamCallback mlc,
+                                       uint8_t nru,
+                                       const std::set<uint16_t> &vbids) {
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        const BlockSummary &block = blocks[b];
+        std::set<uint16_t>::const_iterator first =
+            vbids.lower_bound(block.minVBucket);
+        if ((block.classes & classBit(nru)) == 0 || first == vbids.end() ||
+            *first > block.maxVBucket) {
+            continue;
+        }
+
+        blocksStreamed.incr(1);
+        MutationLog::iterator it(mlog.blockBegin(b));
+        for (uint16_t n = block.entries; n > 0; --n) {
+            const MutationLogEntry *le = *it;
+            if (le->type() == ML_NEW && le->nru() == nru &&
+                vbids.find(le->vbucket()) != vbids.end()) {
+                const std::string key(le->key());
+                if (!inDelta(le->vbucket(), key) &&
+                    !mlc(arg, le->vbucket(), key)) {
+                    return false;
+                }
+            }
+            if (n > 1) {
+                ++it;
+            }
+        }
+    }
+
+    std::set<uint16_t>::const_iterator vit;
+    for (vit = vbids.begin(); vit != vbids.end(); ++vit) {
+        unordered_map<uint16_t, unordered_map<std::string, uint8_t> >::const_iterator
+            found = deltas.find(*vit);
+        if (found == deltas.end()) {
             continue;
         }
-        unordered_map<std::string, uint64_t>::iterator it2 = committed[vb].begin();
-        for (; it2 != committed[vb].end(); ++it2) {
-            // cannot use rowid from access log, so must read from hashtable
-            std::string key = it2->first;
-            StoredValue *v = NULL;
-            if ((v = vbucket->ht.find(key, false))) {
-                fetches.push_back(std::make_pair(it2->first, v->getBySeqno()));
+        unordered_map<std::string, uint8_t>::const_iterator dit;
+        for (dit = found->second.begin(); dit != found->second.end(); ++dit) {
+            if (dit->second == nru && !mlc(arg, *vit, dit->first)) {
+                return false;
             }
         }
-        mlc(vb, fetches, arg);
-        fetches.clear();
+    }
+    return true;
+}
+
+void MutationLogHarvester::apply(void *arg, mlCallback mlc) {
+    for (std::set<uint16_t>::const_iterator it = vbid_set.begin();
+         it != vbid_set.end(); ++it) {
+        applyVBucket(arg, mlc, *it);
+    }
+}
+
+void MutationLogHarvester::apply(void *arg, mlCallback mlc,
+                                 const std::vector<uint16_t> &vbids) {
+    std::vector<uint16_t>::const_iterator it;
+    for (it = vbids.begin(); it != vbids.end(); ++it) {
+        applyVBucket(arg, mlc, *it);
+    }
+}
+
+void MutationLogHarvester::applyVBucket(void *arg, mlCallback mlc,
+                                        uint16_t vb) {
+    // Only look up (never insert) so that several threads can apply
+    // different vbuckets concurrently.
+    unordered_map<uint16_t, unordered_map<std::string, uint64_t> >::iterator
+        found = committed.find(vb);
+    if (found == committed.end()) {
+        return;
+    }
+
+    unordered_map<std::string, uint64_t>::iterator it2;
+    for (it2 = found->second.begin(); it2 != found->second.end(); ++it2) {
+        const std::string key(it2->first);
+        uint64_t rowid(it2->second);
+
+        mlc(arg, vb, key, rowid);
     }
 }
 
@@ -721,5 +940,8 @@ std::ostream& operator <<(std::ostream &out, const MutationLogEntry &mle) {
         << std::dec
         << ", type=" << logType(mle.type())
         << ", key=``" << mle.key() << "''";
+    if (mle.nru() != NO_NRU_VALUE) {
+        out << ", nru=" << static_cast<uint16_t>(mle.nru());
+    }
     return out;
 }
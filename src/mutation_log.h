@@ -28,6 +28,7 @@
 #include <functional>
 #include <iterator>
 #include <limits>
+#include <map>
 #include <numeric>
 #include <set>
 #include <string>
@@ -47,8 +48,12 @@ const int MUTATION_LOG_COMPACTOR_FREQ(3600);
 
 const size_t MIN_LOG_HEADER_SIZE(4096);
 const uint8_t MUTATION_LOG_MAGIC(0x45);
+const uint8_t MUTATION_LOG_NRU_MAGIC(0x46);
+const uint8_t NO_NRU_VALUE(0xff);
 const size_t HEADER_RESERVED(4);
-const uint32_t LOG_VERSION(1);
+//! Version 2 logs may have entries with an NRU class
+//! (MUTATION_LOG_NRU_MAGIC); version 1 logs are read alike.
+const uint32_t LOG_VERSION(2);
 const size_t LOG_ENTRY_BUF_SIZE(512);
 const int DISABLED_FD(-3);
 
@@ -108,6 +113,10 @@ public:
         _rdwr = htonl(nval);
     }
 
+    void setVersion(uint32_t nval) {
+        _version = htonl(nval);
+    }
+
 private:
 
     uint32_t _version;
@@ -194,11 +203,13 @@ public:
      * @param t the type of log entry
      * @param vb the vbucket
      * @param k the key
+     * @param nru the NRU class of the key, NO_NRU_VALUE if not known
      */
     static MutationLogEntry* newEntry(uint8_t *buf,
                                       uint64_t r, mutation_log_type_t t,
-                                      uint16_t vb, const std::string &k) {
-        return new (buf) MutationLogEntry(r, t, vb, k);
+                                      uint16_t vb, const std::string &k,
+                                      uint8_t nru = NO_NRU_VALUE) {
+        return new (buf) MutationLogEntry(r, t, vb, k, nru);
     }
 
     /**
@@ -210,7 +221,8 @@ public:
     static MutationLogEntry* newEntry(uint8_t *buf, size_t buflen) {
         assert(buflen >= len(0));
         MutationLogEntry *me = reinterpret_cast<MutationLogEntry*>(buf);
-        assert(me->magic == MUTATION_LOG_MAGIC);
+        assert(me->magic == MUTATION_LOG_MAGIC ||
+               me->magic == MUTATION_LOG_NRU_MAGIC);
         assert(buflen >= me->len());
         return me;
     }
@@ -221,12 +233,12 @@ public:
 
     /**
      * The size of a MutationLogEntry, in bytes, containing a key of
-     * the specified length.
+     * the specified length (and an NRU class after it if withNRU).
      */
-    static size_t len(size_t klen) {
+    static size_t len(size_t klen, bool withNRU = false) {
         // 13 == the exact empty record size as will be packed into
         // the layout
-        return 13 + klen;
+        return 13 + klen + (withNRU ? 1 : 0);
     }
 
     /**
@@ -234,7 +246,7 @@ public:
      * MutationLogEntry.
      */
     size_t len() const {
-        return len(keylen);
+        return len(keylen, magic == MUTATION_LOG_NRU_MAGIC);
     }
 
     /**
@@ -263,18 +275,31 @@ public:
         return _type;
     }
 
+    /**
+     * The NRU class the key had when it was logged (lower is hotter),
+     * or NO_NRU_VALUE if the entry doesn't carry one.
+     */
+    uint8_t nru() const {
+        return magic == MUTATION_LOG_NRU_MAGIC ?
+            static_cast<uint8_t>(_key[keylen]) : NO_NRU_VALUE;
+    }
+
 private:
 
     friend std::ostream& operator<< (std::ostream& out,
                                      const MutationLogEntry &e);
 
     MutationLogEntry(uint64_t r, mutation_log_type_t t,
-                     uint16_t vb, const std::string &k)
-        : _rowid(htonll(r)), _vbucket(htons(vb)), magic(MUTATION_LOG_MAGIC),
+                     uint16_t vb, const std::string &k, uint8_t nru)
+        : _rowid(htonll(r)), _vbucket(htons(vb)),
+          magic(nru == NO_NRU_VALUE ? MUTATION_LOG_MAGIC : MUTATION_LOG_NRU_MAGIC),
           _type(static_cast<uint8_t>(t)),
           keylen(static_cast<uint8_t>(k.length())) {
         assert(k.length() <= std::numeric_limits<uint8_t>::max());
         memcpy(_key, k.data(), k.length());
+        if (nru != NO_NRU_VALUE) {
+            _key[keylen] = static_cast<char>(nru);
+        }
     }
 
     uint64_t _rowid;
@@ -301,7 +326,8 @@ public:
 
     ~MutationLog();
 
-    void newItem(uint16_t vbucket, const std::string &key, uint64_t rowid);
+    void newItem(uint16_t vbucket, const std::string &key, uint64_t rowid,
+                 uint8_t nru = NO_NRU_VALUE);
 
     void delItem(uint16_t vbucket, const std::string &key);
 
@@ -441,6 +467,12 @@ public:
 
         const MutationLogEntry* operator*();
 
+        /**
+         * Get the number of the block of entries the iterator is at,
+         * counting from 0.
+         */
+        size_t block() const;
+
     private:
 
         friend class MutationLog;
@@ -469,6 +501,17 @@ public:
         return it;
     }
 
+    /**
+     * An iterator pointing to the first entry of the given block of
+     * entries, as numbered by iterator::block().
+     */
+    iterator blockBegin(size_t block) {
+        iterator it(iterator(this));
+        it.offset += static_cast<off_t>(block) * header().blockSize();
+        it.nextBlock();
+        return it;
+    }
+
     /**
      * An iterator pointing at the end of the log file.
      */
@@ -532,6 +575,12 @@ typedef void (*mlCallbackWithQueue)(uint16_t,
                     std::vector<std::pair<std::string, uint64_t> > &,
                     void *arg);
 
+/**
+ * MutationLogHarvester::streamClass callback type: gets a key of a
+ * vbucket, and returns false to stop.
+ */
+typedef bool (*mlStreamCallback)(void*, uint16_t, const std::string &);
+
 /**
  * Type for mutation log leftovers.
  */
@@ -543,6 +592,7 @@ struct mutation_log_uncommitted_t {
 };
 
 class EventuallyPersistentEngine;
+class VBucket;
 
 /**
  * Read log entries back from the log to reconstruct the state.
@@ -550,7 +600,7 @@ class EventuallyPersistentEngine;
 class MutationLogHarvester {
 public:
     MutationLogHarvester(MutationLog &ml, EventuallyPersistentEngine *e = NULL) :
-        mlog(ml), engine(e)
+        mlog(ml), engine(e), streamable(false)
     {
         memset(itemsSeen, 0, sizeof(itemsSeen));
     }
@@ -569,12 +619,92 @@ public:
      */
     bool load();
 
+    /**
+     * Read through the log to check it and count its entries without
+     * keeping any of them, so that it may be streamed instead of loaded.
+     *
+     * @return true if the file was clean and can likely be trusted.
+     */
+    bool scan();
+
+    /**
+     * Read the committed entries of a log of changes to the scanned
+     * one.  When streaming, a key the delta log has is loaded with the
+     * class it got last there (or not at all if it was deleted), no
+     * matter what the scanned log says about it.
+     *
+     * @return true if the delta log was clean and can likely be trusted.
+     */
+    bool merge(MutationLog &delta);
+
+    /**
+     * True if the scanned log only adds keys to the vbuckets that were
+     * set, so that its entries can be streamed straight off the log.
+     */
+    bool canStream() const {
+        return streamable;
+    }
+
+    /**
+     * Read the committed entries of the given vbuckets off the log and
+     * pass the keys that are not resident yet through the given
+     * function in batches of up to batchSize keys of a vbucket.
+     * Keys are passed hottest NRU class first, through streamClass().
+     * Disjoint sets of vbuckets may be streamed from different threads
+     * at the same time.
+     */
+    void stream(void *arg, mlCallbackWithQueue mlc,
+                const std::vector<uint16_t> &vbids, size_t batchSize);
+
+    /**
+     * Read the committed entries of the given vbuckets off the log and
+     * pass the keys that are not resident yet through the given
+     * function one at a time, hottest NRU class first.
+     */
+    void stream(void *arg, mlCallback mlc, const std::vector<uint16_t> &vbids);
+
+    /**
+     * Pass the committed keys of the given vbuckets that have the given
+     * NRU class through the given function: those the scanned log has
+     * and the merged delta doesn't, then those the delta gives it.
+     * Only the blocks of the log that scan() found such keys in are
+     * read, so that each of the shards streaming their own vbuckets
+     * reads little more than its own part of the log per class.
+     *
+     * @return false if the function asked to stop
+     */
+    bool streamClass(void *arg, mlStreamCallback mlc, uint8_t nru,
+                     const std::set<uint16_t> &vbids);
+
+    /**
+     * Get the number of blocks of the log read by streamClass().
+     */
+    size_t getBlocksStreamed() const {
+        return blocksStreamed.get();
+    }
+
+    /**
+     * Get the most memory the entries held by this harvester ever took.
+     */
+    size_t getPeakMemory() const {
+        return peakMem.get();
+    }
+
     /**
      * Apply the processed log entries through the given function.
      */
     void apply(void *arg, mlCallback mlc);
     void apply(void *arg, mlCallbackWithQueue mlc);
 
+    /**
+     * Apply the processed log entries of the given vbuckets through
+     * the given function.  Once loaded, disjoint sets of vbuckets may
+     * be applied from different threads at the same time.
+     */
+    void apply(void *arg, mlCallback mlc, const std::vector<uint16_t> &vbids);
+    void apply(void *arg, mlCallbackWithQueue mlc,
+               const std::vector<uint16_t> &vbids);
+
     /**
      * Get the total number of entries found in the log.
      */
@@ -594,9 +724,86 @@ public:
 
 private:
 
+    void applyVBucket(void *arg, mlCallback mlc, uint16_t vb);
+    void applyVBucket(void *arg, mlCallbackWithQueue mlc, uint16_t vb);
+
+    /**
+     * Find the given key of a vbucket that needs its value loaded.
+     *
+     * @return true (and the key's seqno) if it isn't resident yet
+     */
+    bool needsLoading(RCPtr<VBucket> &vb, const std::string &key,
+                      uint64_t &seqno);
+
+    void getVBuckets(const std::vector<uint16_t> &vbids,
+                     std::map<uint16_t, RCPtr<VBucket> > &vbuckets);
+
+    /**
+     * True if the merged delta log has the given key of a vbucket.
+     */
+    bool inDelta(uint16_t vb, const std::string &key) const;
+
+    /**
+     * Add a key of a vbucket to the vbucket's batch if it needs loading,
+     * and pass the batch through the given function once it's full.
+     */
+    void queueFetch(void *arg, mlCallbackWithQueue mlc, size_t batchSize,
+                    std::map<uint16_t, std::vector<std::pair<std::string, uint64_t> > > &fetches,
+                    RCPtr<VBucket> &vb, const std::string &key);
+
+    /**
+     * Approximate memory taken by a key held in one of the maps.
+     */
+    static size_t harvestedMemory(const std::string &key) {
+        return sizeof(std::string) + key.size() +
+            sizeof(mutation_log_event_t) + 2 * sizeof(void*);
+    }
+
+    static bool streamFetch(void *arg, uint16_t vb, const std::string &key);
+    static bool streamOne(void *arg, uint16_t vb, const std::string &key);
+
+    /**
+     * What the committed entries of a block of the scanned log have.
+     */
+    struct BlockSummary {
+        BlockSummary() : minVBucket(std::numeric_limits<uint16_t>::max()),
+                         maxVBucket(0), classes(0), entries(0) {}
+
+        //! Lowest and highest vbucket of its new keys.
+        uint16_t minVBucket;
+        uint16_t maxVBucket;
+        //! Bit of each NRU class of its new keys (see classBit()).
+        uint8_t classes;
+        //! Number of its entries up to the last commit.
+        uint16_t entries;
+    };
+
+    static uint8_t classBit(uint8_t nru) {
+        // Classes past the known ones share the last bit.
+        return static_cast<uint8_t>(1 << std::min(nru, static_cast<uint8_t>(7)));
+    }
+
+    void addMemory(size_t bytes) {
+        peakMem.setIfBigger(memUsed.incr(bytes) + bytes);
+    }
+
+    void releaseMemory(size_t bytes) {
+        memUsed.decr(bytes);
+    }
+
     MutationLog &mlog;
     EventuallyPersistentEngine *engine;
     std::set<uint16_t> vbid_set;
+    bool streamable;
+    //! NRU classes of the committed keys, NO_NRU_VALUE for unknown.
+    std::set<uint8_t> nruClasses;
+    //! The blocks of the scanned log up to the last commit.
+    std::vector<BlockSummary> blocks;
+    Atomic<size_t> blocksStreamed;
+    //! NRU class of each key of the merged delta log, by vbucket.
+    unordered_map<uint16_t, unordered_map<std::string, uint8_t> > deltas;
+    Atomic<size_t> memUsed;
+    Atomic<size_t> peakMem;
 
     unordered_map<uint16_t, unordered_map<std::string, uint64_t> > committed;
     unordered_map<uint16_t, unordered_map<std::string, mutation_log_event_t> > loading;
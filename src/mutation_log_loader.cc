@@ -0,0 +1,220 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2013 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+// The parts of the MutationLogHarvester that look at the engine's
+// vbuckets, kept out of mutation_log.cc so that the log itself builds
+// without the engine.
+
+#include "config.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ep_engine.h"
+#include "mutation_log.h"
+
+bool MutationLogHarvester::needsLoading(RCPtr<VBucket> &vb,
+                                        const std::string &key,
+                                        uint64_t &seqno) {
+    int bucket_num(0);
+    LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
+    StoredValue *v = vb->ht.unlocked_find(key, bucket_num, false, false);
+    // Keys that weren't dumped, or got their value from an earlier
+    // entry, are skipped.
+    if (v == NULL || v->isResident()) {
+        return false;
+    }
+    seqno = v->getBySeqno();
+    return true;
+}
+
+void MutationLogHarvester::getVBuckets(const std::vector<uint16_t> &vbids,
+                                       std::map<uint16_t, RCPtr<VBucket> > &vbuckets) {
+    std::vector<uint16_t>::const_iterator vit;
+    for (vit = vbids.begin(); vit != vbids.end(); ++vit) {
+        RCPtr<VBucket> vb = engine->getEpStore()->getVBucket(*vit);
+        if (vb) {
+            vbuckets[*vit] = vb;
+        }
+    }
+}
+
+void MutationLogHarvester::queueFetch(void *arg, mlCallbackWithQueue mlc,
+                                      size_t batchSize,
+                                      std::map<uint16_t, std::vector<std::pair<std::string, uint64_t> > > &fetches,
+                                      RCPtr<VBucket> &vb, const std::string &key) {
+    uint64_t seqno(0);
+    if (!needsLoading(vb, key, seqno)) {
+        return;
+    }
+
+    std::vector<std::pair<std::string, uint64_t> > &batch = fetches[vb->getId()];
+    batch.push_back(std::make_pair(key, seqno));
+    addMemory(harvestedMemory(key));
+    if (batch.size() >= batchSize) {
+        mlc(vb->getId(), batch, arg);
+        std::vector<std::pair<std::string, uint64_t> >::iterator fit;
+        for (fit = batch.begin(); fit != batch.end(); ++fit) {
+            releaseMemory(harvestedMemory(fit->first));
+        }
+        batch.clear();
+    }
+}
+
+/**
+ * What a stream of the log hands the keys of a class to.
+ */
+struct StreamContext {
+    MutationLogHarvester *harvester;
+    EPStats *stats;
+    std::map<uint16_t, RCPtr<VBucket> > vbuckets;
+    void *arg;
+    mlCallback mlc;
+    mlCallbackWithQueue qmlc;
+    size_t batchSize;
+    std::map<uint16_t, std::vector<std::pair<std::string, uint64_t> > > fetches;
+};
+
+bool MutationLogHarvester::streamFetch(void *arg, uint16_t vb,
+                                       const std::string &key) {
+    StreamContext *ctx = static_cast<StreamContext*>(arg);
+    ctx->harvester->queueFetch(ctx->arg, ctx->qmlc, ctx->batchSize,
+                               ctx->fetches, ctx->vbuckets[vb], key);
+    return !ctx->stats->warmupComplete.get();
+}
+
+bool MutationLogHarvester::streamOne(void *arg, uint16_t vb,
+                                     const std::string &key) {
+    StreamContext *ctx = static_cast<StreamContext*>(arg);
+    uint64_t seqno(0);
+    if (ctx->harvester->needsLoading(ctx->vbuckets[vb], key, seqno)) {
+        ctx->mlc(ctx->arg, vb, key, seqno);
+    }
+    return !ctx->stats->warmupComplete.get();
+}
+
+void MutationLogHarvester::stream(void *arg, mlCallbackWithQueue mlc,
+                                  const std::vector<uint16_t> &vbids,
+                                  size_t batchSize) {
+    assert(engine && streamable);
+    typedef std::vector<std::pair<std::string, uint64_t> > fetches_t;
+    StreamContext ctx;
+    ctx.harvester = this;
+    ctx.stats = &engine->getEpStats();
+    ctx.arg = arg;
+    ctx.mlc = NULL;
+    ctx.qmlc = mlc;
+    ctx.batchSize = batchSize;
+    getVBuckets(vbids, ctx.vbuckets);
+
+    std::set<uint16_t> found;
+    std::map<uint16_t, RCPtr<VBucket> >::iterator vit;
+    for (vit = ctx.vbuckets.begin(); vit != ctx.vbuckets.end(); ++vit) {
+        found.insert(vit->first);
+    }
+
+    std::set<uint8_t>::const_iterator cit;
+    for (cit = nruClasses.begin();
+         !found.empty() && cit != nruClasses.end() &&
+             !ctx.stats->warmupComplete.get();
+         ++cit) {
+        streamClass(&ctx, streamFetch, *cit, found);
+
+        // Whatever is left of a class goes before the next one.
+        std::map<uint16_t, fetches_t>::iterator bit;
+        for (bit = ctx.fetches.begin(); bit != ctx.fetches.end(); ++bit) {
+            if (!bit->second.empty()) {
+                mlc(bit->first, bit->second, arg);
+            }
+            fetches_t::iterator fit;
+            for (fit = bit->second.begin(); fit != bit->second.end(); ++fit) {
+                releaseMemory(harvestedMemory(fit->first));
+            }
+        }
+        ctx.fetches.clear();
+    }
+}
+
+void MutationLogHarvester::stream(void *arg, mlCallback mlc,
+                                  const std::vector<uint16_t> &vbids) {
+    assert(engine && streamable);
+    StreamContext ctx;
+    ctx.harvester = this;
+    ctx.stats = &engine->getEpStats();
+    ctx.arg = arg;
+    ctx.mlc = mlc;
+    ctx.qmlc = NULL;
+    ctx.batchSize = 0;
+    getVBuckets(vbids, ctx.vbuckets);
+
+    std::set<uint16_t> found;
+    std::map<uint16_t, RCPtr<VBucket> >::iterator vit;
+    for (vit = ctx.vbuckets.begin(); vit != ctx.vbuckets.end(); ++vit) {
+        found.insert(vit->first);
+    }
+
+    std::set<uint8_t>::const_iterator cit;
+    for (cit = nruClasses.begin();
+         !found.empty() && cit != nruClasses.end() &&
+             !ctx.stats->warmupComplete.get();
+         ++cit) {
+        streamClass(&ctx, streamOne, *cit, found);
+    }
+}
+
+void MutationLogHarvester::apply(void *arg, mlCallbackWithQueue mlc) {
+    assert(engine);
+    std::set<uint16_t>::const_iterator it = vbid_set.begin();
+    for (; it != vbid_set.end(); ++it) {
+        applyVBucket(arg, mlc, *it);
+    }
+}
+
+void MutationLogHarvester::apply(void *arg, mlCallbackWithQueue mlc,
+                                 const std::vector<uint16_t> &vbids) {
+    assert(engine);
+    std::vector<uint16_t>::const_iterator it;
+    for (it = vbids.begin(); it != vbids.end(); ++it) {
+        applyVBucket(arg, mlc, *it);
+    }
+}
+
+void MutationLogHarvester::applyVBucket(void *arg, mlCallbackWithQueue mlc,
+                                        uint16_t vb) {
+    RCPtr<VBucket> vbucket = engine->getEpStore()->getVBucket(vb);
+    if (!vbucket) {
+        return;
+    }
+    unordered_map<uint16_t, unordered_map<std::string, uint64_t> >::iterator
+        found = committed.find(vb);
+    std::vector<std::pair<std::string, uint64_t> > fetches;
+    if (found != committed.end()) {
+        unordered_map<std::string, uint64_t>::iterator it2;
+        for (it2 = found->second.begin(); it2 != found->second.end(); ++it2) {
+            // cannot use rowid from access log, so must read from hashtable
+            std::string key = it2->first;
+            StoredValue *v = NULL;
+            if ((v = vbucket->ht.find(key, false))) {
+                fetches.push_back(std::make_pair(it2->first, v->getBySeqno()));
+            }
+        }
+    }
+    mlc(vb, fetches, arg);
+}
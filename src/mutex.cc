@@ -22,7 +22,8 @@
 #include "common.h"
 #include "mutex.h"
 
-Mutex::Mutex() : held(false)
+Mutex::Mutex() : held(false), sequenced(false), tracked(false),
+                 generation(0), acquisitions(0), contentions(0)
 {
     pthread_mutexattr_t *attr = NULL;
     int e=0;
@@ -77,17 +78,35 @@ Mutex::~Mutex() {
 
 void Mutex::acquire() {
     int e;
-    if ((e = pthread_mutex_lock(&mutex)) != 0) {
-        std::cerr << "MUTEX ERROR: Failed to acquire lock: ";
-        std::cerr << std::strerror(e) << std::endl;
-        std::cerr.flush();
-        abort();
+    bool waited = false;
+    if (!tracked || pthread_mutex_trylock(&mutex) != 0) {
+        waited = tracked;
+        if ((e = pthread_mutex_lock(&mutex)) != 0) {
+            std::cerr << "MUTEX ERROR: Failed to acquire lock: ";
+            std::cerr << std::strerror(e) << std::endl;
+            std::cerr.flush();
+            abort();
+        }
     }
     setHolder(true);
+    if (tracked) {
+        ++acquisitions;
+        if (waited) {
+            ++contentions;
+        }
+    }
+    if (sequenced) {
+        ++generation;
+        ep_sync_write_barrier();
+    }
 }
 
 void Mutex::release() {
     assert(held && pthread_equal(holder, pthread_self()));
+    if (sequenced) {
+        ep_sync_write_barrier();
+        ++generation;
+    }
     setHolder(false);
     int e;
     if ((e = pthread_mutex_unlock(&mutex)) != 0) {
@@ -21,6 +21,7 @@
 #include "config.h"
 
 #include <pthread.h>
+#include <stdint.h>
 
 #include <cassert>
 #include <cerrno>
@@ -29,6 +30,11 @@
 #include <sstream>
 #include <stdexcept>
 
+#if defined(HAVE_GCC_ATOMICS)
+#include "atomic/gcc_atomics.h"
+#elif defined(HAVE_ATOMIC_H)
+#include "atomic/libatomic.h"
+#endif
 #include "common.h"
 
 /**
@@ -49,6 +55,47 @@ public:
         return held && pthread_equal(holder, pthread_self());
     }
 
+    /**
+     * Make this a sequence lock: every acquire() and release() bumps
+     * its generation, so a reader looking at the data it guards
+     * without taking it can tell whether a holder got in the way.
+     */
+    void setSequenced(bool s) {
+        sequenced = s;
+    }
+
+    /**
+     * Get the generation of a sequenced lock; it is odd while the
+     * lock is held.  Readers order their own loads around this with
+     * ep_sync_read_barrier().
+     */
+    uint32_t getGeneration() const {
+        return generation;
+    }
+
+    /**
+     * Count how often this lock is taken, and how often that meant
+     * waiting for another holder.
+     */
+    void setTracked(bool t) {
+        tracked = t;
+    }
+
+    /**
+     * Get the number of times this lock was taken while tracked.
+     */
+    size_t getAcquisitions() const {
+        return acquisitions;
+    }
+
+    /**
+     * Get the number of times taking this lock had to wait while
+     * tracked.
+     */
+    size_t getContentions() const {
+        return contentions;
+    }
+
 protected:
 
     // The holders of locks twiddle these flags.
@@ -66,6 +113,12 @@ protected:
     pthread_mutex_t mutex;
     pthread_t holder;
     bool held;
+    bool sequenced;
+    bool tracked;
+    volatile uint32_t generation;
+    // Only ever changed by the holder.
+    size_t acquisitions;
+    size_t contentions;
 
 private:
     DISALLOW_COPY_AND_ASSIGN(Mutex);
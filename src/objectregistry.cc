@@ -22,6 +22,8 @@
 
 static ThreadLocal<EventuallyPersistentEngine*> *th;
 static ThreadLocal<Atomic<size_t>*> *initial_track;
+//! Blob slabs for threads not running on behalf of any engine.
+static SlabAllocator *default_blob_allocator;
 
 /**
  * Object registry link hook for getting the registry thread local
@@ -33,6 +35,8 @@ public:
       if (th == NULL) {
          th = new ThreadLocal<EventuallyPersistentEngine*>();
          initial_track = new ThreadLocal<Atomic<size_t>*>();
+         default_blob_allocator = new SlabAllocator(Blob::slabSize,
+                                                    Blob::maxChunkSize);
       }
    }
 } install;
@@ -50,6 +54,15 @@ static bool verifyEngine(EventuallyPersistentEngine *engine)
 }
 
 
+void *ObjectRegistry::allocateBlob(size_t size)
+{
+   EventuallyPersistentEngine *engine = th->get();
+   if (engine) {
+       return engine->getBlobAllocator().allocate(size);
+   }
+   return default_blob_allocator->allocate(size);
+}
+
 void ObjectRegistry::onCreateBlob(Blob *blob)
 {
    EventuallyPersistentEngine *engine = th->get();
@@ -25,6 +25,7 @@ class QueuedItem;
 
 class ObjectRegistry {
 public:
+    static void *allocateBlob(size_t size);
     static void onCreateBlob(Blob *blob);
     static void onDeleteBlob(Blob *blob);
 
@@ -32,6 +32,7 @@ const Priority Priority::TapBgFetcherPriority("tap_bg_fetcher_priority", 1);
 const Priority Priority::VBucketDeletionPriority("vbucket_deletion_priority", 1);
 const Priority Priority::VBucketPersistHighPriority("vbucket_persist_high_priority", 2);
 const Priority Priority::FlushAllPriority("flush_all_priority", 3);
+const Priority Priority::FlusherCommitPriority("flusher_commit_priority", 4);
 const Priority Priority::FlusherPriority("flusher_priority", 5);
 const Priority Priority::VBucketPersistLowPriority("vbucket_persist_low_priority", 9);
 const Priority Priority::StatSnapPriority("statsnap_priority", 9);
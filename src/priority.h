@@ -40,6 +40,7 @@ public:
     static const Priority VBucketPersistHighPriority;
     static const Priority VBucketDeletionPriority;
     static const Priority FlusherPriority;
+    static const Priority FlusherCommitPriority;
     static const Priority FlushAllPriority;
     static const Priority VBucketPersistLowPriority;
     static const Priority StatSnapPriority;
@@ -51,7 +51,7 @@ class QueuedItem : public RCValue {
 public:
     QueuedItem(const std::string &k, const uint16_t vb,
                enum queue_operation o, const uint64_t revSeq = 1)
-        : key(k), revSeqno(revSeq), queued(ep_current_time()),
+        : key(k), revSeqno(revSeq), mutationId(0), queued(ep_current_time()),
           op(static_cast<uint16_t>(o)), vbucket(vb)
     {
         ObjectRegistry::onCreateQueuedItem(this);
@@ -70,6 +70,16 @@ public:
 
     uint64_t getRevSeqno() const { return revSeqno; }
 
+    /**
+     * Get the id the checkpoint manager gave this item when it was
+     * queued (0 for items that didn't come through a checkpoint).
+     */
+    uint64_t getMutationId() const { return mutationId; }
+
+    void setMutationId(uint64_t mid) {
+        mutationId = mid;
+    }
+
     void setQueuedTime(uint32_t queued_time) {
         queued = queued_time;
     }
@@ -90,6 +100,7 @@ public:
 private:
     std::string key;
     uint64_t revSeqno;
+    uint64_t mutationId;
     uint32_t queued;
     uint16_t op;
     uint16_t vbucket;
@@ -0,0 +1,111 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2013 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <cassert>
+
+#include "atomic.h"
+#include "read_epoch.h"
+
+/**
+ * The state of one reader thread.
+ */
+struct ReaderSlot {
+    //! Epoch the reader entered its read section in (0 if outside one).
+    volatile uint64_t epoch;
+    //! Non-zero while a thread owns this slot.
+    int               owned;
+    //! Number of read sections the owner is in; only it looks at this.
+    int               depth;
+    char              pad[CACHE_LINE_SIZE - sizeof(uint64_t) - 2 * sizeof(int)];
+};
+
+static ReaderSlot slots[ReadEpoch::maxReaders];
+//! One past the highest slot ever handed out.
+static Atomic<size_t> slotsInUse;
+static Atomic<uint64_t> globalEpoch(1);
+
+extern "C" {
+    static void releaseSlot(void *arg) {
+        ReaderSlot *slot = static_cast<ReaderSlot*>(arg);
+        slot->epoch = 0;
+        slot->depth = 0;
+        ep_sync_synchronize();
+        slot->owned = 0;
+    }
+}
+
+static ThreadLocalPtr<ReaderSlot> threadSlot(releaseSlot);
+
+static ReaderSlot *claimSlot() {
+    for (size_t i = 0; i < ReadEpoch::maxReaders; ++i) {
+        if (slots[i].owned == 0 &&
+            ep_sync_bool_compare_and_swap(&slots[i].owned, 0, 1)) {
+            slotsInUse.setIfBigger(i + 1);
+            threadSlot = &slots[i];
+            return &slots[i];
+        }
+    }
+    return NULL;
+}
+
+bool ReadEpoch::enter() {
+    ReaderSlot *slot = threadSlot.get();
+    if (slot == NULL && (slot = claimSlot()) == NULL) {
+        return false;
+    }
+    if (slot->depth++ > 0) {
+        // Already in the epoch of the outermost section.
+        return true;
+    }
+    // This has to be a full barrier: writers that miss us in oldest()
+    // must have unlinked their objects before we look.  A locked
+    // instruction is a lot cheaper than a store and a fence.
+    bool was = ep_sync_bool_compare_and_swap(&slot->epoch, 0,
+                                             globalEpoch.get());
+    assert(was);
+    (void)was;
+    return true;
+}
+
+void ReadEpoch::exit() {
+    ReaderSlot *slot = threadSlot.get();
+    assert(slot != NULL && slot->epoch != 0);
+    if (--slot->depth > 0) {
+        return;
+    }
+    // Everything we read has to be done before we look gone.
+    ep_sync_read_barrier();
+    slot->epoch = 0;
+}
+
+uint64_t ReadEpoch::current() {
+    return globalEpoch.get();
+}
+
+uint64_t ReadEpoch::oldest() {
+    uint64_t rv = globalEpoch.incr(1) + 1;
+    size_t n = slotsInUse.get();
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t e = slots[i].epoch;
+        if (e != 0 && e < rv) {
+            rv = e;
+        }
+    }
+    return rv;
+}
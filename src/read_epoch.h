@@ -0,0 +1,91 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2013 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef SRC_READ_EPOCH_H_
+#define SRC_READ_EPOCH_H_ 1
+
+#include "config.h"
+
+#include <stdint.h>
+
+#include "common.h"
+
+/**
+ * Epoch based reclamation for readers that don't take locks.
+ *
+ * A thread brackets its unlocked reads with enter() and exit()
+ * (usually through a ReadSection); sections may nest.  Anything a writer unlinks while
+ * such readers may still be looking at it is tagged with current()
+ * and kept around until oldest() has moved past that epoch.
+ */
+class ReadEpoch {
+public:
+
+    //! Most threads that can be inside a read section at once.
+    static const size_t maxReaders = 128;
+
+    /**
+     * Enter a read section on behalf of the calling thread.
+     *
+     * @return false if every reader slot is taken, in which case the
+     *         caller must not read anything without its lock
+     */
+    static bool enter();
+
+    /**
+     * Leave the read section the calling thread is in.
+     */
+    static void exit();
+
+    /**
+     * Get the epoch to tag an object that was just unlinked with.
+     */
+    static uint64_t current();
+
+    /**
+     * Start a new epoch and get the oldest one a reader is still in.
+     *
+     * Objects tagged with an epoch lower than this may be released.
+     */
+    static uint64_t oldest();
+};
+
+/**
+ * Holds the calling thread in a read section for its lifetime.
+ */
+class ReadSection {
+public:
+    ReadSection() : entered(ReadEpoch::enter()) {}
+
+    ~ReadSection() {
+        if (entered) {
+            ReadEpoch::exit();
+        }
+    }
+
+    /**
+     * True if the read section could be entered.
+     */
+    bool isEntered() const { return entered; }
+
+private:
+    bool entered;
+
+    DISALLOW_COPY_AND_ASSIGN(ReadSection);
+};
+
+#endif  // SRC_READ_EPOCH_H_
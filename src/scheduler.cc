@@ -28,6 +28,52 @@
 
 Atomic<size_t> GlobalTask::task_id_counter = 1;
 
+/**
+ * It simulates timegm to convert the given GMT time to number of seconds
+ * since epoch but it uses C standard time functions.
+ */
+static time_t do_timegm(struct tm *tmv)
+{
+  time_t epoch = 0;
+  time_t offset = mktime(gmtime(&epoch));
+  time_t gmt = mktime(tmv);
+  return difftime(gmt, offset);
+}
+
+void GlobalTask::snooze(const double secs, bool first) {
+    LockHolder lh(mutex);
+    gettimeofday(&waketime, NULL);
+    // set scheduled task time for new task only
+    if (first && (starttime == 0 || starttime <= 23) && secs >= 3600) {
+        struct tm tim;
+        struct timeval tmval = waketime;
+        time_t seconds = tmval.tv_sec;
+        tim = *(gmtime(&seconds));
+        // change tm structure to the given start hour in GMT
+        tim.tm_min = 0;
+        tim.tm_sec = 0;
+        if (tim.tm_hour >= (time_t)starttime) {
+            tim.tm_hour = (time_t)starttime;
+            tmval.tv_sec = do_timegm(&tim);
+            // advance time until later than current time
+            while (tmval.tv_sec < waketime.tv_sec) {
+                advance_tv(tmval, secs);
+            }
+        } else if (tim.tm_hour < (time_t)starttime) {
+            tim.tm_hour = starttime;
+            tmval.tv_sec = do_timegm(&tim);
+            // backtrack time until last time larger than current time
+            time_t tsec;
+            while ((tsec = tmval.tv_sec - (int)secs) > waketime.tv_sec) {
+                tmval.tv_sec = tsec;
+            }
+        }
+        waketime = tmval;
+    } else {
+        advance_tv(waketime, secs);
+    }
+}
+
 extern "C" {
     static void* launch_executor_thread(void* arg);
 }
@@ -47,10 +93,8 @@ static void* launch_executor_thread(void *arg) {
 }
 
 void ExecutorThread::moveReadyTasks(const struct timeval &tv) {
-    if (!readyQueue.empty()) {
-        return;
-    }
-
+    // Even with tasks ready already: they may be held back by their
+    // serial, and must not keep the others from getting ready.
     std::queue<ExTask> notReady;
     while (!futureQueue.empty()) {
         const ExTask &tid = futureQueue.top();
@@ -80,14 +124,97 @@ void ExecutorThread::moveReadyTasks(const struct timeval &tv) {
     }
 }
 
-ExTask ExecutorThread::nextTask() {
-    assert (!empty());
-    return readyQueue.empty() ? futureQueue.top() : readyQueue.top();
+ExTask ExecutorThread::nextRunnable(bool take) {
+    // The task with the highest priority whose serial isn't taken by a
+    // task running elsewhere.
+    ExTask task;
+    std::vector<ExTask> putBack;
+    while (!readyQueue.empty()) {
+        ExTask next = readyQueue.top();
+        readyQueue.pop();
+        LockHolder tlh(next->mutex);
+        if (next->state == TASK_DEAD) {
+            continue;
+        }
+        tlh.unlock();
+        bool runnable = take ? manager->claimSerial(this, next)
+                             : !manager->isSerialRunning(this, next);
+        if (!runnable || !take) {
+            putBack.push_back(next);
+        }
+        if (runnable) {
+            task = next;
+            break;
+        }
+    }
+    std::vector<ExTask>::iterator it;
+    for (it = putBack.begin(); it != putBack.end(); ++it) {
+        readyQueue.push(*it);
+    }
+    return task;
 }
 
-void ExecutorThread::popNext() {
-    assert (!empty());
-    readyQueue.empty() ? futureQueue.pop() : readyQueue.pop();
+ExTask ExecutorThread::steal(const struct timeval &tv,
+                             ExecutorThread *&owner,
+                             struct timeval &due, bool &hasDue) {
+    // Look at the peers that are busy running something for the ready
+    // task with the highest priority, then take it if it's still there.
+    // Note when the first of their other tasks gets due, so that this
+    // one can be back by then.
+    ExecutorThread *victim = NULL;
+    ExTask best;
+    CompareByPriority lower;
+    for (size_t i = 0; i < peers.size(); ++i) {
+        ExecutorThread *peer = peers[(stealCursor + i) % peers.size()];
+        if (peer == this || !peer->busy.get()) {
+            continue;
+        }
+        LockHolder plh(peer->mutex);
+        peer->moveReadyTasks(tv);
+        ExTask task = peer->nextRunnable(false);
+        if (task && (!best || lower(best, task))) {
+            best = task;
+            victim = peer;
+        }
+        if (!peer->futureQueue.empty()) {
+            const struct timeval &next = peer->futureQueue.top()->waketime;
+            if (!hasDue || less_tv(next, due)) {
+                due = next;
+                hasDue = true;
+            }
+        }
+    }
+    ++stealCursor;
+    if (victim == NULL) {
+        return ExTask();
+    }
+
+    LockHolder plh(victim->mutex);
+    ExTask task = victim->nextRunnable(true);
+    if (task) {
+        steals.incr(1);
+        victim->stolen.incr(1);
+        owner = victim;
+        LOG(EXTENSION_LOG_DEBUG, "%s: Took a task \"%s\" from %s",
+            name.c_str(), task->getDescription().c_str(),
+            victim->name.c_str());
+    }
+    return task;
+}
+
+void ExecutorThread::poke() {
+    LockHolder lh(mutex);
+    ++wakeups;
+    notify();
+}
+
+void ExecutorThread::pokePeers() {
+    std::vector<ExecutorThread *>::iterator it;
+    for (it = peers.begin(); it != peers.end(); ++it) {
+        if (*it != this && !(*it)->busy.get()) {
+            (*it)->poke();
+        }
+    }
 }
 
 void ExecutorThread::start() {
@@ -121,66 +248,97 @@ void ExecutorThread::run() {
         if (state != EXECUTOR_RUNNING) {
             break;
         }
-        if (empty()) {
-            state = EXECUTOR_WAITING;
-            mutex.wait();
-            if (state == EXECUTOR_WAITING) {
-                state = EXECUTOR_RUNNING;
-            }
-        } else {
-            struct timeval tv;
-            gettimeofday(&tv, NULL);
 
-            // Get any ready tasks out of the due queue.
-            moveReadyTasks(tv);
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+
+        // Get any ready tasks out of the due queue.
+        moveReadyTasks(tv);
 
-            currentTask = nextTask();
-            assert(currentTask);
-            LockHolder tlh(currentTask->mutex);
-            if (currentTask->state == TASK_DEAD) {
-                popNext();
+        ExecutorThread *owner = this;
+        struct timeval waketime;
+        bool hasDue = false;
+        currentTask = nextRunnable(true);
+        if (!currentTask && !peers.empty()) {
+            // Nothing to do here; help a busy peer out.
+            size_t seen = wakeups;
+            lh.unlock();
+            currentTask = steal(tv, owner, waketime, hasDue);
+            lh.lock();
+            if (!currentTask && (seen != wakeups ||
+                                 state != EXECUTOR_RUNNING)) {
                 continue;
             }
-            tlh.unlock();
+        }
 
-            if (less_tv(tv, currentTask->waketime)) {
-                state = EXECUTOR_SLEEPING;
-                mutex.wait(currentTask->waketime);
-                if (state == EXECUTOR_SLEEPING) {
+        if (!currentTask) {
+            // Sleep until the next task here or at a busy peer is due.
+            // Anything else that gives this thread work pokes it.
+            if (!futureQueue.empty() &&
+                (!hasDue || less_tv(futureQueue.top()->waketime,
+                                    waketime))) {
+                waketime = futureQueue.top()->waketime;
+                hasDue = true;
+            }
+            if (!hasDue) {
+                state = EXECUTOR_WAITING;
+                mutex.wait();
+                if (state == EXECUTOR_WAITING) {
                     state = EXECUTOR_RUNNING;
                 }
                 continue;
-            } else {
-                popNext();
             }
+
+            state = empty() ? EXECUTOR_WAITING : EXECUTOR_SLEEPING;
+            executor_state_t was = state;
+            mutex.wait(waketime);
+            if (state == was) {
+                state = EXECUTOR_RUNNING;
+            }
+            continue;
+        } else {
+            busy.set(true);
+            bool queued = !empty();
             lh.unlock();
+            if (queued) {
+                // The idle peers only look at busy threads' tasks.
+                pokePeers();
+            }
 
             taskStart = gethrtime();
             rel_time_t startReltime = ep_current_time();
             try {
                 bool again = currentTask->run();
+                manager->releaseSerial(owner, currentTask);
                 if(again) {
-                    reschedule(currentTask);
+                    owner->reschedule(currentTask);
                 } else if (!currentTask->isDaemonTask) {
                     manager->cancel(currentTask->taskId);
                 } else {
                 }
             } catch (std::exception& e) {
+                manager->releaseSerial(owner, currentTask);
                 LOG(EXTENSION_LOG_WARNING,
                     "%s: Exception caught in task \"%s\": %s", name.c_str(),
                     currentTask->getDescription().c_str(), e.what());
             } catch(...) {
+                manager->releaseSerial(owner, currentTask);
                 LOG(EXTENSION_LOG_WARNING,
                     "%s: Fatal exception caught in task \"%s\"\n", name.c_str(),
                     currentTask->getDescription().c_str());
             }
+            busy.set(false);
+            if (owner != this) {
+                // It may have tasks of the same serial waiting for this.
+                owner->poke();
+            }
 
             hrtime_t runtime((gethrtime() - taskStart) / 1000);
             TaskLogEntry tle(currentTask->getDescription(), runtime,
                              startReltime);
             tasklog.add(tle);
-            if (runtime > (hrtime_t)currentTask->maxExpectedDuration()) {
-                slowjobs.add(tle);
+            if (runtime > currentTask->maxExpectedDuration()) {
+                manager->logSlowJob(engine, tle);
             }
         }
     }
@@ -194,9 +352,14 @@ void ExecutorThread::schedule(ExTask &task) {
 
     LockHolder lh(mutex);
     futureQueue.push(task);
+    ++wakeups;
     notify();
     LOG(EXTENSION_LOG_DEBUG, "%s: Schedule a task \"%s\"", name.c_str(),
         task->getDescription().c_str());
+    lh.unlock();
+    if (busy.get()) {
+        pokePeers();
+    }
 }
 
 void ExecutorThread::reschedule(ExTask &task) {
@@ -204,6 +367,13 @@ void ExecutorThread::reschedule(ExTask &task) {
         task->getDescription().c_str());
     LockHolder lh(mutex);
     futureQueue.push(task);
+    // The task may have been run by a peer, while this one slept.
+    ++wakeups;
+    notify();
+    lh.unlock();
+    if (busy.get()) {
+        pokePeers();
+    }
 }
 
 void ExecutorThread::wake(ExTask &task) {
@@ -212,7 +382,12 @@ void ExecutorThread::wake(ExTask &task) {
         task->getDescription().c_str());
     task->snooze(0, false);
     hasWokenTask = true;
+    ++wakeups;
     notify();
+    lh.unlock();
+    if (busy.get()) {
+        pokePeers();
+    }
 }
 
 const std::string ExecutorThread::getStateName() {
@@ -264,7 +439,41 @@ bool ExecutorPool::snooze(size_t taskId, double tosleep) {
     return false;
 }
 
-size_t ExecutorPool::schedule(ExTask task, int tidx) {
+bool ExecutorPool::claimSerial(ExecutorThread *home, const ExTask &task) {
+    if (task->serial < 0) {
+        return true;
+    }
+    LockHolder lh(serialMutex);
+    return runningSerials.insert(std::make_pair(home, task->serial)).second;
+}
+
+bool ExecutorPool::isSerialRunning(ExecutorThread *home, const ExTask &task) {
+    if (task->serial < 0) {
+        return false;
+    }
+    LockHolder lh(serialMutex);
+    return runningSerials.count(std::make_pair(home, task->serial)) > 0;
+}
+
+void ExecutorPool::releaseSerial(ExecutorThread *home, const ExTask &task) {
+    if (task->serial < 0) {
+        return;
+    }
+    LockHolder lh(serialMutex);
+    runningSerials.erase(std::make_pair(home, task->serial));
+}
+
+void ExecutorPool::logSlowJob(EventuallyPersistentEngine *engine,
+                              const TaskLogEntry &entry) {
+    LockHolder lh(mutex);
+    std::map<EventuallyPersistentEngine*, RingBuffer<TaskLogEntry>*>::iterator
+        itr = slowLogs.find(engine);
+    if (itr != slowLogs.end()) {
+        itr->second->add(entry);
+    }
+}
+
+size_t ExecutorPool::schedule(ExTask task, int tidx, int serial) {
     LockHolder lh(mutex);
     if (bucketRegistry.find(task->getEngine()) == bucketRegistry.end()) {
         LOG(EXTENSION_LOG_WARNING, "Trying to schedule task for unregistered "
@@ -273,6 +482,7 @@ size_t ExecutorPool::schedule(ExTask task, int tidx) {
     }
 
     threadQ &threads = bucketRegistry[task->getEngine()];
+    task->serial = serial;
     threads[tidx]->schedule(task);
     lookupId loc(task, threads[tidx]);
     taskLocator[task->getId()] = loc;
@@ -299,31 +509,33 @@ void ExecutorPool::unregisterBucket(EventuallyPersistentEngine *engine) {
 
     threadQ threads = itr->second;
     bucketRegistry.erase(itr);
+    delete slowLogs[engine];
+    slowLogs.erase(engine);
+
+    // Forget the bucket's tasks; they go away with its threads.
+    std::map<size_t, lookupId>::iterator titr = taskLocator.begin();
+    while (titr != taskLocator.end()) {
+        if (titr->second.first->getEngine() == engine) {
+            taskLocator.erase(titr++);
+        } else {
+            ++titr;
+        }
+    }
     lh.unlock();
 
-    for (size_t tidx = 0; tidx < threads.size(); ++tidx) {
-        LOG(EXTENSION_LOG_INFO,
-            "Waiting for thread[%d] to finish in bucket: %s", tidx,
-            engine->getName());
-        threads[tidx]->stop();
-        delete threads[tidx];
-    }
+    LOG(EXTENSION_LOG_INFO, "Waiting for the threads of bucket %s to finish",
+        engine->getName());
+    stopThreads(threads);
 }
 
 bool ExecutorPool::startWorkers(EventuallyPersistentEngine *engine) {
     if (bucketRegistry.find(engine) == bucketRegistry.end()) {
         WorkLoadPolicy &workload = engine->getWorkLoadPolicy();
-        int numThreads = workload.calculateNumReaders() +
-                         workload.calculateNumWriters();
-        threadQ threads;
-        threads.reserve(numThreads);
-        for (int tidx = 0; tidx < numThreads; ++tidx) {
-            std::stringstream ss;
-            ss << "iomanager_worker_" << tidx;
-            threads.push_back(new ExecutorThread(this, engine, ss.str()));
-            threads.back()->start();
-        }
-        bucketRegistry[engine] = threads;
+        bucketRegistry[engine] =
+            startThreads(engine, workload.calculateNumWriters(),
+                         workload.calculateNumReaders(),
+                         workload.getNumNonIO());
+        slowLogs[engine] = new RingBuffer<TaskLogEntry>(TASK_LOG_SIZE);
         return true;
     } else {
         LOG(EXTENSION_LOG_WARNING,
@@ -332,6 +544,56 @@ bool ExecutorPool::startWorkers(EventuallyPersistentEngine *engine) {
     }
 }
 
+threadQ ExecutorPool::startThreads(EventuallyPersistentEngine *engine,
+                                   int numWriters, int numReaders,
+                                   int numNonIO) {
+    int numIO = numWriters + numReaders;
+    int firstNonIO = numIO + 1;
+    int numThreads = firstNonIO + numNonIO;
+    threadQ threads;
+    threads.reserve(numThreads);
+    for (int tidx = 0; tidx < numThreads; ++tidx) {
+        std::stringstream ss;
+        if (tidx < numIO) {
+            ss << "iomanager_worker_" << tidx;
+        } else if (tidx < firstNonIO) {
+            ss << "auxio_worker_" << tidx - numIO;
+        } else {
+            ss << "nonio_worker_" << tidx - firstNonIO;
+        }
+        threads.push_back(new ExecutorThread(this, engine, ss.str()));
+    }
+    // Threads only help out threads of their own kind, so that no
+    // kind of work can keep another one waiting.  The auxiliary IO
+    // thread has none.
+    threadQ writers(threads.begin(), threads.begin() + numWriters);
+    threadQ readers(threads.begin() + numWriters,
+                    threads.begin() + numIO);
+    threadQ nonio(threads.begin() + firstNonIO, threads.end());
+    for (int tidx = 0; tidx < numThreads; ++tidx) {
+        if (tidx < numIO || tidx >= firstNonIO) {
+            threadQ &peers = tidx < numWriters ? writers :
+                             tidx < numIO ? readers : nonio;
+            if (peers.size() > 1) {
+                threads[tidx]->setPeers(peers);
+            }
+        }
+        threads[tidx]->start();
+    }
+    return threads;
+}
+
+void ExecutorPool::stopThreads(threadQ &threads) {
+    // Peers may still look at each other's queues until all are stopped.
+    for (size_t tidx = 0; tidx < threads.size(); ++tidx) {
+        threads[tidx]->stop();
+    }
+    for (size_t tidx = 0; tidx < threads.size(); ++tidx) {
+        delete threads[tidx];
+    }
+    threads.clear();
+}
+
 static void showJobLog(const char *logname, const char *prefix,
                        std::vector<TaskLogEntry> log,
                        const void *cookie, ADD_STAT add_stat) {
@@ -369,9 +631,18 @@ static void addWorkerStats(const char *prefix, threadQ threads, size_t t,
                 add_stat, cookie);
     }
 
+    snprintf(statname, sizeof(statname), "%s:steals", prefix);
+    add_casted_stat(statname, threads[t]->getSteals(), add_stat, cookie);
+    snprintf(statname, sizeof(statname), "%s:stolen", prefix);
+    add_casted_stat(statname, threads[t]->getStolen(), add_stat, cookie);
+    size_t ready(0), future(0);
+    threads[t]->getQueueDepth(ready, future);
+    snprintf(statname, sizeof(statname), "%s:ready_queue", prefix);
+    add_casted_stat(statname, ready, add_stat, cookie);
+    snprintf(statname, sizeof(statname), "%s:future_queue", prefix);
+    add_casted_stat(statname, future, add_stat, cookie);
+
     showJobLog("log", prefix, threads[t]->getLog(), cookie, add_stat);
-    showJobLog("slow", prefix, threads[t]->getSlowLog(), cookie,
-               add_stat);
 }
 
 void ExecutorPool::doWorkerStat(EventuallyPersistentEngine *engine,
@@ -390,4 +661,12 @@ void ExecutorPool::doWorkerStat(EventuallyPersistentEngine *engine,
         addWorkerStats(threads[tidx]->getName().c_str(), threads, tidx,
                      cookie, add_stat);
     }
+
+    LockHolder lh(mutex);
+    std::vector<TaskLogEntry> slow;
+    if (slowLogs.find(engine) != slowLogs.end()) {
+        slow = slowLogs[engine]->contents();
+    }
+    lh.unlock();
+    showJobLog("slow", "executor", slow, cookie, add_stat);
 }
@@ -24,6 +24,7 @@
 #include <list>
 #include <map>
 #include <queue>
+#include <set>
 #include <string>
 #include <utility>
 #include <vector>
@@ -39,6 +40,16 @@
 
 class ExecutorPool;
 
+/**
+ * The kinds of threads a bucket runs its tasks on.
+ */
+typedef enum {
+    WRITER_TASK_IDX,            //!< Tasks writing to the shard stores
+    READER_TASK_IDX,            //!< Tasks reading from the shard stores
+    AUXIO_TASK_IDX,             //!< Tasks reading from the auxiliary store
+    NONIO_TASK_IDX              //!< Tasks doing no disk IO at all
+} task_type_t;
+
 typedef enum {
     EXECUTOR_CREATING,
     EXECUTOR_RUNNING,
@@ -86,8 +97,8 @@ public:
     ExecutorThread(ExecutorPool *m, EventuallyPersistentEngine *e,
                    const std::string nm)
         : name(nm), state(EXECUTOR_CREATING), manager(m), engine(e),
-          hasWokenTask(false), tasklog(TASK_LOG_SIZE), slowjobs(TASK_LOG_SIZE),
-          currentTask(NULL), taskStart(NULL) {}
+          hasWokenTask(false), wakeups(0), stealCursor(0),
+          tasklog(TASK_LOG_SIZE), currentTask(NULL), taskStart(NULL) {}
 
     ~ExecutorThread() {
         LOG(EXTENSION_LOG_INFO, "Executor killing %s", name.c_str());
@@ -113,6 +124,15 @@ public:
         mutex.notify();
     }
 
+    /**
+     * Set the threads this one may take ready tasks from while it has
+     * none of its own (itself included or not).  Must be called before
+     * start().
+     */
+    void setPeers(const std::vector<ExecutorThread *> &p) {
+        peers = p;
+    }
+
     const std::string& getName() const {
         return name;
     }
@@ -131,11 +151,26 @@ public:
 
     const std::vector<TaskLogEntry> getLog() { return tasklog.contents(); }
 
-    const std::vector<TaskLogEntry> getSlowLog() { return slowjobs.contents(); }
+    /**
+     * Get the number of tasks this thread took from its peers.
+     */
+    size_t getSteals() { return steals.get(); }
+
+    /**
+     * Get the number of tasks the peers of this thread took from it.
+     */
+    size_t getStolen() { return stolen.get(); }
 
-private:
+    /**
+     * Get the number of tasks due to run and waiting to be due.
+     */
+    void getQueueDepth(size_t &ready, size_t &future) {
+        LockHolder lh(mutex);
+        ready = readyQueue.size();
+        future = futureQueue.size();
+    }
 
-    ExTask nextTask();
+private:
 
     bool empty() {
         return readyQueue.empty() && futureQueue.empty();
@@ -143,7 +178,24 @@ private:
 
     void moveReadyTasks(const struct timeval &tv);
 
-    void popNext();
+    ExTask nextRunnable(bool take);
+
+    /**
+     * Take the ready task with the highest priority from a busy peer.
+     *
+     * @param tv the current time
+     * @param owner set to the peer the task was taken from
+     * @param due set to when the first task of the busy peers not
+     *            ready yet is due, if earlier than it was or hasDue
+     *            is false
+     * @param hasDue set if due was
+     */
+    ExTask steal(const struct timeval &tv, ExecutorThread *&owner,
+                 struct timeval &due, bool &hasDue);
+
+    void poke();
+
+    void pokePeers();
 
     SyncObject mutex;
     pthread_t thread;
@@ -152,12 +204,20 @@ private:
     ExecutorPool *manager;
     EventuallyPersistentEngine *engine;
     bool hasWokenTask;
+    //! Bumped whenever this thread is given something to look at.
+    size_t wakeups;
     std::priority_queue<ExTask, std::deque<ExTask >,
                         CompareByPriority> readyQueue;
     std::priority_queue<ExTask, std::deque<ExTask >,
                         CompareByDueDate> futureQueue;
+    std::vector<ExecutorThread *> peers;
+    //! Peer to start looking for work at next time.
+    size_t stealCursor;
+    //! True while this thread is running a task.
+    Atomic<bool> busy;
+    Atomic<size_t> steals;
+    Atomic<size_t> stolen;
     RingBuffer<TaskLogEntry> tasklog;
-    RingBuffer<TaskLogEntry> slowjobs;
     ExTask currentTask;
     hrtime_t taskStart;
 };
@@ -181,12 +241,54 @@ public:
     void doWorkerStat (EventuallyPersistentEngine *engine, const void *cookie,
                        ADD_STAT add_stat);
 
+    /**
+     * Claim the serial of a task for the thread it was scheduled on,
+     * failing if another of that thread's tasks with the same serial is
+     * running.
+     */
+    bool claimSerial(ExecutorThread *home, const ExTask &task);
+
+    bool isSerialRunning(ExecutorThread *home, const ExTask &task);
+
+    void releaseSerial(ExecutorThread *home, const ExTask &task);
+
+    /**
+     * Add a job that ran longer than it was expected to, on any of
+     * the threads of the given bucket, to the bucket's slow job log.
+     */
+    void logSlowJob(EventuallyPersistentEngine *engine,
+                    const TaskLogEntry &entry);
+
 protected:
 
     ExecutorPool(int r, int w) : workers(r+w) {}
 
     bool startWorkers(EventuallyPersistentEngine *engine);
-    size_t schedule(ExTask task, int tidx);
+
+    /**
+     * Start the threads of a bucket: the writers, the readers, one
+     * auxiliary IO thread, then the non-IO threads.
+     */
+    threadQ startThreads(EventuallyPersistentEngine *engine,
+                         int numWriters, int numReaders, int numNonIO);
+
+    /**
+     * Stop and delete the threads of a bucket.
+     */
+    static void stopThreads(threadQ &threads);
+
+    /**
+     * Schedule a task on a given thread of the bucket.  The thread's
+     * idle peers may still run it while that one is busy, but never
+     * while a task scheduled on the same thread with the same serial
+     * is running.
+     *
+     * @param task the task to schedule
+     * @param tidx the thread to schedule it on
+     * @param serial tasks that must not run at the same time as the
+     *               others of this serial (-1 if it may)
+     */
+    size_t schedule(ExTask task, int tidx, int serial = -1);
 
     SyncObject mutex;
     //! Default number of worker ExecutorThreads
@@ -194,7 +296,15 @@ protected:
     //! A mapping of task ids to workers in the thread pool
     std::map<size_t, lookupId> taskLocator;
     //! A registry of buckets using this pool and a list of their threads
+    //! (the writers, the readers, the auxiliary IO thread, then the
+    //! non-IO threads)
     std::map<EventuallyPersistentEngine*, threadQ> bucketRegistry;
+    //! The jobs that took too long on each bucket's threads
+    std::map<EventuallyPersistentEngine*, RingBuffer<TaskLogEntry>*> slowLogs;
+    //! Guards runningSerials; no other lock is taken while holding it
+    Mutex serialMutex;
+    //! The serials of the tasks running, with the thread they belong to
+    std::set<std::pair<ExecutorThread*, int> > runningSerials;
 };
 
 #endif  // SRC_SCHEDULER_H_
@@ -67,6 +67,7 @@ int main(int, char **) {
 
     display("GIGANTOR", GIGANTOR);
     display("Stored Value", sizeof(StoredValue));
+    display("Stored Value (empty key)", StoredValue::sizeForKey(0));
 
     display("Stored Value Factory", sizeof(StoredValueFactory));
     display("Blob", sizeof(Blob));
@@ -0,0 +1,375 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2013 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <cassert>
+#include <new>
+
+#include "locks.h"
+#include "slab_allocator.h"
+
+//! Chunk sizes are multiples of this.
+static const size_t CHUNK_ALIGN(16);
+//! Each size class is at most this much (in 1/8ths) bigger than the last.
+static const size_t GROWTH_EIGHTHS(9);
+
+static inline size_t roundUp(size_t n, size_t to) {
+    return (n + to - 1) / to * to;
+}
+
+const size_t SlabAllocator::headerSize;
+
+//! Initial number of entries in the table of slabs with handles.
+static const size_t INITIAL_SLAB_TABLE_SIZE(64);
+//! Chunks too big for any class sit this far off CHUNK_ALIGN.
+static const size_t LARGE_SKEW(CHUNK_ALIGN / 2);
+
+SlabAllocator::SlabAllocator(size_t ss, size_t maxChunkSize,
+                             Atomic<size_t> *o, bool h)
+    : slabSize(ss), overhead(o), chunkBits(0), handles(h), slabTable(NULL),
+      nextId(1) {
+    assert((slabSize & (slabSize - 1)) == 0);
+
+    while ((static_cast<size_t>(1) << chunkBits) < slabSize / CHUNK_ALIGN) {
+        ++chunkBits;
+    }
+    if (handles) {
+        slabTable = newSlabTable(INITIAL_SLAB_TABLE_SIZE);
+    }
+
+    size_t largest = std::min(roundUp(maxChunkSize, CHUNK_ALIGN),
+                              (slabSize - headerSize) / CHUNK_ALIGN * CHUNK_ALIGN);
+    size_t chunk = CHUNK_ALIGN;
+    while (true) {
+        SlabClass *c = new SlabClass;
+        c->chunkSize = std::min(chunk, largest);
+        c->perSlab = (slabSize - headerSize) / c->chunkSize;
+        c->partial = NULL;
+        c->chunks.set(0);
+        c->requested.set(0);
+        classes.push_back(c);
+        if (c->chunkSize == largest) {
+            break;
+        }
+        chunk = std::max(chunk + CHUNK_ALIGN,
+                         roundUp(chunk * GROWTH_EIGHTHS / 8, CHUNK_ALIGN));
+    }
+}
+
+SlabAllocator::~SlabAllocator() {
+    // Slabs are freed as soon as they become empty.  One still in use
+    // here would be left pointing at a dead owner, so everything
+    // allocated from us must have been released by now.
+    assert(slabBytes.get() == 0);
+    assert(usedBytes.get() == 0);
+    std::vector<SlabClass*>::iterator it;
+    for (it = classes.begin(); it != classes.end(); ++it) {
+        delete *it;
+    }
+    std::vector<SlabTable*>::iterator tit;
+    for (tit = oldSlabTables.begin(); tit != oldSlabTables.end(); ++tit) {
+        free(*tit);
+    }
+    free(slabTable.get());
+}
+
+SlabAllocator::SlabClass *SlabAllocator::classFor(size_t size) {
+    if (size > classes.back()->chunkSize) {
+        return NULL;
+    }
+    size_t lo(0), hi(classes.size() - 1);
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (classes[mid]->chunkSize < size) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return classes[lo];
+}
+
+size_t SlabAllocator::getChunkSize(size_t size) {
+    SlabClass *c = classFor(size);
+    return c ? c->chunkSize : size;
+}
+
+void SlabAllocator::addClassStats(std::vector<ClassStats> &stats) {
+    if (stats.size() < classes.size()) {
+        stats.resize(classes.size());
+    }
+    for (size_t i = 0; i < classes.size(); ++i) {
+        stats[i].chunkSize = classes[i]->chunkSize;
+        stats[i].chunks += classes[i]->chunks.get();
+        stats[i].requested += classes[i]->requested.get();
+    }
+}
+
+void SlabAllocator::registerSlab(Slab *slab) {
+    LockHolder lh(slabTableMutex);
+    if (freeIds.empty()) {
+        if (nextId >= (static_cast<size_t>(1) << (32 - chunkBits))) {
+            throw std::bad_alloc();
+        }
+        slab->id = nextId++;
+    } else {
+        slab->id = freeIds.back();
+        freeIds.pop_back();
+    }
+
+    SlabTable *table = slabTable.get();
+    if (slab->id < table->size) {
+        table->slabs[slab->id] = slab;
+        return;
+    }
+
+    // fromHandle() doesn't lock, so the new table must be complete
+    // before it's published, and readers may still be looking at the
+    // old one: keep it around until we go away.
+    SlabTable *newTable;
+    try {
+        newTable = newSlabTable(table->size * 2);
+    } catch (std::bad_alloc &) {
+        freeIds.push_back(slab->id);
+        throw;
+    }
+    std::copy(table->slabs, table->slabs + table->size, newTable->slabs);
+    newTable->slabs[slab->id] = slab;
+    oldSlabTables.push_back(table);
+    ep_sync_synchronize();
+    slabTable = newTable;
+}
+
+void SlabAllocator::unregisterSlab(Slab *slab) {
+    LockHolder lh(slabTableMutex);
+    slabTable->slabs[slab->id] = NULL;
+    freeIds.push_back(slab->id);
+}
+
+SlabAllocator::SlabTable *SlabAllocator::newSlabTable(size_t size) {
+    SlabTable *table = static_cast<SlabTable*>(
+        calloc(1, sizeof(SlabTable) + (size - 1) * sizeof(Slab*)));
+    if (table == NULL) {
+        throw std::bad_alloc();
+    }
+    table->size = size;
+    return table;
+}
+
+SlabAllocator::Slab *SlabAllocator::newSlab() {
+    void *p(NULL);
+    if (posix_memalign(&p, slabSize, slabSize) != 0) {
+        throw std::bad_alloc();
+    }
+    Slab *slab = static_cast<Slab*>(p);
+    slab->owner = this;
+    slab->cls = NULL;
+    slab->prev = slab->next = NULL;
+    slab->freeList = NULL;
+    slab->inUse = 0;
+    slab->carved = 0;
+    slab->id = 0;
+    if (handles) {
+        try {
+            registerSlab(slab);
+        } catch (std::bad_alloc &) {
+            free(slab);
+            throw;
+        }
+    }
+
+    slabBytes.incr(slabSize);
+    if (overhead) {
+        overhead->incr(slabSize);
+    }
+    return slab;
+}
+
+void SlabAllocator::freeSlab(Slab *slab) {
+    if (handles) {
+        unregisterSlab(slab);
+    }
+    slabBytes.decr(slabSize);
+    if (overhead) {
+        overhead->decr(slabSize);
+    }
+    free(slab);
+}
+
+bool SlabAllocator::isLarge(const void *p) {
+    return (reinterpret_cast<uintptr_t>(p) & (CHUNK_ALIGN - 1)) != 0;
+}
+
+void *SlabAllocator::allocateLarge(size_t size) {
+    // There's no slab for a handle to refer to.
+    assert(!handles);
+
+    // malloc aligns to at least half of CHUNK_ALIGN, and the chunk
+    // goes to the first address past the header that is LARGE_SKEW
+    // off CHUNK_ALIGN.
+    size_t length = sizeof(LargeChunk) + CHUNK_ALIGN + size;
+    char *base = static_cast<char*>(malloc(length));
+    if (base == NULL) {
+        throw std::bad_alloc();
+    }
+    char *p = base + sizeof(LargeChunk);
+    size_t skew = reinterpret_cast<uintptr_t>(p) & (CHUNK_ALIGN - 1);
+    p += (LARGE_SKEW + CHUNK_ALIGN - skew) & (CHUNK_ALIGN - 1);
+    assert(isLarge(p));
+
+    LargeChunk *large = largeOf(p);
+    large->owner = this;
+    large->base = base;
+    large->length = length;
+    large->size = size;
+
+    slabBytes.incr(length);
+    usedBytes.incr(size);
+    requestedBytes.incr(size);
+    if (overhead) {
+        overhead->incr(length - size);
+    }
+    return p;
+}
+
+void SlabAllocator::releaseLarge(LargeChunk *large) {
+    slabBytes.decr(large->length);
+    usedBytes.decr(large->size);
+    if (overhead) {
+        overhead->decr(large->length);
+    }
+    free(large->base);
+}
+
+void *SlabAllocator::allocate(size_t size) {
+    SlabClass *c = classFor(size);
+    if (c == NULL) {
+        return allocateLarge(size);
+    }
+
+    LockHolder lh(c->mutex);
+    Slab *slab = c->partial;
+    if (slab == NULL) {
+        slab = newSlab();
+        slab->cls = c;
+        c->partial = slab;
+    }
+
+    void *rv;
+    if (slab->freeList) {
+        rv = slab->freeList;
+        slab->freeList = *static_cast<void**>(rv);
+    } else {
+        assert(slab->carved < c->perSlab);
+        rv = reinterpret_cast<char*>(slab) + headerSize
+            + slab->carved * c->chunkSize;
+        ++slab->carved;
+    }
+
+    if (++slab->inUse == c->perSlab) {
+        // Full, stop offering it.
+        c->partial = slab->next;
+        if (c->partial) {
+            c->partial->prev = NULL;
+        }
+        slab->next = NULL;
+    }
+
+    ++c->chunks;
+    c->requested.incr(size);
+    usedBytes.incr(c->chunkSize);
+    requestedBytes.incr(size);
+    // The end of the chunk the object didn't ask for stays overhead.
+    if (overhead) {
+        overhead->decr(size);
+    }
+    return rv;
+}
+
+void SlabAllocator::deallocate(void *p, size_t slabSize) {
+    if (p == NULL) {
+        return;
+    }
+    if (isLarge(p)) {
+        LargeChunk *large = largeOf(p);
+        large->owner->releaseLarge(large);
+        return;
+    }
+    Slab *slab = slabOf(p, slabSize);
+    assert(slab->owner->slabSize == slabSize);
+    slab->owner->release(slab, p);
+}
+
+void SlabAllocator::forget(const void *p, size_t slabSize, size_t size) {
+    if (isLarge(p)) {
+        LargeChunk *large = largeOf(p);
+        assert(large->size == size);
+        large->owner->requestedBytes.decr(size);
+        if (large->owner->overhead) {
+            large->owner->overhead->incr(size);
+        }
+        return;
+    }
+    Slab *slab = slabOf(p, slabSize);
+    SlabAllocator *owner = slab->owner;
+    SlabClass *c = slab->cls;
+    assert(size <= c->chunkSize);
+    c->requested.decr(size);
+    owner->requestedBytes.decr(size);
+    if (owner->overhead) {
+        owner->overhead->incr(size);
+    }
+}
+
+void SlabAllocator::release(Slab *slab, void *p) {
+    SlabClass *c = slab->cls;
+    LockHolder lh(c->mutex);
+    --c->chunks;
+    usedBytes.decr(c->chunkSize);
+
+    bool wasFull = slab->inUse == c->perSlab;
+    if (--slab->inUse == 0) {
+        if (!wasFull) {
+            if (slab->prev) {
+                slab->prev->next = slab->next;
+            } else {
+                c->partial = slab->next;
+            }
+            if (slab->next) {
+                slab->next->prev = slab->prev;
+            }
+        }
+        freeSlab(slab);
+        return;
+    }
+
+    *static_cast<void**>(p) = slab->freeList;
+    slab->freeList = p;
+    if (wasFull) {
+        slab->prev = NULL;
+        slab->next = c->partial;
+        if (c->partial) {
+            c->partial->prev = slab;
+        }
+        c->partial = slab;
+    }
+}
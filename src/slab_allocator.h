@@ -0,0 +1,288 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2013 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef SRC_SLAB_ALLOCATOR_H_
+#define SRC_SLAB_ALLOCATOR_H_ 1
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "atomic.h"
+#include "common.h"
+#include "mutex.h"
+
+/**
+ * Size-class slab allocator for small, variable sized objects.
+ *
+ * Memory is reserved in slabs of a fixed size, each of them carved
+ * into chunks of a single size class.  Slabs are aligned to their
+ * size, so the slab (and allocator) owning a chunk can be found from
+ * the chunk's address alone.  Requests larger than the biggest size
+ * class are passed on to malloc behind a small header, and placed
+ * off the chunk alignment so they can be told apart from chunks.
+ *
+ * A slab is returned to the system as soon as its last chunk is
+ * released.  An allocator must outlive everything allocated from it;
+ * it must be empty by the time it is destroyed.
+ *
+ * The reserved bytes that don't hold an object, both in free chunks
+ * and at the end of chunks bigger than their objects asked for, are
+ * the allocator's overhead.  Objects tell the allocator they're going
+ * away with forget() so the latter can be accounted for exactly.
+ *
+ * An allocator may also hand out 32-bit handles for its chunks, for
+ * structures that would rather not spend a whole pointer on a link.
+ */
+class SlabAllocator {
+public:
+
+    /**
+     * Create a new allocator.
+     *
+     * @param slabSize size and alignment of a slab (a power of two)
+     * @param maxChunkSize the largest size class
+     * @param overhead if not NULL, kept up to date with the number of
+     *                 reserved bytes not taken by any object
+     * @param handles true if toHandle() and fromHandle() will be used
+     *                (no request may then exceed maxChunkSize)
+     */
+    SlabAllocator(size_t slabSize, size_t maxChunkSize,
+                  Atomic<size_t> *overhead = NULL, bool handles = false);
+
+    ~SlabAllocator();
+
+    /**
+     * Allocate memory for an object of the given size.
+     *
+     * @throws std::bad_alloc if no memory could be reserved
+     */
+    void *allocate(size_t size);
+
+    /**
+     * Release memory obtained from any allocator using the given slab
+     * size.
+     */
+    static void deallocate(void *p, size_t slabSize);
+
+    /**
+     * Note that the object at p, which asked for the given number of
+     * bytes, is going away.  Objects call this from their destructors,
+     * before their memory is released with deallocate().
+     */
+    static void forget(const void *p, size_t slabSize, size_t size);
+
+    /**
+     * Get a 32-bit handle for a chunk of this allocator (0 for NULL).
+     */
+    uint32_t toHandle(const void *p) {
+        if (p == NULL) {
+            return 0;
+        }
+        const Slab *slab = slabOf(p, slabSize);
+        size_t chunk = (reinterpret_cast<const char*>(p)
+                        - reinterpret_cast<const char*>(slab) - headerSize)
+            / slab->cls->chunkSize;
+        return static_cast<uint32_t>((slab->id << chunkBits) | chunk);
+    }
+
+    /**
+     * Get the chunk a handle returned by toHandle() refers to.
+     *
+     * The caller must have observed the handle being stored after the
+     * chunk was allocated (e.g. by holding the lock protecting it).
+     * No lock is taken here: the table of slabs is replaced as a
+     * whole when it grows, and the tables it replaced stay valid
+     * until the allocator goes away.
+     */
+    void *fromHandle(uint32_t h) {
+        if (h == 0) {
+            return NULL;
+        }
+        const SlabTable *table = slabTable.get();
+        size_t id = h >> chunkBits;
+        assert(id < table->size);
+        Slab *slab = table->slabs[id];
+        size_t chunk = h & ((1 << chunkBits) - 1);
+        return reinterpret_cast<char*>(slab) + headerSize
+            + chunk * slab->cls->chunkSize;
+    }
+
+    /**
+     * Get the allocator that handed out the given chunk (which must
+     * not be larger than the biggest size class).
+     */
+    static SlabAllocator *ownerOf(const void *p, size_t slabSize) {
+        return slabOf(p, slabSize)->owner;
+    }
+
+    /**
+     * Get the size of the chunk an allocation of the given size uses.
+     */
+    size_t getChunkSize(size_t size);
+
+    /**
+     * Get the number of bytes reserved by all slabs.
+     */
+    size_t getSlabBytes() { return slabBytes.get(); }
+
+    /**
+     * Get the number of bytes in chunks currently handed out.
+     */
+    size_t getUsedBytes() { return usedBytes.get(); }
+
+    /**
+     * Get the number of bytes the objects in the chunks asked for.
+     */
+    size_t getRequestedBytes() { return requestedBytes.get(); }
+
+    /**
+     * Get the number of reserved bytes not in use by any object.
+     */
+    size_t getFragmentedBytes() {
+        size_t reserved = slabBytes.get();
+        size_t used = usedBytes.get();
+        return reserved > used ? reserved - used : 0;
+    }
+
+    /**
+     * Get the number of bytes at the end of chunks their objects
+     * didn't ask for.
+     */
+    size_t getWastedBytes() {
+        size_t used = usedBytes.get();
+        size_t requested = requestedBytes.get();
+        return used > requested ? used - requested : 0;
+    }
+
+    /**
+     * How the chunks of a size class are used.
+     */
+    struct ClassStats {
+        ClassStats() : chunkSize(0), chunks(0), requested(0) {}
+
+        //! Get the bytes of the chunks their objects didn't ask for.
+        size_t getWaste() const {
+            size_t used = chunks * chunkSize;
+            return used > requested ? used - requested : 0;
+        }
+
+        size_t chunkSize;
+        //! Number of chunks handed out.
+        size_t chunks;
+        //! Bytes asked for by the objects in those chunks.
+        size_t requested;
+    };
+
+    /**
+     * Add the usage of each size class to the given list, one entry
+     * per class in size order.  Allocators created with the same
+     * parameters have the same classes, so their usage may be summed
+     * up in a single list.
+     */
+    void addClassStats(std::vector<ClassStats> &stats);
+
+private:
+
+    struct SlabClass;
+
+    struct Slab {
+        SlabAllocator *owner;
+        SlabClass     *cls;
+        Slab          *prev;
+        Slab          *next;
+        void          *freeList;
+        uint32_t       inUse;
+        //! Number of chunks ever carved out of this slab.
+        uint32_t       carved;
+        //! Position in slabTable (0 unless handles are in use).
+        size_t         id;
+    };
+
+    struct SlabClass {
+        Mutex           mutex;
+        size_t          chunkSize;
+        size_t          perSlab;
+        //! Slabs of this class with at least one free chunk.
+        Slab           *partial;
+        Atomic<size_t>  chunks;
+        Atomic<size_t>  requested;
+    };
+
+    //! Put in front of a chunk too big for any class.
+    struct LargeChunk {
+        SlabAllocator *owner;
+        //! What malloc returned, and the size it was asked for.
+        void          *base;
+        size_t         length;
+        size_t         size;
+    };
+
+    //! Slabs by id, along with the number of ids it has room for.
+    struct SlabTable {
+        size_t  size;
+        Slab   *slabs[1];
+    };
+
+    static Slab *slabOf(const void *p, size_t slabSize) {
+        return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(p)
+                                       & ~(static_cast<uintptr_t>(slabSize) - 1));
+    }
+
+    static SlabTable *newSlabTable(size_t size);
+    void registerSlab(Slab *slab);
+    void unregisterSlab(Slab *slab);
+    Slab *newSlab();
+    void freeSlab(Slab *slab);
+    void release(Slab *slab, void *p);
+    void *allocateLarge(size_t size);
+    void releaseLarge(LargeChunk *large);
+    static bool isLarge(const void *p);
+    static LargeChunk *largeOf(const void *p) {
+        return reinterpret_cast<LargeChunk*>(
+            const_cast<char*>(static_cast<const char*>(p))
+            - sizeof(LargeChunk));
+    }
+    SlabClass *classFor(size_t size);
+
+    //! Chunks start this far into a slab (a multiple of 16 bytes).
+    static const size_t        headerSize = (sizeof(Slab) + 15) / 16 * 16;
+
+    const size_t               slabSize;
+    std::vector<SlabClass*>    classes;
+    Atomic<size_t>            *overhead;
+    Atomic<size_t>             slabBytes;
+    Atomic<size_t>             usedBytes;
+    Atomic<size_t>             requestedBytes;
+
+    //! Number of low bits of a handle holding the chunk number.
+    size_t                     chunkBits;
+    bool                       handles;
+    //! Slabs by id; replaced (never freed) as it grows.
+    AtomicPtr<SlabTable>       slabTable;
+    std::vector<SlabTable*>    oldSlabTables;
+    std::vector<size_t>        freeIds;
+    size_t                     nextId;
+    Mutex                      slabTableMutex;
+
+    DISALLOW_COPY_AND_ASSIGN(SlabAllocator);
+};
+
+#endif  // SRC_SLAB_ALLOCATOR_H_
@@ -37,6 +37,16 @@
 
 static const hrtime_t ONE_SECOND(1000000);
 
+/**
+ * The ways the item pager can pick the values it ejects.
+ */
+typedef enum {
+    EVICTION_NRU,               //!< Sweep for not recently used values
+    EVICTION_CLOCK,             //!< Age and eject values behind a clock hand
+    EVICTION_SAMPLED_LFU,       //!< Eject the coldest of a random sample
+    EVICTION_POLICY_COUNT
+} eviction_policy_t;
+
 /**
  * Global engine stats container.
  */
@@ -47,6 +57,8 @@ public:
                 maxRemainingBgJobs(0),
                 dirtyAgeHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
                 diskCommitHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
+                flushCollectHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
+                flushQueueHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
                 mlogCompactorHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
                 timingLog(NULL), maxDataSize(DEFAULT_MAX_DATA_SIZE) {}
 
@@ -103,6 +115,12 @@ public:
     //! Fill % of number of items read during warmup we're going to
     //  enable traffic
     Atomic<double> warmupNumReadCap;
+    //! Time the warmup hit rate window closes (0 until warmup is done).
+    Atomic<rel_time_t> warmupHitWindowEnd;
+    //! Number of gets served within the warmup hit rate window.
+    Atomic<size_t> warmupWindowGets;
+    //! Number of those that had to wait for their value to be read.
+    Atomic<size_t> warmupWindowBgFetches;
 
     //! The tap throttle write queue cap
     Atomic<ssize_t> tapThrottleWriteQueueCap;
@@ -168,8 +186,33 @@ public:
     Atomic<size_t> numValueEjects;
     //! Number of times a value could not be ejected
     Atomic<size_t> numFailedEjects;
+
+    /**
+     * What the item pager did while using an eviction policy.
+     */
+    struct EvictionStats {
+        //! Gets served while the policy was in use
+        Atomic<size_t> gets;
+        //! Of those, the ones that had to fetch their value from disk
+        Atomic<size_t> bgFetches;
+        //! Bytes of values the policy ejected
+        Atomic<size_t> bytesFreed;
+        //! Time spent finding and ejecting those values (µs)
+        Atomic<hrtime_t> evictTime;
+
+        void reset() {
+            gets.set(0);
+            bgFetches.set(0);
+            bytesFreed.set(0);
+            evictTime.set(0);
+        }
+    };
+    //! Eviction stats of each policy
+    EvictionStats evictionStats[EVICTION_POLICY_COUNT];
     //! Number of times "Not my bucket" happened
     Atomic<size_t> numNotMyVBuckets;
+    //! Number of lock-free lookups that raced with a writer
+    Atomic<size_t> numOptimisticReadFallbacks;
     //! Total size of stored objects.
     Atomic<size_t> currentSize;
     //! Total memory overhead to store values for resident keys.
@@ -209,6 +252,16 @@ public:
     //! Histogram of pending operation wait times.
     Histogram<hrtime_t> pendingOpsHisto;
 
+    //! Number of connections that waited in CMD_WAIT_DURABILITY
+    Atomic<size_t> durabilityWaits;
+    //! Number of durability waits that timed out
+    Atomic<size_t> durabilityTimeouts;
+
+    //! Number of batch gets (CMD_GET_MULTI)
+    Atomic<size_t> numGetMultis;
+    //! Number of keys of batch gets that had to be fetched from disk
+    Atomic<size_t> numGetMultiBgFetches;
+
     //! Number of times background fetches occurred.
     Atomic<size_t> bg_fetched;
     //! Number of times meta background fetches occurred.
@@ -321,6 +374,14 @@ public:
     Atomic<hrtime_t> alogTime;
     //! The number of seconds that the last access scanner task took
     Atomic<rel_time_t> alogRuntime;
+    //! The number of items in the access log last written in full
+    Atomic<size_t> alogBaseItems;
+    //! The number of entries appended to its delta log since
+    Atomic<size_t> alogDeltaItems;
+    //! The number of bytes the last access scanner task wrote
+    Atomic<size_t> alogBytesWritten;
+    //! The number of bytes the access scanner wrote in all
+    Atomic<size_t> alogTotalBytesWritten;
 
     //! Histogram of queue processing dirty age.
     Histogram<hrtime_t> dirtyAgeHisto;
@@ -368,6 +429,18 @@ public:
     //! Histogram of wait_for_checkpoint_persistence command
     Histogram<hrtime_t> chkPersistenceHisto;
 
+    //! Histogram of the time a durability wait took to see its mutation persisted
+    Histogram<hrtime_t> durabilityPersistHisto;
+
+    //! Histogram of the time a durability wait took to see its mutation replicated
+    Histogram<hrtime_t> durabilityReplicateHisto;
+
+    //! Histogram of batch get commands, from request to response
+    Histogram<hrtime_t> getMultiCmdHisto;
+
+    //! Histogram of the number of keys in a batch get
+    Histogram<size_t> getMultiSizeHisto;
+
     //
     // DB timers.
     //
@@ -387,6 +460,12 @@ public:
     //! Histogram of disk commits
     Histogram<hrtime_t> diskCommitHisto;
 
+    //! Histogram of collecting a batch of items to flush
+    Histogram<hrtime_t> flushCollectHisto;
+
+    //! Histogram of batches waiting for their commit to start
+    Histogram<hrtime_t> flushQueueHisto;
+
     //! Histogram of setting vbucket state
     Histogram<hrtime_t> snapshotVbucketHisto;
 
@@ -396,6 +475,9 @@ public:
     //! Historgram of batch reads
     Histogram<hrtime_t> getMultiHisto;
 
+    //! Histogram of the number of items read by a batch read
+    Histogram<size_t> getMultiBatchSizeHisto;
+
     //! Reset all stats to reasonable values.
     void reset() {
         tooYoung.set(0);
@@ -407,7 +489,11 @@ public:
         itemsRemovedFromCheckpoints.set(0);
         numValueEjects.set(0);
         numFailedEjects.set(0);
+        for (int i = 0; i < EVICTION_POLICY_COUNT; ++i) {
+            evictionStats[i].reset();
+        }
         numNotMyVBuckets.set(0);
+        numOptimisticReadFallbacks.set(0);
         io_num_read.set(0);
         io_num_write.set(0);
         io_read_bytes.set(0);
@@ -431,6 +517,10 @@ public:
         pendingOpsTotal.set(0);
         pendingOpsMax.set(0);
         pendingOpsMaxDuration.set(0);
+        durabilityWaits.set(0);
+        durabilityTimeouts.set(0);
+        numGetMultis.set(0);
+        numGetMultiBgFetches.set(0);
         numTapFetched.set(0);
         vbucketDelMaxWalltime.set(0);
         vbucketDelTotWalltime.set(0);
@@ -456,16 +546,23 @@ public:
         notifyIOHisto.reset();
         getStatsCmdHisto.reset();
         chkPersistenceHisto.reset();
+        durabilityPersistHisto.reset();
+        durabilityReplicateHisto.reset();
+        getMultiCmdHisto.reset();
+        getMultiSizeHisto.reset();
         diskInsertHisto.reset();
         diskUpdateHisto.reset();
         diskDelHisto.reset();
         diskVBDelHisto.reset();
         diskCommitHisto.reset();
+        flushCollectHisto.reset();
+        flushQueueHisto.reset();
 
         itemAllocSizeHisto.reset();
         dirtyAgeHisto.reset();
         mlogCompactorHisto.reset();
         getMultiHisto.reset();
+        getMultiBatchSizeHisto.reset();
     }
 
     // Used by stats logging infrastructure.
@@ -18,9 +18,13 @@
 #include "config.h"
 
 #include <cassert>
+#include <new>
 #include <limits>
+#include <list>
+#include <set>
 #include <string>
 
+#include "read_epoch.h"
 #include "stored-value.h"
 
 #ifndef DEFAULT_HT_SIZE
@@ -29,6 +33,11 @@
 
 size_t HashTable::defaultNumBuckets = DEFAULT_HT_SIZE;
 size_t HashTable::defaultNumLocks = 193;
+size_t HashTable::bucketsPerLock = 0;
+size_t HashTable::maxLocks = 1024;
+bool HashTable::incrementalResize = false;
+bool HashTable::defaultOptimisticReads = false;
+hash_function_t HashTable::defaultHashFunction = DJB_HASH;
 double StoredValue::mutation_mem_threshold = 0.9;
 const int64_t StoredValue::state_cleared = -1;
 const int64_t StoredValue::state_pending = -2;
@@ -46,8 +55,7 @@ static ssize_t prime_size_table[] = {
 bool StoredValue::ejectValue(EPStats &stats, HashTable &ht) {
     if (eligibleForEviction()) {
         reduceCacheSize(ht, value->length());
-        markNotResident();
-        value = NULL;
+        markNotResident(ht);
 
         ++stats.numValueEjects;
         ++ht.numNonResidentItems;
@@ -58,6 +66,19 @@ bool StoredValue::ejectValue(EPStats &stats, HashTable &ht) {
     return false;
 }
 
+#ifdef COMPACT_STORED_VALUE
+StoredValue::Extension *StoredValue::extend() {
+    if (extension == 0) {
+        StoredValueAllocator &a = allocator();
+        void *p = a.allocate(sizeof(Extension));
+        std::memset(p, 0, sizeof(Extension));
+        extension = a.toHandle(p);
+        increaseMetaDataSize(a.table, a.stats, sizeof(Extension));
+    }
+    return getExtension();
+}
+#endif
+
 void StoredValue::referenced() {
     if (nru > MIN_NRU_VALUE) {
         --nru;
@@ -88,9 +109,9 @@ bool StoredValue::unlocked_restoreValue(Item *itm, HashTable &ht) {
     // this as an unexpected size change.
     if (getCas() == 0) {
         cas = itm->getCas();
-        flags = itm->getFlags();
-        exptime = itm->getExptime();
-        revSeqno = itm->getRevSeqno();
+        setFlags(itm->getFlags());
+        setExptime(itm->getExptime());
+        setRevSeqno(itm->getRevSeqno());
         setValue(*itm, ht, true);
         if (!isResident()) {
             --ht.numNonResidentItems;
@@ -128,13 +149,13 @@ mutation_type_t HashTable::insert(Item &itm, bool eject, bool partial) {
     StoredValue *v = unlocked_find(itm.getKey(), bucket_num, true, false);
 
     if (v == NULL) {
-        v = valFact(itm, values[bucket_num], *this);
+        v = valFact(itm, bucketHead(bucket_num), *this);
         v->markClean();
         if (partial) {
-            v->markNotResident();
+            v->markNotResident(*this);
             ++numNonResidentItems;
         }
-        values[bucket_num] = v;
+        bucketHead(bucket_num) = v;
         ++numItems;
     } else {
         if (partial) {
@@ -146,9 +167,9 @@ mutation_type_t HashTable::insert(Item &itm, bool eject, bool partial) {
         if (v->getCas() != itm.getCas()) {
             if (v->getCas() == 0) {
                 v->cas = itm.getCas();
-                v->flags = itm.getFlags();
-                v->exptime = itm.getExptime();
-                v->revSeqno = itm.getRevSeqno();
+                v->setFlags(itm.getFlags());
+                v->setExptime(itm.getExptime());
+                v->setRevSeqno(itm.getRevSeqno());
             } else {
                 return INVALID_CAS;
             }
@@ -179,7 +200,7 @@ bool StoredValue::unlocked_restoreMeta(Item *itm, ENGINE_ERROR_CODE status) {
         assert(0 == itm->getValue()->length());
         setRevSeqno(itm->getRevSeqno());
         setCas(itm->getCas());
-        flags = itm->getFlags();
+        setFlags(itm->getFlags());
         setExptime(itm->getExptime());
         setStoredValueState(state_deleted_key);
         return true;
@@ -223,6 +244,94 @@ void HashTable::setDefaultNumLocks(size_t to) {
     }
 }
 
+HashTable::LockStripes::LockStripes(size_t n, bool sequenced) : count(n) {
+    void *p(NULL);
+    if (posix_memalign(&p, CACHE_LINE_SIZE, count * sizeof(HashTableLock)) != 0) {
+        throw std::bad_alloc();
+    }
+    locks = static_cast<HashTableLock*>(p);
+    for (size_t i = 0; i < count; ++i) {
+        new (&locks[i]) HashTableLock();
+        locks[i].setSequenced(sequenced);
+        locks[i].setTracked(true);
+    }
+}
+
+HashTable::LockStripes::~LockStripes() {
+    for (size_t i = 0; i < count; ++i) {
+        locks[i].~HashTableLock();
+    }
+    free(locks);
+}
+
+LockHolder HashTable::getLockedBucketSlow(int h, int *bucket) {
+    // Nothing replaces the locks while we hold this.
+    LockHolder slh(stripesLock);
+    while (true) {
+        *bucket = getBucketForHash(h);
+        LockHolder rv(stripes->forBucket(*bucket));
+        if (*bucket == getBucketForHash(h)) {
+            return rv;
+        }
+    }
+}
+
+HashTable::LockStripes *HashTable::getStableStripes() {
+    // The caller is counted in visitors already, so once a resize
+    // that may have missed it is done with the locks, nobody will
+    // replace them until it's gone.
+    assert(visitors.get() > 0);
+    LockHolder slh(stripesLock);
+    return stripes;
+}
+
+HashTable::LockStripes *HashTable::restripe() {
+    size_t n(n_locks);
+    if (bucketsPerLock != 0) {
+        n = std::max(static_cast<size_t>(1),
+                     std::min(size / bucketsPerLock, std::min(maxLocks, size)));
+    }
+    if (n == n_locks) {
+        return NULL;
+    }
+
+    LockStripes *rv = stripes;
+    LockStripes *ns = new LockStripes(n, optimisticReads);
+    for (size_t i = 0; i < rv->count; ++i) {
+        oldAcquisitions += rv->locks[i].getAcquisitions();
+        oldContentions += rv->locks[i].getContentions();
+    }
+    stats.memOverhead.decr(n_locks * sizeof(HashTableLock));
+    stats.memOverhead.incr(n * sizeof(HashTableLock));
+    assert(stats.memOverhead.get() < GIGANTOR);
+    ++numRestripes;
+
+    // Whoever finds the new locks must find the table they guard
+    // done, too.
+    ep_sync_write_barrier();
+    stripes = ns;
+    n_locks = n;
+    return rv;
+}
+
+void HashTable::getLockStats(HashTableLockStats &rv) {
+    LockHolder slh(stripesLock);
+    rv.locks = stripes->count;
+    rv.acquisitions = oldAcquisitions;
+    rv.contentions = oldContentions;
+    rv.restripes = numRestripes.get();
+    for (size_t i = 0; i < stripes->count; ++i) {
+        size_t contentions = stripes->locks[i].getContentions();
+        rv.acquisitions += stripes->locks[i].getAcquisitions();
+        rv.contentions += contentions;
+        rv.contentionHisto.add(contentions);
+        if (contentions > rv.hottestContentions) {
+            rv.hottest = i;
+            rv.hottestContentions = contentions;
+        }
+    }
+}
+
 HashTableStatVisitor HashTable::clear(bool deactivate) {
     HashTableStatVisitor rv;
 
@@ -230,7 +339,8 @@ HashTableStatVisitor HashTable::clear(bool deactivate) {
         // If not deactivating, assert we're already active.
         assert(isActive());
     }
-    MultiLockHolder mlh(mutexes, n_locks);
+    LockHolder slh(stripesLock);
+    MultiLockHolder mlh(stripes->locks, stripes->count);
     if (deactivate) {
         setActiveState(false);
     }
@@ -238,13 +348,20 @@ HashTableStatVisitor HashTable::clear(bool deactivate) {
         while (values[i]) {
             StoredValue *v = values[i];
             rv.visit(v);
-            values[i] = v->next;
-            delete v;
+            StoredValue::reduceMetaDataSize(*this, stats, v->metaDataSize());
+            values[i] = nextOf(v);
+            retire(v);
+        }
+    }
+    for (int i = 0; i < (int)nextSize; i++) {
+        while (nextValues[i]) {
+            StoredValue *v = nextValues[i];
+            rv.visit(v);
+            StoredValue::reduceMetaDataSize(*this, stats, v->metaDataSize());
+            nextValues[i] = nextOf(v);
+            retire(v);
         }
     }
-
-    stats.currentSize.decr(rv.memSize - rv.valSize);
-    assert(stats.currentSize.get() < GIGANTOR);
 
     numItems.set(0);
     numTempItems.set(0);
@@ -269,8 +386,14 @@ void HashTable::resize(size_t newSize) {
         return;
     }
 
-    MultiLockHolder mlh(mutexes, n_locks);
-    if (visitors.get() > 0) {
+    if (incrementalResize) {
+        startResize(newSize);
+        return;
+    }
+
+    LockHolder slh(stripesLock);
+    MultiLockHolder mlh(stripes->locks, stripes->count);
+    if (visitors.get() > 0 || isResizing()) {
         // Do not allow a resize while any visitors are actually
         // processing.  The next attempt will have to pick it up.  New
         // visitors cannot start doing meaningful work (we own all
@@ -286,7 +409,7 @@ void HashTable::resize(size_t newSize) {
         return;
     }
 
-    stats.memOverhead.decr(memorySize());
+    stats.memOverhead.decr(tableMemorySize());
     ++numResizes;
 
     // Set the new size so all the hashy stuff works.
@@ -298,20 +421,25 @@ void HashTable::resize(size_t newSize) {
     for (size_t i = 0; i < oldSize; i++) {
         while (values[i]) {
             StoredValue *v = values[i];
-            values[i] = v->next;
+            values[i] = nextOf(v);
 
             int newBucket = getBucketForHash(hash(v->getKeyBytes(), v->getKeyLen()));
-            v->next = newValues[newBucket];
+            setNext(v, newValues[newBucket]);
             newValues[newBucket] = v;
         }
     }
 
     // values still points to the old (now empty) table.
-    free(values);
+    StoredValue **oldValues = values;
     values = newValues;
+    retire(oldValues);
 
-    stats.memOverhead.incr(memorySize());
+    stats.memOverhead.incr(tableMemorySize());
     assert(stats.memOverhead.get() < GIGANTOR);
+
+    LockStripes *oldStripes = restripe();
+    mlh.unlock();
+    retire(oldStripes);
 }
 
 static size_t distance(size_t a, size_t b) {
@@ -327,6 +455,367 @@ static bool isCurrently(size_t size, ssize_t a, ssize_t b) {
     return (current == a || current == b);
 }
 
+void HashTable::startResize(size_t newSize) {
+    LockHolder rlh(resizeLock);
+    if (isResizing()) {
+        // Let the migration in progress finish first.
+        return;
+    }
+
+    StoredValue **newValues = static_cast<StoredValue**>(calloc(newSize,
+                                                                sizeof(StoredValue*)));
+    if (!newValues) {
+        return;
+    }
+
+    // Nothing is moved here, but the tables may only change shape
+    // while no visitors are walking them.
+    LockHolder slh(stripesLock);
+    MultiLockHolder mlh(stripes->locks, stripes->count);
+    if (visitors.get() > 0) {
+        free(newValues);
+        return;
+    }
+
+    stats.memOverhead.incr(newSize * sizeof(StoredValue*));
+    assert(stats.memOverhead.get() < GIGANTOR);
+    nextValues = newValues;
+    migrated.set(0);
+    nextSize = newSize;
+}
+
+bool HashTable::resizeStep(hrtime_t limit) {
+    LockHolder rlh(resizeLock);
+    if (!isActive() || !isResizing()) {
+        return false;
+    }
+
+    hrtime_t start = gethrtime();
+    while (migrated.get() < size) {
+        if (!migrateBucket(migrated.get())) {
+            // A walk is halfway across the chain, try again later.
+            return true;
+        }
+        if (gethrtime() - start >= limit) {
+            break;
+        }
+    }
+
+    if (migrated.get() == size) {
+        completeResize();
+    }
+    return isResizing();
+}
+
+bool HashTable::migrateBucket(size_t bucket_num) {
+    // Lock the bucket and every bucket its chain is moving to.  The
+    // locks are always taken in ascending order so we can't deadlock
+    // against MultiLockHolder.
+    LockHolder slh(stripesLock);
+    std::set<int> needed;
+    needed.insert(mutexForBucket(static_cast<int>(bucket_num)));
+    while (true) {
+        std::list<LockHolder> lhs;
+        std::set<int>::iterator it;
+        for (it = needed.begin(); it != needed.end(); ++it) {
+            lhs.push_back(LockHolder(stripes->locks[*it]));
+        }
+
+        bool covered = true;
+        for (StoredValue *v = values[bucket_num]; v; v = nextOf(v)) {
+            int h = hash(v->getKeyBytes(), v->getKeyLen());
+            int newBucket = abs(h % static_cast<int>(nextSize));
+            if (needed.insert(mutexForBucket(newBucket)).second) {
+                covered = false;
+            }
+        }
+        if (!covered) {
+            // The chain changed while we were unlocked; take the
+            // whole set again.
+            continue;
+        }
+
+        if (straddlesWalk(needed)) {
+            return false;
+        }
+
+        while (values[bucket_num]) {
+            StoredValue *v = values[bucket_num];
+            values[bucket_num] = nextOf(v);
+
+            int h = hash(v->getKeyBytes(), v->getKeyLen());
+            int newBucket = abs(h % static_cast<int>(nextSize));
+            setNext(v, nextValues[newBucket]);
+            nextValues[newBucket] = v;
+        }
+        migrated.set(bucket_num + 1);
+        return true;
+    }
+}
+
+bool HashTable::straddlesWalk(const std::set<int> &lockNums) {
+    LockHolder wlh(walksLock);
+    std::list<Walk*>::iterator it;
+    for (it = walks.begin(); it != walks.end(); ++it) {
+        size_t done = (*it)->done.get();
+        size_t numVisited = 0;
+        std::set<int>::const_iterator l;
+        for (l = lockNums.begin(); l != lockNums.end(); ++l) {
+            size_t pos = (*l + n_locks - (*it)->start) % n_locks;
+            if (pos < done) {
+                ++numVisited;
+            }
+        }
+        if (numVisited != 0 && numVisited != lockNums.size()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+HashTable::WalkTracker::WalkTracker(HashTable &h, size_t start) :
+    walk(start), ht(h) {
+    LockHolder wlh(ht.walksLock);
+    ht.walks.push_back(&walk);
+}
+
+HashTable::WalkTracker::~WalkTracker() {
+    LockHolder wlh(ht.walksLock);
+    ht.walks.remove(&walk);
+}
+
+void HashTable::completeResize() {
+    LockHolder slh(stripesLock);
+    MultiLockHolder mlh(stripes->locks, stripes->count);
+    if (visitors.get() > 0) {
+        return;
+    }
+
+    stats.memOverhead.decr(size * sizeof(StoredValue*));
+    assert(stats.memOverhead.get() < GIGANTOR);
+    ++numResizes;
+
+    // Every chain lives in nextValues at this point.
+    StoredValue **oldValues = values;
+    values = nextValues;
+    size = nextSize;
+    nextValues = NULL;
+    nextSize = 0;
+    migrated.set(0);
+    retire(oldValues);
+
+    LockStripes *oldStripes = restripe();
+    mlh.unlock();
+    retire(oldStripes);
+}
+
+bool HashTable::optimisticFind(const std::string &key, HashTableReader &reader,
+                               bool wantsDeleted, bool trackReference) {
+    if (!optimisticReads) {
+        return false;
+    }
+    assert(isActive());
+    ReadSection rs;
+    if (!rs.isEntered()) {
+        return false;
+    }
+
+    int h = hash(key.data(), key.size());
+    LockStripes *s = stripes;
+    int bucket_num = getBucketForHash(h);
+    Mutex &lock = s->forBucket(bucket_num);
+    uint32_t generation = lock.getGeneration();
+    ep_sync_read_barrier();
+    if (generation & 1) {
+        ++stats.numOptimisticReadFallbacks;
+        return false;
+    }
+
+    // The bucket number and the table it lives in only go together
+    // if no resize got in between.  Once the locks were replaced,
+    // writers use the new ones, so the old one can't tell us anything.
+    StoredValue **table = bucket_num >= 0 ? values : nextValues;
+    int index = bucket_num >= 0 ? bucket_num : -bucket_num - 1;
+    bool consistent = bucket_num == getBucketForHash(h);
+    ep_sync_read_barrier();
+    consistent = consistent && lock.getGeneration() == generation &&
+        s == stripes;
+
+    StoredValue *v = consistent ? table[index] : NULL;
+    for (size_t hops = 1; v && !v->hasKey(key); ++hops) {
+        v = nextOf(v);
+        // A chain changing under us may lead anywhere, so check every
+        // now and then that it still is the one we started on.
+        if (hops % 64 == 0) {
+            ep_sync_read_barrier();
+            if (lock.getGeneration() != generation || s != stripes) {
+                consistent = false;
+                break;
+            }
+        }
+    }
+
+    if (consistent && v) {
+        if (v->isDeleted()) {
+            if (!wantsDeleted) {
+                v = NULL;
+            }
+        } else if (trackReference && v->getNRUValue() > MIN_NRU_VALUE) {
+            // Tracking the reference means writing to the item.
+            return false;
+        }
+    }
+
+    if (!consistent || !reader.read(v)) {
+        if (!consistent) {
+            ++stats.numOptimisticReadFallbacks;
+        }
+        return false;
+    }
+
+    ep_sync_read_barrier();
+    if (lock.getGeneration() != generation || s != stripes) {
+        reader.discard();
+        ++stats.numOptimisticReadFallbacks;
+        return false;
+    }
+    return true;
+}
+
+size_t HashTable::visitKeys(const std::vector<std::string> &keys,
+                            HashTableKeyVisitor &visitor) {
+    assert(isActive());
+    // Order the keys by the lock they need right now.  Should the
+    // table be resized meanwhile, a lock is just taken more often.
+    std::vector<int> hashes(keys.size());
+    std::vector<std::pair<size_t, size_t> > order;
+    order.reserve(keys.size());
+    size_t numLocks = n_locks;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        hashes[i] = hash(keys[i]);
+        int bucket_num = getBucketForHash(hashes[i]);
+        if (bucket_num < 0) {
+            bucket_num = -bucket_num - 1;
+        }
+        order.push_back(std::make_pair(bucket_num % numLocks, i));
+    }
+    std::sort(order.begin(), order.end());
+
+    size_t acquisitions(0);
+    size_t i(0);
+    while (i < order.size()) {
+        int bucket_num(0);
+        LockHolder lh = getLockedBucket(hashes[order[i].second], &bucket_num);
+        ++acquisitions;
+        // Nothing replaces the locks or moves the buckets they cover
+        // while we hold one of them.
+        Mutex &held = stripes->forBucket(bucket_num);
+        visitor.visit(order[i].second, bucket_num);
+        for (++i; i < order.size(); ++i) {
+            bucket_num = getBucketForHash(hashes[order[i].second]);
+            if (&stripes->forBucket(bucket_num) != &held) {
+                break;
+            }
+            visitor.visit(order[i].second, bucket_num);
+        }
+    }
+    return acquisitions;
+}
+
+void HashTable::retire(StoredValue *v) {
+    if (!optimisticReads) {
+        delete v;
+        return;
+    }
+    Retired r;
+    r.sv = v;
+    addRetired(r);
+}
+
+void HashTable::retire(StoredValue **table) {
+    if (!optimisticReads) {
+        free(table);
+        return;
+    }
+    Retired r;
+    r.table = table;
+    addRetired(r);
+}
+
+void HashTable::retire(LockStripes *locks) {
+    if (!locks) {
+        return;
+    }
+    // getLockedBucket() may be waiting on these even without
+    // optimistic reads.
+    Retired r;
+    r.locks = locks;
+    addRetired(r);
+    reclaim(false);
+}
+
+void HashTable::retireValue(value_t &value) {
+    if (!optimisticReads || !value) {
+        value.reset();
+        return;
+    }
+    bool full;
+    {
+        LockHolder lh(retireLock);
+        retired.push_back(Retired());
+        Retired &r = retired.back();
+        r.value = value;
+        value.reset();
+        ep_sync_synchronize();
+        r.epoch = ReadEpoch::current();
+        full = retired.size() >= reclaimAt;
+    }
+    if (full) {
+        reclaim(false);
+    }
+}
+
+void HashTable::addRetired(Retired &r) {
+    bool full;
+    {
+        LockHolder lh(retireLock);
+        r.epoch = ReadEpoch::current();
+        retired.push_back(r);
+        full = retired.size() >= reclaimAt;
+    }
+    if (full) {
+        reclaim(false);
+    }
+}
+
+void HashTable::reclaim(bool wait) {
+    while (true) {
+        std::vector<Retired> done;
+        bool drained;
+        {
+            LockHolder lh(retireLock);
+            uint64_t oldest = ReadEpoch::oldest();
+            while (!retired.empty() && retired.front().epoch < oldest) {
+                done.push_back(retired.front());
+                retired.pop_front();
+            }
+            reclaimAt = retired.size() + RECLAIM_BATCH;
+            drained = retired.empty();
+        }
+
+        std::vector<Retired>::iterator it;
+        for (it = done.begin(); it != done.end(); ++it) {
+            delete it->sv;
+            free(it->table);
+            delete it->locks;
+        }
+        if (drained || !wait) {
+            return;
+        }
+        usleep(100);
+    }
+}
+
 void HashTable::resize() {
     size_t ni = getNumItems();
     int i(0);
@@ -361,25 +850,94 @@ void HashTable::visit(HashTableVisitor &visitor) {
         return;
     }
     VisitorTracker vt(&visitors);
+    LockStripes *s = getStableStripes();
+    WalkTracker wt(*this, 0);
     bool aborted = !visitor.shouldContinue();
     size_t visited = 0;
     for (int l = 0; isActive() && !aborted && l < static_cast<int>(n_locks); l++) {
-        LockHolder lh(mutexes[l]);
-        for (int i = l; i < static_cast<int>(size); i+= n_locks) {
-            assert(l == mutexForBucket(i));
-            StoredValue *v = values[i];
-            assert(v == NULL || i == getBucketForHash(hash(v->getKeyBytes(),
-                                                           v->getKeyLen())));
-            while (v) {
-                visitor.visit(v);
-                v = v->next;
-            }
-            ++visited;
-        }
-        lh.unlock();
+        visited += visitLock(visitor, s, l, wt.walk);
         aborted = !visitor.shouldContinue();
     }
-    assert(aborted || visited == size);
+    assert(aborted || visited == size + nextSize);
+}
+
+size_t HashTable::visitLocks(HashTableVisitor &visitor, size_t start,
+                             size_t count) {
+    if ((numItems.get() + numTempItems.get()) == 0 || !isActive()) {
+        return start;
+    }
+    VisitorTracker vt(&visitors);
+    LockStripes *s = getStableStripes();
+    size_t l = start % n_locks;
+    if (count == 0 || count > n_locks) {
+        count = n_locks;
+    }
+    WalkTracker wt(*this, l);
+    for (size_t i = 0; isActive() && i < count && visitor.shouldContinue(); ++i) {
+        visitLock(visitor, s, static_cast<int>(l), wt.walk);
+        l = (l + 1) % n_locks;
+    }
+    return l;
+}
+
+void HashTable::visitChain(HashTableVisitor &visitor, size_t chain) {
+    if ((numItems.get() + numTempItems.get()) == 0 || !isActive()) {
+        return;
+    }
+    VisitorTracker vt(&visitors);
+    LockStripes *s = getStableStripes();
+    int l = static_cast<int>(chain % n_locks);
+    LockHolder lh(s->locks[l]);
+    // The chains under the lock are numbered as in visitLock(): those
+    // of the old table, then those of the one being resized to.
+    size_t inOld = (size + n_locks - 1 - l) / n_locks;
+    size_t inNext = (nextSize + n_locks - 1 - l) / n_locks;
+    if (inOld + inNext == 0) {
+        return;
+    }
+    size_t n = (chain / n_locks) % (inOld + inNext);
+    StoredValue *v;
+    if (n < inOld) {
+        v = values[l + n * n_locks];
+    } else {
+        v = nextValues[l + (n - inOld) * n_locks];
+    }
+    while (v) {
+        visitor.visit(v);
+        v = nextOf(v);
+    }
+}
+
+size_t HashTable::visitLock(HashTableVisitor &visitor, LockStripes *s, int l,
+                            Walk &walk) {
+    size_t visited = 0;
+    LockHolder lh(s->locks[l]);
+    // Chains still in the old table, then the ones already moved
+    // to the table an incremental resize is filling.
+    for (int i = l; i < static_cast<int>(size); i+= n_locks) {
+        assert(l == mutexForBucket(i));
+        StoredValue *v = values[i];
+        assert(v == NULL || i == getBucketForHash(hash(v->getKeyBytes(),
+                                                       v->getKeyLen())));
+        while (v) {
+            visitor.visit(v);
+            v = nextOf(v);
+        }
+        ++visited;
+    }
+    for (int i = l; i < static_cast<int>(nextSize); i+= n_locks) {
+        assert(l == mutexForBucket(-i - 1));
+        StoredValue *v = nextValues[i];
+        assert(v == NULL || -i - 1 == getBucketForHash(hash(v->getKeyBytes(),
+                                                            v->getKeyLen())));
+        while (v) {
+            visitor.visit(v);
+            v = nextOf(v);
+        }
+        ++visited;
+    }
+    ++walk.done;
+    return visited;
 }
 
 void HashTable::visitDepth(HashTableDepthVisitor &visitor) {
@@ -388,10 +946,17 @@ void HashTable::visitDepth(HashTableDepthVisitor &visitor) {
     }
     size_t visited = 0;
     VisitorTracker vt(&visitors);
+    LockStripes *s = getStableStripes();
+    WalkTracker wt(*this, 0);
 
     for (int l = 0; l < static_cast<int>(n_locks); l++) {
-        LockHolder lh(mutexes[l]);
+        LockHolder lh(s->locks[l]);
         for (int i = l; i < static_cast<int>(size); i+= n_locks) {
+            ++visited;
+            if (nextSize != 0 && static_cast<size_t>(i) < migrated.get()) {
+                // Already moved; reported with the new table below.
+                continue;
+            }
             size_t depth = 0;
             StoredValue *p = values[i];
             assert(p == NULL || i == getBucketForHash(hash(p->getKeyBytes(),
@@ -400,14 +965,26 @@ void HashTable::visitDepth(HashTableDepthVisitor &visitor) {
             while (p) {
                 depth++;
                 mem += p->size();
-                p = p->next;
+                p = nextOf(p);
             }
             visitor.visit(i, depth, mem);
+        }
+        for (int i = l; i < static_cast<int>(nextSize); i+= n_locks) {
+            size_t depth = 0;
+            StoredValue *p = nextValues[i];
+            size_t mem(0);
+            while (p) {
+                depth++;
+                mem += p->size();
+                p = nextOf(p);
+            }
+            visitor.visit(-i - 1, depth, mem);
             ++visited;
         }
+        ++wt.walk.done;
     }
 
-    assert(visited == size);
+    assert(visited == size + nextSize);
 }
 
 add_type_t HashTable::unlocked_add(int &bucket_num,
@@ -434,8 +1011,8 @@ add_type_t HashTable::unlocked_add(int &bucket_num,
                 v->markClean();
             }
         } else {
-            v = valFact(itm, values[bucket_num], *this, isDirty);
-            values[bucket_num] = v;
+            v = valFact(itm, bucketHead(bucket_num), *this, isDirty);
+            bucketHead(bucket_num) = v;
 
             if (v->isTempItem()) {
                 ++numTempItems;
@@ -456,7 +1033,7 @@ add_type_t HashTable::unlocked_add(int &bucket_num,
             v->ejectValue(stats, *this);
         }
         if (v->isTempItem()) {
-            v->resetValue();
+            v->resetValue(*this);
             v->setNRUValue(MAX_NRU_VALUE);
         }
     }
@@ -500,6 +1077,10 @@ void StoredValue::reduceCacheSize(HashTable &ht, size_t by) {
     assert(ht.memSize.get() < GIGANTOR);
 }
 
+void StoredValue::releaseValue(HashTable &ht) {
+    ht.retireValue(value);
+}
+
 void StoredValue::increaseMetaDataSize(HashTable &ht, EPStats &st, size_t by) {
     ht.metaDataMemory.incr(by);
     assert(ht.metaDataMemory.get() < GIGANTOR);
@@ -519,14 +1100,14 @@ void StoredValue::reduceMetaDataSize(HashTable &ht, EPStats &st, size_t by) {
  */
 bool StoredValue::hasAvailableSpace(EPStats &st, const Item &itm) {
     double newSize = static_cast<double>(st.getTotalMemoryUsed() +
-                                         sizeof(StoredValue) + itm.getNKey());
+                                         StoredValue::sizeForKey(itm.getNKey()));
     double maxSize=  static_cast<double>(st.getMaxDataSize()) * mutation_mem_threshold;
     return newSize <= maxSize;
 }
 
-Item* StoredValue::toItem(bool lck, uint16_t vbucket) const {
-    return new Item(getKey(), getFlags(), getExptime(),
-                    value,
-                    lck ? static_cast<uint64_t>(-1) : getCas(),
-                    bySeqno, vbucket, getRevSeqno());
+Item* StoredValue::toItem(bool lck, uint16_t vbucket, ItemPool &pool) const {
+    return pool.newItem(getKeyBytes(), getKeyLen(), getFlags(), getExptime(),
+                        value,
+                        lck ? static_cast<uint64_t>(-1) : getCas(),
+                        bySeqno, vbucket, getRevSeqno());
 }
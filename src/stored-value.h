@@ -23,14 +23,20 @@
 #include <algorithm>
 #include <climits>
 #include <cstring>
+#include <deque>
+#include <list>
+#include <set>
 #include <string>
+#include <vector>
 
 #include "common.h"
 #include "ep_time.h"
 #include "histo.h"
 #include "item.h"
 #include "locks.h"
+#include "slab_allocator.h"
 #include "queueditem.h"
+#include "read_epoch.h"
 #include "stats.h"
 
 // Max value for NRU bits
@@ -39,21 +45,73 @@ const uint8_t MAX_NRU_VALUE = 3;
 const uint8_t INITIAL_NRU_VALUE = 2;
 // Min value for NRU bits
 const uint8_t MIN_NRU_VALUE = 0;
+// NRU class of an item that isn't in the access log
+const uint8_t NO_LOGGED_NRU_VALUE = 0xff;
 
 // Forward declaration for StoredValue
 class HashTable;
+class StoredValue;
 class StoredValueFactory;
 
+/**
+ * The allocator a HashTable carves its StoredValues from.
+ *
+ * With the compact layout it also hands out the extension records of
+ * the items that need one, and charges them to the table it belongs
+ * to.  Each HashTable, and so each engine, has its own.
+ */
+class StoredValueAllocator : public SlabAllocator {
+public:
+
+    StoredValueAllocator(size_t slabSz, size_t maxChunkSize,
+                         HashTable &ht, EPStats &st)
+#ifdef COMPACT_STORED_VALUE
+        : SlabAllocator(slabSz, maxChunkSize, &st.memOverhead, true),
+#else
+        : SlabAllocator(slabSz, maxChunkSize, &st.memOverhead),
+#endif
+          table(ht), stats(st) { }
+
+    HashTable &table;
+    EPStats   &stats;
+};
+
 /**
  * In-memory storage for an item.
  */
 class StoredValue {
 public:
 
+    //! Size of the slabs StoredValue instances are carved from.
+    static const size_t slabSize = 4096;
+
     void operator delete(void* p) {
-        ::operator delete(p);
+        SlabAllocator::deallocate(p, slabSize);
      }
 
+    ~StoredValue() {
+#ifdef COMPACT_STORED_VALUE
+        if (extension) {
+            Extension *ext = getExtension();
+            SlabAllocator::forget(ext, slabSize, sizeof(Extension));
+            SlabAllocator::deallocate(ext, slabSize);
+        }
+#endif
+        SlabAllocator::forget(this, slabSize, sizeForKey(getKeyLen()));
+    }
+
+    /**
+     * Get the number of bytes needed for a StoredValue with a key of
+     * the given length.
+     */
+    static size_t sizeForKey(size_t len) {
+#ifdef COMPACT_STORED_VALUE
+        return sizeof(StoredValue) - inlineKeyBytes + len;
+#else
+        return sizeof(StoredValue) + len;
+#endif
+    }
+
     uint8_t getNRUValue();
 
     void setNRUValue(uint8_t nru_val);
@@ -62,6 +120,22 @@ public:
 
     void referenced();
 
+    /**
+     * Get the NRU class this item was last written to the access log
+     * with, or NO_LOGGED_NRU_VALUE if the log doesn't have it.
+     */
+    uint8_t getLoggedNRUValue() const {
+        return loggedNRU == 0 ? NO_LOGGED_NRU_VALUE : loggedNRU - 1;
+    }
+
+    /**
+     * Remember the NRU class this item was written to the access log
+     * with (NO_LOGGED_NRU_VALUE if it was left out).
+     */
+    void setLoggedNRUValue(uint8_t nru_val) {
+        loggedNRU = nru_val <= MAX_NRU_VALUE ? nru_val + 1 : 0;
+    }
+
     /**
      * Mark this item as needing to be persisted.
      */
@@ -169,11 +243,21 @@ public:
      * @return the expiration time for feature items, 0 for small items
      */
     time_t getExptime() const {
+#ifdef COMPACT_STORED_VALUE
+        return extension ? getExtension()->exptime : 0;
+#else
         return exptime;
+#endif
     }
 
     void setExptime(time_t tim) {
+#ifdef COMPACT_STORED_VALUE
+        if (tim != 0 || extension) {
+            extend()->exptime = tim;
+        }
+#else
         exptime = tim;
+#endif
         markDirty();
     }
 
@@ -183,14 +267,24 @@ public:
      * @return the flags for feature items, 0 for small items
      */
     uint32_t getFlags() const {
+#ifdef COMPACT_STORED_VALUE
+        return extension ? getExtension()->flags : 0;
+#else
         return flags;
+#endif
     }
 
     /**
      * Set the client-defined flags for this item.
      */
     void setFlags(uint32_t fl) {
+#ifdef COMPACT_STORED_VALUE
+        if (fl != 0 || extension) {
+            extend()->flags = fl;
+        }
+#else
         flags = fl;
+#endif
     }
 
     /**
@@ -203,17 +297,18 @@ public:
     void setValue(Item &itm, HashTable &ht, bool preserveSeqno) {
         size_t currSize = size();
         reduceCacheSize(ht, currSize);
+        releaseValue(ht);
         value = itm.getValue();
         deleted = false;
-        flags = itm.getFlags();
+        setFlags(itm.getFlags());
 
         cas = itm.getCas();
-        exptime = itm.getExptime();
+        setExptime(itm.getExptime());
         if (preserveSeqno) {
-            revSeqno = itm.getRevSeqno();
+            setRevSeqno(itm.getRevSeqno());
         } else {
-            ++revSeqno;
-            itm.setRevSeqno(revSeqno);
+            setRevSeqno(getRevSeqno() + 1);
+            itm.setRevSeqno(getRevSeqno());
         }
 
         markDirty();
@@ -223,10 +318,12 @@ public:
 
     /**
      * Reset the value of this item.
+     *
+     * @param ht the hashtable that contains this StoredValue instance
      */
-    void resetValue() {
+    void resetValue(HashTable &ht) {
         assert(!isDeleted());
-        markNotResident();
+        markNotResident(ht);
         // item no longer resident once reset the value
         deleted = true;
     }
@@ -279,14 +376,24 @@ public:
      * This is a NOOP for small item types.
      */
     void lock(rel_time_t expiry) {
+#ifdef COMPACT_STORED_VALUE
+        extend()->lockExpiry = expiry;
+#else
         lock_expiry = expiry;
+#endif
     }
 
     /**
      * Unlock this item.
      */
     void unlock() {
+#ifdef COMPACT_STORED_VALUE
+        if (extension) {
+            getExtension()->lockExpiry = 0;
+        }
+#else
         lock_expiry = 0;
+#endif
     }
 
     /**
@@ -315,7 +422,7 @@ public:
      * It is an error to set an ID on an item that already has one.
      */
     void setBySeqno(int64_t to) {
-        bySeqno = to;
+        bySeqno = checkedBySeqno(to);
         assert(hasBySeqno());
     }
 
@@ -409,11 +516,25 @@ public:
      * @return the amount of memory used by this item.
      */
     size_t size() {
-        return sizeof(StoredValue) + getKeyLen() + valuelen();
+        return sizeForKey(getKeyLen()) + valuelen();
     }
 
     size_t metaDataSize() {
-        return sizeof(StoredValue) + getKeyLen();
+#ifdef COMPACT_STORED_VALUE
+        if (extension) {
+            return sizeForKey(getKeyLen()) + sizeof(Extension);
+        }
+#endif
+        return sizeForKey(getKeyLen());
+    }
+
+    /**
+     * True if this item carries a lock, expired or not.
+     *
+     * Unlike isLocked() this never changes the item.
+     */
+    bool hasLock() const {
+        return getLockExpiry() != 0;
     }
 
     /**
@@ -423,8 +544,9 @@ public:
      * @return true if the item is locked
      */
     bool isLocked(rel_time_t curtime) {
-        if (lock_expiry == 0 || (curtime > lock_expiry)) {
-            lock_expiry = 0;
+        rel_time_t lockExpiry = getLockExpiry();
+        if (lockExpiry == 0 || (curtime > lockExpiry)) {
+            unlock();
             return false;
         }
         return true;
@@ -437,8 +559,13 @@ public:
         return value.get() != NULL;
     }
 
-    void markNotResident() {
-        value.reset();
+    /**
+     * Drop the value of this item.
+     *
+     * @param ht the hashtable that contains this StoredValue instance
+     */
+    void markNotResident(HashTable &ht) {
+        releaseValue(ht);
     }
 
     /**
@@ -457,7 +584,7 @@ public:
         }
 
         reduceCacheSize(ht, valuelen());
-        resetValue();
+        resetValue(ht);
         markDirty();
         if (!isMetaDelete) {
             setCas(getCas() + 1);
@@ -466,14 +593,33 @@ public:
 
 
     uint64_t getRevSeqno() const {
+#ifdef COMPACT_STORED_VALUE
+        uint64_t high = extension ? getExtension()->revSeqnoHigh : 0;
+        return (high << revSeqnoLowBits) | revSeqno;
+#else
         return revSeqno;
+#endif
     }
 
     /**
      * Set a new revision sequence number.
+     *
+     * The compact layout keeps 48 bits of it; larger numbers stick at
+     * the largest one it can hold.
      */
     void setRevSeqno(uint64_t s) {
+#ifdef COMPACT_STORED_VALUE
+        if (s > maxRevSeqno) {
+            s = maxRevSeqno;
+        }
+        revSeqno = s & ((static_cast<uint64_t>(1) << revSeqnoLowBits) - 1);
+        if ((s >> revSeqnoLowBits) != 0 || extension) {
+            extend()->revSeqnoHigh =
+                static_cast<uint32_t>(s >> revSeqnoLowBits);
+        }
+#else
         revSeqno = s;
+#endif
     }
 
 
@@ -482,8 +628,10 @@ public:
      *
      * @param lck if true, the new item will return a locked CAS ID.
      * @param vbucket the vbucket containing this item.
+     * @param pool where to get the item from; it shares this object's
+     *             value rather than copying it
      */
-    Item *toItem(bool lck, uint16_t vbucket) const;
+    Item *toItem(bool lck, uint16_t vbucket, ItemPool &pool) const;
 
     /**
      * Set the memory threshold on the current bucket quota for accepting a new mutation
@@ -508,15 +656,31 @@ private:
 
     StoredValue(const Item &itm, StoredValue *n, EPStats &stats, HashTable &ht,
                 bool setDirty = true) :
+#ifdef COMPACT_STORED_VALUE
+        // The factory links compact instances into the chain.
+        value(itm.getValue()), bySeqno(checkedBySeqno(itm.getBySeqno())),
+        revSeqno(0), next(0), extension(0) {
+        (void)n;
+#else
         value(itm.getValue()), next(n), bySeqno(itm.getBySeqno()),
         flags(itm.getFlags()) {
-        cas = itm.getCas();
+        lock_expiry = 0;
         exptime = itm.getExptime();
+        revSeqno = itm.getRevSeqno();
+#endif
+        cas = itm.getCas();
         deleted = false;
         nru = INITIAL_NRU_VALUE;
-        lock_expiry = 0;
+        loggedNRU = 0;
         keylen = itm.getKey().length();
-        revSeqno = itm.getRevSeqno();
+
+        increaseMetaDataSize(ht, stats, metaDataSize());
+#ifdef COMPACT_STORED_VALUE
+        // An extension record is charged as it's added.
+        setFlags(itm.getFlags());
+        setExptime(itm.getExptime());
+        setRevSeqno(itm.getRevSeqno());
+#endif
 
         if (setDirty) {
             markDirty();
@@ -524,13 +688,80 @@ private:
             markClean();
         }
 
-        increaseMetaDataSize(ht, stats, metaDataSize());
         increaseCacheSize(ht, size());
     }
 
+    /**
+     * Get the time the lock on this item expires at (0 if unlocked).
+     */
+    rel_time_t getLockExpiry() const {
+#ifdef COMPACT_STORED_VALUE
+        return extension ? getExtension()->lockExpiry : 0;
+#else
+        return lock_expiry;
+#endif
+    }
+
+    /**
+     * Check a sequence number fits the bits the layout keeps for it.
+     */
+    static int64_t checkedBySeqno(int64_t s) {
+#ifdef COMPACT_STORED_VALUE
+        assert(s <= maxBySeqno && s >= -maxBySeqno);
+#endif
+        return s;
+    }
+
     friend class HashTable;
     friend class StoredValueFactory;
 
+#ifdef COMPACT_STORED_VALUE
+    /*
+     * Compact layout: the chain is linked by slab handles, the by
+     * sequence number is packed into 48 bits next to the low bits of
+     * the revision number, and what most items go without (an
+     * expiry, flags, a lock or a long revision history) lives in an
+     * extension record allocated the first time it's needed.  The
+     * fixed part of an item without one is 34 bytes rather than 56;
+     * the CAS keeps all of its 64 bits, as replicated items may carry
+     * any value there.
+     */
+    struct Extension {
+        uint32_t           exptime;        //!< Expiration time of this item.
+        uint32_t           flags;          //!< Client-defined flags.
+        rel_time_t         lockExpiry;     //!< getl lock expiration
+        uint32_t           revSeqnoHigh;   //!< Revision number above the low bits
+    };
+
+    static const size_t inlineKeyBytes = 6;
+    static const size_t revSeqnoLowBits = 16;
+    static const int64_t maxBySeqno = (static_cast<int64_t>(1) << 47) - 1;
+    static const uint64_t maxRevSeqno = (static_cast<uint64_t>(1) << 48) - 1;
+
+    value_t            value;          //!< NULL while the value is ejected
+    uint64_t           cas;            //!< CAS identifier.
+    int64_t            bySeqno   : 48; //!< By sequence id number
+    uint64_t           revSeqno  : 16; //!< Low bits of the revision number
+    uint32_t           next;           //!< Slab handle of the next item
+    uint32_t           extension;      //!< Slab handle of the Extension, or 0
+    uint8_t            keylen;
+    bool               _isDirty  :  1;
+    bool               deleted   :  1;
+    uint8_t            nru       :  2; //!< True if referenced since last sweep
+    uint8_t            loggedNRU :  3; //!< NRU class in the access log + 1
+    char               keybytes[inlineKeyBytes]; //!< The key itself.
+
+    StoredValueAllocator &allocator() const {
+        return *static_cast<StoredValueAllocator*>(
+            SlabAllocator::ownerOf(this, slabSize));
+    }
+
+    Extension *getExtension() const {
+        return static_cast<Extension*>(allocator().fromHandle(extension));
+    }
+
+    Extension *extend();
+#else
     value_t            value;          // 16 bytes
     StoredValue        *next;          // 8 bytes
     uint64_t           cas;            //!< CAS identifier.
@@ -542,13 +773,16 @@ private:
     bool               _isDirty  :  1; // 1 bit
     bool               deleted   :  1;
     uint8_t            nru       :  2; //!< True if referenced since last sweep
+    uint8_t            loggedNRU :  3; //!< NRU class in the access log + 1
     uint8_t            keylen;
     char               keybytes[1];    //!< The key itself.
+#endif
 
     static void increaseMetaDataSize(HashTable &ht, EPStats &st, size_t by);
     static void reduceMetaDataSize(HashTable &ht, EPStats &st, size_t by);
     static void increaseCacheSize(HashTable &ht, size_t by);
     static void reduceCacheSize(HashTable &ht, size_t by);
+    void releaseValue(HashTable &ht);
     static bool hasAvailableSpace(EPStats&, const Item &item);
     static double mutation_mem_threshold;
 
@@ -571,6 +805,14 @@ typedef enum {
     NOMEM                       //!< Insufficient memory to store this item.
 } mutation_type_t;
 
+/**
+ * Functions a HashTable may hash its keys with.
+ */
+typedef enum {
+    DJB_HASH,                   //!< Byte at a time DJB hash (the original)
+    WORD_HASH                   //!< Word at a time MurmurHash64A
+} hash_function_t;
+
 /**
  * Result from add operation.
  */
@@ -603,6 +845,50 @@ public:
     virtual bool shouldContinue() { return true; }
 };
 
+/**
+ * Copies what it needs out of an item found by
+ * HashTable::optimisticFind().
+ *
+ * The item is read without its bucket lock, so it may be half way
+ * through being changed.  Whatever was copied out of it is handed back
+ * through discard() unless the lookup turns out not to have raced with
+ * a writer.
+ */
+class HashTableReader {
+public:
+    virtual ~HashTableReader() {}
+
+    /**
+     * Read the item found.  This must not change it.
+     *
+     * @param v the item, or NULL if there is none
+     * @return false if the item can't be served without the lock
+     */
+    virtual bool read(StoredValue *v) = 0;
+
+    /**
+     * Throw away what read() copied out.
+     */
+    virtual void discard() {}
+};
+
+/**
+ * Looks at the items of a batch of keys, each under its bucket lock.
+ */
+class HashTableKeyVisitor {
+public:
+    virtual ~HashTableKeyVisitor() {}
+
+    /**
+     * Called for each key with its bucket locked.  This must not
+     * release the lock.
+     *
+     * @param pos the position of the key in the batch
+     * @param bucket_num the bucket the key belongs in
+     */
+    virtual void visit(size_t pos, int bucket_num) = 0;
+};
+
 /**
  * Hash table visitor that reports the depth of each hashtable bucket.
  */
@@ -639,9 +925,41 @@ public:
         depthHisto.add(depth);
         size += depth;
         memUsed += mem;
+        if (static_cast<size_t>(depth) >= depthCounts.size()) {
+            depthCounts.resize(depth + 1);
+        }
+        ++depthCounts[depth];
+    }
+
+    /**
+     * Get the number of buckets with no items.
+     */
+    size_t emptyBuckets() const {
+        return depthCounts.empty() ? 0 : depthCounts[0];
+    }
+
+    /**
+     * Get the chain length at or below which the given percentage of
+     * the non-empty buckets fall.
+     */
+    size_t chainLengthPercentile(double pct) const {
+        size_t chains(0);
+        for (size_t d = 1; d < depthCounts.size(); ++d) {
+            chains += depthCounts[d];
+        }
+        size_t seen(0);
+        for (size_t d = 1; d < depthCounts.size(); ++d) {
+            seen += depthCounts[d];
+            if (seen >= chains * pct / 100.0) {
+                return d;
+            }
+        }
+        return 0;
     }
 
     Histogram<unsigned int> depthHisto;
+    //! Number of buckets by chain length.
+    std::vector<size_t>     depthCounts;
     size_t                  size;
     size_t                  memUsed;
     int                     min;
@@ -710,8 +1028,11 @@ public:
 
     /**
      * Create a new StoredValueFactory of the given type.
+     *
+     * @param s the global stats reference
+     * @param a the allocator StoredValue instances are carved from
      */
-    StoredValueFactory(EPStats &s) : stats(&s) { }
+    StoredValueFactory(EPStats &s, SlabAllocator &a) : stats(&s), allocator(&a) { }
 
     /**
      * Create a new StoredValue with the given item.
@@ -730,19 +1051,56 @@ private:
 
     StoredValue* newStoredValue(const Item &itm, StoredValue *n, HashTable &ht,
                                 bool setDirty) {
-        size_t base = sizeof(StoredValue);
-
         const std::string &key = itm.getKey();
         assert(key.length() < 256);
-        size_t len = key.length() + base;
+        size_t len = StoredValue::sizeForKey(key.length());
 
-        StoredValue *t = new (::operator new(len))
+        StoredValue *t = new (allocator->allocate(len))
         StoredValue(itm, n, *stats, ht, setDirty);
+#ifdef COMPACT_STORED_VALUE
+        t->next = allocator->toHandle(n);
+#endif
         std::memcpy(t->keybytes, key.data(), key.length());
         return t;
     }
 
     EPStats                *stats;
+    SlabAllocator          *allocator;
+};
+
+/**
+ * One of the locks the buckets of a HashTable are striped over.  It
+ * has its cache lines to itself, so threads taking neighbouring locks
+ * don't keep stealing them from each other.
+ */
+class HashTableLock : public Mutex, private CacheLinePadding<sizeof(Mutex)> {
+};
+
+/**
+ * How contended the locks of a HashTable have been.
+ */
+class HashTableLockStats {
+public:
+
+    HashTableLockStats() : contentionHisto(GrowingWidthGenerator<size_t>(0, 1, 2.0),
+                                           30),
+                           locks(0), acquisitions(0), contentions(0),
+                           hottest(0), hottestContentions(0), restripes(0) {}
+
+    //! Number of locks by how often they had to be waited for.
+    Histogram<size_t> contentionHisto;
+    //! Number of locks the table has now.
+    size_t            locks;
+    //! Acquisitions of all the locks the table ever had.
+    size_t            acquisitions;
+    //! How many of those had to wait for another holder.
+    size_t            contentions;
+    //! The lock that had to be waited for most often.
+    size_t            hottest;
+    //! How often that was.
+    size_t            hottestContentions;
+    //! Number of times the number of locks changed.
+    size_t            restripes;
 };
 
 /**
@@ -758,14 +1116,23 @@ public:
      * @param s the number of hash table buckets
      * @param l the number of locks in the hash table
      */
-    HashTable(EPStats &st, size_t s = 0, size_t l = 0) : stats(st), valFact(st) {
+    HashTable(EPStats &st, size_t s = 0, size_t l = 0)
+        : stats(st),
+          svAllocator(StoredValue::slabSize, StoredValue::sizeForKey(255),
+                      *this, st),
+          valFact(st, svAllocator), hashFunction(defaultHashFunction),
+          optimisticReads(defaultOptimisticReads), reclaimAt(RECLAIM_BATCH) {
         size = HashTable::getNumBuckets(s);
         n_locks = HashTable::getNumLocks(l);
         assert(size > 0);
         assert(n_locks > 0);
         assert(visitors == 0);
         values = static_cast<StoredValue**>(calloc(size, sizeof(StoredValue*)));
-        mutexes = new Mutex[n_locks];
+        nextValues = NULL;
+        nextSize = 0;
+        stripes = new LockStripes(n_locks, optimisticReads);
+        oldAcquisitions = 0;
+        oldContentions = 0;
         activeState = true;
     }
 
@@ -775,15 +1142,51 @@ public:
         while (visitors > 0) {
             usleep(100);
         }
-        delete []mutexes;
+        reclaim(true);
+        delete stripes;
         free(values);
         values = NULL;
+        free(nextValues);
+        nextValues = NULL;
     }
 
+    /**
+     * Get the memory used by the table beyond the sizes of the items
+     * it holds: its buckets and locks, and the slab space the items
+     * don't take (free chunks and the unused ends of chunks).
+     */
     size_t memorySize() {
+        return tableMemorySize() + svAllocator.getFragmentedBytes()
+            + svAllocator.getWastedBytes();
+    }
+
+    /**
+     * Get the memory used by the buckets and locks of the table.
+     *
+     * This is what the table charges to memOverhead; the allocator
+     * charges the slab space the items don't take on its own.
+     */
+    size_t tableMemorySize() {
         return sizeof(HashTable)
-            + (size * sizeof(StoredValue*))
-            + (n_locks * sizeof(Mutex));
+            + ((size + nextSize) * sizeof(StoredValue*))
+            + (n_locks * sizeof(HashTableLock));
+    }
+
+    /**
+     * Get the number of bytes reserved in slabs for StoredValues.
+     */
+    size_t getSlabBytes() { return svAllocator.getSlabBytes(); }
+
+    /**
+     * Get the number of slab bytes handed out to StoredValues.
+     */
+    size_t getSlabUsedBytes() { return svAllocator.getUsedBytes(); }
+
+    /**
+     * Add the usage of each of the item slab classes to the list.
+     */
+    void addSlabClassStats(std::vector<SlabAllocator::ClassStats> &s) {
+        svAllocator.addClassStats(s);
     }
 
     /**
@@ -796,6 +1199,11 @@ public:
      */
     size_t getNumLocks(void) { return n_locks; }
 
+    /**
+     * Get how contended the locks of this hash table have been.
+     */
+    void getLockStats(HashTableLockStats &rv);
+
     /**
      * Get the number of items within this hash table.
      */
@@ -842,9 +1250,44 @@ public:
 
     /**
      * Resize to the specified size.
+     *
+     * When incremental resizing is enabled this only allocates the new
+     * table; the chains are moved over by subsequent calls to
+     * resizeStep().
      */
     void resize(size_t to);
 
+    /**
+     * Move chains from the current table into the table being resized
+     * to, until either everything has been moved or the time limit
+     * expires.  Chains are moved while visitors walk the table, except
+     * for one moving from locks a visitor is done with to locks it
+     * hasn't reached yet (or the other way round), which waits for the
+     * visitor to get past.  The tables are swapped once no visitors
+     * are left.
+     *
+     * @param limit maximum amount of time (in ns) to spend migrating
+     * @return true if the resize is still in progress
+     */
+    bool resizeStep(hrtime_t limit);
+
+    /**
+     * True if an incremental resize is in progress.
+     */
+    bool isResizing() { return nextSize != 0; }
+
+    /**
+     * Get the number of buckets of the table being resized to (0 if
+     * there is no resize in progress).
+     */
+    size_t getResizeTarget() { return nextSize; }
+
+    /**
+     * Get the number of buckets already migrated by the resize in
+     * progress.
+     */
+    size_t getResizeMigrated() { return nextSize != 0 ? migrated.get() : 0; }
+
     /**
      * Find the item with the given key.
      *
@@ -858,6 +1301,34 @@ public:
         return unlocked_find(key, bucket_num, false, trackReference);
     }
 
+    /**
+     * Find the item with the given key without locking its bucket.
+     *
+     * The reader gets to copy what it needs out of the item, which is
+     * only kept if no writer held the bucket lock meanwhile.  Items
+     * whose reference would have to be tracked can't be served this
+     * way.
+     *
+     * @param key the key to find
+     * @param reader receives the item (NULL if not found)
+     * @param wantsDeleted true if soft deleted items should be returned
+     * @param trackReference true if the lookup counts as an access
+     * @return false if the caller has to take the bucket lock instead
+     */
+    bool optimisticFind(const std::string &key, HashTableReader &reader,
+                        bool wantsDeleted = false, bool trackReference = true);
+
+    /**
+     * Visit the buckets of a batch of keys in the order of their locks,
+     * so that a lock covering several of the keys is taken only once.
+     *
+     * @param keys the keys to visit
+     * @param visitor called for every key under its bucket lock
+     * @return the number of times a lock was taken
+     */
+    size_t visitKeys(const std::vector<std::string> &keys,
+                     HashTableKeyVisitor &visitor);
+
     /**
      * Add an item from online restore.
      *
@@ -872,9 +1343,9 @@ public:
             return false;
         }
 
-        StoredValue *v = valFact(itm, values[bucket_num], *this);
+        StoredValue *v = valFact(itm, bucketHead(bucket_num), *this);
         assert(v);
-        values[bucket_num] = v;
+        bucketHead(bucket_num) = v;
         ++numItems;
         if (op == queue_op_del) {
             unlocked_softDelete(v, itm.getCas());
@@ -985,8 +1456,8 @@ public:
                 itm.setCas();
             }
             int bucket_num = getBucketForHash(hash(itm.getKey()));
-            v = valFact(itm, values[bucket_num], *this);
-            values[bucket_num] = v;
+            v = valFact(itm, bucketHead(bucket_num), *this);
+            bucketHead(bucket_num) = v;
             ++numItems;
             if (nru <= MAX_NRU_VALUE && !v->isTempItem()) {
                 v->setNRUValue(nru);
@@ -1154,7 +1625,7 @@ public:
      */
     StoredValue *unlocked_find(const std::string &key, int bucket_num,
                                bool wantsDeleted=false, bool trackReference=true) {
-        StoredValue *v = values[bucket_num];
+        StoredValue *v = bucketHead(bucket_num);
         while (v) {
             if (v->hasKey(key)) {
                 if (trackReference && !v->isDeleted()) {
@@ -1166,7 +1637,7 @@ public:
                     return NULL;
                 }
             }
-            v = v->next;
+            v = nextOf(v);
         }
         return NULL;
     }
@@ -1181,6 +1652,16 @@ public:
      */
     inline int hash(const char *str, const size_t len) {
         assert(isActive());
+        if (hashFunction == WORD_HASH) {
+            return wordHash(str, len);
+        }
+        return djbHash(str, len);
+    }
+
+    /**
+     * The original byte at a time hash.
+     */
+    static inline int djbHash(const char *str, const size_t len) {
         int h=5381;
 
         for(size_t i=0; i < len; i++) {
@@ -1190,6 +1671,47 @@ public:
         return h;
     }
 
+    /**
+     * MurmurHash64A, consuming the key a word at a time.
+     *
+     * Unlike djbHash() every input bit affects every output bit, so
+     * keys differing only in their last few characters (as sequential
+     * keys do) still spread across the whole table.  The result is
+     * never negative.
+     */
+    static inline int wordHash(const char *str, size_t len) {
+        const uint64_t m = 0xc6a4a7935bd1e995ULL;
+        uint64_t h = 0x8445d61a4e774912ULL ^ (len * m);
+
+        while (len >= sizeof(uint64_t)) {
+            uint64_t k;
+            memcpy(&k, str, sizeof(k));
+            k *= m;
+            k ^= k >> 47;
+            k *= m;
+            h ^= k;
+            h *= m;
+            str += sizeof(k);
+            len -= sizeof(k);
+        }
+        const unsigned char *tail = reinterpret_cast<const unsigned char*>(str);
+        switch (len) {
+        case 7: h ^= static_cast<uint64_t>(tail[6]) << 48; // fall through
+        case 6: h ^= static_cast<uint64_t>(tail[5]) << 40; // fall through
+        case 5: h ^= static_cast<uint64_t>(tail[4]) << 32; // fall through
+        case 4: h ^= static_cast<uint64_t>(tail[3]) << 24; // fall through
+        case 3: h ^= static_cast<uint64_t>(tail[2]) << 16; // fall through
+        case 2: h ^= static_cast<uint64_t>(tail[1]) << 8;  // fall through
+        case 1: h ^= static_cast<uint64_t>(tail[0]);
+            h *= m;
+        }
+
+        h ^= h >> 47;
+        h *= m;
+        h ^= h >> 47;
+        return static_cast<int>(h & INT_MAX);
+    }
+
     /**
      * Compute a hash for the given string.
      *
@@ -1211,9 +1733,16 @@ public:
     inline LockHolder getLockedBucket(int h, int *bucket) {
         while (true) {
             assert(isActive());
+            // The locks may be replaced while we wait for one; the read
+            // section keeps the old ones around until we noticed.
+            ReadSection rs;
+            if (!rs.isEntered()) {
+                return getLockedBucketSlow(h, bucket);
+            }
+            LockStripes *s = stripes;
             *bucket = getBucketForHash(h);
-            LockHolder rv(mutexes[mutexForBucket(*bucket)]);
-            if (*bucket == getBucketForHash(h)) {
+            LockHolder rv(s->forBucket(*bucket));
+            if (s == stripes && *bucket == getBucketForHash(h)) {
                 return rv;
             }
         }
@@ -1255,7 +1784,7 @@ public:
      */
     bool unlocked_del(const std::string &key, int bucket_num) {
         assert(isActive());
-        StoredValue *v = values[bucket_num];
+        StoredValue *v = bucketHead(bucket_num);
 
         // Special case empty bucket.
         if (!v) {
@@ -1268,7 +1797,7 @@ public:
                 return false;
             }
 
-            values[bucket_num] = v->next;
+            bucketHead(bucket_num) = nextOf(v);
             StoredValue::reduceCacheSize(*this, v->size());
             StoredValue::reduceMetaDataSize(*this, stats, v->metaDataSize());
             if (v->isTempItem()) {
@@ -1276,18 +1805,18 @@ public:
             } else {
                 --numItems;
             }
-            delete v;
+            retire(v);
             return true;
         }
 
-        while (v->next) {
-            if (v->next->hasKey(key)) {
-                StoredValue *tmp = v->next;
+        while (nextOf(v)) {
+            StoredValue *tmp = nextOf(v);
+            if (tmp->hasKey(key)) {
                 if (!tmp->isDeleted() && tmp->isLocked(ep_current_time())) {
                     return false;
                 }
 
-                v->next = v->next->next;
+                setNext(v, nextOf(tmp));
                 StoredValue::reduceCacheSize(*this, tmp->size());
                 StoredValue::reduceMetaDataSize(*this, stats, tmp->metaDataSize());
                 if (tmp->isTempItem()) {
@@ -1295,10 +1824,10 @@ public:
                 } else {
                     --numItems;
                 }
-                delete tmp;
+                retire(tmp);
                 return true;
             } else {
-                v = v->next;
+                v = tmp;
             }
         }
 
@@ -1323,6 +1852,29 @@ public:
      */
     void visit(HashTableVisitor &visitor);
 
+    /**
+     * Visit the items under a run of locks, starting with the given one
+     * and wrapping around, without sweeping the whole table.
+     *
+     * @param visitor the visitor
+     * @param start the first lock to visit (taken modulo the lock count)
+     * @param count the number of locks to visit (0 for all of them)
+     * @return the lock to start the next run from
+     */
+    size_t visitLocks(HashTableVisitor &visitor, size_t start,
+                      size_t count = 1);
+
+    /**
+     * Visit the items of a single chain, holding only its lock.  Chain
+     * numbers below the table size are its buckets while it isn't
+     * being resized; any number picks some chain, so random ones
+     * sample the table.
+     *
+     * @param visitor the visitor
+     * @param chain the chain to visit (any number)
+     */
+    void visitChain(HashTableVisitor &visitor, size_t chain);
+
     /**
      * Visit all items within this call with a depth visitor.
      */
@@ -1352,6 +1904,52 @@ public:
      */
     static void setDefaultNumLocks(size_t);
 
+    /**
+     * Set the number of buckets per lock that resizes keep the number
+     * of locks at (0 keeps the number of locks a table starts with).
+     */
+    static void setBucketsPerLock(size_t to) {
+        bucketsPerLock = to;
+    }
+
+    /**
+     * Set the most locks a resize may give a table.
+     */
+    static void setMaxLocks(size_t to) {
+        if (to != 0) {
+            maxLocks = to;
+        }
+    }
+
+    /**
+     * Set the hash function used by hash tables created from now on.
+     */
+    static void setDefaultHashFunction(hash_function_t to) {
+        defaultHashFunction = to;
+    }
+
+    /**
+     * Get the hash function used by this hash table.
+     */
+    hash_function_t getHashFunction() const {
+        return hashFunction;
+    }
+
+    /**
+     * Set whether resizes should migrate buckets incrementally.
+     */
+    static void setIncrementalResize(bool to) {
+        incrementalResize = to;
+    }
+
+    /**
+     * Set whether tables created from now on serve optimistic
+     * lookups.
+     */
+    static void setOptimisticReads(bool to) {
+        defaultOptimisticReads = to;
+    }
+
     /**
      * Get the max deleted revision seqno seen so far.
      */
@@ -1387,34 +1985,213 @@ private:
     inline bool isActive() const { return activeState; }
     inline void setActiveState(bool newv) { activeState = newv; }
 
+    /**
+     * The locks the buckets are striped over.
+     */
+    struct LockStripes {
+        LockStripes(size_t n, bool sequenced);
+        ~LockStripes();
+
+        HashTableLock &forBucket(int bucket_num) {
+            if (bucket_num < 0) {
+                bucket_num = -bucket_num - 1;
+            }
+            return locks[bucket_num % count];
+        }
+
+        size_t         count;
+        //! Aligned to a cache line.
+        HashTableLock *locks;
+
+        DISALLOW_COPY_AND_ASSIGN(LockStripes);
+    };
+
     size_t               size;
+    //! Number of locks in stripes.
     size_t               n_locks;
     StoredValue        **values;
-    Mutex               *mutexes;
+    //! Table being resized to while an incremental resize is running.
+    StoredValue        **nextValues;
+    size_t               nextSize;
+    //! Number of buckets in values already moved to nextValues.
+    Atomic<size_t>       migrated;
+    //! Serializes the drivers of an incremental resize.
+    Mutex                resizeLock;
+
+    /**
+     * A walk over the locks in progress: it started at lock start and
+     * is done with the next done locks after it, wrapping around.
+     */
+    struct Walk {
+        explicit Walk(size_t s) : start(s), done(0) {}
+
+        size_t         start;
+        //! Only advanced while holding the lock just visited.
+        Atomic<size_t> done;
+    };
+
+    /**
+     * Registers a walk with the table for as long as it's in scope.
+     */
+    class WalkTracker {
+    public:
+        WalkTracker(HashTable &h, size_t start);
+        ~WalkTracker();
+
+        Walk walk;
+
+    private:
+        HashTable &ht;
+
+        DISALLOW_COPY_AND_ASSIGN(WalkTracker);
+    };
+    friend class WalkTracker;
+
+    //! Walks an incremental resize mustn't move chains across.
+    std::list<Walk*>     walks;
+    Mutex                walksLock;
+    /*
+     * Replaced with a different number of locks by resizes, which
+     * hold all of the current locks and stripesLock while they do.
+     * Anything locking more than one bucket holds stripesLock too.
+     */
+    LockStripes         *stripes;
+    Mutex                stripesLock;
+    //! Counters of the locks replaced so far.
+    size_t               oldAcquisitions;
+    size_t               oldContentions;
+    Atomic<size_t>       numRestripes;
     EPStats&             stats;
+    StoredValueAllocator svAllocator;
     StoredValueFactory   valFact;
+    //! Fixed for the life of the table, as buckets depend on it.
+    const hash_function_t hashFunction;
     Atomic<size_t>       visitors;
     Atomic<size_t>       numItems;
     Atomic<size_t>       numResizes;
     Atomic<size_t>       numTempItems;
     bool                 activeState;
 
+    /**
+     * Something unlinked from the table that optimistic readers may
+     * still be looking at.
+     */
+    struct Retired {
+        Retired() : epoch(0), sv(NULL), table(NULL), locks(NULL) {}
+
+        uint64_t           epoch;
+        StoredValue       *sv;
+        StoredValue      **table;
+        LockStripes       *locks;
+        value_t            value;
+    };
+
+    //! True if lookups may be served without the bucket locks.
+    const bool           optimisticReads;
+    //! Retired objects not released yet, oldest first.
+    std::deque<Retired>  retired;
+    //! Number of retired objects to try releasing them at.
+    size_t               reclaimAt;
+    Mutex                retireLock;
+
     static size_t                 defaultNumBuckets;
     static size_t                 defaultNumLocks;
+    static size_t                 bucketsPerLock;
+    static size_t                 maxLocks;
+    static bool                   incrementalResize;
+    static bool                   defaultOptimisticReads;
+    static hash_function_t        defaultHashFunction;
+
+    //! Retired objects to let pile up between attempts to release them.
+    static const size_t           RECLAIM_BATCH = 64;
 
+    friend class StoredValue;
+
+    /*
+     * While an incremental resize is running, buckets of the table
+     * being resized to are numbered -(n + 1).  A bucket number thus
+     * always maps to the same lock, even if the tables are swapped
+     * while a thread waits for it, so the recheck in getLockedBucket()
+     * stays sufficient.
+     */
     int getBucketForHash(int h) {
-        return abs(h % static_cast<int>(size));
+        size_t next = nextSize;
+        int bucket_num = abs(h % static_cast<int>(size));
+        if (next != 0 && static_cast<size_t>(bucket_num) < migrated.get()) {
+            bucket_num = -(abs(h % static_cast<int>(next)) + 1);
+        }
+        return bucket_num;
+    }
+
+    inline StoredValue *nextOf(StoredValue *v) {
+#ifdef COMPACT_STORED_VALUE
+        return static_cast<StoredValue*>(svAllocator.fromHandle(v->next));
+#else
+        return v->next;
+#endif
+    }
+
+    inline void setNext(StoredValue *v, StoredValue *n) {
+#ifdef COMPACT_STORED_VALUE
+        v->next = svAllocator.toHandle(n);
+#else
+        v->next = n;
+#endif
+    }
+
+    inline StoredValue *&bucketHead(int bucket_num) {
+        return bucket_num >= 0 ? values[bucket_num] : nextValues[-bucket_num - 1];
     }
 
     inline int mutexForBucket(int bucket_num) {
         assert(isActive());
-        assert(bucket_num >= 0);
+        if (bucket_num < 0) {
+            bucket_num = -bucket_num - 1;
+        }
         int lock_num = bucket_num % static_cast<int>(n_locks);
         assert(lock_num < static_cast<int>(n_locks));
         assert(lock_num >= 0);
         return lock_num;
     }
 
+    LockHolder getLockedBucketSlow(int h, int *bucket);
+    LockStripes *getStableStripes();
+
+    // Visit the chains under a lock; returns the number of buckets seen.
+    size_t visitLock(HashTableVisitor &visitor, LockStripes *s, int l,
+                     Walk &walk);
+
+    /*
+     * True if some walk is done with some of the given locks but not
+     * with all of them, so moving chains among them could make it miss
+     * items or see them twice.  The caller holds all of the locks.
+     */
+    bool straddlesWalk(const std::set<int> &lockNums);
+
+    void startResize(size_t newSize);
+    bool migrateBucket(size_t bucket_num);
+    void completeResize();
+
+    /*
+     * Give the table as many locks as suits its size, returning the
+     * ones replaced (to be retired once released), or NULL.  The
+     * caller holds stripesLock and all of the current locks.
+     */
+    LockStripes *restripe();
+
+    /*
+     * Things optimistic readers may be looking at are retired instead
+     * of being released when they are unlinked, and only released once
+     * every reader that could have seen them is gone.  The caller must
+     * have unlinked them already.
+     */
+    void retire(StoredValue *v);
+    void retire(StoredValue **table);
+    void retire(LockStripes *locks);
+    void retireValue(value_t &value);
+    void addRetired(Retired &r);
+    void reclaim(bool wait);
+
     DISALLOW_COPY_AND_ASSIGN(HashTable);
 };
 
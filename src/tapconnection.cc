@@ -19,8 +19,8 @@
 
 #include <limits>
 
-#include "dispatcher.h"
 #include "ep_engine.h"
+#include "iomanager/iomanager.h"
 #define STATWRITER_NAMESPACE tap
 #include "statwriter.h"
 #undef STATWRITER_NAMESPACE
@@ -153,8 +153,10 @@ public:
             config.setAckWindowSize(value);
         } else if (key.compare("tap_bg_max_pending") == 0) {
             config.setBgMaxPending(value);
-        } else if (key.compare("tap_backlog_limit") == 0) {
-            config.setBackfillBacklogLimit(value);
+        } else if (key.compare("tap_queue_mem_limit") == 0) {
+            config.setQueueMemLimit(value);
+        } else if (key.compare("tap_send_batch_bytes") == 0) {
+            config.setSendBatchBytes(value);
         }
     }
 
@@ -183,8 +185,9 @@ TapConfig::TapConfig(EventuallyPersistentEngine &e)
     bgMaxPending = config.getTapBgMaxPending();
     backoffSleepTime = config.getTapBackoffPeriod();
     requeueSleepTime = config.getTapRequeueSleepTime();
-    backfillBacklogLimit = config.getTapBacklogLimit();
     backfillResidentThreshold = config.getTapBackfillResident();
+    queueMemLimit = config.getTapQueueMemLimit();
+    sendBatchBytes = config.getTapSendBatchBytes();
 }
 
 void TapConfig::addConfigChangeListener(EventuallyPersistentEngine &engine) {
@@ -203,7 +206,9 @@ void TapConfig::addConfigChangeListener(EventuallyPersistentEngine &engine) {
                               new TapConfigChangeListener(engine.getTapConfig()));
     configuration.addValueChangedListener("tap_requeue_sleep_time",
                               new TapConfigChangeListener(engine.getTapConfig()));
-    configuration.addValueChangedListener("tap_backlog_limit",
+    configuration.addValueChangedListener("tap_queue_mem_limit",
+                              new TapConfigChangeListener(engine.getTapConfig()));
+    configuration.addValueChangedListener("tap_send_batch_bytes",
                               new TapConfigChangeListener(engine.getTapConfig()));
     configuration.addValueChangedListener("tap_backfill_resident",
                               new TapConfigChangeListener(engine.getTapConfig()));
@@ -216,6 +221,7 @@ TapProducer::TapProducer(EventuallyPersistentEngine &theEngine,
     TapConnection(theEngine, c, n),
     queue(NULL),
     queueSize(0),
+    sendBatches(0),
     flags(f),
     recordsFetched(0),
     pendingFlush(false),
@@ -624,6 +630,9 @@ void TapProducer::clearQueues_UNLOCKED() {
     mem_overhead += (bgResultSize * sizeof(Item *));
     bgResultSize = 0;
 
+    // Clear items fetched to be sent.
+    clearSendBatch_UNLOCKED(false);
+
     // Reset bg result size in a checkpoint state.
     std::map<uint16_t, TapCheckpointState>::iterator it = tapCheckpointState.begin();
     for (; it != tapCheckpointState.end(); ++it) {
@@ -735,6 +744,9 @@ void TapProducer::rollback() {
         ++tapLogSize;
     }
 
+    // Whatever was fetched but not sent yet goes after the unacked messages.
+    clearSendBatch_UNLOCKED(true);
+
     stats.memOverhead.decr(tapLogSize * sizeof(TapLogElement));
     assert(stats.memOverhead.get() < GIGANTOR);
 
@@ -745,19 +757,22 @@ void TapProducer::rollback() {
 }
 
 /**
- * Dispatcher task to wake a tap connection.
+ * Task to wake a tap connection.
  */
-class TapResumeCallback : public DispatcherCallback {
+class TapResumeTask : public GlobalTask {
 public:
-    TapResumeCallback(EventuallyPersistentEngine &e, TapProducer &c)
-        : engine(e), connection(c) {
+    TapResumeTask(EventuallyPersistentEngine &e, TapProducer &c,
+                  double sleeptime)
+        : GlobalTask(&e, Priority::TapResumePriority, sleeptime,
+                     NO_START_TIME, false),
+          connection(c) {
         std::stringstream ss;
         ss << "Resuming suspended tap connection: " << connection.getName();
         descr = ss.str();
     }
 
-    bool callback(Dispatcher &, TaskId &) {
-        if (engine.getEpStats().shutdown.isShutdown) {
+    bool run() {
+        if (engine->getEpStats().shutdown.isShutdown) {
             return false;
         }
         connection.setSuspended(false);
@@ -767,12 +782,11 @@ public:
         return false;
     }
 
-    std::string description() {
+    std::string getDescription() {
         return descr;
     }
 
 private:
-    EventuallyPersistentEngine &engine;
     TapProducer &connection;
     std::string descr;
 };
@@ -786,11 +800,9 @@ void TapProducer::setSuspended_UNLOCKED(bool value)
     if (value) {
         const TapConfig &config = engine.getTapConfig();
         if (config.getBackoffSleepTime() > 0 && !suspended) {
-            Dispatcher *d = engine.getEpStore()->getNonIODispatcher();
-            d->schedule(shared_ptr<DispatcherCallback>
-                        (new TapResumeCallback(engine, *this)),
-                        NULL, Priority::TapResumePriority, config.getBackoffSleepTime(),
-                        false);
+            ExTask task = new TapResumeTask(engine, *this,
+                                            config.getBackoffSleepTime());
+            IOManager::get()->scheduleTask(task, NONIO_TASK_IDX);
             LOG(EXTENSION_LOG_WARNING, "%s Suspend for %.2f secs\n",
                 logHeader(), config.getBackoffSleepTime());
         } else {
@@ -894,6 +906,8 @@ ENGINE_ERROR_CODE TapProducer::processAck(uint32_t s,
     }
 
     bool notifyTapNotificationThread = false;
+    // The highest mutation id acked in each vbucket.
+    std::map<uint16_t, uint64_t> ackedMutations;
 
     switch (status) {
     case PROTOCOL_BINARY_RESPONSE_SUCCESS:
@@ -918,6 +932,20 @@ ENGINE_ERROR_CODE TapProducer::processAck(uint32_t s,
                 iter->seqno);
             ++num_logs;
             ++iter;
+            // An item being fetched from disk goes out after the ones queued
+            // behind it, and loses its mutation id, so the acks don't say
+            // anything about a vbucket's checkpoint order until it is sent.
+            if (bgResultSize == 0 && (bgJobIssued - bgJobCompleted) == 0) {
+                std::list<TapLogElement>::iterator acked = tapLog.begin();
+                for (; acked != iter; ++acked) {
+                    if (acked->item && acked->item->getMutationId() > 0) {
+                        uint64_t &mid = ackedMutations[acked->vbucket];
+                        if (acked->item->getMutationId() > mid) {
+                            mid = acked->item->getMutationId();
+                        }
+                    }
+                }
+            }
             tapLog.erase(tapLog.begin(), iter);
             isLastAckSucceed = true;
         } else {
@@ -936,6 +964,16 @@ ENGINE_ERROR_CODE TapProducer::processAck(uint32_t s,
             engine.notifyNotificationThread();
         }
 
+        if (!ackedMutations.empty()) {
+            std::map<uint16_t, uint64_t>::iterator mit = ackedMutations.begin();
+            for (; mit != ackedMutations.end(); ++mit) {
+                RCPtr<VBucket> vb = engine.getEpStore()->getVBucket(mit->first);
+                if (vb) {
+                    vb->notifyReplicaAck(engine, name, mit->second);
+                }
+            }
+        }
+
         lh.lock();
         if (mayCompleteDumpOrTakeover_UNLOCKED() && idle_UNLOCKED()) {
             // We've got all of the ack's need, now we can shut down the
@@ -1048,20 +1086,22 @@ bool TapProducer::waitForOpaqueMsgAck() {
 }
 
 /**
- * A Dispatcher job that performs a background fetch on behalf of tap.
+ * A task that performs a background fetch on behalf of tap.
  */
-class TapBGFetchCallback : public DispatcherCallback {
+class TapBGFetchTask : public GlobalTask {
 public:
-    TapBGFetchCallback(EventuallyPersistentEngine *e, const std::string &n,
-                       const std::string &k, uint16_t vbid,
-                       uint64_t r, hrtime_t token) :
+    TapBGFetchTask(EventuallyPersistentEngine *e, const std::string &n,
+                   const std::string &k, uint16_t vbid,
+                   uint64_t r, hrtime_t token) :
+        GlobalTask(e, Priority::TapBgFetcherPriority, 0, NO_START_TIME,
+                   false),
         name(n), key(k), epe(e), init(gethrtime()),
         connToken(token), rowid(r), vbucket(vbid)
     {
         assert(epe);
     }
 
-    bool callback(Dispatcher & d, TaskId &t) {
+    bool run() {
         hrtime_t start = gethrtime();
         RememberingCallback<GetValue> gcb;
 
@@ -1085,7 +1125,7 @@ public:
                     rowid = v->getBySeqno();
                     lh.unlock();
                     const TapConfig &config = epe->getTapConfig();
-                    d.snooze(t, config.getRequeueSleepTime());
+                    snooze(config.getRequeueSleepTime(), false);
                     ++stats.numTapBGFetchRequeued;
                     return true;
                 } else {
@@ -1136,7 +1176,7 @@ public:
         return false;
     }
 
-    std::string description() {
+    std::string getDescription() {
         std::stringstream ss;
         ss << "Fetching item from disk for tap:  " << key;
         return ss.str();
@@ -1153,10 +1193,9 @@ private:
 };
 
 void TapProducer::queueBGFetch_UNLOCKED(const std::string &key, uint64_t id, uint16_t vb) {
-    shared_ptr<TapBGFetchCallback> dcb(new TapBGFetchCallback(&engine,
-                                                              getName(), key,
-                                                              vb, id, getConnectionToken()));
-    engine.getEpStore()->getAuxIODispatcher()->schedule(dcb, NULL, Priority::TapBgFetcherPriority);
+    ExTask task = new TapBGFetchTask(&engine, getName(), key, vb, id,
+                                     getConnectionToken());
+    IOManager::get()->scheduleTask(task, AUXIO_TASK_IDX);
     ++bgJobIssued;
     std::map<uint16_t, TapCheckpointState>::iterator it = tapCheckpointState.find(vb);
     if (it != tapCheckpointState.end()) {
@@ -1190,6 +1229,7 @@ void TapProducer::completeBGFetchJob(Item *itm, uint16_t vbid, bool implicitEnqu
         if (it != tapCheckpointState.end()) {
             ++(it->second.bgResultSize);
         }
+        queueMemSize.incr(sizeof(Item *) + itm->size());
         stats.memOverhead.incr(sizeof(Item *));
         assert(stats.memOverhead.get() < GIGANTOR);
     } else {
@@ -1210,6 +1250,7 @@ Item* TapProducer::nextBgFetchedItem_UNLOCKED() {
         --(it->second.bgResultSize);
     }
 
+    decrQueueMemSize_UNLOCKED(sizeof(Item *) + rv->size());
     stats.memOverhead.decr(sizeof(Item *));
     assert(stats.memOverhead.get() < GIGANTOR);
 
@@ -1234,6 +1275,8 @@ void TapProducer::addStats(ADD_STAT add_stat, const void *c) {
     addStat("bg_result_size", bgResultSize, add_stat, c);
     addStat("bg_jobs_issued", bgJobIssued, add_stat, c);
     addStat("bg_jobs_completed", bgJobCompleted, add_stat, c);
+    addStat("send_batches", sendBatches, add_stat, c);
+    addStat("send_batch_size", sendBatch.size(), add_stat, c);
     addStat("flags", flagsText, add_stat, c);
     addStat("suspended", isSuspended(), add_stat, c);
     addStat("paused", paused, add_stat, c);
@@ -1574,7 +1617,8 @@ queued_item TapProducer::nextFgFetched_UNLOCKED(bool &shouldPause) {
                         seqno_acked = isLastAckSucceed ? seqnoReceived : seqnoReceived - 1;
                     }
                     if (it->second.lastSeqNum <= seqno_acked &&
-                        it->second.isBgFetchCompleted()) {
+                        it->second.isBgFetchCompleted() &&
+                        it->second.batchedItems == 0) {
                         // All resident and non-resident items in a checkpoint are sent
                         // and acked. CHEKCPOINT_END message is going to be sent.
                         addCheckpointMessage_UNLOCKED(qi);
@@ -1610,11 +1654,7 @@ queued_item TapProducer::nextFgFetched_UNLOCKED(bool &shouldPause) {
         queued_item qi = queue->front();
         queue->pop_front();
         queueSize = queue->empty() ? 0 : queueSize - 1;
-        if (queueMemSize > sizeof(queued_item)) {
-            queueMemSize.decr(sizeof(queued_item));
-        } else {
-            queueMemSize.set(0);
-        }
+        decrQueueMemSize_UNLOCKED(sizeof(queued_item) + qi->size());
         stats.memOverhead.decr(sizeof(queued_item));
         assert(stats.memOverhead.get() < GIGANTOR);
         ++recordsFetched;
@@ -1745,6 +1785,111 @@ void TapProducer::scheduleBackfill_UNLOCKED(const std::vector<uint16_t> &vblist)
 Item* TapProducer::getNextItem(const void *c, uint16_t *vbucket, tap_event_t &ret,
                                uint8_t &nru) {
     LockHolder lh(queueLock);
+    if (sendBatch.empty()) {
+        fillSendBatch_UNLOCKED(c, ret);
+        if (sendBatch.empty()) {
+            return NULL;
+        }
+    }
+
+    TapBatchedItem next(sendBatch.front());
+    sendBatch.pop_front();
+    decrQueueMemSize_UNLOCKED(next.item->size());
+    std::map<uint16_t, TapCheckpointState>::iterator it =
+        tapCheckpointState.find(next.vbucket);
+    if (it != tapCheckpointState.end() && it->second.batchedItems > 0) {
+        --(it->second.batchedItems);
+    }
+
+    if (!vbucketFilter(next.vbucket)) {
+        LOG(EXTENSION_LOG_WARNING,
+            "%s Drop a fetched item because vbucket %d is no longer valid"
+            " against vbucket filter.\n", logHeader(), next.vbucket);
+        if (next.event == TAP_CHECKPOINT_START ||
+            next.event == TAP_CHECKPOINT_END) {
+            --checkpointMsgCounter;
+        }
+        delete next.item;
+        ret = TAP_NOOP;
+        return NULL;
+    }
+
+    *vbucket = next.vbucket;
+    ret = next.event;
+    nru = next.nru;
+    addTapLogElement_UNLOCKED(next.qi);
+    if (ret == TAP_MUTATION || ret == TAP_DELETION) {
+        ++queueDrain;
+        if (!isBackfillCompleted_UNLOCKED() && totalBackfillBacklogs > 0) {
+            --totalBackfillBacklogs;
+        }
+    }
+    transmitted[next.vbucket]++;
+    return next.item;
+}
+
+void TapProducer::fillSendBatch_UNLOCKED(const void *c, tap_event_t &ret) {
+    size_t maxBytes = engine.getTapConfig().getSendBatchBytes();
+    size_t bytes = 0;
+    do {
+        uint16_t vbucket = 0;
+        uint8_t nru = INITIAL_NRU_VALUE;
+        tap_event_t event = ret;
+        queued_item qi;
+        Item *itm = fetchNextItem_UNLOCKED(c, &vbucket, event, nru, qi);
+        if (itm == NULL) {
+            if (event == TAP_DISCONNECT) {
+                clearSendBatch_UNLOCKED(false);
+            }
+            // Whatever got fetched so far goes out first, we'll be back
+            // for the rest.
+            if (sendBatch.empty()) {
+                ret = event;
+            }
+            break;
+        }
+
+        sendBatch.push_back(TapBatchedItem(itm, event, vbucket, nru, qi));
+        bytes += itm->size();
+        queueMemSize.incr(itm->size());
+        std::map<uint16_t, TapCheckpointState>::iterator it =
+            tapCheckpointState.find(vbucket);
+        if (it != tapCheckpointState.end()) {
+            ++(it->second.batchedItems);
+        }
+    } while (bytes < maxBytes);
+
+    if (!sendBatch.empty()) {
+        ++sendBatches;
+    }
+}
+
+void TapProducer::clearSendBatch_UNLOCKED(bool requeue) {
+    std::list<TapBatchedItem>::iterator it = sendBatch.begin();
+    for (; it != sendBatch.end(); ++it) {
+        if (it->event == TAP_CHECKPOINT_START ||
+            it->event == TAP_CHECKPOINT_END) {
+            --checkpointMsgCounter;
+            if (requeue) {
+                addCheckpointMessage_UNLOCKED(it->qi);
+            }
+        } else if (requeue) {
+            addEvent_UNLOCKED(it->qi);
+        }
+        decrQueueMemSize_UNLOCKED(it->item->size());
+        delete it->item;
+    }
+    sendBatch.clear();
+
+    std::map<uint16_t, TapCheckpointState>::iterator cit = tapCheckpointState.begin();
+    for (; cit != tapCheckpointState.end(); ++cit) {
+        cit->second.batchedItems = 0;
+    }
+}
+
+Item* TapProducer::fetchNextItem_UNLOCKED(const void *c, uint16_t *vbucket,
+                                          tap_event_t &ret, uint8_t &nru,
+                                          queued_item &qi) {
     Item *itm = NULL;
 
     // Check if there are any checkpoint start / end messages to be sent to the TAP client.
@@ -1769,12 +1914,10 @@ Item* TapProducer::getNextItem(const void *c, uint16_t *vbucket, tap_event_t &re
         value_t vblob(Blob::New((const char*)&cid, sizeof(cid)));
         itm = new Item(checkpoint_msg->getKey(), 0, 0, vblob,
                        0, -1, checkpoint_msg->getVBucketId());
-        transmitted[checkpoint_msg->getVBucketId()]++;
+        qi = checkpoint_msg;
         return itm;
     }
 
-    queued_item qi;
-
     // Check if there are any items fetched from disk for backfill operations.
     if (hasItemFromDisk_UNLOCKED()) {
         ret = TAP_MUTATION;
@@ -1878,15 +2021,6 @@ Item* TapProducer::getNextItem(const void *c, uint16_t *vbucket, tap_event_t &re
         }
     }
 
-    if (ret == TAP_MUTATION || ret == TAP_DELETION) {
-        ++queueDrain;
-        addTapLogElement_UNLOCKED(qi);
-        if (!isBackfillCompleted_UNLOCKED() && totalBackfillBacklogs > 0) {
-            --totalBackfillBacklogs;
-        }
-        transmitted[qi->getVBucketId()]++;
-    }
-
     return itm;
 }
 
@@ -1936,7 +2070,7 @@ bool TapProducer::addEvent_UNLOCKED(const queued_item &it) {
         bool wasEmpty = queue->empty();
         queue->push_back(it);
         ++queueSize;
-        queueMemSize.incr(sizeof(queued_item));
+        queueMemSize.incr(sizeof(queued_item) + it->size());
         stats.memOverhead.incr(sizeof(queued_item));
         assert(stats.memOverhead.get() < GIGANTOR);
         return wasEmpty;
@@ -2006,7 +2140,6 @@ queued_item TapProducer::nextCheckpointMessage_UNLOCKED() {
         }
         ++checkpointMsgCounter;
         ++recordsFetched;
-        addTapLogElement_UNLOCKED(an_item);
     }
     return an_item;
 }
@@ -2022,7 +2155,8 @@ size_t TapProducer::getBackfillQueueSize_UNLOCKED() {
 size_t TapProducer::getQueueSize_UNLOCKED() {
     bgResultSize = backfilledItems.empty() ? 0 : bgResultSize.get();
     queueSize = queue->empty() ? 0 : queueSize;
-    return bgResultSize + (bgJobIssued - bgJobCompleted) + queueSize;
+    return sendBatch.size() + bgResultSize + (bgJobIssued - bgJobCompleted) +
+        queueSize;
 }
 
 void TapProducer::incrBackfillRemaining(size_t incr) {
@@ -2043,17 +2177,19 @@ void TapProducer::flush() {
 void TapProducer::appendQueue(std::list<queued_item> *q) {
     LockHolder lh(queueLock);
     size_t count = 0;
+    size_t bytes = 0;
     std::list<queued_item>::iterator it = q->begin();
     for (; it != q->end(); ++it) {
         if (vbucketFilter((*it)->getVBucketId())) {
             queue->push_back(*it);
             ++count;
+            bytes += (*it)->size();
         }
     }
     queueSize += count;
     stats.memOverhead.incr(count * sizeof(queued_item));
     assert(stats.memOverhead.get() < GIGANTOR);
-    queueMemSize.incr(count * sizeof(queued_item));
+    queueMemSize.incr(count * sizeof(queued_item) + bytes);
     q->clear();
 }
 
@@ -39,7 +39,6 @@ class TapProducer;
 class BackFillVisitor;
 class TapBGFetchCallback;
 class CompleteBackfillOperation;
-class Dispatcher;
 class Item;
 class TapProducer;
 class VBucketFilter;
@@ -130,6 +129,27 @@ public:
     queued_item item;
 };
 
+/**
+ * An item fetched for a tap stream that is waiting in the connection's
+ * send batch to be handed to the client.
+ */
+class TapBatchedItem {
+public:
+    TapBatchedItem(Item *i, tap_event_t e, uint16_t vb, uint8_t n,
+                   const queued_item &q) :
+        item(i), event(e), vbucket(vb), nru(n), qi(q)
+    {
+        // EMPTY
+    }
+
+    Item *item;
+    tap_event_t event;
+    uint16_t vbucket;
+    uint8_t nru;
+    //! What goes into the tap log once the item is sent
+    queued_item qi;
+};
+
 /**
  * Aggregator object to count all tap stats.
  */
@@ -165,12 +185,13 @@ class TapCheckpointState {
 public:
     TapCheckpointState() :
         currentCheckpointId(0), lastSeqNum(0), bgResultSize(0),
-        bgJobIssued(0), bgJobCompleted(0), lastItem(false), state(backfill) {}
+        bgJobIssued(0), bgJobCompleted(0), batchedItems(0), lastItem(false),
+        state(backfill) {}
 
     TapCheckpointState(uint16_t vb, uint64_t checkpointId, tap_checkpoint_state s) :
         vbucket(vb), currentCheckpointId(checkpointId), lastSeqNum(0),
         bgResultSize(0), bgJobIssued(0), bgJobCompleted(0),
-        lastItem(false), state(s) {}
+        batchedItems(0), lastItem(false), state(s) {}
 
     bool isBgFetchCompleted(void) const {
         return bgResultSize == 0 && (bgJobIssued - bgJobCompleted) == 0;
@@ -188,6 +209,8 @@ public:
     size_t bgJobIssued;
     // Number of bg-fetched jobs completed for a given vbucket
     size_t bgJobCompleted;
+    // Number of items for a given vbucket fetched into the send batch, but not sent yet.
+    size_t batchedItems;
 
     // True if the TAP cursor reaches to the last item at its current checkpoint.
     bool lastItem;
@@ -228,8 +251,12 @@ public:
         return requeueSleepTime;
     }
 
-    size_t getBackfillBacklogLimit() const {
-        return backfillBacklogLimit;
+    size_t getQueueMemLimit() const {
+        return queueMemLimit;
+    }
+
+    size_t getSendBatchBytes() const {
+        return sendBatchBytes;
     }
 
     double getBackfillResidentThreshold() const {
@@ -268,8 +295,12 @@ protected:
         requeueSleepTime = value;
     }
 
-    void setBackfillBacklogLimit(size_t value) {
-        backfillBacklogLimit = value;
+    void setQueueMemLimit(size_t value) {
+        queueMemLimit = value;
+    }
+
+    void setSendBatchBytes(size_t value) {
+        sendBatchBytes = value;
     }
 
     void setBackfillResidentThreshold(double value) {
@@ -299,9 +330,13 @@ private:
     double requeueSleepTime;
 
     // Parameters to control the backfill
-    size_t backfillBacklogLimit;
     double backfillResidentThreshold;
 
+    // Bytes of items a producer may hold before its backfill pauses
+    size_t queueMemLimit;
+    // Bytes of items a producer fetches at once to send
+    size_t sendBatchBytes;
+
     EventuallyPersistentEngine &engine;
 };
 
@@ -689,6 +724,31 @@ private:
     Item *getNextItem(const void *c, uint16_t *vbucket, tap_event_t &ret,
                       uint8_t &nru);
 
+    /**
+     * Fetch the next item to be transmitted without doing the bookkeeping
+     * for sending it.
+     *
+     * @param qi set to the item to log once the returned item is sent
+     */
+    Item *fetchNextItem_UNLOCKED(const void *c, uint16_t *vbucket,
+                                 tap_event_t &ret, uint8_t &nru,
+                                 queued_item &qi);
+
+    /**
+     * Fetch items into the send batch until it holds the number of
+     * bytes in the tap config, or there is nothing more to send yet.
+     *
+     * @param ret set to what to tell the client if nothing was fetched
+     */
+    void fillSendBatch_UNLOCKED(const void *c, tap_event_t &ret);
+
+    /**
+     * Drop everything in the send batch.
+     *
+     * @param requeue true if the items should be queued to be fetched again
+     */
+    void clearSendBatch_UNLOCKED(bool requeue);
+
     /**
      * Check if TAP_DUMP or TAP_TAKEOVER is completed and close the connection if
      * all messages including vbucket_state change commands are sent.
@@ -846,7 +906,8 @@ private:
     }
 
     bool emptyQueue_UNLOCKED() {
-        return !hasItemFromDisk_UNLOCKED() && (bgJobIssued - bgJobCompleted) == 0 &&
+        return sendBatch.empty() && !hasItemFromDisk_UNLOCKED() &&
+               (bgJobIssued - bgJobCompleted) == 0 &&
                !hasItemFromVBHashtable_UNLOCKED();
     }
 
@@ -885,6 +946,14 @@ private:
         return queueMemSize;
     }
 
+    void decrQueueMemSize_UNLOCKED(size_t bytes) {
+        if (queueMemSize > bytes) {
+            queueMemSize.decr(bytes);
+        } else {
+            queueMemSize.set(0);
+        }
+    }
+
     size_t getRemaingOnDisk() {
          LockHolder lh(queueLock);
          return bgJobIssued - bgJobCompleted;
@@ -1095,6 +1164,10 @@ private:
     size_t queueSize;
     //! Queue of items backfilled from disk
     std::queue<Item*> backfilledItems;
+    //! Items fetched to be sent, in the order they're sent
+    std::list<TapBatchedItem> sendBatch;
+    //! Number of times the send batch was filled
+    size_t sendBatches;
     //! List of items that are waiting for acks from the client
     std::list<TapLogElement> tapLog;
 
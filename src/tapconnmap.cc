@@ -25,6 +25,7 @@
 #include <vector>
 
 #include "ep_engine.h"
+#include "iomanager/iomanager.h"
 #include "tapconnection.h"
 #include "tapconnmap.h"
 
@@ -32,49 +33,54 @@ size_t TapConnMap::vbConnLockNum = 32;
 const double TapConnNotifier::DEFAULT_MIN_STIME = 0.001;
 
 /**
- * Dispatcher task to free the resource of a tap connection.
+ * Task to free the resource of a tap connection.
  */
-class TapConnectionReaperCallback : public DispatcherCallback {
+class TapConnectionReaperTask : public GlobalTask {
 public:
-    TapConnectionReaperCallback(EventuallyPersistentEngine &e, connection_t &conn)
-        : engine(e), connection(conn)
+    TapConnectionReaperTask(EventuallyPersistentEngine &e, connection_t &conn)
+        : GlobalTask(&e, Priority::TapConnectionReaperPriority, 0,
+                     NO_START_TIME, false),
+          connection(conn)
     {
         std::stringstream ss;
         ss << "Reaping tap connection: " << connection->getName();
         descr = ss.str();
     }
 
-    bool callback(Dispatcher &, TaskId &) {
+    bool run() {
         TapProducer *tp = dynamic_cast<TapProducer*>(connection.get());
         if (tp) {
             tp->clearQueues();
-            engine.getTapConnMap().removeVBTapConnections(connection);
+            engine->getTapConnMap().removeVBTapConnections(connection);
         }
         return false;
     }
 
-    std::string description() {
+    std::string getDescription() {
         return descr;
     }
 
 private:
-    EventuallyPersistentEngine &engine;
     connection_t connection;
     std::string descr;
 };
 
 /**
- * A DispatcherCallback for Tap connection notifier
+ * A task for Tap connection notifier
  */
-class TapConnNotifierCallback : public DispatcherCallback {
+class TapConnNotifierTask : public GlobalTask {
 public:
-    TapConnNotifierCallback(TapConnNotifier *notifier) : tapNotifier(notifier) { }
+    TapConnNotifierTask(EventuallyPersistentEngine *e,
+                        TapConnNotifier *notifier) :
+        GlobalTask(e, Priority::TapConnNotificationPriority, 0,
+                   NO_START_TIME, false),
+        tapNotifier(notifier) { }
 
-    bool callback(Dispatcher &, TaskId &) {
+    bool run() {
         return tapNotifier->notify();
     }
 
-    std::string description() {
+    std::string getDescription() {
         return std::string("Tap connection notifier");
     }
 
@@ -83,20 +89,19 @@ private:
 };
 
 void TapConnNotifier::start() {
-    shared_ptr<TapConnNotifierCallback> cb(new TapConnNotifierCallback(this));
-    dispatcher->schedule(cb, &task, Priority::TapConnNotificationPriority);
-    assert(task.get());
+    ExTask notifyTask = new TapConnNotifierTask(&engine, this);
+    task = IOManager::get()->scheduleTask(notifyTask, NONIO_TASK_IDX);
 }
 
 void TapConnNotifier::stop() {
-    dispatcher->cancel(task);
+    IOManager::get()->cancel(task);
 }
 
 bool TapConnNotifier::notify() {
     engine.getTapConnMap().notifyAllPausedConnections();
 
     if (engine.getTapConnMap().notificationQueueEmpty()) {
-        dispatcher->snooze(task, minSleepTime);
+        IOManager::get()->snooze(task, minSleepTime);
         if (minSleepTime == 1.0) {
             minSleepTime = DEFAULT_MIN_STIME;
         } else {
@@ -140,7 +145,7 @@ TapConnMap::TapConnMap(EventuallyPersistentEngine &theEngine) :
 }
 
 void TapConnMap::initialize() {
-    tapConnNotifier = new TapConnNotifier(engine, engine.getEpStore()->getNonIODispatcher());
+    tapConnNotifier = new TapConnNotifier(engine);
     tapConnNotifier->start();
 }
 
@@ -193,7 +198,7 @@ bool TapConnMap::setEvents(const std::string &name,
     return found;
 }
 
-ssize_t TapConnMap::backfillQueueDepth(const std::string &name) {
+ssize_t TapConnMap::queueMemory(const std::string &name) {
     ssize_t rv(-1);
     LockHolder lh(notifySync);
 
@@ -201,7 +206,7 @@ ssize_t TapConnMap::backfillQueueDepth(const std::string &name) {
     if (tc.get()) {
         TapProducer *tp = dynamic_cast<TapProducer*>(tc.get());
         assert(tp);
-        rv = tp->getBackfillQueueSize();
+        rv = tp->getQueueMemory();
     }
 
     return rv;
@@ -259,7 +264,8 @@ void TapConnMap::getExpiredConnections_UNLOCKED(std::list<connection_t> &deadCli
 }
 
 void TapConnMap::removeTapCursors_UNLOCKED(TapProducer *tp) {
-    // Remove all the checkpoint cursors belonging to the TAP connection.
+    // Remove all the checkpoint cursors belonging to the TAP connection,
+    // along with the acks it got for durability waiters.
     if (tp) {
         const VBucketMap &vbuckets = tp->engine.getEpStore()->getVBuckets();
         size_t numOfVBuckets = vbuckets.getSize();
@@ -271,6 +277,7 @@ void TapConnMap::removeTapCursors_UNLOCKED(TapProducer *tp) {
             if (!vb) {
                 continue;
             }
+            vb->removeReplicaAck(tp->name);
             if (tp->vbucketFilter(vbid)) {
                 LOG(EXTENSION_LOG_INFO,
                     "%s Remove the TAP cursor from vbucket %d",
@@ -682,17 +689,14 @@ void TapConnMap::notifyIOThreadMain() {
     }
 
     // Delete all of the dead clients
-    Dispatcher *d = engine.getEpStore()->getNonIODispatcher();
     std::list<connection_t>::iterator ii;
     for (ii = deadClients.begin(); ii != deadClients.end(); ++ii) {
         LOG(EXTENSION_LOG_WARNING, "Clean up \"%s\"", (*ii)->getName().c_str());
         (*ii)->releaseReference();
         TapProducer *tp = dynamic_cast<TapProducer*>((*ii).get());
         if (tp) {
-            d->schedule(shared_ptr<DispatcherCallback>
-                        (new TapConnectionReaperCallback(engine, *ii)),
-                        NULL, Priority::TapConnectionReaperPriority,
-                        0, false, true);
+            ExTask reapTask = new TapConnectionReaperTask(engine, *ii);
+            IOManager::get()->scheduleTask(reapTask, NONIO_TASK_IDX);
         }
     }
 }
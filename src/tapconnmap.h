@@ -110,8 +110,8 @@ public:
  */
 class TapConnNotifier {
 public:
-    TapConnNotifier(EventuallyPersistentEngine &e, Dispatcher *d)
-        : engine(e), dispatcher(d), minSleepTime(DEFAULT_MIN_STIME)  { }
+    TapConnNotifier(EventuallyPersistentEngine &e)
+        : engine(e), task(0), minSleepTime(DEFAULT_MIN_STIME)  { }
 
     void start();
 
@@ -123,8 +123,7 @@ private:
     static const double DEFAULT_MIN_STIME;
 
     EventuallyPersistentEngine &engine;
-    Dispatcher *dispatcher;
-    TaskId task;
+    size_t task;
     double minSleepTime;
 };
 
@@ -185,11 +184,11 @@ public:
                    std::list<queued_item> *q);
 
     /**
-     * Get the size of the named backfill queue.
+     * Get the bytes of items the named connection holds to be sent.
      *
-     * @return the size, or -1 if we can't find the queue
+     * @return the size, or -1 if we can't find the connection
      */
-    ssize_t backfillQueueDepth(const std::string &name);
+    ssize_t queueMemory(const std::string &name);
 
     /**
      * Add an event to all tap connections telling them to flush their
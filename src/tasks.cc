@@ -24,56 +24,15 @@
 #include "tasks.h"
 #include "warmup.h"
 
-/**
- * It simulates timegm to convert the given GMT time to number of seconds
- * since epoch but it uses C standard time functions.
- */
-static time_t do_timegm(struct tm *tmv)
-{
-  time_t epoch = 0;
-  time_t offset = mktime(gmtime(&epoch));
-  time_t gmt = mktime(tmv);
-  return difftime(gmt, offset);
-}
-
-void GlobalTask::snooze(const double secs, bool first) {
-    LockHolder lh(mutex);
-    gettimeofday(&waketime, NULL);
-    // set scheduled task time for new task only
-    if (first && (starttime == 0 || starttime <= 23) && secs >= 3600) {
-        struct tm tim;
-        struct timeval tmval = waketime;
-        time_t seconds = tmval.tv_sec;
-        tim = *(gmtime(&seconds));
-        // change tm structure to the given start hour in GMT
-        tim.tm_min = 0;
-        tim.tm_sec = 0;
-        if (tim.tm_hour >= (time_t)starttime) {
-            tim.tm_hour = (time_t)starttime;
-            tmval.tv_sec = do_timegm(&tim);
-            // advance time until later than current time
-            while (tmval.tv_sec < waketime.tv_sec) {
-                advance_tv(tmval, secs);
-            }
-        } else if (tim.tm_hour < (time_t)starttime) {
-            tim.tm_hour = starttime;
-            tmval.tv_sec = do_timegm(&tim);
-            // backtrack time until last time larger than current time
-            time_t tsec;
-            while ((tsec = tmval.tv_sec - (int)secs) > waketime.tv_sec) {
-                tmval.tv_sec = tsec;
-            }
-        }
-        waketime = tmval;
-    } else {
-        advance_tv(waketime, secs);
-    }
-}
-
 bool FlusherTask::run() {
     return flusher->step(taskId);
 }
 
+bool FlushCommitTask::run() {
+    flusher->commit(batches);
+    return false;
+}
+
 bool VBSnapshotTask::run() {
     engine->getEpStore()->snapshotVBuckets(priority, shardID);
     return false;
@@ -109,3 +68,8 @@ bool BGFetchTask::run() {
                                           metaFetch);
     return false;
 }
+
+bool WarmupShardTask::run() {
+    warmup->loadShard(shardID);
+    return false;
+}
@@ -21,6 +21,7 @@
 #include "config.h"
 
 #include <string>
+#include <vector>
 
 #include "atomic.h"
 #include "priority.h"
@@ -35,19 +36,34 @@ class CompareTasksByDueDate;
 class CompareTasksByPriority;
 class EventuallyPersistentEngine;
 class Flusher;
+struct FlushBatch;
 class Warmup;
 
+//! Start time of tasks whose first run isn't put at a given hour.
+#define NO_START_TIME 24
+
 class GlobalTask : public RCValue {
 friend class CompareByDueDate;
 friend class CompareByPriority;
 friend class ExecutorThread;
+friend class ExecutorPool;
 public:
+    /**
+     * @param e the engine the task is scheduled from
+     * @param p the priority of the task
+     * @param sleeptime seconds to wait before the first run
+     * @param sttime hour (0 to 23, GMT) the first run of a task waiting
+     *               an hour or more is put at, or NO_START_TIME
+     * @param isDaemon false if the task is to be forgotten once it's done
+     * @param completeBeforeShutdown whether the task must run before the
+     *                               bucket shuts down
+     */
     GlobalTask(EventuallyPersistentEngine *e, const Priority &p,
                double sleeptime = 0, size_t sttime = 0, bool isDaemon = true,
                bool completeBeforeShutdown = true) :
           RCValue(), priority(p), starttime(sttime),
           isDaemonTask(isDaemon), blockShutdown(completeBeforeShutdown),
-          state(TASK_RUNNING), taskId(nextTaskId()), engine(e) {
+          state(TASK_RUNNING), taskId(nextTaskId()), serial(-1), engine(e) {
         snooze(sleeptime, true);
     }
 
@@ -69,8 +85,13 @@ public:
      */
     virtual std::string getDescription() = 0;
 
-    virtual int maxExpectedDuration() {
-        return 3600;
+    /**
+     * Maximum amount of time (in microseconds) this task should run
+     * before considered slow.
+     */
+    virtual hrtime_t maxExpectedDuration() {
+        // Default == 1 second
+        return 1 * 1000 * 1000;
     }
 
     /**
@@ -93,6 +114,14 @@ public:
      */
     size_t getId() { return taskId; }
 
+    /**
+     * Returns the time this task is due to run next.
+     */
+    struct timeval getWaketime() {
+        LockHolder lh(mutex);
+        return waketime;
+    }
+
     /**
      * Gets the engine that this task was scheduled from
      *
@@ -107,6 +136,8 @@ protected:
     bool blockShutdown;
     task_state_t state;
     const size_t taskId;
+    //! Tasks of a thread with the same serial never run at once (-1: none).
+    int serial;
     struct timeval waketime;
     EventuallyPersistentEngine *engine;
     Mutex mutex;
@@ -137,6 +168,31 @@ private:
     Flusher* flusher;
 };
 
+/**
+ * A task for committing a batch of items collected by a flusher.
+ */
+class FlushCommitTask : public GlobalTask {
+public:
+    FlushCommitTask(EventuallyPersistentEngine *e, Flusher* f,
+                    const std::vector<FlushBatch*> &b, const Priority &p,
+                    bool isDaemon = false,
+                    bool completeBeforeShutdown = true) :
+                    GlobalTask(e, p, 0, 0, isDaemon, completeBeforeShutdown),
+                               flusher(f), batches(b) {}
+
+    bool run();
+
+    std::string getDescription() {
+        std::stringstream ss;
+        ss << "Committing " << batches.size() << " flusher batches";
+        return ss.str();
+    }
+
+private:
+    Flusher* flusher;
+    std::vector<FlushBatch*> batches;
+};
+
 /**
  * A task for persisting VBucket state changes to disk and creating a new
  * VBucket database files.
@@ -284,6 +340,30 @@ private:
     hrtime_t                   init;
 };
 
+/**
+ * A task that warms up the vbuckets of a single shard.
+ */
+class WarmupShardTask : public GlobalTask {
+public:
+    WarmupShardTask(EventuallyPersistentEngine *e, Warmup *w, uint16_t sID,
+                    const Priority &p, bool isDaemon = false,
+                    bool shutdown = false) :
+        GlobalTask(e, p, 0, 0, isDaemon, shutdown), warmup(w),
+        shardID(sID) { }
+
+    bool run();
+
+    std::string getDescription() {
+        std::stringstream ss;
+        ss << "Warming up shard " << shardID;
+        return ss.str();
+    }
+
+private:
+    Warmup  *warmup;
+    uint16_t shardID;
+};
+
 /**
  * Order tasks by their priority and taskId (try to ensure FIFO)
  */
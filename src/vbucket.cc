@@ -17,6 +17,7 @@
 
 #include "config.h"
 
+#include <algorithm>
 #include <functional>
 #include <list>
 #include <set>
@@ -192,11 +193,31 @@ void VBucket::doStatsForFlushing(QueuedItem& qi, size_t itemBytes)
     }
 }
 
+size_t VBucket::updateEvictionHitRate() {
+    size_t gets = opsGet.get();
+    size_t fetches = opsBgFetch.get();
+    // Either may have been reset since the last call.
+    size_t newGets = gets >= lastOpsGet ? gets - lastOpsGet : gets;
+    size_t newFetches = fetches >= lastOpsBgFetch ? fetches - lastOpsBgFetch
+                                                  : fetches;
+    lastOpsGet = gets;
+    lastOpsBgFetch = fetches;
+
+    size_t rv(0);
+    if (newGets > 0) {
+        rv = (newGets - std::min(newFetches, newGets)) * 100 / newGets;
+    }
+    evictionHitRate.set(rv);
+    return rv;
+}
+
 void VBucket::resetStats() {
     opsCreate.set(0);
     opsUpdate.set(0);
     opsDelete.set(0);
     opsReject.set(0);
+    opsGet.set(0);
+    opsBgFetch.set(0);
 
     stats.decrDiskQueueSize(dirtyQueueSize.get());
     dirtyQueueSize.set(0);
@@ -309,6 +330,102 @@ size_t VBucket::getCheckpointFlushTimeout() {
     return chkFlushTimeout;
 }
 
+bool VBucket::addDurabilityWaiter(DurabilityWaiter *waiter) {
+    LockHolder lh(durabilityMutex);
+    if (updateDurability_UNLOCKED(waiter, gethrtime())) {
+        return false;
+    }
+    durabilityWaiters.push_back(waiter);
+    return true;
+}
+
+void VBucket::notifyPersisted(EventuallyPersistentEngine &e, uint64_t mid) {
+    LockHolder lh(durabilityMutex);
+    if (mid > persistedMutationId) {
+        persistedMutationId = mid;
+    }
+    if (durabilityWaiters.empty()) {
+        return;
+    }
+    lh.unlock();
+    fireDurabilityWaiters(e);
+}
+
+void VBucket::notifyReplicaAck(EventuallyPersistentEngine &e,
+                               const std::string &name, uint64_t mid) {
+    LockHolder lh(durabilityMutex);
+    uint64_t &acked = replicaAcks[name];
+    if (mid > acked) {
+        acked = mid;
+    }
+    if (durabilityWaiters.empty()) {
+        return;
+    }
+    lh.unlock();
+    fireDurabilityWaiters(e);
+}
+
+void VBucket::removeReplicaAck(const std::string &name) {
+    LockHolder lh(durabilityMutex);
+    replicaAcks.erase(name);
+}
+
+void VBucket::fireDurabilityWaiters(EventuallyPersistentEngine &e, bool all) {
+    std::vector<const void*> done;
+    LockHolder lh(durabilityMutex);
+    hrtime_t now = gethrtime();
+    std::list<DurabilityWaiter*>::iterator it = durabilityWaiters.begin();
+    while (it != durabilityWaiters.end()) {
+        DurabilityWaiter *waiter = *it;
+        if (updateDurability_UNLOCKED(waiter, now)) {
+            done.push_back(waiter->cookie);
+            it = durabilityWaiters.erase(it);
+        } else if (all || now >= waiter->deadline) {
+            waiter->timedOut = true;
+            ++stats.durabilityTimeouts;
+            done.push_back(waiter->cookie);
+            it = durabilityWaiters.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    lh.unlock();
+
+    // The waiters belong to their connections once they are off the list.
+    if (!done.empty()) {
+        e.notifyIOComplete(done, ENGINE_SUCCESS);
+    }
+}
+
+size_t VBucket::getNumDurabilityWaiters() {
+    LockHolder lh(durabilityMutex);
+    return durabilityWaiters.size();
+}
+
+bool VBucket::updateDurability_UNLOCKED(DurabilityWaiter *waiter, hrtime_t now) {
+    if (!waiter->persisted && persistedMutationId >= waiter->mutationId) {
+        waiter->persisted = true;
+        if (waiter->persist) {
+            stats.durabilityPersistHisto.add((now - waiter->start) / 1000);
+        }
+    }
+    if (waiter->replicated < waiter->replicas) {
+        uint8_t acked = 0;
+        std::map<std::string, uint64_t>::iterator it;
+        for (it = replicaAcks.begin(); it != replicaAcks.end(); ++it) {
+            if (it->second >= waiter->mutationId && acked < 0xff) {
+                ++acked;
+            }
+        }
+        waiter->replicated = acked;
+        if (acked >= waiter->replicas) {
+            stats.durabilityReplicateHisto.add((now - waiter->start) / 1000);
+        }
+    }
+    return (!waiter->persist || waiter->persisted) &&
+        waiter->replicated >= waiter->replicas;
+}
+
 void VBucket::addStats(bool details, ADD_STAT add_stat, const void *c) {
     addStat(NULL, toString(state), add_stat, c);
     if (details) {
@@ -325,6 +442,10 @@ void VBucket::addStats(bool details, ADD_STAT add_stat, const void *c) {
         addStat("ops_update", opsUpdate, add_stat, c);
         addStat("ops_delete", opsDelete, add_stat, c);
         addStat("ops_reject", opsReject, add_stat, c);
+        addStat("ops_get", opsGet, add_stat, c);
+        addStat("ops_bg_fetch", opsBgFetch, add_stat, c);
+        addStat("eviction_quota", evictionQuota, add_stat, c);
+        addStat("eviction_hit_rate", evictionHitRate, add_stat, c);
         addStat("queue_size", dirtyQueueSize, add_stat, c);
         addStat("queue_memory", dirtyQueueMem, add_stat, c);
         addStat("queue_fill", dirtyQueueFill, add_stat, c);
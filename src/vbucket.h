@@ -21,6 +21,7 @@
 #include "config.h"
 
 #include <list>
+#include <map>
 #include <queue>
 #include <set>
 #include <sstream>
@@ -48,6 +49,30 @@ struct HighPriorityVBEntry {
     hrtime_t start;
 };
 
+/**
+ * A connection blocked in CMD_WAIT_DURABILITY until a mutation is
+ * persisted and/or acked by enough TAP connections.
+ */
+struct DurabilityWaiter {
+    DurabilityWaiter(const void *c, uint64_t mid, bool p, uint8_t r,
+                     hrtime_t timeout) :
+        cookie(c), mutationId(mid), persist(p), replicas(r),
+        start(gethrtime()), deadline(start + timeout), persisted(false),
+        replicated(0), timedOut(false) { }
+
+    const void *cookie;
+    uint64_t mutationId;
+    bool persist;
+    uint8_t replicas;
+    hrtime_t start;
+    hrtime_t deadline;
+
+    //! Set by the vbucket before the connection is woken up.
+    bool persisted;
+    uint8_t replicated;
+    bool timedOut;
+};
+
 /**
  * Function object that returns true if the given vbucket is acceptable.
  */
@@ -144,8 +169,11 @@ public:
 
         backfill.isBackfillPhase = false;
         pendingOpsStart = 0;
+        persistedMutationId = 0;
+        lastOpsGet = 0;
+        lastOpsBgFetch = 0;
         stats.memOverhead.incr(sizeof(VBucket)
-                               + ht.memorySize() + sizeof(CheckpointManager));
+                               + ht.tableMemorySize() + sizeof(CheckpointManager));
         assert(stats.memOverhead.get() < GIGANTOR);
     }
 
@@ -163,7 +191,7 @@ public:
             delete pendingBGFetches.front();
             pendingBGFetches.pop();
         }
-        stats.memOverhead.decr(sizeof(VBucket) + ht.memorySize() + sizeof(CheckpointManager));
+        stats.memOverhead.decr(sizeof(VBucket) + ht.tableMemorySize() + sizeof(CheckpointManager));
         assert(stats.memOverhead.get() < GIGANTOR);
         LOG(EXTENSION_LOG_INFO, "Destroying vbucket %d\n", id);
     }
@@ -281,8 +309,49 @@ public:
     size_t getHighPriorityChkSize() const;
     static size_t getCheckpointFlushTimeout();
 
+    /**
+     * Park a connection until its mutation is persisted and replicated
+     * as asked for.
+     *
+     * @return false if it already is, in which case it isn't parked
+     */
+    bool addDurabilityWaiter(DurabilityWaiter *waiter);
+
+    /**
+     * Note that everything up to a given mutation id is persisted.
+     */
+    void notifyPersisted(EventuallyPersistentEngine &e, uint64_t mid);
+
+    /**
+     * Note that a TAP connection got acks for everything up to a given
+     * mutation id.
+     */
+    void notifyReplicaAck(EventuallyPersistentEngine &e,
+                          const std::string &name, uint64_t mid);
+
+    /**
+     * Forget the acks of a TAP connection that is going away.
+     */
+    void removeReplicaAck(const std::string &name);
+
+    /**
+     * Wake the durability waiters that are done or past their deadline.
+     *
+     * @param all time out the ones that are still waiting too
+     */
+    void fireDurabilityWaiters(EventuallyPersistentEngine &e, bool all = false);
+
+    size_t getNumDurabilityWaiters();
+
     void addStats(bool details, ADD_STAT add_stat, const void *c);
 
+    /**
+     * Get the percentage of the gets since the last call that were
+     * served from memory (0 if there were none), and keep it as the
+     * hit rate the eviction quota is chosen with.
+     */
+    size_t updateEvictionHitRate();
+
     static const vbucket_state_t ACTIVE;
     static const vbucket_state_t REPLICA;
     static const vbucket_state_t PENDING;
@@ -302,6 +371,9 @@ public:
     Atomic<size_t>  opsUpdate;
     Atomic<size_t>  opsDelete;
     Atomic<size_t>  opsReject;
+    //! Gets served, and the ones of those that waited for a bg fetch
+    Atomic<size_t>  opsGet;
+    Atomic<size_t>  opsBgFetch;
 
     Atomic<size_t>  dirtyQueueSize;
     Atomic<size_t>  dirtyQueueMem;
@@ -312,6 +384,11 @@ public:
 
     Atomic<size_t>  numExpiredItems;
 
+    //! Bytes of values the item pager last set out to eject from here
+    Atomic<size_t>  evictionQuota;
+    //! Hit rate (%) that quota was chosen with
+    Atomic<size_t>  evictionHitRate;
+
 private:
     template <typename T>
     void addStat(const char *nm, T val, ADD_STAT add_stat, const void *c);
@@ -320,6 +397,8 @@ private:
 
     void adjustCheckpointFlushTimeout(size_t wall_time);
 
+    bool updateDurability_UNLOCKED(DurabilityWaiter *waiter, hrtime_t now);
+
     int                      id;
     Atomic<vbucket_state_t>  state;
     vbucket_state_t          initialState;
@@ -333,6 +412,16 @@ private:
 
     Mutex hpChksMutex;
     std::list<HighPriorityVBEntry> hpChks;
+
+    Mutex durabilityMutex;
+    std::list<DurabilityWaiter*> durabilityWaiters;
+    //! Mutation id everything up to which is persisted.
+    uint64_t persistedMutationId;
+    //! opsGet and opsBgFetch at the last updateEvictionHitRate().
+    size_t lastOpsGet;
+    size_t lastOpsBgFetch;
+    //! Mutation id everything up to which each TAP connection got acks for.
+    std::map<std::string, uint64_t> replicaAcks;
     KVShard *shard;
 
     static size_t chkFlushTimeout;
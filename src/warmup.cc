@@ -17,6 +17,7 @@
 
 #include "config.h"
 
+#include <algorithm>
 #include <limits>
 #include <list>
 #include <map>
@@ -25,14 +26,15 @@
 #include <vector>
 
 #include "ep_engine.h"
+#include "iomanager/iomanager.h"
 #define STATWRITER_NAMESPACE warmup
 #include "statwriter.h"
 #undef STATWRITER_NAMESPACE
 #include "warmup.h"
 
 struct WarmupCookie {
-    WarmupCookie(EventuallyPersistentStore *s, Callback<GetValue>&c) :
-        store(s->getAuxUnderlying()), cb(c), stats(&s->getEPEngine().getEpStats()),
+    WarmupCookie(KVStore *s, Callback<GetValue>&c, EPStats &st) :
+        store(s), cb(c), stats(&st),
         loaded(0), skipped(0), error(0)
     { /* EMPTY */ }
     KVStore *store;
@@ -215,17 +217,56 @@ void LoadStorageKVPairCallback::initVBucket(uint16_t vbid,
 void LoadStorageKVPairCallback::callback(GetValue &val) {
     Item *i = val.getValue();
     if (i != NULL) {
-        RCPtr<VBucket> vb = vbuckets.getBucket(i->getVBucketId());
-        if (!vb) {
-            vb.reset(new VBucket(i->getVBucketId(), vbucket_state_dead, stats,
-                                 epstore->getEPEngine().getCheckpointConfig(),
-                                 epstore->getVBuckets().getShard(i->getVBucketId())));
-            vbuckets.addBucket(vb);
+        if (!batch.empty() && (batch.size() >= batchSize ||
+                               batch.back().first->getVBucketId() !=
+                               i->getVBucketId())) {
+            flush();
         }
+        batch.push_back(std::make_pair(i, val.isPartial()));
+        val.setValue(NULL);
+    }
+
+    switch (warmupState) {
+        case WarmupState::KeyDump:
+            ++stats.warmedUpKeys;
+            ++keysLoaded;
+            break;
+        case WarmupState::LoadingData:
+        case WarmupState::LoadingAccessLog:
+            ++stats.warmedUpValues;
+            ++valuesLoaded;
+            break;
+        default:
+            ++stats.warmedUpKeys;
+            ++stats.warmedUpValues;
+            ++keysLoaded;
+            ++valuesLoaded;
+    }
+}
+
+void LoadStorageKVPairCallback::flush() {
+    if (batch.empty()) {
+        return;
+    }
+
+    uint16_t vbid = batch.front().first->getVBucketId();
+    RCPtr<VBucket> vb = vbuckets.getBucket(vbid);
+    if (!vb) {
+        vb.reset(new VBucket(vbid, vbucket_state_dead, stats,
+                             epstore->getEPEngine().getCheckpointConfig(),
+                             epstore->getVBuckets().getShard(vbid)));
+        vbuckets.addBucket(vb);
+    }
+
+    // Only check the memory usage once for the whole batch.
+    bool eject = shouldEject();
+    std::vector<std::pair<Item*, bool> >::iterator it;
+    for (it = batch.begin(); it != batch.end(); ++it) {
+        Item *i = it->first;
         bool succeeded(false);
         int retry = 2;
         do {
-            switch (vb->ht.insert(*i, shouldEject(), val.isPartial())) {
+            switch (vb->ht.insert(*i, eject, it->second)) {
             case NOMEM:
                 if (retry == 2) {
                     if (hasPurged) {
@@ -243,6 +284,7 @@ void LoadStorageKVPairCallback::callback(GetValue &val) {
                         "Cannot store an item after emergency purge.");
                     ++stats.warmOOM;
                 }
+                eject = shouldEject();
                 break;
             case INVALID_CAS:
                 if (epstore->getAuxUnderlying()->isKeyDumpSupported()) {
@@ -282,24 +324,11 @@ void LoadStorageKVPairCallback::callback(GetValue &val) {
         }
 
         delete i;
-        val.setValue(NULL);
-
-        if (maybeEnableTraffic) {
-            epstore->maybeEnableTraffic();
-        }
     }
+    batch.clear();
 
-    switch (warmupState) {
-        case WarmupState::KeyDump:
-            ++stats.warmedUpKeys;
-            break;
-        case WarmupState::LoadingData:
-        case WarmupState::LoadingAccessLog:
-            ++stats.warmedUpValues;
-            break;
-        default:
-            ++stats.warmedUpKeys;
-            ++stats.warmedUpValues;
+    if (maybeEnableTraffic) {
+        epstore->maybeEnableTraffic();
     }
 }
 
@@ -359,13 +388,28 @@ bool LoadStorageKVPairCallback::isLoaded(const char* buf,
 //////////////////////////////////////////////////////////////////////////////
 
 
-Warmup::Warmup(EventuallyPersistentStore *st, Dispatcher *d) :
-    state(), store(st), dispatcher(d), startTime(0), metadata(0), warmup(0),
+Warmup::Warmup(EventuallyPersistentStore *st) :
+    state(), store(st), taskId(0), startTime(0), metadata(0), warmup(0),
     estimateTime(0), estimatedItemCount(std::numeric_limits<size_t>::max()),
     corruptAccessLog(false),
-    estimatedWarmupCount(std::numeric_limits<size_t>::max())
+    estimatedWarmupCount(std::numeric_limits<size_t>::max()),
+    runningShards(0), stopping(false), shardsScheduled(false),
+    harvester(NULL), accessLogStart(0), accessLogPeakMem(0)
 {
+    size_t numShards = store->getEPEngine().getWorkLoadPolicy().getNumShards();
+    shardVBuckets.resize(numShards);
+    for (size_t i = 0; i < numShards; ++i) {
+        shardProgress.push_back(new ShardProgress);
+    }
+}
 
+Warmup::~Warmup()
+{
+    delete harvester;
+    std::vector<ShardProgress*>::iterator it;
+    for (it = shardProgress.begin(); it != shardProgress.end(); ++it) {
+        delete *it;
+    }
 }
 
 void Warmup::setEstimatedItemCount(size_t to)
@@ -381,31 +425,193 @@ void Warmup::setEstimatedWarmupCount(size_t to)
 void Warmup::start(void)
 {
     store->stats.warmupComplete.set(false);
-    dispatcher->schedule(shared_ptr<WarmupStepper>(new WarmupStepper(this)),
-                         &task, Priority::WarmupPriority);
+    ExTask task = new WarmupStepper(&store->getEPEngine(), this);
+    taskId = IOManager::get()->scheduleTask(task, AUXIO_TASK_IDX);
 }
 
 void Warmup::stop(void)
 {
-    if (task.get()) {
-        dispatcher->cancel(task);
+    if (taskId != 0) {
+        IOManager::get()->cancel(taskId);
+        {
+            LockHolder lh(shardSync);
+            stopping = true;
+        }
+        std::vector<size_t>::iterator it;
+        for (it = shardTasks.begin(); it != shardTasks.end(); ++it) {
+            IOManager::get()->cancel(*it);
+        }
         // immediately transition to completion so that
         // the warmup listener also breaks away from the waiting
         transition(WarmupState::Done, true);
-        done(*dispatcher, task);
+        done();
+
+        // Shard tasks already running got past the cancel; they stop
+        // at the next vbucket now that warmup is complete, but must
+        // be out before we can go away.
+        LockHolder lh(shardSync);
+        while (runningShards > 0) {
+            shardSync.wait();
+        }
     }
 }
 
-bool Warmup::initialize(Dispatcher&, TaskId &)
+bool Warmup::initialize()
 {
     startTime = gethrtime();
     initialVbState = store->loadVBucketState();
     store->loadSessionStats();
+    initVBuckets();
     transition(WarmupState::EstimateDatabaseItemCount);
     return true;
 }
 
-bool Warmup::estimateDatabaseItemCount(Dispatcher&, TaskId &)
+void Warmup::initVBuckets(void)
+{
+    LoadStorageKVPairCallback load_cb(store, false, state.getState());
+    std::map<uint16_t, vbucket_state>::const_iterator it;
+    for (it = initialVbState.begin(); it != initialVbState.end(); ++it) {
+        uint16_t vbid = it->first;
+        vbucket_state vbs = it->second;
+        vbs.checkpointId++;
+        load_cb.initVBucket(vbid, vbs);
+    }
+
+    // Each shard loads its active vbuckets before its replicas and
+    // pending vbuckets, and dead vbuckets aren't loaded at all.
+    vbucket_state_t order[] = { vbucket_state_active, vbucket_state_replica,
+                                vbucket_state_pending };
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); ++i) {
+        for (it = initialVbState.begin(); it != initialVbState.end(); ++it) {
+            if (it->second.state == order[i]) {
+                KVShard *shard = store->getVBuckets().getShard(it->first);
+                shardVBuckets[shard->getId()].push_back(it->first);
+            }
+        }
+    }
+    for (size_t i = 0; i < shardVBuckets.size(); ++i) {
+        shardProgress[i]->vbuckets = shardVBuckets[i].size();
+    }
+}
+
+bool Warmup::loadShards()
+{
+    if (!shardsScheduled) {
+        shardsScheduled = true;
+        shardTasks.clear();
+        pendingShards.set(shardVBuckets.size());
+        for (size_t i = 0; i < shardVBuckets.size(); ++i) {
+            shardProgress[i]->vbucketsDone.set(0);
+            shardTasks.push_back(IOManager::get()->scheduleWarmupShard(
+                                 &store->getEPEngine(), this,
+                                 Priority::WarmupPriority, i));
+        }
+    }
+
+    // The last shard to finish wakes us up.
+    IOManager::get()->snooze(taskId, 1);
+    if (pendingShards.get() != 0) {
+        return false;
+    }
+    IOManager::get()->snooze(taskId, 0);
+    shardsScheduled = false;
+    return true;
+}
+
+void Warmup::loadShard(uint16_t shardId)
+{
+    {
+        LockHolder lh(shardSync);
+        if (stopping) {
+            return;
+        }
+        ++runningShards;
+    }
+
+    hrtime_t st = gethrtime();
+    int warmupState = state.getState();
+    bool maybeEnable = (warmupState == WarmupState::LoadingAccessLog ||
+                        warmupState == WarmupState::LoadingData);
+    KVStore *kvstore = store->getVBuckets().getShard(shardId)->getROUnderlying();
+    EPStats &stats = store->getEPEngine().getEpStats();
+    LoadStorageKVPairCallback *load_cb =
+        new LoadStorageKVPairCallback(store, maybeEnable, warmupState);
+    shared_ptr<Callback<GetValue> > cb(load_cb);
+    WarmupCookie cookie(kvstore, *load_cb, stats);
+
+    ShardProgress *progress = shardProgress[shardId];
+    size_t keys = progress->keys.get();
+    size_t values = progress->values.get();
+    const std::vector<uint16_t> &vbids = shardVBuckets[shardId];
+    bool perVBucket = true;
+    if (warmupState == WarmupState::LoadingAccessLog &&
+        harvester->canStream()) {
+        perVBucket = false;
+        // Read the log once for all of the shard's vbuckets instead of
+        // once per vbucket.
+        if (store->multiBGFetchEnabled()) {
+            harvester->stream(&cookie, &batchWarmupCallback, vbids,
+                              store->getEPEngine().getConfiguration().getWarmupBatchSize());
+        } else {
+            harvester->stream(&cookie, &warmupCallback, vbids);
+        }
+        load_cb->flush();
+
+        progress->vbucketsDone.set(vbids.size());
+        progress->keys.set(keys + load_cb->getKeysLoaded());
+        progress->values.set(values + load_cb->getValuesLoaded());
+    }
+
+    std::vector<uint16_t>::const_iterator it;
+    for (it = vbids.begin(); perVBucket && it != vbids.end(); ++it) {
+        if (stats.warmupComplete.get()) {
+            break;
+        }
+
+        std::vector<uint16_t> vb(1, *it);
+        switch (warmupState) {
+        case WarmupState::KeyDump:
+            kvstore->dumpKeys(vb, cb);
+            break;
+        case WarmupState::LoadingAccessLog:
+            if (store->multiBGFetchEnabled()) {
+                harvester->apply(&cookie, &batchWarmupCallback, vb);
+            } else {
+                harvester->apply(&cookie, &warmupCallback, vb);
+            }
+            break;
+        default:
+            kvstore->dump(vb, cb);
+        }
+        load_cb->flush();
+
+        ++progress->vbucketsDone;
+        progress->keys.set(keys + load_cb->getKeysLoaded());
+        progress->values.set(values + load_cb->getValuesLoaded());
+    }
+
+    hrtime_t spent = gethrtime() - st;
+    progress->time.incr(spent);
+    if (warmupState == WarmupState::LoadingAccessLog) {
+        LOG(EXTENSION_LOG_DEBUG, "Populated log for shard %d in %s "
+            "with(l: %ld, s: %ld, e: %ld)", shardId,
+            hrtime2text(spent).c_str(), cookie.loaded, cookie.skipped,
+            cookie.error);
+    } else {
+        LOG(EXTENSION_LOG_DEBUG, "Warmup of shard %d done in %s", shardId,
+            hrtime2text(spent).c_str());
+    }
+
+    if (--pendingShards == 0) {
+        IOManager::get()->wake(taskId);
+    }
+
+    LockHolder lh(shardSync);
+    --runningShards;
+    shardSync.notify();
+}
+
+bool Warmup::estimateDatabaseItemCount()
 {
     hrtime_t st = gethrtime();
     store->getAuxUnderlying()->getEstimatedItemCount(estimatedItemCount);
@@ -415,40 +621,21 @@ bool Warmup::estimateDatabaseItemCount(Dispatcher&, TaskId &)
     return true;
 }
 
-bool Warmup::keyDump(Dispatcher&, TaskId &)
+bool Warmup::keyDump()
 {
-    bool success = false;
     if (store->getAuxUnderlying()->isKeyDumpSupported()) {
-        shared_ptr<Callback<GetValue> > cb(createLKVPCB(initialVbState, false,
-                                                        state.getState()));
-        std::map<uint16_t, vbucket_state>::const_iterator it;
-        std::vector<uint16_t> vbids;
-        for (it = initialVbState.begin(); it != initialVbState.end(); ++it) {
-            uint16_t vbid = it->first;
-            vbucket_state vbs = it->second;
-            if (vbs.state == vbucket_state_active || vbs.state == vbucket_state_replica) {
-                vbids.push_back(vbid);
-            }
+        if (!loadShards()) {
+            return true;
         }
-
-        store->getAuxUnderlying()->dumpKeys(vbids, cb);
-        success = true;
-    }
-
-    if (success) {
         transition(WarmupState::CheckForAccessLog);
     } else {
-        if (store->getAuxUnderlying()->isKeyDumpSupported()) {
-            LOG(EXTENSION_LOG_WARNING,
-                "Failed to dump keys, falling back to full dump");
-        }
         transition(WarmupState::LoadingKVPairs);
     }
 
     return true;
 }
 
-bool Warmup::checkForAccessLog(Dispatcher&, TaskId &)
+bool Warmup::checkForAccessLog()
 {
     metadata = gethrtime() - startTime;
     LOG(EXTENSION_LOG_WARNING, "metadata loaded in %s",
@@ -466,24 +653,40 @@ bool Warmup::checkForAccessLog(Dispatcher&, TaskId &)
     return true;
 }
 
-bool Warmup::loadingAccessLog(Dispatcher&, TaskId &)
+bool Warmup::loadingAccessLog()
 {
-    LoadStorageKVPairCallback *load_cb = createLKVPCB(initialVbState, true,
-                                                      state.getState());
-    bool success = false;
-    hrtime_t stTime = gethrtime();
+    if (harvester == NULL) {
+        accessLogStart = gethrtime();
+        harvester = harvestAccessLog();
+        if (harvester == NULL) {
+            return accessLogLoaded(false);
+        }
+    }
+
+    if (!loadShards()) {
+        return true;
+    }
+    accessLogPeakMem = harvester->getPeakMemory();
+    delete harvester;
+    harvester = NULL;
+    return accessLogLoaded(true);
+}
+
+MutationLogHarvester *Warmup::harvestAccessLog(void)
+{
+    MutationLogHarvester *rv = NULL;
     if (store->accessLog.exists()) {
+        MutationLog delta(store->accessLog.getLogFile() + ".delta");
         try {
             store->accessLog.open();
-            if (doWarmup(store->accessLog, initialVbState, *load_cb) != (size_t)-1) {
-                success = true;
-            }
+            rv = doWarmup(store->accessLog, initialVbState,
+                          delta.exists() ? &delta : NULL);
         } catch (MutationLog::ReadException &e) {
             corruptAccessLog = true;
         }
     }
 
-    if (!success) {
+    if (rv == NULL) {
         // Do we have the previous file?
         std::string nm = store->accessLog.getLogFile();
         nm.append(".old");
@@ -491,20 +694,22 @@ bool Warmup::loadingAccessLog(Dispatcher&, TaskId &)
         if (old.exists()) {
             try {
                 old.open();
-                if (doWarmup(old, initialVbState, *load_cb) != (size_t)-1) {
-                    success = true;
-                }
+                rv = doWarmup(old, initialVbState);
             } catch (MutationLog::ReadException &e) {
                 corruptAccessLog = true;
             }
         }
     }
+    return rv;
+}
 
+bool Warmup::accessLogLoaded(bool success)
+{
     size_t numItems = store->getEPEngine().getEpStats().warmedUpValues;
     if (success && numItems) {
         LOG(EXTENSION_LOG_WARNING,
             "%d items loaded from access log, completed in %s", numItems,
-            hrtime2text((gethrtime() - stTime) / 1000).c_str());
+            hrtime2text((gethrtime() - accessLogStart) / 1000).c_str());
     } else {
         size_t estimatedCount = store->getEPEngine().getEpStats().warmedUpKeys;
         setEstimatedWarmupCount(estimatedCount);
@@ -517,67 +722,88 @@ bool Warmup::loadingAccessLog(Dispatcher&, TaskId &)
     else {
         transition(WarmupState::Done);
     }
-
-    delete load_cb;
     return true;
 }
 
-size_t Warmup::doWarmup(MutationLog &lf, const std::map<uint16_t,
-                        vbucket_state> &vbmap, Callback<GetValue> &cb)
+MutationLogHarvester *Warmup::doWarmup(MutationLog &lf, const std::map<uint16_t,
+                                       vbucket_state> &vbmap,
+                                       MutationLog *delta)
 {
-    MutationLogHarvester harvester(lf, &store->getEPEngine());
+    MutationLogHarvester *rv = new MutationLogHarvester(lf, &store->getEPEngine());
     std::map<uint16_t, vbucket_state>::const_iterator it;
     for (it = vbmap.begin(); it != vbmap.end(); ++it) {
-        harvester.setVBucket(it->first);
+        rv->setVBucket(it->first);
     }
 
     hrtime_t st = gethrtime();
-    if (!harvester.load()) {
-        return -1;
+    bool loaded(false);
+    try {
+        loaded = rv->scan();
+        if (loaded && delta != NULL && rv->canStream()) {
+            try {
+                delta->open(true);
+                if (!rv->merge(*delta)) {
+                    LOG(EXTENSION_LOG_INFO, "Ignoring the uncommitted end "
+                        "of access log delta %s", delta->getLogFile().c_str());
+                }
+            } catch (MutationLog::ReadException &e) {
+                // What was merged up to the last commit read still holds.
+                LOG(EXTENSION_LOG_WARNING, "Failed to read access log delta "
+                    "%s: %s", delta->getLogFile().c_str(), e.what());
+            }
+        }
+        if (loaded && !rv->canStream()) {
+            // Only a log that never removes keys can be read by the
+            // shards as they go; this one has to be read in whole.
+            if (delta != NULL) {
+                LOG(EXTENSION_LOG_WARNING, "Ignoring access log delta %s: "
+                    "access log %s has to be loaded in whole",
+                    delta->getLogFile().c_str(), lf.getLogFile().c_str());
+            }
+            loaded = rv->load();
+        }
+    } catch (...) {
+        delete rv;
+        throw;
+    }
+    if (!loaded) {
+        accessLogPeakMem = rv->getPeakMemory();
+        delete rv;
+        return NULL;
     }
     hrtime_t end = gethrtime();
 
-    size_t total = harvester.total();
+    size_t total = rv->total();
     setEstimatedWarmupCount(total);
     LOG(EXTENSION_LOG_DEBUG, "Completed log read in %s with %ld entries",
         hrtime2text(end - st).c_str(), total);
-
-    st = gethrtime();
-    WarmupCookie cookie(store, cb);
-    if (store->multiBGFetchEnabled()) {
-        harvester.apply(&cookie, &batchWarmupCallback);
-    } else {
-        harvester.apply(&cookie, &warmupCallback);
-    }
-    end = gethrtime();
-    LOG(EXTENSION_LOG_DEBUG, "Populated log in %s with(l: %ld, s: %ld, e: %ld)",
-        hrtime2text(end - st).c_str(), cookie.loaded, cookie.skipped,
-        cookie.error);
-    return cookie.loaded;
+    return rv;
 }
 
-bool Warmup::loadingKVPairs(Dispatcher&, TaskId &)
+bool Warmup::loadingKVPairs()
 {
-    shared_ptr<Callback<GetValue> > cb(createLKVPCB(initialVbState, false,
-                                                    state.getState()));
-    store->getAuxUnderlying()->dump(cb);
+    if (!loadShards()) {
+        return true;
+    }
     transition(WarmupState::Done);
     return true;
 }
 
-bool Warmup::loadingData(Dispatcher&, TaskId &)
+bool Warmup::loadingData()
 {
-    size_t estimatedCount = store->getEPEngine().getEpStats().warmedUpKeys;
-    setEstimatedWarmupCount(estimatedCount);
+    if (!shardsScheduled) {
+        size_t estimatedCount = store->getEPEngine().getEpStats().warmedUpKeys;
+        setEstimatedWarmupCount(estimatedCount);
+    }
 
-    shared_ptr<Callback<GetValue> > cb(createLKVPCB(initialVbState, true,
-                                       state.getState()));
-    store->getAuxUnderlying()->dump(cb);
+    if (!loadShards()) {
+        return true;
+    }
     transition(WarmupState::Done);
     return true;
 }
 
-bool Warmup::done(Dispatcher&, TaskId &)
+bool Warmup::done()
 {
     warmup = gethrtime() - startTime;
     store->warmupCompleted();
@@ -587,25 +813,25 @@ bool Warmup::done(Dispatcher&, TaskId &)
     return false;
 }
 
-bool Warmup::step(Dispatcher &d, TaskId &t) {
+bool Warmup::step() {
     try {
         switch (state.getState()) {
         case WarmupState::Initialize:
-            return initialize(d, t);
+            return initialize();
         case WarmupState::EstimateDatabaseItemCount:
-            return estimateDatabaseItemCount(d, t);
+            return estimateDatabaseItemCount();
         case WarmupState::KeyDump:
-            return keyDump(d, t);
+            return keyDump();
         case WarmupState::CheckForAccessLog:
-            return checkForAccessLog(d, t);
+            return checkForAccessLog();
         case WarmupState::LoadingAccessLog:
-            return loadingAccessLog(d, t);
+            return loadingAccessLog();
         case WarmupState::LoadingKVPairs:
-            return loadingKVPairs(d, t);
+            return loadingKVPairs();
         case WarmupState::LoadingData:
-            return loadingData(d, t);
+            return loadingData();
         case WarmupState::Done:
-            return done(d, t);
+            return done();
         default:
             LOG(EXTENSION_LOG_WARNING,
                 "Internal error.. Illegal warmup state %d", state.getState());
@@ -684,6 +910,17 @@ void Warmup::addStats(ADD_STAT add_stat, const void *c) const
         addStat("min_item_threshold",
                 stats.warmupNumReadCap * 100.0, add_stat, c);
 
+        if (stats.warmupHitWindowEnd.get() != 0) {
+            size_t gets = stats.warmupWindowGets.get();
+            size_t fetches = std::min(stats.warmupWindowBgFetches.get(), gets);
+            addStat("window_gets", gets, add_stat, c);
+            addStat("window_bg_fetches", fetches, add_stat, c);
+            if (gets > 0) {
+                addStat("hit_rate", (gets - fetches) * 100.0 / gets,
+                        add_stat, c);
+            }
+        }
+
         if (metadata > 0) {
             addStat("keys_time", metadata / 1000, add_stat, c);
         }
@@ -704,29 +941,29 @@ void Warmup::addStats(ADD_STAT add_stat, const void *c) const
         if (corruptAccessLog) {
             addStat("access_log", "corrupt", add_stat, c);
         }
+        addStat("access_log_peak_mem", accessLogPeakMem, add_stat, c);
 
         if (estimatedWarmupCount ==  std::numeric_limits<size_t>::max()) {
             addStat("estimated_value_count", "unknown", add_stat, c);
         } else {
             addStat("estimated_value_count", estimatedWarmupCount, add_stat, c);
         }
+
+        for (size_t i = 0; i < shardProgress.size(); ++i) {
+            const ShardProgress *progress = shardProgress[i];
+            char buf[64];
+            snprintf(buf, sizeof(buf), "shard_%d:vbuckets", (int)i);
+            addStat(buf, progress->vbuckets, add_stat, c);
+            snprintf(buf, sizeof(buf), "shard_%d:vbuckets_done", (int)i);
+            addStat(buf, progress->vbucketsDone.get(), add_stat, c);
+            snprintf(buf, sizeof(buf), "shard_%d:key_count", (int)i);
+            addStat(buf, progress->keys.get(), add_stat, c);
+            snprintf(buf, sizeof(buf), "shard_%d:value_count", (int)i);
+            addStat(buf, progress->values.get(), add_stat, c);
+            snprintf(buf, sizeof(buf), "shard_%d:time", (int)i);
+            addStat(buf, progress->time.get() / 1000, add_stat, c);
+        }
    } else {
         addStat(NULL, "disabled", add_stat, c);
     }
 }
-
-LoadStorageKVPairCallback *Warmup::createLKVPCB(const std::map<uint16_t, vbucket_state> &st,
-                                                bool maybeEnable, int warmupState)
-{
-    LoadStorageKVPairCallback *load_cb;
-    load_cb = new LoadStorageKVPairCallback(store, maybeEnable, warmupState);
-    std::map<uint16_t, vbucket_state>::const_iterator it;
-    for (it = st.begin(); it != st.end(); ++it) {
-        uint16_t vbid = it->first;
-        vbucket_state vbs = it->second;
-        vbs.checkpointId++;
-        load_cb->initVBucket(vbid, vbs);
-    }
-
-    return load_cb;
-}
@@ -23,6 +23,8 @@
 #include <map>
 #include <ostream>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "ep_engine.h"
 
@@ -69,6 +71,10 @@ public:
 /**
  * Helper class used to insert items into the storage by using
  * the KVStore::dump method to load items from the database
+ *
+ * Items are inserted in batches of consecutive items of the same
+ * vbucket (of up to warmup_batch_size items), so flush() must be
+ * called once the dump is done.
  */
 class LoadStorageKVPairCallback : public Callback<GetValue> {
 public:
@@ -77,17 +83,31 @@ public:
         : vbuckets(ep->vbMap), stats(ep->getEPEngine().getEpStats()),
           epstore(ep), startTime(ep_real_time()),
           hasPurged(false), maybeEnableTraffic(_maybeEnableTraffic),
-          warmupState(_warmupState)
+          warmupState(_warmupState),
+          batchSize(ep->getEPEngine().getConfiguration().getWarmupBatchSize()),
+          keysLoaded(0), valuesLoaded(0)
     {
         assert(epstore);
     }
 
+    ~LoadStorageKVPairCallback() {
+        flush();
+    }
+
     void initVBucket(uint16_t vbid,
                      const vbucket_state &vbstate);
 
     void callback(GetValue &val);
     bool isLoaded(const char* buf, size_t size, uint16_t vbid);
 
+    /**
+     * Insert all of the items handed to callback() not inserted yet.
+     */
+    void flush();
+
+    size_t getKeysLoaded() const { return keysLoaded; }
+    size_t getValuesLoaded() const { return valuesLoaded; }
+
 private:
 
     bool shouldEject() {
@@ -103,14 +123,22 @@ private:
     bool        hasPurged;
     bool        maybeEnableTraffic;
     int         warmupState;
+    size_t      batchSize;
+    size_t      keysLoaded;
+    size_t      valuesLoaded;
+    //! Items (and whether they are partial) waiting to be inserted.
+    std::vector<std::pair<Item*, bool> > batch;
+
+    DISALLOW_COPY_AND_ASSIGN(LoadStorageKVPairCallback);
 };
 
 
 class Warmup {
 public:
-    Warmup(EventuallyPersistentStore *st, Dispatcher *d);
+    Warmup(EventuallyPersistentStore *st);
+    ~Warmup();
 
-    bool step(Dispatcher&, TaskId &);
+    bool step();
     void start(void);
     void stop(void);
 
@@ -127,34 +155,65 @@ public:
 
     hrtime_t getTime(void) { return warmup; }
 
-    size_t doWarmup(MutationLog &lf, const std::map<uint16_t,
-                    vbucket_state> &vbmap, Callback<GetValue> &cb);
+    /**
+     * Read the given access log for the given vbuckets, with the
+     * changes of the given delta log merged over it if there is one.
+     *
+     * @return the harvested entries, ready to be applied (or NULL if
+     *         the log could not be trusted)
+     */
+    MutationLogHarvester *doWarmup(MutationLog &lf, const std::map<uint16_t,
+                                   vbucket_state> &vbmap,
+                                   MutationLog *delta = NULL);
+
+    /**
+     * Load the data for the current state from the vbuckets of the
+     * given shard.  Run by a WarmupShardTask on the shard's reader.
+     * Does nothing once the warmup has been stopped.
+     */
+    void loadShard(uint16_t shardId);
 
 private:
+    /**
+     * Progress of the warmup of a single shard.
+     */
+    struct ShardProgress {
+        ShardProgress() : vbuckets(0) { }
+
+        //! Number of vbuckets to warm up from the shard.
+        size_t vbuckets;
+        //! Number of those done in the current state.
+        Atomic<size_t> vbucketsDone;
+        Atomic<size_t> keys;
+        Atomic<size_t> values;
+        //! Time spent loading data from the shard.
+        Atomic<hrtime_t> time;
+    };
+
     template <typename T>
     void addStat(const char *nm, T val, ADD_STAT add_stat, const void *c) const;
 
     void fireStateChange(const int from, const int to);
 
-    bool initialize(Dispatcher&, TaskId &);
-    bool estimateDatabaseItemCount(Dispatcher&, TaskId &);
-    bool keyDump(Dispatcher&, TaskId &);
-    bool loadingAccessLog(Dispatcher&, TaskId &);
-    bool checkForAccessLog(Dispatcher&, TaskId &);
-    bool loadingKVPairs(Dispatcher&, TaskId &);
-    bool loadingData(Dispatcher&, TaskId &);
-    bool done(Dispatcher&, TaskId &);
+    bool initialize();
+    bool estimateDatabaseItemCount();
+    bool keyDump();
+    bool loadingAccessLog();
+    bool checkForAccessLog();
+    bool loadingKVPairs();
+    bool loadingData();
+    bool done();
 
     void transition(int to, bool force=false);
 
-
-    LoadStorageKVPairCallback *createLKVPCB(const std::map<uint16_t, vbucket_state> &st,
-                                            bool maybeEnable, int warmupState);
+    void initVBuckets(void);
+    bool loadShards();
+    MutationLogHarvester *harvestAccessLog(void);
+    bool accessLogLoaded(bool success);
 
     WarmupState state;
     EventuallyPersistentStore *store;
-    Dispatcher *dispatcher;
-    TaskId task;
+    size_t taskId;
     hrtime_t startTime;
     hrtime_t metadata;
     hrtime_t warmup;
@@ -166,6 +225,25 @@ private:
     bool corruptAccessLog;
     size_t estimatedWarmupCount;
 
+    //! The vbuckets to load from each shard, actives first.
+    std::vector<std::vector<uint16_t> > shardVBuckets;
+    std::vector<ShardProgress*> shardProgress;
+    std::vector<size_t> shardTasks;
+    //! Number of shards still loading data for the current state.
+    Atomic<size_t> pendingShards;
+    //! Guards runningShards and stopping, notified as shards finish.
+    SyncObject shardSync;
+    //! Number of shard tasks inside loadShard() right now.
+    size_t runningShards;
+    //! Set by stop(); shard tasks that haven't started yet won't.
+    bool stopping;
+    bool shardsScheduled;
+    //! Access log entries being applied by the shards.
+    MutationLogHarvester *harvester;
+    hrtime_t accessLogStart;
+    //! Most memory the access log harvester took.
+    size_t accessLogPeakMem;
+
     struct {
         Mutex mutex;
         std::list<WarmupStateListener*> listeners;
@@ -174,11 +252,13 @@ private:
     DISALLOW_COPY_AND_ASSIGN(Warmup);
 };
 
-class WarmupStepper : public DispatcherCallback {
+class WarmupStepper : public GlobalTask {
 public:
-    WarmupStepper(Warmup* w) : warmup(w) { }
+    WarmupStepper(EventuallyPersistentEngine *e, Warmup* w) :
+        GlobalTask(e, Priority::WarmupPriority, 0, NO_START_TIME, false),
+        warmup(w) { }
 
-    std::string description() {
+    std::string getDescription() {
         return std::string("Running a warmup loop.");
     }
 
@@ -188,8 +268,8 @@ public:
         return 10 * 60 * 1000 * 1000;
     }
 
-    bool callback(Dispatcher &d, TaskId &t) {
-        return warmup->step(d, t);
+    bool run() {
+        return warmup->step();
     }
 
 private:
@@ -30,6 +30,9 @@ workload_pattern_t WorkLoadPolicy::calculatePattern(const std::string &p) {
 }
 
 size_t WorkLoadPolicy::calculateNumReaders() {
+    if (numReaders > 0) {
+        return numReaders;
+    }
     size_t readers;
     switch (pattern) {
         case MIX:
@@ -45,6 +48,9 @@ size_t WorkLoadPolicy::calculateNumReaders() {
 }
 
 size_t WorkLoadPolicy::calculateNumWriters() {
+    if (numWriters > 0) {
+        return numWriters;
+    }
     size_t writers;
     switch (pattern) {
         case MIX:
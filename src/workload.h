@@ -36,8 +36,17 @@ const double workload_low_priority=0.4;
  */
 class WorkLoadPolicy {
 public:
-    WorkLoadPolicy(int m, const std::string p)
-        : pattern(calculatePattern(p)), maxNumWorkers(m) { }
+    /**
+     * @param m max number of IO threads
+     * @param p the workload pattern
+     * @param r number of reader threads (0 to derive it from the pattern)
+     * @param w number of writer threads (0 to derive it from the pattern)
+     * @param n number of non-IO threads
+     */
+    WorkLoadPolicy(int m, const std::string p, size_t r = 0, size_t w = 0,
+                   size_t n = 1)
+        : pattern(calculatePattern(p)), maxNumWorkers(m), numReaders(r),
+          numWriters(w), numNonIO(n) { }
 
     /**
      * Caculate workload pattern based on configuraton
@@ -57,6 +66,13 @@ public:
      */
     size_t calculateNumWriters();
 
+    /**
+     * Get the number of threads running tasks that do no disk IO.
+     */
+    size_t getNumNonIO() {
+        return numNonIO > 0 ? numNonIO : 1;
+    }
+
     /**
      * reset workload pattern
      */
@@ -95,6 +111,9 @@ private:
 
     workload_pattern_t pattern;
     int maxNumWorkers;
+    size_t numReaders;
+    size_t numWriters;
+    size_t numNonIO;
 };
 
 #endif  // SRC_WORKLOAD_H_
@@ -435,6 +435,45 @@ void observe(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
     free(request);
 }
 
+ENGINE_ERROR_CODE waitDurability(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
+                                 const void *cookie, const char *key,
+                                 uint16_t vb, bool persist, uint8_t replicas,
+                                 uint32_t timeout) {
+    char ext[8];
+    timeout = htonl(timeout);
+    memcpy(ext, &timeout, sizeof(timeout));
+    ext[4] = persist ? 1 : 0;
+    ext[5] = replicas;
+    ext[6] = ext[7] = 0;
+    protocol_binary_request_header *request;
+    request = createPacket(CMD_WAIT_DURABILITY, vb, 0, ext, sizeof(ext),
+                           key, strlen(key));
+    ENGINE_ERROR_CODE rv = h1->unknown_command(h, cookie, request, add_response);
+    free(request);
+    return rv;
+}
+
+ENGINE_ERROR_CODE getMulti(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
+                           const void *cookie,
+                           const std::vector<std::string> &keys, uint16_t vb) {
+    std::stringstream value;
+    std::vector<std::string>::const_iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        uint16_t vbid = htons(vb);
+        uint16_t keylen = htons(it->length());
+        value.write((char*) &vbid, sizeof(uint16_t));
+        value.write((char*) &keylen, sizeof(uint16_t));
+        value.write(it->c_str(), it->length());
+    }
+
+    protocol_binary_request_header *request;
+    request = createPacket(CMD_GET_MULTI, 0, 0, NULL, 0, NULL, 0,
+                           value.str().data(), value.str().length());
+    ENGINE_ERROR_CODE rv = h1->unknown_command(h, cookie, request, add_response);
+    free(request);
+    return rv;
+}
+
 void get_replica(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1, const char* key,
                  uint16_t vbid) {
     protocol_binary_request_header *pkt;
@@ -25,6 +25,7 @@
 
 #include <map>
 #include <string>
+#include <vector>
 
 #include "ep-engine/command_ids.h"
 #include "item.h"
@@ -73,10 +74,17 @@ bool get_key(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1, item *i,
              std::string &key);
 void getl(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1, const char* key, uint16_t vb,
           uint32_t lock_timeout);
+ENGINE_ERROR_CODE getMulti(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
+                           const void *cookie,
+                           const std::vector<std::string> &keys, uint16_t vb);
 void get_replica(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1, const char* key,
                  uint16_t vb);
 void observe(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
              std::map<std::string, uint16_t> obskeys);
+ENGINE_ERROR_CODE waitDurability(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
+                                 const void *cookie, const char *key,
+                                 uint16_t vb, bool persist, uint8_t replicas,
+                                 uint32_t timeout);
 protocol_binary_request_header* prepare_get_replica(ENGINE_HANDLE *h,
                                                     ENGINE_HANDLE_V1 *h1,
                                                     vbucket_state_t state,
@@ -3459,6 +3459,12 @@ static enum test_result test_set_tap_param(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h
     set_param(h, h1, engine_param_tap, "tap_keepalive", "5000");
     check(last_status == PROTOCOL_BINARY_RESPONSE_EINVAL,
           "Expected an invalid value error due to exceeding a max value allowed");
+    set_param(h, h1, engine_param_tap, "tap_send_batch_bytes", "65536");
+    check(get_int_stat(h, h1, "ep_tap_send_batch_bytes") == 65536,
+          "Incorrect tap_send_batch_bytes value.");
+    set_param(h, h1, engine_param_tap, "tap_queue_mem_limit", "1048576");
+    check(get_int_stat(h, h1, "ep_tap_queue_mem_limit") == 1048576,
+          "Incorrect tap_queue_mem_limit value.");
     return SUCCESS;
 }
 
@@ -3933,6 +3939,11 @@ static enum test_result test_warmup_accesslog(ENGINE_HANDLE *h, ENGINE_HANDLE_V1
 
     // sleep so that scanner task can have timew to generate access log
     sleep(61);
+    // The first run writes every resident item, later ones only changes.
+    check(get_int_stat(h, h1, "ep_access_scanner_base_items") == n_items_to_store1,
+          "Expected the access log to be written in full");
+    check(get_int_stat(h, h1, "ep_access_scanner_bytes_written") > 0,
+          "Expected the access scanner to report what it wrote");
 
     // store additional items
     int n_items_to_store2 = 10;
@@ -3961,6 +3972,17 @@ static enum test_result test_warmup_accesslog(ENGINE_HANDLE *h, ENGINE_HANDLE_V1
     int expected = (n_items_to_store1 + n_items_to_store2) * 0.75 + 1;
 
     check(warmedup == expected, "Expected 16 items to be resident");
+    check(get_int_stat(h, h1, "ep_warmup_access_log_peak_mem", "warmup") > 0,
+          "Expected the access log harvester to report its memory");
+
+    // The accessed keys were loaded first, so a get finds its value.
+    check(h1->get(h, NULL, &it, "key-0", 5, 0) == ENGINE_SUCCESS,
+          "Failed to get an accessed key after warmup");
+    h1->release(h, NULL, it);
+    check(get_int_stat(h, h1, "ep_warmup_window_gets", "warmup") == 1,
+          "Expected the get to count towards the warmup hit rate");
+    check(get_int_stat(h, h1, "ep_warmup_hit_rate", "warmup") == 100,
+          "Expected the get to be a warmup hit");
     return SUCCESS;
 }
 
@@ -4088,6 +4110,16 @@ static enum test_result test_worker_stats(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1
     check(statelist.find(worker_1_state)!=statelist.end(),
           "worker_1's state incorrect");
 
+    // The auxiliary IO and housekeeping tasks run on threads of their own.
+    std::string auxio_0_state = vals["auxio_worker_0:state"];
+    check(statelist.find(auxio_0_state)!=statelist.end(),
+          "auxio_worker_0's state incorrect");
+    std::string nonio_0_state = vals["nonio_worker_0:state"];
+    check(statelist.find(nonio_0_state)!=statelist.end(),
+          "nonio_worker_0's state incorrect");
+    check(get_int_stat(h, h1, "ep_workload:num_nonio", "workload") == 1,
+          "Incorrect number of non-IO threads");
+
     return SUCCESS;
 }
 
@@ -6381,6 +6413,119 @@ static enum test_result test_observe_errors(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *
     return SUCCESS;
 }
 
+static enum test_result test_wait_durability(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    const void *cookie = testHarness.create_cookie();
+    testHarness.lock_cookie(cookie);
+    stop_persistence(h, h1);
+
+    item *i = NULL;
+    check(store(h, h1, NULL, OPERATION_SET, "key", "somevalue", &i) == ENGINE_SUCCESS,
+          "Failed set.");
+    h1->release(h, NULL, i);
+
+    // Blocks until the flusher is back.
+    check(waitDurability(h, h1, cookie, "key", 0, true, 0, 0) == ENGINE_EWOULDBLOCK,
+          "Expected the durability wait to block");
+    start_persistence(h, h1);
+    testHarness.waitfor_cookie(cookie);
+    check(waitDurability(h, h1, cookie, "key", 0, true, 0, 0) == ENGINE_SUCCESS,
+          "Durability wait failed");
+    check(last_status == PROTOCOL_BINARY_RESPONSE_SUCCESS, "Expected success");
+    check(last_body[0] == 1 && last_body[1] == 0, "Expected persisted, not replicated");
+
+    // Already persisted, so it doesn't block.
+    check(waitDurability(h, h1, cookie, "key", 0, true, 0, 0) == ENGINE_SUCCESS,
+          "Durability wait failed");
+    check(last_status == PROTOCOL_BINARY_RESPONSE_SUCCESS, "Expected success");
+
+    // There are no replicas to ack it.
+    check(waitDurability(h, h1, cookie, "key", 0, true, 1, 100) == ENGINE_EWOULDBLOCK,
+          "Expected the durability wait to block");
+    testHarness.waitfor_cookie(cookie);
+    check(waitDurability(h, h1, cookie, "key", 0, true, 1, 100) == ENGINE_SUCCESS,
+          "Durability wait failed");
+    check(last_status == PROTOCOL_BINARY_RESPONSE_ETMPFAIL, "Expected a timeout");
+    check(last_body[0] == 1 && last_body[1] == 0, "Expected persisted, not replicated");
+
+    check(get_int_stat(h, h1, "ep_durability_waits") == 3, "Expected 3 waits");
+    check(get_int_stat(h, h1, "ep_durability_timeouts") == 1, "Expected 1 timeout");
+
+    check(waitDurability(h, h1, cookie, "key", 1, true, 0, 0) == ENGINE_SUCCESS,
+          "Durability wait failed");
+    check(last_status == PROTOCOL_BINARY_RESPONSE_NOT_MY_VBUCKET,
+          "Expected not my vbucket");
+
+    testHarness.unlock_cookie(cookie);
+    testHarness.destroy_cookie(cookie);
+    return SUCCESS;
+}
+
+static enum test_result test_get_multi(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    const void *cookie = testHarness.create_cookie();
+    testHarness.lock_cookie(cookie);
+
+    item *i = NULL;
+    check(store(h, h1, NULL, OPERATION_SET, "key1", "value1", &i) == ENGINE_SUCCESS,
+          "Failed set.");
+    h1->release(h, NULL, i);
+    check(store(h, h1, NULL, OPERATION_SET, "key2", "value22", &i) == ENGINE_SUCCESS,
+          "Failed set.");
+    h1->release(h, NULL, i);
+    wait_for_flusher_to_settle(h, h1);
+    evict_key(h, h1, "key2", 0, "Ejected.");
+
+    std::vector<std::string> keys;
+    keys.push_back("key1");
+    keys.push_back("key2");
+    keys.push_back("nokey");
+
+    // key2 has to come from disk first.
+    check(getMulti(h, h1, cookie, keys, 0) == ENGINE_EWOULDBLOCK,
+          "Expected the batch get to block");
+    testHarness.waitfor_cookie(cookie);
+    check(getMulti(h, h1, cookie, keys, 0) == ENGINE_SUCCESS, "Batch get failed");
+    check(last_status == PROTOCOL_BINARY_RESPONSE_SUCCESS, "Expected success");
+
+    const char *values[] = { "value1", "value22", "" };
+    uint16_t statuses[] = { PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                            PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                            PROTOCOL_BINARY_RESPONSE_KEY_ENOENT };
+    uint32_t offset = 0;
+    for (size_t k = 0; k < keys.size(); ++k) {
+        uint16_t keylen, status;
+        uint32_t nbytes;
+        check(last_bodylen - offset >= 22, "Truncated batch get response");
+        memcpy(&keylen, last_body + offset + 2, sizeof(keylen));
+        memcpy(&status, last_body + offset + 4, sizeof(status));
+        memcpy(&nbytes, last_body + offset + 18, sizeof(nbytes));
+        keylen = ntohs(keylen);
+        nbytes = ntohl(nbytes);
+        offset += 22;
+        check(std::string(last_body + offset, keylen) == keys[k],
+              "Unexpected key in batch get response");
+        offset += keylen;
+        check(ntohs(status) == statuses[k], "Unexpected status for a key");
+        check(std::string(last_body + offset, nbytes) == values[k],
+              "Unexpected value for a key");
+        offset += nbytes;
+    }
+    check(offset == last_bodylen, "Unexpected data after the last key");
+
+    // Everything is resident now.
+    check(getMulti(h, h1, cookie, keys, 0) == ENGINE_SUCCESS, "Batch get failed");
+    check(get_int_stat(h, h1, "ep_get_multis") == 2, "Expected 2 batch gets");
+    check(get_int_stat(h, h1, "ep_get_multi_bg_fetches") == 1,
+          "Expected 1 key fetched from disk");
+
+    check(getMulti(h, h1, cookie, keys, 1) == ENGINE_SUCCESS, "Batch get failed");
+    check(last_bodylen > 4 && ntohs(*(uint16_t*)(last_body + 4)) ==
+          PROTOCOL_BINARY_RESPONSE_NOT_MY_VBUCKET, "Expected not my vbucket");
+
+    testHarness.unlock_cookie(cookie);
+    testHarness.destroy_cookie(cookie);
+    return SUCCESS;
+}
+
 static enum test_result test_CBD_152(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
     item *i = NULL;
 
@@ -6469,6 +6614,8 @@ static enum test_result test_item_pager(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1)
         }
     }
     keys.clear();
+    check(get_int_stat(h, h1, "vb_0:ops_get", "vbucket-details") == 500,
+          "Expected the gets to be counted for vbucket 0");
 
     for (int j = 100; j < 200;  ++j) {
         std::stringstream ss;
@@ -6489,6 +6636,8 @@ static enum test_result test_item_pager(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1)
     wait_for_memory_usage_below(h, h1, get_int_stat(h, h1, "ep_mem_low_wat"));
     check(get_int_stat(h, h1, "ep_num_non_resident") > 0,
           "Expect some non-resident items");
+    check(get_int_stat(h, h1, "vb_0:eviction_quota", "vbucket-details") > 0,
+          "Expected vbucket 0 to have an eviction quota");
 
     for (int j = 0; j < 100; ++j) {
         std::stringstream ss;
@@ -6510,6 +6659,85 @@ static enum test_result test_item_pager(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1)
     return SUCCESS;
 }
 
+static enum test_result test_eviction_quota(ENGINE_HANDLE *h,
+                                            ENGINE_HANDLE_V1 *h1) {
+    check(set_vbucket_state(h, h1, 1, vbucket_state_active),
+          "Failed to set vbucket 1 state.");
+    char data[1024];
+    memset(&data, 'x', sizeof(data)-1);
+    data[1023] = '\0';
+
+    // A small vbucket whose values are all read, and a bigger one whose
+    // values never are.
+    for (int j = 0; j < 60; ++j) {
+        std::stringstream ss;
+        ss << "hot-" << j;
+        std::string key(ss.str());
+        item *i;
+        store(h, h1, NULL, OPERATION_SET, key.c_str(), data, &i, 0, 0);
+        h1->release(h, NULL, i);
+        for (int k = 0; k < 5; ++k) {
+            check(h1->get(h, NULL, &i, key.c_str(), key.size(), 0) == ENGINE_SUCCESS,
+                  "Failed to get value.");
+            h1->release(h, NULL, i);
+        }
+    }
+    for (int j = 0; j < 140; ++j) {
+        std::stringstream ss;
+        ss << "cold-" << j;
+        item *i;
+        store(h, h1, NULL, OPERATION_SET, ss.str().c_str(), data, &i, 0, 1);
+        h1->release(h, NULL, i);
+    }
+
+    testHarness.time_travel(5);
+
+    wait_for_memory_usage_below(h, h1, get_int_stat(h, h1, "ep_mem_low_wat"));
+    int hot = get_int_stat(h, h1, "vb_0:eviction_quota", "vbucket-details");
+    int cold = get_int_stat(h, h1, "vb_1:eviction_quota", "vbucket-details");
+    check(cold > 0, "Expected vbucket 1 to have an eviction quota");
+    check(cold > hot,
+          "Expected the bigger, colder vbucket to give up more than the other");
+
+    return SUCCESS;
+}
+
+static enum test_result test_eviction_policy(ENGINE_HANDLE *h,
+                                             ENGINE_HANDLE_V1 *h1) {
+    std::string policy = get_str_stat(h, h1, "ep_eviction_policy");
+    char data[1024];
+    memset(&data, 'x', sizeof(data)-1);
+    data[1023] = '\0';
+
+    for (int j = 0; j < 200; ++j) {
+        std::stringstream ss;
+        ss << "key-" << j;
+        item *i;
+        store(h, h1, NULL, OPERATION_SET, ss.str().c_str(), data, &i);
+        h1->release(h, NULL, i);
+    }
+
+    testHarness.time_travel(5);
+
+    wait_for_memory_usage_below(h, h1, get_int_stat(h, h1, "ep_mem_low_wat"));
+    check(get_int_stat(h, h1, "ep_num_non_resident") > 0,
+          "Expect some non-resident items");
+    std::string freed("ep_eviction_" + policy + "_bytes_freed");
+    check(get_int_stat(h, h1, freed.c_str()) > 0,
+          "Expected the eviction policy to have freed some bytes");
+
+    check(!set_param(h, h1, engine_param_flush, "eviction_policy", "lru"),
+          "Set eviction_policy to an unknown policy should have failed");
+    check(!set_param(h, h1, engine_param_flush, "eviction_sample_size", "0"),
+          "Set eviction_sample_size to 0 should have failed");
+    check(set_param(h, h1, engine_param_flush, "eviction_policy", "nru"),
+          "Set eviction_policy should have worked");
+    check(get_str_stat(h, h1, "ep_eviction_policy") == "nru",
+          "Incorrect eviction policy");
+
+    return SUCCESS;
+}
+
 static enum test_result test_set_vbucket_out_of_range(ENGINE_HANDLE *h,
                                                        ENGINE_HANDLE_V1 *h1) {
     check(!set_vbucket_state(h, h1, 10000, vbucket_state_active),
@@ -7410,8 +7638,21 @@ engine_test_t* get_tests(void) {
                  teardown, NULL, prepare, cleanup),
         TestCase("test observe not my vbucket", test_observe_errors, test_setup,
                  teardown, NULL, prepare, cleanup),
+        TestCase("test wait durability", test_wait_durability, test_setup,
+                 teardown, NULL, prepare, cleanup),
+        TestCase("test get multi", test_get_multi, test_setup,
+                 teardown, NULL, prepare, cleanup),
         TestCase("test item pager", test_item_pager, test_setup,
                  teardown, "max_size=204800", prepare, cleanup),
+        TestCase("test eviction quota", test_eviction_quota, test_setup,
+                 teardown, "max_size=204800", prepare, cleanup),
+        TestCase("test clock eviction policy", test_eviction_policy,
+                 test_setup, teardown,
+                 "max_size=204800;eviction_policy=clock", prepare, cleanup),
+        TestCase("test sampled lfu eviction policy", test_eviction_policy,
+                 test_setup, teardown,
+                 "max_size=204800;eviction_policy=sampled_lfu", prepare,
+                 cleanup),
         TestCase("warmup conf", test_warmup_conf, test_setup,
                  teardown, NULL, prepare, cleanup),
 
@@ -7496,6 +7737,8 @@ engine_test_t* get_tests(void) {
                  test_setup, teardown, NULL, prepare, cleanup),
         TestCase("tap stream", test_tap_stream, test_setup,
                  teardown, NULL, prepare, cleanup),
+        TestCase("tap stream without send batches", test_tap_stream, test_setup,
+                 teardown, "tap_send_batch_bytes=0", prepare, cleanup),
         TestCase("tap stream send deletes", test_tap_sends_deleted, test_setup,
                  teardown, NULL, prepare, cleanup),
         TestCase("tap tap sent from vb", test_sent_from_vb, test_setup,
@@ -0,0 +1,85 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2013 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "bgfetcher.h"
+
+static const hrtime_t target = 6400;
+
+static void testNoTarget() {
+    assert(BgFetcher::nextWindow(0, 0, 10, 0, 0) == 0);
+    assert(BgFetcher::nextWindow(1000, 0, 10, 0, 0) == 0);
+}
+
+static void testAdditiveIncrease() {
+    hrtime_t window = 0;
+    for (int i = 1; i <= 16; ++i) {
+        window = BgFetcher::nextWindow(window, target, 2, target / 2, 0);
+        assert(window == i * target / 16);
+    }
+    // Never held for longer than the target.
+    window = BgFetcher::nextWindow(window, target, 2, target / 2, 0);
+    assert(window == target);
+
+    // A single fetch grows the window only if they come in often.
+    assert(BgFetcher::nextWindow(0, target, 1, 100, target) == target / 16);
+    assert(BgFetcher::nextWindow(target / 2, target, 1, 100, target + 1) ==
+           target / 4);
+}
+
+static void testMultiplicativeDecrease() {
+    // Over the target: halve it.
+    assert(BgFetcher::nextWindow(target, target, 10, target + 1, 0) ==
+           target / 2);
+    assert(BgFetcher::nextWindow(target / 2, target, 10, target + 1, 0) ==
+           target / 4);
+
+    // Below a 64th of the target it's not worth holding at all.
+    assert(BgFetcher::nextWindow(target / 32, target, 10, target + 1, 0) ==
+           target / 64);
+    assert(BgFetcher::nextWindow(target / 64, target, 10, target + 1, 0) ==
+           0);
+    assert(BgFetcher::nextWindow(0, target, 10, target + 1, 0) == 0);
+}
+
+static void testConverges() {
+    // Batches take longer the longer they're held; the window settles
+    // just around where the latency meets the target.
+    hrtime_t window = 0;
+    hrtime_t largest = 0;
+    for (int i = 0; i < 1000; ++i) {
+        hrtime_t latency = window + target / 4;
+        window = BgFetcher::nextWindow(window, target, 5, latency, 0);
+        if (i > 100) {
+            largest = std::max(largest, window);
+            assert(window >= (target * 3 / 4) / 2);
+        }
+    }
+    assert(largest <= target * 3 / 4 + target / 16);
+}
+
+int main() {
+    testNoTarget();
+    testAdditiveIncrease();
+    testMultiplicativeDecrease();
+    testConverges();
+    return 0;
+}
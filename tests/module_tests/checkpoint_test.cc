@@ -301,9 +301,163 @@ void test_reset_checkpoint_id() {
     assert(items.size() == 0);
 }
 
+void test_dedup_tombstones() {
+    RCPtr<VBucket> vbucket(new VBucket(0, vbucket_state_active, global_stats,
+                                       checkpoint_config, NULL));
+    size_t memOverhead = global_stats.memOverhead.get();
+    CheckpointManager *manager =
+        new CheckpointManager(global_stats, 0, checkpoint_config, 1);
+    manager->registerTAPCursor("tap");
+
+    int i;
+    for (i = 0; i < 10; ++i) {
+        std::stringstream key;
+        key << "key-" << i;
+        queued_item qi(new QueuedItem (key.str(), 0, queue_op_set));
+        assert(manager->queueDirty(qi, vbucket));
+    }
+    std::vector<queued_item> items;
+    manager->getAllItemsForPersistence(items);
+    assert(items.size() == 11);
+    items.clear();
+
+    // Both keys were persisted already, so they have to be persisted again.
+    queued_item again(new QueuedItem ("key-0", 0, queue_op_set));
+    assert(manager->queueDirty(again, vbucket));
+    again.reset(new QueuedItem ("key-5", 0, queue_op_del));
+    assert(manager->queueDirty(again, vbucket));
+    // Enough tombstones for the checkpoint to be compacted a few times.
+    for (i = 0; i < 1000; ++i) {
+        queued_item qi(new QueuedItem ("key-5", 0, queue_op_set));
+        assert(!manager->queueDirty(qi, vbucket));
+    }
+    assert(manager->getNumOpenChkItems() == 11);
+    assert(manager->getNumItemsForPersistence() == 2);
+
+    manager->getAllItemsForPersistence(items);
+    assert(items.size() == 2);
+    assert(items[0]->getKey() == "key-0");
+    assert(items[1]->getKey() == "key-5");
+    assert(items[1]->getOperation() == queue_op_set);
+    assert(manager->getNumItemsForPersistence() == 0);
+    assert(!manager->hasNextForPersistence());
+    items.clear();
+
+    // The TAP cursor sees every key once, in the order of their last mutation.
+    const char *expected[] = {"key-1", "key-2", "key-3", "key-4", "key-6",
+                              "key-7", "key-8", "key-9", "key-0", "key-5"};
+    assert(manager->getNumItemsForTAPConnection("tap") == 11);
+    manager->getAllItemsForTAPConnection("tap", items);
+    assert(items.size() == 11);
+    assert(items[0]->getOperation() == queue_op_checkpoint_start);
+    uint64_t lastMutationId = 0;
+    for (i = 0; i < 10; ++i) {
+        assert(items[i + 1]->getKey() == expected[i]);
+        uint64_t mid = manager->getMutationIdForKey(1, expected[i]);
+        assert(mid > lastMutationId);
+        lastMutationId = mid;
+    }
+    assert(!manager->hasNext("tap"));
+
+    delete manager;
+    assert(global_stats.memOverhead.get() == memOverhead);
+}
+
+static std::string nextKey(CheckpointManager *manager, const std::string &name) {
+    bool isLastMutationItem;
+    queued_item qi = manager->nextItem(name, isLastMutationItem);
+    return qi->getKey();
+}
+
+void test_collapse_closed_checkpoints() {
+    RCPtr<VBucket> vbucket(new VBucket(0, vbucket_state_active, global_stats,
+                                       checkpoint_config, NULL));
+    CheckpointManager *manager =
+        new CheckpointManager(global_stats, 0, checkpoint_config, 1);
+
+    const char *keys[] = {"a", "b", NULL, "b", "c", NULL, "d", NULL, "e"};
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i) {
+        if (keys[i] == NULL) {
+            manager->createNewCheckpoint();
+        } else {
+            queued_item qi(new QueuedItem (keys[i], 0, queue_op_set));
+            manager->queueDirty(qi, vbucket);
+        }
+    }
+    assert(manager->getNumCheckpoints() == 4);
+
+    // One cursor is still at the start of the first checkpoint, the other one
+    // is in the middle of the last closed checkpoint.
+    assert(manager->registerTAPCursor("slow", 1));
+    assert(manager->registerTAPCursor("fast", 3));
+    assert(nextKey(manager, "fast") == "checkpoint_start");
+    assert(nextKey(manager, "fast") == "d");
+    std::vector<queued_item> items;
+    manager->getAllItemsForPersistence(items);
+
+    bool newCheckpoint;
+    manager->removeClosedUnrefCheckpoints(vbucket, newCheckpoint);
+    assert(!newCheckpoint);
+    assert(manager->getNumCheckpoints() == 2);
+    assert(manager->getCheckpointIdForTAPCursor("slow") == 3);
+
+    assert(nextKey(manager, "fast") == "checkpoint_end");
+    const char *expected[] = {"checkpoint_start", "a", "b", "c", "d", "checkpoint_end",
+                              "checkpoint_start", "e"};
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); ++i) {
+        assert(nextKey(manager, "slow") == expected[i]);
+    }
+    assert(!manager->hasNext("slow"));
+
+    delete manager;
+}
+
+void test_persisted_mutation_ids() {
+    RCPtr<VBucket> vbucket(new VBucket(0, vbucket_state_active, global_stats,
+                                       checkpoint_config, NULL));
+    CheckpointManager *manager =
+        new CheckpointManager(global_stats, 0, checkpoint_config, 1);
+
+    queued_item a(new QueuedItem ("a", 0, queue_op_set));
+    assert(manager->queueDirty(a, vbucket));
+    queued_item b(new QueuedItem ("b", 0, queue_op_set));
+    assert(manager->queueDirty(b, vbucket));
+    assert(a->getMutationId() < b->getMutationId());
+    assert(manager->getLastMutationIdForKey("b") == b->getMutationId());
+
+    std::vector<queued_item> items;
+    uint64_t persisted = manager->getAllItemsForPersistence(items);
+    assert(persisted >= b->getMutationId());
+
+    // The item the flusher has keeps its id, the new one is past the batch.
+    queued_item again(new QueuedItem ("a", 0, queue_op_del));
+    assert(manager->queueDirty(again, vbucket));
+    assert(a->getMutationId() <= persisted);
+    assert(manager->getLastMutationIdForKey("a") == again->getMutationId());
+    assert(again->getMutationId() > persisted);
+
+    // A key that isn't in a checkpoint is covered by anything persisted.
+    assert(manager->getLastMutationIdForKey("missing") <= persisted);
+
+    items.clear();
+    assert(manager->getAllItemsForPersistence(items) >= again->getMutationId());
+    assert(items.size() == 1);
+
+    // Clearing the checkpoints doesn't take the ids back.
+    manager->clear(vbucket_state_active);
+    queued_item c(new QueuedItem ("c", 0, queue_op_set));
+    assert(manager->queueDirty(c, vbucket));
+    assert(c->getMutationId() > again->getMutationId());
+
+    delete manager;
+}
+
 int main(int argc, char **argv) {
     (void)argc; (void)argv;
     putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
     basic_chk_test();
     test_reset_checkpoint_id();
+    test_dedup_tombstones();
+    test_collapse_closed_checkpoints();
+    test_persisted_mutation_ids();
 }
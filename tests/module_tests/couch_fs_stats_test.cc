@@ -0,0 +1,184 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2013 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <vector>
+
+#include "couch-kvstore/couch-fs-stats.h"
+
+static const size_t fileSize = 256 * 1024;
+static char path[] = "/tmp/couch_fs_stats_test.XXXXXX";
+
+static char expected(cs_off_t off) {
+    return static_cast<char>(off % 251);
+}
+
+static void createFile() {
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    std::vector<char> data(fileSize);
+    for (size_t i = 0; i < fileSize; ++i) {
+        data[i] = expected(i);
+    }
+    assert(write(fd, &data[0], fileSize) == static_cast<ssize_t>(fileSize));
+    close(fd);
+}
+
+/**
+ * A file opened through the stat collecting file ops.
+ */
+class StatsFile {
+public:
+    StatsFile(CouchstoreStats *stats) : ops(getCouchstoreStatsOps(stats)) {
+        handle = ops.constructor(ops.cookie);
+        assert(ops.open(&handle, path, O_RDONLY) == COUCHSTORE_SUCCESS);
+    }
+
+    ~StatsFile() {
+        ops.close(handle);
+        ops.destructor(handle);
+    }
+
+    /**
+     * Read a range of the file and check it holds what was written.
+     */
+    void check(cs_off_t off, size_t len) {
+        std::vector<char> buf(len);
+        assert(ops.pread(handle, &buf[0], len, off) ==
+               static_cast<ssize_t>(len));
+        for (size_t i = 0; i < len; ++i) {
+            assert(buf[i] == expected(off + i));
+        }
+    }
+
+private:
+    couch_file_ops ops;
+    couch_file_handle handle;
+};
+
+static void testNoReadAhead() {
+    CouchstoreStats stats;
+    StatsFile f(&stats);
+    f.check(0, 100);
+    f.check(5000, 100);
+    assert(stats.readSizeHisto.total() == 2);
+    assert(stats.mergedReads.get() == 0);
+}
+
+static void testMergedReads() {
+    CouchstoreStats stats;
+    StatsFile f(&stats);
+    {
+        CouchReadAhead readAhead(&stats, 4096);
+        // The first three are close enough to be read at once, the
+        // fourth is too far from them.
+        readAhead.plan(0, 100);
+        readAhead.plan(200, 100);
+        readAhead.plan(1000, 100);
+        readAhead.plan(100000, 100);
+
+        f.check(0, 100);
+        f.check(200, 100);
+        f.check(1000, 100);
+        f.check(100000, 100);
+        // Reads outside of the planned bodies go to the file.
+        f.check(50000, 10);
+    }
+    assert(stats.readSizeHisto.total() == 3);
+    assert(stats.mergedReads.get() == 1);
+    // Of the 1100 bytes read for the first three, 300 were wanted.
+    assert(stats.readaheadWasted.get() == 800);
+}
+
+static void testWindow() {
+    CouchstoreStats stats;
+    StatsFile f(&stats);
+    {
+        CouchReadAhead readAhead(&stats, 4096);
+        // A gap of more than a quarter of the window starts a new run,
+        // and so does a run getting longer than the window.
+        readAhead.plan(0, 100);
+        readAhead.plan(1200, 100);
+        readAhead.plan(1400, 100);
+        readAhead.plan(1600, 4000);
+
+        f.check(0, 100);
+        f.check(1200, 100);
+        f.check(1400, 100);
+        f.check(1600, 4000);
+    }
+    assert(stats.readSizeHisto.total() == 3);
+    assert(stats.mergedReads.get() == 1);
+    assert(stats.readaheadWasted.get() == 100);
+}
+
+static void testFileReader() {
+    CouchstoreStats stats;
+    StatsFile f(&stats);
+    CouchFileReader reader(2);
+    {
+        CouchReadAhead readAhead(&stats, 4096, &reader);
+        for (cs_off_t off = 0; off < 100000; off += 10000) {
+            readAhead.plan(off, 100);
+            readAhead.plan(off + 500, 100);
+        }
+        for (cs_off_t off = 0; off < 100000; off += 10000) {
+            f.check(off, 100);
+            f.check(off + 500, 100);
+        }
+    }
+    // Every run was read once, by the reader.
+    assert(stats.readSizeHisto.total() == 10);
+    assert(stats.mergedReads.get() == 10);
+    assert(stats.readQueueDepthHisto.total() == 10);
+    assert(stats.readaheadWasted.get() == 10 * 400);
+}
+
+static void testFileReaderUnusedRuns() {
+    CouchstoreStats stats;
+    StatsFile f(&stats);
+    CouchFileReader reader(4);
+    {
+        CouchReadAhead readAhead(&stats, 4096, &reader);
+        for (cs_off_t off = 0; off < 100000; off += 10000) {
+            readAhead.plan(off, 100);
+        }
+        // Entering the first run gets the next ones going; they have
+        // to be waited for even though nobody reads them.
+        f.check(0, 100);
+    }
+    assert(stats.readSizeHisto.total() == 4);
+    assert(stats.readaheadWasted.get() == 3 * 100);
+}
+
+int main() {
+    createFile();
+    testNoReadAhead();
+    testMergedReads();
+    testWindow();
+    testFileReader();
+    testFileReaderUnusedRuns();
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,171 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2013 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Count the heap allocations a get makes to hand a resident item to
+ * the network layer, and the time it takes:
+ *
+ *   get_alloc_bench [-k keys] [-l key length] [-n gets]
+ *
+ * "copy" builds a new Item out of the stored value and deletes it once
+ * done, the way gets used to; "pooled" takes it from an ItemPool and
+ * releases it back.  Both share the value of the stored value.
+ */
+
+#include "config.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <iostream>
+#include <limits>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "stats.h"
+#include "stored-value.h"
+
+time_t time_offset;
+
+extern "C" {
+    static rel_time_t basic_current_time(void) {
+        return 0;
+    }
+
+    rel_time_t (*ep_current_time)() = basic_current_time;
+
+    time_t ep_real_time() {
+        return time(NULL) + time_offset;
+    }
+}
+
+//! Number of calls to operator new so far.
+static size_t allocations(0);
+
+void *operator new(size_t size) throw(std::bad_alloc) {
+    ++allocations;
+    void *p = malloc(size == 0 ? 1 : size);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) throw() {
+    free(p);
+}
+
+static EPStats global_stats;
+
+static size_t numKeys(10000);
+static size_t keyLength(32);
+static size_t numGets(1000000);
+
+static Item *copyItem(StoredValue *v, ItemPool &) {
+    return new Item(v->getKey(), v->getFlags(), v->getExptime(),
+                    v->getValue(), v->getCas(), v->getBySeqno(), 0,
+                    v->getRevSeqno());
+}
+
+static void deleteItem(Item *itm, ItemPool &) {
+    delete itm;
+}
+
+static Item *poolItem(StoredValue *v, ItemPool &pool) {
+    return v->toItem(false, 0, pool);
+}
+
+static void releaseItem(Item *itm, ItemPool &pool) {
+    pool.release(itm);
+}
+
+static void run(const char *name, HashTable &ht,
+                const std::vector<std::string> &keys,
+                Item *(*get)(StoredValue *, ItemPool &),
+                void (*release)(Item *, ItemPool &)) {
+    ItemPool pool;
+    unsigned int seed(0);
+    size_t before = allocations;
+    hrtime_t start = gethrtime();
+    for (size_t i = 0; i < numGets; ++i) {
+        const std::string &key = keys[rand_r(&seed) % keys.size()];
+        int bucket_num(0);
+        LockHolder lh = ht.getLockedBucket(key, &bucket_num);
+        StoredValue *v = ht.unlocked_find(key, bucket_num, false, false);
+        assert(v);
+        Item *itm = get(v, pool);
+        lh.unlock();
+        assert(itm->getNBytes() == key.size());
+        release(itm, pool);
+    }
+    hrtime_t spent = gethrtime() - start;
+    std::cout << "  " << name << ": "
+              << static_cast<double>(allocations - before) / numGets
+              << " allocations/get, "
+              << static_cast<double>(spent) / numGets << " ns/get"
+              << std::endl;
+}
+
+int main(int argc, char **argv) {
+    putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
+    global_stats.setMaxDataSize(std::numeric_limits<size_t>::max());
+
+    int c;
+    while ((c = getopt(argc, argv, "k:l:n:")) != -1) {
+        switch (c) {
+        case 'k':
+            numKeys = strtoul(optarg, NULL, 10);
+            break;
+        case 'l':
+            keyLength = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            numGets = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            std::cerr << "Usage: " << argv[0]
+                      << " [-k keys] [-l key length] [-n gets]" << std::endl;
+            return 1;
+        }
+    }
+    if (numKeys == 0 || keyLength < 12 || keyLength > 250) {
+        std::cerr << "Need at least one key of 12 to 250 bytes" << std::endl;
+        return 1;
+    }
+
+    HashTable ht(global_stats, numKeys, 0);
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < numKeys; ++i) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "user::%06d", static_cast<int>(i));
+        std::string key(buf);
+        key.resize(keyLength, 'x');
+        keys.push_back(key);
+        Item itm(key, 0, 0, key.data(), key.size());
+        ht.set(itm);
+    }
+
+    std::cout << numKeys << " keys of " << keyLength << " bytes, "
+              << numGets << " gets" << std::endl;
+    run("copy  ", ht, keys, copyItem, deleteItem);
+    run("pooled", ht, keys, poolItem, releaseItem);
+    ht.clear(true);
+    return 0;
+}
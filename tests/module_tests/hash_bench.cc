@@ -0,0 +1,180 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2013 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Compare the hash functions a HashTable can use, on generated keys or
+ * on a file of keys (one per line):
+ *
+ *   hash_bench [-b buckets] [keyfile]
+ *
+ * For each function this reports the time spent hashing the keys and
+ * how evenly they spread over the buckets of a table holding them.
+ * The table is sized the way the resizer would size it, unless a
+ * number of buckets is given.
+ */
+
+#include "config.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "stats.h"
+#include "stored-value.h"
+
+time_t time_offset;
+
+extern "C" {
+    static rel_time_t basic_current_time(void) {
+        return 0;
+    }
+
+    rel_time_t (*ep_current_time)() = basic_current_time;
+
+    time_t ep_real_time() {
+        return time(NULL) + time_offset;
+    }
+}
+
+static EPStats global_stats;
+
+static const size_t NUM_GENERATED_KEYS(1000000);
+static const int HASH_ROUNDS(10);
+
+//! Number of buckets to use, or 0 to size the table for the keys.
+static size_t numBuckets(0);
+
+static std::vector<std::string> sequentialKeys() {
+    std::vector<std::string> rv;
+    for (size_t i = 0; i < NUM_GENERATED_KEYS; ++i) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "user::%06d", static_cast<int>(i));
+        rv.push_back(buf);
+    }
+    return rv;
+}
+
+static std::vector<std::string> randomKeys() {
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    std::vector<std::string> rv;
+    srand(4711);
+    for (size_t i = 0; i < NUM_GENERATED_KEYS; ++i) {
+        std::string key(8 + rand() % 40, ' ');
+        for (size_t j = 0; j < key.size(); ++j) {
+            key[j] = chars[rand() % (sizeof(chars) - 1)];
+        }
+        rv.push_back(key);
+    }
+    return rv;
+}
+
+static std::vector<std::string> fileKeys(const char *path) {
+    std::vector<std::string> rv;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty()) {
+            rv.push_back(line);
+        }
+    }
+    return rv;
+}
+
+static void run(const char *name, hash_function_t fn,
+                const std::vector<std::string> &keys) {
+    HashTable::setDefaultHashFunction(fn);
+    HashTable ht(global_stats, numBuckets != 0 ? numBuckets : keys.size(), 1);
+    // Account for the table the way a VBucket would.
+    global_stats.memOverhead.incr(ht.tableMemorySize());
+
+    int sum(0);
+    hrtime_t start = gethrtime();
+    for (int r = 0; r < HASH_ROUNDS; ++r) {
+        std::vector<std::string>::const_iterator it;
+        for (it = keys.begin(); it != keys.end(); ++it) {
+            sum += ht.hash(*it);
+        }
+    }
+    hrtime_t spent = gethrtime() - start;
+
+    std::vector<std::string>::const_iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        Item itm(*it, 0, 0, NULL, 0);
+        ht.set(itm);
+    }
+    if (numBuckets == 0) {
+        // Size the table the way the resizer would for this many items.
+        ht.resize();
+    }
+    HashTableDepthStatVisitor depth;
+    ht.visitDepth(depth);
+
+    std::cout << "  " << name << ": "
+              << static_cast<double>(spent) / (HASH_ROUNDS * keys.size())
+              << " ns/key, " << ht.getSize() << " buckets, "
+              << depth.emptyBuckets() << " empty, chain length median "
+              << depth.chainLengthPercentile(50) << " 99% "
+              << depth.chainLengthPercentile(99) << " max " << depth.max
+              << " (" << (sum & 1) << ")" << std::endl;
+
+    ht.clear(true);
+    global_stats.memOverhead.decr(ht.tableMemorySize());
+}
+
+static void compare(const char *what, const std::vector<std::string> &keys) {
+    std::cout << what << " (" << keys.size() << " keys)" << std::endl;
+    run("djb ", DJB_HASH, keys);
+    run("word", WORD_HASH, keys);
+}
+
+int main(int argc, char **argv) {
+    putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
+    global_stats.setMaxDataSize(std::numeric_limits<size_t>::max());
+
+    int c;
+    while ((c = getopt(argc, argv, "b:")) != -1) {
+        switch (c) {
+        case 'b':
+            numBuckets = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            std::cerr << "Usage: " << argv[0] << " [-b buckets] [keyfile]"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    if (optind < argc) {
+        std::vector<std::string> keys = fileKeys(argv[optind]);
+        if (keys.empty()) {
+            std::cerr << "No keys found in " << argv[optind] << std::endl;
+            return 1;
+        }
+        compare(argv[optind], keys);
+    } else {
+        compare("sequential keys", sequentialKeys());
+        compare("random keys", randomKeys());
+    }
+    return 0;
+}
@@ -0,0 +1,239 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2013 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Compare lookups through the bucket lock with optimistic lookups
+ * under contention:
+ *
+ *   hash_read_bench [-r readers] [-w writers] [-k keys] [-h hot keys]
+ *                   [-n lookups per reader]
+ *
+ * Every reader looks up random keys, copying out the value the way a
+ * get does, while the writers keep replacing random keys.  With hot
+ * keys, all lookups go to that many keys, so the readers pile up on
+ * the same few locks.  The run is repeated for 1, 2, 4, ... readers.
+ */
+
+#include "config.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "stats.h"
+#include "stored-value.h"
+#include "threadtests.h"
+
+time_t time_offset;
+
+extern "C" {
+    static rel_time_t basic_current_time(void) {
+        return 0;
+    }
+
+    rel_time_t (*ep_current_time)() = basic_current_time;
+
+    time_t ep_real_time() {
+        return time(NULL) + time_offset;
+    }
+}
+
+static EPStats global_stats;
+
+static size_t maxReaders(8);
+static size_t numWriters(1);
+static size_t numKeys(100000);
+static size_t numHotKeys(0);
+static size_t lookupsPerReader(1000000);
+
+/**
+ * Copies out the value of the item found, like a get.
+ */
+class ValueReader : public HashTableReader {
+public:
+    bool read(StoredValue *v) {
+        if (v) {
+            value = v->getValue().get();
+            if (!value) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void discard() {
+        value.reset();
+    }
+
+    value_t value;
+};
+
+/**
+ * Runs the readers and writers of one round.
+ *
+ * The first threads to start are the writers, which keep going until
+ * the last reader is done.
+ */
+class LookupGenerator : public Generator<hrtime_t> {
+public:
+    LookupGenerator(HashTable &h, const std::vector<std::string> &k,
+                    bool o, size_t r) : ht(h), keys(k), optimistic(o),
+                                        readers(r) {}
+
+    hrtime_t operator()() {
+        size_t me = started++;
+        unsigned int seed = static_cast<unsigned int>(me);
+        if (me < numWriters) {
+            write(seed);
+            return 0;
+        }
+
+        size_t range = numHotKeys != 0 ? numHotKeys : keys.size();
+        size_t found(0);
+        hrtime_t start = gethrtime();
+        for (size_t i = 0; i < lookupsPerReader; ++i) {
+            const std::string &key = keys[rand_r(&seed) % range];
+            if (optimistic) {
+                ValueReader r;
+                if (ht.optimisticFind(key, r, false, false)) {
+                    found += r.value ? 1 : 0;
+                    continue;
+                }
+            }
+            int bucket_num(0);
+            LockHolder lh = ht.getLockedBucket(key, &bucket_num);
+            StoredValue *v = ht.unlocked_find(key, bucket_num, false, false);
+            value_t value(v ? v->getValue() : value_t());
+            found += value ? 1 : 0;
+        }
+        hrtime_t spent = gethrtime() - start;
+        hits.incr(found);
+        ++readersDone;
+        return spent;
+    }
+
+    Atomic<size_t> started;
+    Atomic<size_t> readersDone;
+    //! Lookups that found the key.
+    Atomic<size_t> hits;
+
+private:
+    void write(unsigned int seed) {
+        while (readersDone.get() < readers) {
+            const std::string &key = keys[rand_r(&seed) % keys.size()];
+            Item itm(key, 0, 0, key.data(), key.size());
+            ht.set(itm);
+        }
+    }
+
+    HashTable                      &ht;
+    const std::vector<std::string> &keys;
+    bool                            optimistic;
+    size_t                          readers;
+};
+
+static void run(const char *name, bool optimistic, size_t readers,
+                const std::vector<std::string> &keys) {
+    HashTable::setOptimisticReads(optimistic);
+    HashTable ht(global_stats, keys.size(), 0);
+    global_stats.memOverhead.incr(ht.tableMemorySize());
+    std::vector<std::string>::const_iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        Item itm(*it, 0, 0, it->data(), it->size());
+        ht.set(itm);
+    }
+
+    size_t fallbacks = global_stats.numOptimisticReadFallbacks.get();
+    LookupGenerator gen(ht, keys, optimistic, readers);
+    std::vector<hrtime_t> spent = getCompletedThreads(numWriters + readers,
+                                                      &gen);
+    assert(gen.hits.get() == readers * lookupsPerReader);
+
+    hrtime_t total(0);
+    std::vector<hrtime_t>::iterator sit;
+    for (sit = spent.begin(); sit != spent.end(); ++sit) {
+        total += *sit;
+    }
+    double nsPerLookup = static_cast<double>(total) / (readers * lookupsPerReader);
+    std::cout << "  " << name << " " << readers << " readers: "
+              << nsPerLookup << " ns/lookup, "
+              << readers * 1000.0 / nsPerLookup << " M lookups/s";
+    if (optimistic) {
+        std::cout << ", " << global_stats.numOptimisticReadFallbacks.get() - fallbacks
+                  << " fallbacks";
+    }
+    std::cout << std::endl;
+
+    ht.clear(true);
+    global_stats.memOverhead.decr(ht.tableMemorySize());
+}
+
+int main(int argc, char **argv) {
+    putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
+    global_stats.setMaxDataSize(std::numeric_limits<size_t>::max());
+
+    int c;
+    while ((c = getopt(argc, argv, "r:w:k:h:n:")) != -1) {
+        switch (c) {
+        case 'r':
+            maxReaders = strtoul(optarg, NULL, 10);
+            break;
+        case 'w':
+            numWriters = strtoul(optarg, NULL, 10);
+            break;
+        case 'k':
+            numKeys = strtoul(optarg, NULL, 10);
+            break;
+        case 'h':
+            numHotKeys = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            lookupsPerReader = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            std::cerr << "Usage: " << argv[0]
+                      << " [-r readers] [-w writers] [-k keys] [-h hot keys]"
+                      << " [-n lookups per reader]" << std::endl;
+            return 1;
+        }
+    }
+    if (numKeys == 0 || numHotKeys > numKeys) {
+        std::cerr << "Need at least as many keys as hot keys" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < numKeys; ++i) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "user::%06d", static_cast<int>(i));
+        keys.push_back(buf);
+    }
+
+    std::cout << numKeys << " keys, " << numHotKeys << " hot, "
+              << numWriters << " writers" << std::endl;
+    for (size_t readers = 1; readers <= maxReaders; readers *= 2) {
+        run("locked    ", false, readers, keys);
+        run("optimistic", true, readers, keys);
+    }
+    return 0;
+}
@@ -237,6 +237,81 @@ static void testFind() {
     testFind(h);
 }
 
+/**
+ * Finds every key it visits, checking it is in the bucket it was
+ * visited for.
+ */
+class FindingKeyVisitor : public HashTableKeyVisitor {
+public:
+    FindingKeyVisitor(HashTable &ht, const std::vector<std::string> &k) :
+        h(ht), keys(k), visits(k.size()) {}
+
+    void visit(size_t pos, int bucket_num) {
+        assert(h.unlocked_find(keys[pos], bucket_num, false, false));
+        ++visits[pos];
+    }
+
+    HashTable &h;
+    const std::vector<std::string> &keys;
+    std::vector<int> visits;
+};
+
+static void testVisitKeys() {
+    HashTable h(global_stats, 1031, 7);
+    std::vector<std::string> keys = generateKeys(5000);
+    storeMany(h, keys);
+
+    FindingKeyVisitor visitor(h, keys);
+    size_t acquisitions = h.visitKeys(keys, visitor);
+    assert(acquisitions == 7);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        assert(visitor.visits[i] == 1);
+    }
+}
+
+static void testVisitLocks() {
+    HashTable h(global_stats, 1031, 7);
+    std::vector<std::string> keys = generateKeys(5000);
+    storeMany(h, keys);
+
+    // Runs of one lock go around the table once in seven.
+    Counter c(true);
+    size_t next = 5;
+    for (int i = 0; i < 7; ++i) {
+        next = h.visitLocks(c, next);
+    }
+    assert(next == 5);
+    assert(c.count == keys.size());
+
+    // The start wraps around, and no count means every lock.
+    Counter all(true);
+    assert(h.visitLocks(all, 12, 0) == 5);
+    assert(all.count == keys.size());
+}
+
+static void testVisitChain() {
+    HashTable h(global_stats, 1031, 7);
+    std::vector<std::string> keys = generateKeys(5000);
+    storeMany(h, keys);
+
+    // The chains below the table size are its buckets, one at a time.
+    Counter c(true);
+    size_t most = 0;
+    for (size_t i = 0; i < h.getSize(); ++i) {
+        size_t before = c.count;
+        h.visitChain(c, i);
+        most = std::max(most, c.count - before);
+    }
+    assert(c.count == keys.size());
+    assert(most < 50);
+
+    // Any other number picks one of them too.
+    Counter any(true);
+    h.visitChain(any, std::numeric_limits<size_t>::max());
+    h.visitChain(any, 7 * h.getSize() + 12);
+    assert(any.count <= 2 * most);
+}
+
 static void testAddExpiry() {
     HashTable h(global_stats, 5, 1);
     std::string k("aKey");
@@ -327,6 +402,640 @@ static void testConcurrentAccessResize() {
     getCompletedThreads(16, &gen);
 }
 
+static void testIncrementalResize() {
+    HashTable::setIncrementalResize(true);
+    HashTable h(global_stats, 5, 3);
+
+    std::vector<std::string> keys = generateKeys(5000);
+    storeMany(h, keys);
+
+    h.resize(6143);
+    assert(h.isResizing());
+    assert(h.getSize() == 5);
+    assert(h.getResizeTarget() == 6143);
+
+    // A zero time limit moves a single bucket per step.
+    std::vector<std::string> more = generateKeys(6000, 5000);
+    std::vector<std::string>::iterator it = more.begin();
+    while (h.resizeStep(0)) {
+        assert(h.getResizeMigrated() < 5);
+        verifyFound(h, keys);
+        assert(count(h) == static_cast<int>(keys.size()));
+        store(h, *it);
+        keys.push_back(*it);
+        ++it;
+    }
+
+    assert(!h.isResizing());
+    assert(h.getSize() == 6143);
+    assert(h.getResizeMigrated() == 0);
+    verifyFound(h, keys);
+    assert(count(h) == static_cast<int>(keys.size()));
+
+    HashTable::setIncrementalResize(false);
+}
+
+class IncrementalAccessGenerator : public Generator<bool> {
+public:
+
+    IncrementalAccessGenerator(const std::vector<std::string> &k,
+                               HashTable &h) : keys(k), ht(h), size(10000) {
+        std::random_shuffle(keys.begin(), keys.end());
+    }
+
+    bool operator()() {
+        std::vector<std::string>::iterator it;
+        for (it = keys.begin(); it != keys.end(); ++it) {
+            if (rand() % 111 == 0) {
+                resize();
+            }
+            if (rand() % 11 == 0) {
+                ht.resizeStep(10000);
+            }
+            ht.del(*it);
+        }
+        return true;
+    }
+
+private:
+
+    void resize() {
+        ht.resize(size);
+        size = size == 10000 ? 30000 : 10000;
+    }
+
+    std::vector<std::string>  keys;
+    HashTable                &ht;
+    size_t                    size;
+};
+
+static void testConcurrentAccessIncrementalResize() {
+    HashTable::setIncrementalResize(true);
+    HashTable h(global_stats, 5, 3);
+
+    std::vector<std::string> keys = generateKeys(20000);
+    storeMany(h, keys);
+
+    verifyFound(h, keys);
+
+    srand(918475);
+    IncrementalAccessGenerator gen(keys, h);
+    getCompletedThreads(16, &gen);
+    assert(count(h) == 0);
+
+    while (h.resizeStep(1000000)) {
+        // Finish whatever migration the threads left behind.
+    }
+    assert(!h.isResizing());
+
+    HashTable::setIncrementalResize(false);
+}
+
+/**
+ * Counts the items it sees, stopping once it has gone over the given
+ * number of locks until it's told to go on.
+ */
+class PausingVisitor : public HashTableVisitor {
+public:
+
+    PausingVisitor(size_t at) : pauseAt(at), calls(0), seen(0) {}
+
+    void visit(StoredValue *) {
+        ++seen;
+    }
+
+    bool shouldContinue() {
+        if (calls++ == pauseAt) {
+            paused.decr();
+            resumed.wait();
+        }
+        return true;
+    }
+
+    size_t         pauseAt;
+    size_t         calls;
+    size_t         seen;
+    CountDownLatch paused;
+    CountDownLatch resumed;
+};
+
+struct PausedVisit {
+    HashTable      *ht;
+    PausingVisitor *visitor;
+};
+
+extern "C" {
+    static void *launchPausedVisit(void *arg) {
+        PausedVisit *pv = static_cast<PausedVisit*>(arg);
+        pv->ht->visit(*pv->visitor);
+        return NULL;
+    }
+}
+
+static void testResizeDuringVisit() {
+    HashTable::setIncrementalResize(true);
+    std::vector<std::string> keys = generateKeys(5000);
+
+    // Stop before the first of the three locks, after the first one,
+    // and after all of them.
+    for (size_t pauseAt = 0; pauseAt <= 3; pauseAt = pauseAt * 2 + 1) {
+        HashTable h(global_stats, 5, 3);
+        storeMany(h, keys);
+        h.resize(6143);
+
+        PausingVisitor visitor(pauseAt);
+        PausedVisit pv = { &h, &visitor };
+        pthread_t thread;
+        assert(pthread_create(&thread, NULL, launchPausedVisit, &pv) == 0);
+        visitor.paused.wait();
+
+        if (pauseAt == 1) {
+            // Only chains the visitor isn't halfway across may move.
+            for (int i = 0; i < 5; ++i) {
+                h.resizeStep(0);
+            }
+        } else {
+            // Every chain is on one side of the visitor, but the
+            // tables can't be swapped while it's walking them.
+            while (h.getResizeMigrated() < 5) {
+                assert(h.resizeStep(0));
+            }
+            assert(h.resizeStep(0));
+        }
+
+        visitor.resumed.decr();
+        assert(pthread_join(thread, NULL) == 0);
+        assert(visitor.seen == keys.size());
+
+        while (h.resizeStep(1000000)) {
+        }
+        assert(!h.isResizing());
+        verifyFound(h, keys);
+    }
+
+    HashTable::setIncrementalResize(false);
+}
+
+static void testRestripe() {
+    HashTable::setBucketsPerLock(4);
+    HashTable::setMaxLocks(64);
+    HashTable h(global_stats, 5, 3);
+
+    std::vector<std::string> keys = generateKeys(5000);
+    storeMany(h, keys);
+
+    h.resize(6143);
+    assert(h.getNumLocks() == 64);
+    verifyFound(h, keys);
+
+    h.resize(101);
+    assert(h.getNumLocks() == 25);
+    verifyFound(h, keys);
+
+    HashTableLockStats lockStats;
+    h.getLockStats(lockStats);
+    assert(lockStats.locks == 25);
+    assert(lockStats.restripes == 2);
+    // Every store and every lookup took a lock.
+    assert(lockStats.acquisitions >= 3 * keys.size());
+    assert(lockStats.contentions <= lockStats.acquisitions);
+    assert(lockStats.hottest < 25);
+
+    // An incremental resize changes the locks once it's done.
+    HashTable::setIncrementalResize(true);
+    h.resize(1031);
+    assert(h.getNumLocks() == 25);
+    while (h.resizeStep(1000000)) {
+    }
+    assert(h.getNumLocks() == 64);
+    verifyFound(h, keys);
+    HashTable::setIncrementalResize(false);
+
+    HashTable::setBucketsPerLock(0);
+    HashTable::setMaxLocks(1024);
+}
+
+static void testConcurrentAccessRestripe() {
+    HashTable::setBucketsPerLock(64);
+    HashTable::setOptimisticReads(true);
+    for (int incremental = 0; incremental < 2; ++incremental) {
+        HashTable::setIncrementalResize(incremental != 0);
+        HashTable h(global_stats, 5, 3);
+
+        std::vector<std::string> keys = generateKeys(5000);
+        storeMany(h, keys);
+
+        srand(918475);
+        if (incremental) {
+            IncrementalAccessGenerator gen(keys, h);
+            getCompletedThreads(16, &gen);
+        } else {
+            AccessGenerator gen(keys, h);
+            getCompletedThreads(16, &gen);
+        }
+        assert(count(h) == 0);
+        HashTableLockStats lockStats;
+        h.getLockStats(lockStats);
+        assert(lockStats.restripes > 0);
+    }
+    HashTable::setIncrementalResize(false);
+    HashTable::setOptimisticReads(false);
+    HashTable::setBucketsPerLock(0);
+}
+
+/**
+ * Remembers the key and value of the item an optimistic lookup found.
+ */
+class KeyValueReader : public HashTableReader {
+public:
+    KeyValueReader() : found(false) {}
+
+    bool read(StoredValue *v) {
+        found = v != NULL;
+        if (v) {
+            value = v->getValue().get();
+            if (!value && !v->isDeleted()) {
+                return false;
+            }
+            key = v->getKey();
+        }
+        return true;
+    }
+
+    void discard() {
+        found = false;
+        key.clear();
+        value.reset();
+    }
+
+    bool        found;
+    std::string key;
+    value_t     value;
+};
+
+static void testOptimisticFind() {
+    HashTable::setOptimisticReads(true);
+    HashTable h(global_stats, 5, 3);
+
+    std::vector<std::string> keys = generateKeys(500);
+    storeMany(h, keys);
+
+    std::vector<std::string>::iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        KeyValueReader r;
+        // New items still have their reference to be tracked.
+        assert(!h.optimisticFind(*it, r));
+        assert(h.optimisticFind(*it, r, false, false));
+        assert(r.found && r.key == *it && r.value->to_s() == *it);
+    }
+
+    std::string key = keys[0];
+    while (h.find(key)->getNRUValue() > MIN_NRU_VALUE) {
+        // Each lookup through the lock counts as a reference.
+    }
+    KeyValueReader r;
+    assert(h.optimisticFind(key, r));
+    assert(r.found);
+
+    std::string missingKey = "aMissingKey";
+    KeyValueReader missing;
+    assert(h.optimisticFind(missingKey, missing));
+    assert(!missing.found);
+
+    int bucket_num(0);
+    {
+        LockHolder lh = h.getLockedBucket(key, &bucket_num);
+        StoredValue *v = h.unlocked_find(key, bucket_num, false, false);
+        h.unlocked_softDelete(v, 0);
+    }
+    KeyValueReader deleted;
+    assert(h.optimisticFind(key, deleted, false, false));
+    assert(!deleted.found);
+    assert(h.optimisticFind(key, deleted, true, false));
+    assert(deleted.found && !deleted.value);
+
+    HashTable::setOptimisticReads(false);
+    HashTable locked(global_stats, 5, 3);
+    storeMany(locked, keys);
+    KeyValueReader none;
+    assert(!locked.optimisticFind(keys[1], none, false, false));
+}
+
+class OptimisticAccessGenerator : public Generator<bool> {
+public:
+
+    OptimisticAccessGenerator(const std::vector<std::string> &k,
+                              HashTable &h) : keys(k), ht(h) {
+        std::random_shuffle(keys.begin(), keys.end());
+    }
+
+    bool operator()() {
+        std::vector<std::string>::iterator it;
+        for (it = keys.begin(); it != keys.end(); ++it) {
+            switch (rand() % 4) {
+            case 0:
+                ht.del(*it);
+                break;
+            case 1: {
+                Item i(*it, 0, 0, it->c_str(), it->length());
+                ht.set(i);
+                break;
+            }
+            default:
+                read(*it);
+            }
+            if (rand() % 1111 == 0) {
+                ht.resize(rand() % 2 ? 10000 : 30000);
+            }
+        }
+        return true;
+    }
+
+private:
+
+    void read(const std::string &key) {
+        KeyValueReader r;
+        if (ht.optimisticFind(key, r, false, false)) {
+            // Whatever was found must have been consistent.
+            assert(!r.found || (r.key == key && r.value->to_s() == key));
+        }
+    }
+
+    std::vector<std::string>  keys;
+    HashTable                &ht;
+};
+
+static void testConcurrentOptimisticFind() {
+    HashTable::setOptimisticReads(true);
+    HashTable h(global_stats, 5, 3);
+
+    std::vector<std::string> keys = generateKeys(20000);
+    storeMany(h, keys);
+
+    srand(918475);
+    OptimisticAccessGenerator gen(keys, h);
+    getCompletedThreads(16, &gen);
+    count(h);
+
+    HashTable::setOptimisticReads(false);
+}
+
+static void testSlabAccounting() {
+    size_t initialOverhead = global_stats.memOverhead.get();
+    {
+        HashTable h(global_stats, 5, 3);
+        size_t emptySize = h.memorySize();
+        assert(emptySize == h.tableMemorySize());
+        assert(h.getSlabBytes() == 0);
+
+        std::vector<std::string> keys = generateKeys(5000);
+        storeMany(h, keys);
+
+        assert(h.getSlabUsedBytes() >= 5000 * StoredValue::sizeForKey(4));
+        assert(h.getSlabBytes() >= h.getSlabUsedBytes());
+        // The slab space the items don't take is charged once, by the
+        // allocator, and reported by the table.
+        size_t slack = h.memorySize() - h.tableMemorySize();
+        assert(slack > 0);
+        assert(global_stats.memOverhead.get() == initialOverhead + slack);
+
+        // Whatever of the slab space the items use but didn't ask for
+        // is the waste of their classes.
+        std::vector<SlabAllocator::ClassStats> classes;
+        h.addSlabClassStats(classes);
+        size_t chunks(0), used(0), waste(0);
+        std::vector<SlabAllocator::ClassStats>::iterator cit;
+        for (cit = classes.begin(); cit != classes.end(); ++cit) {
+            assert(cit->requested <= cit->chunks * cit->chunkSize);
+            chunks += cit->chunks;
+            used += cit->chunks * cit->chunkSize;
+            waste += cit->getWaste();
+        }
+        assert(chunks == 5000);
+        assert(used == h.getSlabUsedBytes());
+        assert(slack == h.getSlabBytes() - h.getSlabUsedBytes() + waste);
+
+        std::vector<std::string>::iterator it;
+        for (it = keys.begin(); it != keys.end(); ++it) {
+            assert(h.del(*it));
+        }
+        assert(h.getSlabBytes() == 0);
+        assert(h.getSlabUsedBytes() == 0);
+        assert(h.memorySize() == emptySize);
+    }
+    assert(global_stats.memOverhead.get() == initialOverhead);
+}
+
+static void testLargeBlobs() {
+    size_t initialOverhead = global_stats.memOverhead.get();
+    {
+        SlabAllocator a(Blob::slabSize, Blob::maxChunkSize,
+                        &global_stats.memOverhead);
+        size_t sizes[] = { 1, Blob::maxChunkSize, Blob::maxChunkSize + 1,
+                           100000 };
+        void *chunks[sizeof(sizes) / sizeof(sizes[0])];
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+            chunks[i] = a.allocate(sizes[i]);
+            std::memset(chunks[i], 'x', sizes[i]);
+        }
+        assert(a.getRequestedBytes() == 1 + Blob::maxChunkSize
+               + Blob::maxChunkSize + 1 + 100000);
+        // Blobs too big for a class only take a little more than they
+        // asked for, rather than a slab of their own.
+        assert(a.getSlabBytes() < 2 * Blob::slabSize + Blob::maxChunkSize + 1
+               + 100000 + 256);
+        assert(global_stats.memOverhead.get() == initialOverhead
+               + a.getSlabBytes() - a.getRequestedBytes());
+
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+            SlabAllocator::forget(chunks[i], Blob::slabSize, sizes[i]);
+            SlabAllocator::deallocate(chunks[i], Blob::slabSize);
+        }
+        assert(a.getSlabBytes() == 0);
+        assert(a.getUsedBytes() == 0);
+        assert(a.getRequestedBytes() == 0);
+    }
+    assert(global_stats.memOverhead.get() == initialOverhead);
+}
+
+/**
+ * One thread stores new keys while the others keep finding the ones
+ * that were already there, so chains are followed while the table
+ * of slabs their links are resolved through is growing.
+ */
+class GrowingGenerator : public Generator<bool> {
+public:
+
+    GrowingGenerator(HashTable &h, const std::vector<std::string> &k,
+                     const std::vector<std::string> &n) :
+        ht(h), keys(k), newKeys(n) {}
+
+    bool operator()() {
+        if (threads++ == 0) {
+            std::vector<std::string>::iterator it;
+            for (it = newKeys.begin(); it != newKeys.end(); ++it) {
+                store(ht, *it);
+            }
+        } else {
+            for (int i = 0; i < 5; ++i) {
+                verifyFound(ht, keys);
+            }
+        }
+        return true;
+    }
+
+private:
+
+    HashTable                &ht;
+    std::vector<std::string>  keys;
+    std::vector<std::string>  newKeys;
+    Atomic<int>               threads;
+};
+
+static void testChainsAcrossSlabs() {
+    HashTable h(global_stats, 7, 3);
+
+    std::vector<std::string> keys = generateKeys(2000);
+    storeMany(h, keys);
+    verifyFound(h, keys);
+
+    // Free chunks (and whole slabs) all over the place and fill them
+    // up again.
+    std::vector<std::string> odd;
+    for (size_t i = 1; i < keys.size(); i += 2) {
+        assert(h.del(keys[i]));
+        odd.push_back(keys[i]);
+    }
+    assert(count(h) == 1000);
+    for (size_t i = 1; i < keys.size(); i += 2) {
+        assert(h.find(keys[i]) == NULL);
+    }
+    storeMany(h, odd);
+    verifyFound(h, keys);
+    assert(count(h) == 2000);
+
+    GrowingGenerator gen(h, keys, generateKeys(6000, 2000));
+    getCompletedThreads(8, &gen);
+    verifyFound(h, generateKeys(6000));
+    assert(count(h) == 6000);
+}
+
+static void testLockExpiry() {
+    HashTable h1(global_stats, 5, 1);
+    HashTable h2(global_stats, 5, 1);
+    std::string k("locked");
+    store(h1, k);
+    store(h2, k);
+
+    StoredValue *v1 = h1.find(k);
+    StoredValue *v2 = h2.find(k);
+    assert(!v1->hasLock());
+    v1->lock(10);
+    assert(v1->hasLock());
+    assert(v1->isLocked(5));
+    assert(!v2->hasLock());
+    assert(!v2->isLocked(5));
+
+    // An expired lock goes away once it's noticed.
+    assert(!v1->isLocked(11));
+    assert(!v1->hasLock());
+
+    v1->lock(10);
+    v2->lock(20);
+    assert(!v1->isLocked(15));
+    assert(v2->isLocked(15));
+    v2->unlock();
+    assert(!v2->isLocked(15));
+
+    // A locked item can't be deleted, but it can be cleared, and
+    // whatever takes its place starts out unlocked.
+    v1->lock(10);
+    assert(!h1.del(k));
+    h1.clear();
+    store(h1, k);
+    v1 = h1.find(k);
+    assert(!v1->hasLock());
+    assert(!v1->isLocked(5));
+}
+
+static void testItemMetadata() {
+    global_stats.reset();
+    HashTable ht(global_stats, 5, 1);
+    size_t initialSize = global_stats.currentSize.get();
+    std::string plainKey("plain"), richKey("rich");
+
+    Item plain(plainKey, 0, 0, "v", 1);
+    Item rich(richKey, 0xdeadbeef, 1234, "v", 1);
+    assert(ht.set(plain) == WAS_CLEAN);
+    assert(ht.set(rich) == WAS_CLEAN);
+
+    StoredValue *v = ht.find(plainKey);
+    assert(v->getFlags() == 0);
+    assert(v->getExptime() == 0);
+    assert(!v->hasLock());
+
+    v = ht.find(richKey);
+    assert(v->getFlags() == 0xdeadbeef);
+    assert(v->getExptime() == 1234);
+    v->setRevSeqno(70000);
+    assert(v->getRevSeqno() == 70000);
+    v->lock(10);
+    assert(v->isLocked(5));
+    v->unlock();
+    assert(v->getFlags() == 0xdeadbeef);
+    assert(v->getRevSeqno() == 70000);
+#ifdef COMPACT_STORED_VALUE
+    // Revision numbers stick at the largest one the layout can hold.
+    v->setRevSeqno(std::numeric_limits<uint64_t>::max());
+    assert(v->getRevSeqno() == (static_cast<uint64_t>(1) << 48) - 1);
+#endif
+
+    // Whatever the items took is given back, however they go.
+    assert(ht.del(plainKey));
+    assert(ht.del(richKey));
+    assert(initialSize == global_stats.currentSize.get());
+
+    Item again(richKey, 0xdeadbeef, 1234, "v", 1);
+    assert(ht.set(again) == WAS_CLEAN);
+    ht.find(richKey)->lock(10);
+    ht.clear();
+    assert(initialSize == global_stats.currentSize.get());
+}
+
+static void testItemPool() {
+    HashTable h(global_stats, 5, 3);
+    std::string longKey(100, 'k');
+    Item itm(longKey, 3, 0, "value", 5);
+    h.set(itm);
+
+    ItemPool pool;
+    int bucket_num(0);
+    LockHolder lh = h.getLockedBucket(longKey, &bucket_num);
+    StoredValue *v = h.unlocked_find(longKey, bucket_num, false, false);
+    assert(v);
+    Item *first = v->toItem(false, 0, pool);
+    assert(first->getValue().get() == v->getValue().get());
+    pool.release(first);
+    assert(pool.getNumIdle() == 1);
+
+    Item *second = v->toItem(true, 0, pool);
+    assert(second == first);
+    assert(pool.getNumReused() == 1);
+    assert(pool.getNumIdle() == 0);
+    assert(second->getKey() == longKey);
+    assert(second->getFlags() == 3);
+    assert(second->getCas() == static_cast<uint64_t>(-1));
+    assert(second->getValue().get() == v->getValue().get());
+    pool.release(second);
+
+    // Any item can be released to the pool, and an idle one doesn't
+    // keep its value alive.
+    Item *other = new Item("other", 0, 0, "x", 1);
+    pool.release(other);
+    assert(pool.getNumIdle() == 2);
+    assert(other->getValue().get() == NULL);
+}
+
 static void testAutoResize() {
     HashTable h(global_stats, 5, 3);
 
@@ -386,6 +1095,40 @@ static void testDepthCounting() {
     assert(depthCounter.max > 1000);
 }
 
+static void testWordHash() {
+    HashTable::setDefaultHashFunction(WORD_HASH);
+    HashTable h(global_stats, 1009, 7);
+    assert(h.getHashFunction() == WORD_HASH);
+
+    std::vector<std::string> keys = generateKeys(5000);
+    std::vector<std::string>::iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        assert(h.hash(*it) >= 0);
+        assert(h.hash(*it) == HashTable::wordHash(it->data(), it->size()));
+    }
+    storeMany(h, keys);
+    verifyFound(h, keys);
+    assert(count(h) == 5000);
+
+    HashTableDepthStatVisitor depthCounter;
+    h.visitDepth(depthCounter);
+    assert(depthCounter.size == 5000);
+    assert(depthCounter.emptyBuckets() < 100);
+    assert(depthCounter.chainLengthPercentile(50) >= 4);
+    assert(depthCounter.chainLengthPercentile(50) <= 6);
+    assert(depthCounter.chainLengthPercentile(99)
+           >= depthCounter.chainLengthPercentile(50));
+    assert(depthCounter.chainLengthPercentile(100)
+           == static_cast<size_t>(depthCounter.max));
+
+    h.resize(3079);
+    verifyFound(h, keys);
+
+    HashTable::setDefaultHashFunction(DJB_HASH);
+    HashTable d(global_stats, 5, 1);
+    assert(d.getHashFunction() == DJB_HASH);
+}
+
 static void testPoisonKey() {
     std::string k("A\\NROBs_oc)$zqJ1C.9?XU}Vn^(LW\"`+K/4lykF[ue0{ram;fvId6h=p&Zb3T~SQ]82'ixDP");
 
@@ -569,13 +1312,30 @@ int main() {
     testReverseDeletions();
     testForwardDeletions();
     testFind();
+    testVisitKeys();
+    testVisitLocks();
+    testVisitChain();
     testAdd();
     testAddExpiry();
     testDepthCounting();
+    testWordHash();
     testPoisonKey();
     testResize();
     testConcurrentAccessResize();
+    testIncrementalResize();
+    testConcurrentAccessIncrementalResize();
+    testResizeDuringVisit();
+    testRestripe();
+    testConcurrentAccessRestripe();
+    testOptimisticFind();
+    testConcurrentOptimisticFind();
     testAutoResize();
+    testSlabAccounting();
+    testLargeBlobs();
+    testChainsAcrossSlabs();
+    testLockExpiry();
+    testItemMetadata();
+    testItemPool();
     testSizeStats();
     testSizeStatsFlush();
     testSizeStatsSoftDel();
@@ -17,12 +17,16 @@
 
 #include "config.h"
 
+#include <arpa/inet.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <signal.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <map>
 #include <set>
+#include <sstream>
 #include <stdexcept>
 #include <vector>
 
@@ -30,6 +34,7 @@
 #include "mutation_log.h"
 
 #define TMP_LOG_FILE "/tmp/mlt_test.log"
+#define TMP_DELTA_LOG_FILE "/tmp/mlt_test.log.delta"
 
 static void testUnconfigured() {
     MutationLog ml("");
@@ -182,6 +187,294 @@ static void testLogging() {
     remove(TMP_LOG_FILE);
 }
 
+static void testScan() {
+    remove(TMP_LOG_FILE);
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+
+        ml.newItem(3, "key1", 1);
+        ml.newItem(2, "key1", 2);
+        ml.newItem(3, "key2", 3);
+        ml.commit1();
+        ml.commit2();
+        ml.newItem(3, "key3", 4);
+    }
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        MutationLogHarvester h(ml);
+        h.setVBucket(2);
+        h.setVBucket(3);
+
+        // The last entry isn't committed.
+        assert(!h.scan());
+        assert(h.getItemsSeen()[ML_NEW] == 4);
+        assert(h.getItemsSeen()[ML_COMMIT2] == 1);
+        assert(h.canStream());
+        // Nothing is held on to while scanning.
+        assert(h.getPeakMemory() == 0);
+
+        assert(!h.load());
+        assert(h.getItemsSeen()[ML_NEW] == 4);
+        assert(h.getPeakMemory() > 0);
+    }
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        ml.delItem(3, "key1");
+        ml.commit1();
+        ml.commit2();
+    }
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        MutationLogHarvester h(ml);
+        h.setVBucket(3);
+
+        assert(h.scan());
+        assert(h.total() == 9);
+        // Deletions need the whole log to be loaded.
+        assert(!h.canStream());
+    }
+
+    remove(TMP_LOG_FILE);
+}
+
+static void testNRU() {
+    remove(TMP_LOG_FILE);
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+
+        ml.newItem(3, "key1", 1, 2);
+        ml.newItem(3, "key2", 2);
+        ml.newItem(3, "key3", 3, 0);
+        ml.commit1();
+        ml.commit2();
+    }
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+
+        // Entries with and without a class read back alike.
+        MutationLog::iterator it(ml.begin());
+        assert((*it)->key() == "key1");
+        assert((*it)->nru() == 2);
+        ++it;
+        assert((*it)->key() == "key2");
+        assert((*it)->nru() == NO_NRU_VALUE);
+        ++it;
+        assert((*it)->key() == "key3");
+        assert((*it)->rowid() == 3);
+        assert((*it)->nru() == 0);
+
+        MutationLogHarvester h(ml);
+        h.setVBucket(3);
+        assert(h.scan());
+        assert(h.canStream());
+        assert(h.load());
+        assert(h.getItemsSeen()[ML_NEW] == 3);
+    }
+}
+
+static void testMerge() {
+    remove(TMP_LOG_FILE);
+    remove(TMP_DELTA_LOG_FILE);
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        ml.newItem(3, "key1", 1, 1);
+        ml.newItem(3, "key2", 2, 0);
+        ml.commit1();
+        ml.commit2();
+
+        MutationLog delta(TMP_DELTA_LOG_FILE);
+        delta.open();
+        delta.delItem(3, "key1");
+        delta.newItem(3, "key3", 3, 2);
+        delta.commit1();
+        delta.commit2();
+        delta.newItem(3, "key4", 4, 0);
+    }
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        MutationLogHarvester h(ml);
+        h.setVBucket(3);
+        assert(h.scan());
+        assert(h.getPeakMemory() == 0);
+
+        MutationLog delta(TMP_DELTA_LOG_FILE);
+        delta.open(true);
+        // The last entry of the delta isn't committed.
+        assert(!h.merge(delta));
+        assert(h.total() == 9);
+        assert(h.getItemsSeen()[ML_DEL] == 1);
+        // Deletions in the delta don't keep the log from streaming.
+        assert(h.canStream());
+        // The delta's keys are held on to.
+        assert(h.getPeakMemory() > 0);
+    }
+
+    remove(TMP_DELTA_LOG_FILE);
+}
+
+typedef std::set<std::pair<uint16_t, std::string> > streamed_t;
+
+static bool collectKey(void *arg, uint16_t vb, const std::string &key) {
+    streamed_t *keys = static_cast<streamed_t *>(arg);
+    keys->insert(std::make_pair(vb, key));
+    return true;
+}
+
+static std::string streamKey(uint16_t vb, int i) {
+    std::stringstream ss;
+    ss << "key_" << vb << "_" << i;
+    return ss.str();
+}
+
+static void testStreamClass() {
+    remove(TMP_LOG_FILE);
+    remove(TMP_DELTA_LOG_FILE);
+
+    {
+        // Written a vbucket at a time, as the access scanner does.
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        for (uint16_t vb = 0; vb < 8; ++vb) {
+            for (int i = 0; i < 200; ++i) {
+                ml.newItem(vb, streamKey(vb, i), i, i % 2);
+            }
+        }
+        ml.commit1();
+        ml.commit2();
+        ml.newItem(2, "uncommitted", 1, 0);
+
+        MutationLog delta(TMP_DELTA_LOG_FILE);
+        delta.open();
+        delta.newItem(2, streamKey(2, 1), 1, 0);
+        delta.delItem(2, streamKey(2, 2));
+        delta.commit1();
+        delta.commit2();
+    }
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        MutationLogHarvester h(ml);
+        for (uint16_t vb = 0; vb < 8; ++vb) {
+            h.setVBucket(vb);
+        }
+        assert(!h.scan());
+        assert(h.canStream());
+        MutationLog delta(TMP_DELTA_LOG_FILE);
+        delta.open(true);
+        assert(h.merge(delta));
+
+        std::set<uint16_t> vbids;
+        vbids.insert(2);
+        streamed_t keys;
+        assert(h.streamClass(&keys, collectKey, 0, vbids));
+        // The even keys of the log but the one the delta removed, and
+        // the odd one it moved to this class.
+        assert(keys.size() == 100);
+        assert(keys.count(std::make_pair(2, streamKey(2, 0))) == 1);
+        assert(keys.count(std::make_pair(2, streamKey(2, 1))) == 1);
+        assert(keys.count(std::make_pair(2, streamKey(2, 2))) == 0);
+        assert(keys.count(std::make_pair(2, streamKey(2, 3))) == 0);
+        assert(keys.count(std::make_pair(2, std::string("uncommitted"))) == 0);
+        // Only the blocks with vbucket 2 in them were read.
+        size_t streamed = h.getBlocksStreamed();
+        assert(streamed > 0 && streamed <= 3);
+
+        keys.clear();
+        assert(h.streamClass(&keys, collectKey, 1, vbids));
+        // The delta moved one of the odd keys out of this class.
+        assert(keys.size() == 99);
+        assert(keys.count(std::make_pair(2, streamKey(2, 1))) == 0);
+        assert(h.getBlocksStreamed() == 2 * streamed);
+
+        keys.clear();
+        assert(h.streamClass(&keys, collectKey, 3, vbids));
+        assert(keys.empty());
+        assert(h.getBlocksStreamed() == 2 * streamed);
+    }
+
+    remove(TMP_LOG_FILE);
+    remove(TMP_DELTA_LOG_FILE);
+}
+
+static void setLogVersion(uint32_t version) {
+    int fd = open(TMP_LOG_FILE, O_RDWR);
+    assert(fd >= 0);
+    uint32_t v = htonl(version);
+    assert(pwrite(fd, &v, sizeof(v), 0) == sizeof(v));
+    close(fd);
+}
+
+static uint32_t getLogVersion() {
+    int fd = open(TMP_LOG_FILE, O_RDONLY);
+    assert(fd >= 0);
+    uint32_t v(0);
+    assert(pread(fd, &v, sizeof(v), 0) == sizeof(v));
+    close(fd);
+    return ntohl(v);
+}
+
+static void testVersion() {
+    remove(TMP_LOG_FILE);
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        ml.newItem(3, "key1", 1);
+        ml.commit1();
+        ml.commit2();
+    }
+    assert(getLogVersion() == LOG_VERSION);
+
+    // An older log reads alike, and is upgraded once written to.
+    setLogVersion(1);
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open(true);
+        MutationLogHarvester h(ml);
+        h.setVBucket(3);
+        assert(h.scan());
+        assert(h.getItemsSeen()[ML_NEW] == 1);
+    }
+    assert(getLogVersion() == 1);
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        ml.newItem(3, "key2", 2, 1);
+    }
+    assert(getLogVersion() == LOG_VERSION);
+
+    // A newer one isn't read at all.
+    setLogVersion(LOG_VERSION + 1);
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        try {
+            ml.open(true);
+            abort();
+        } catch (MutationLog::ReadException &e) {
+            // expected
+        }
+    }
+
+    remove(TMP_LOG_FILE);
+}
+
 static void testDelAll() {
     remove(TMP_LOG_FILE);
 
@@ -524,6 +817,11 @@ int main(int, char **) {
     testUnconfigured();
     testSyncSet();
     testLogging();
+    testScan();
+    testNRU();
+    testMerge();
+    testStreamClass();
+    testVersion();
     testDelAll();
     testLoggingDirty();
     testLoggingBadCRC();
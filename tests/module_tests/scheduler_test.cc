@@ -0,0 +1,284 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2013 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <unistd.h>
+
+#include <cassert>
+#include <sstream>
+#include <vector>
+
+#include "atomic.h"
+#include "priority.h"
+#include "scheduler.h"
+
+extern "C" {
+    static rel_time_t basic_current_time(void) {
+        return 0;
+    }
+
+    rel_time_t (*ep_current_time)() = basic_current_time;
+}
+
+/**
+ * A pool the test threads are created for by hand, or laid out as for
+ * a bucket.
+ */
+class TestPool : public ExecutorPool {
+public:
+    TestPool() : ExecutorPool(0, 0) {}
+
+    threadQ start(int writers, int readers, int nonio) {
+        return startThreads(NULL, writers, readers, nonio);
+    }
+
+    void stop(threadQ &threads) {
+        stopThreads(threads);
+    }
+};
+
+static TestPool pool;
+
+/**
+ * Wait up to about five seconds for a condition to hold.
+ */
+static bool waitFor(Atomic<bool> &cond) {
+    for (int i = 0; i < 5000 && !cond.get(); ++i) {
+        usleep(1000);
+    }
+    return cond.get();
+}
+
+/**
+ * Keeps the thread running it busy until released.
+ */
+class BlockingTask : public GlobalTask {
+public:
+    BlockingTask(Atomic<bool> &r)
+        : GlobalTask(NULL, Priority::BgFetcherPriority, 0, 0, false),
+          release(r) {}
+
+    bool run() {
+        started.set(true);
+        waitFor(release);
+        finished.set(true);
+        return false;
+    }
+
+    std::string getDescription() { return "Blocking"; }
+
+    Atomic<bool> started;
+    Atomic<bool> finished;
+
+private:
+    Atomic<bool> &release;
+};
+
+/**
+ * Notes when it ran, and how many of its kind ran with it.
+ */
+class RecordingTask : public GlobalTask {
+public:
+    RecordingTask(int s, useconds_t d, double sleeptime = 0)
+        : GlobalTask(NULL, Priority::BgFetcherPriority, sleeptime, 0, false),
+          duration(d), ranAt(0) {
+        serial = s;
+    }
+
+    bool run() {
+        maxRunning.setIfBigger(++running);
+        ranAt = gethrtime();
+        usleep(duration);
+        running.decr(1);
+        done.set(true);
+        completed.incr(1);
+        return false;
+    }
+
+    std::string getDescription() { return "Recording"; }
+
+    static Atomic<int> running;
+    static Atomic<int> maxRunning;
+    static Atomic<int> completed;
+
+    useconds_t duration;
+    hrtime_t ranAt;
+    Atomic<bool> done;
+};
+
+Atomic<int> RecordingTask::running;
+Atomic<int> RecordingTask::maxRunning;
+Atomic<int> RecordingTask::completed;
+
+/**
+ * A few peers, started and stopped with the test.
+ */
+class Threads {
+public:
+    Threads(size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            std::stringstream ss;
+            ss << "test_worker_" << i;
+            threads.push_back(new ExecutorThread(&pool, NULL, ss.str()));
+        }
+        for (size_t i = 0; i < n; ++i) {
+            threads[i]->setPeers(threads);
+            threads[i]->start();
+        }
+    }
+
+    ~Threads() {
+        for (size_t i = 0; i < threads.size(); ++i) {
+            threads[i]->stop();
+        }
+        for (size_t i = 0; i < threads.size(); ++i) {
+            delete threads[i];
+        }
+    }
+
+    ExecutorThread &operator[](size_t i) { return *threads[i]; }
+
+    /**
+     * Keep the given thread busy until release is set.
+     */
+    void block(size_t i, Atomic<bool> &release) {
+        BlockingTask *blocker = new BlockingTask(release);
+        ExTask task(blocker);
+        threads[i]->schedule(task);
+        assert(waitFor(blocker->started));
+    }
+
+private:
+    std::vector<ExecutorThread *> threads;
+};
+
+static void testSameSerialNeverConcurrent() {
+    // Outlives the threads, which may still be looking at it.
+    Atomic<bool> release;
+    Threads threads(3);
+    threads.block(0, release);
+
+    // Both idle peers take these from the busy one, one at a time.
+    RecordingTask::running.set(0);
+    RecordingTask::maxRunning.set(0);
+    RecordingTask::completed.set(0);
+    std::vector<ExTask> tasks;
+    for (int i = 0; i < 20; ++i) {
+        tasks.push_back(ExTask(new RecordingTask(0, 2000)));
+        threads[0].schedule(tasks.back());
+    }
+    for (int i = 0; i < 5000 && RecordingTask::completed.get() < 20; ++i) {
+        usleep(1000);
+    }
+    assert(RecordingTask::completed.get() == 20);
+    assert(RecordingTask::maxRunning.get() == 1);
+
+    // Without a serial, they do run side by side.
+    RecordingTask::maxRunning.set(0);
+    RecordingTask::completed.set(0);
+    for (int i = 0; i < 20; ++i) {
+        tasks.push_back(ExTask(new RecordingTask(-1, 20000)));
+        threads[0].schedule(tasks.back());
+    }
+    for (int i = 0; i < 5000 && RecordingTask::completed.get() < 20; ++i) {
+        usleep(1000);
+    }
+    assert(RecordingTask::completed.get() == 20);
+    assert(RecordingTask::maxRunning.get() == 2);
+
+    release.set(true);
+}
+
+static void testIdleThreadSteals() {
+    // Outlives the threads, which may still be looking at it.
+    Atomic<bool> release;
+    Threads threads(2);
+    threads.block(0, release);
+
+    RecordingTask *recording = new RecordingTask(-1, 0);
+    ExTask task(recording);
+    threads[0].schedule(task);
+    assert(waitFor(recording->done));
+    assert(threads[1].getSteals() == 1);
+    assert(threads[0].getStolen() == 1);
+
+    release.set(true);
+}
+
+static void testPokeWakesSleepingThread() {
+    // Outlives the threads, which may still be looking at it.
+    Atomic<bool> release;
+    Threads threads(2);
+    threads.block(0, release);
+
+    // The idle thread sleeps until this is due, a minute from now;
+    // waking it up early must get it run right away.
+    RecordingTask *woken = new RecordingTask(-1, 0, 60);
+    ExTask wtask(woken);
+    threads[0].schedule(wtask);
+    usleep(50000);
+    assert(!woken->done.get());
+    threads[0].wake(wtask);
+    assert(waitFor(woken->done));
+
+    // One due shortly is run by then, without anything waking it up.
+    hrtime_t start = gethrtime();
+    RecordingTask *later = new RecordingTask(-1, 0, 0.2);
+    ExTask ltask(later);
+    threads[0].schedule(ltask);
+    assert(waitFor(later->done));
+    assert(later->ranAt - start >= 150 * 1000 * 1000);
+    assert(threads[1].getSteals() == 2);
+
+    release.set(true);
+}
+
+static void testAuxIODoesNotStarveReaders() {
+    // Outlives the threads, which may still be looking at it.
+    Atomic<bool> release;
+    threadQ threads = pool.start(1, 1, 1);
+    assert(threads.size() == 4);
+    ExecutorThread &reader = *threads[1];
+    ExecutorThread &auxio = *threads[2];
+    assert(auxio.getName() == "auxio_worker_0");
+
+    // A long backfill on the auxiliary IO thread leaves the only
+    // reader free for the bg fetches of its shard.
+    BlockingTask *backfill = new BlockingTask(release);
+    ExTask btask(backfill);
+    auxio.schedule(btask);
+    assert(waitFor(backfill->started));
+
+    RecordingTask *fetch = new RecordingTask(0, 0);
+    ExTask ftask(fetch);
+    reader.schedule(ftask);
+    assert(waitFor(fetch->done));
+    assert(!backfill->finished.get());
+    assert(reader.getSteals() == 0 && auxio.getSteals() == 0);
+
+    release.set(true);
+    pool.stop(threads);
+}
+
+int main() {
+    testSameSerialNeverConcurrent();
+    testIdleThreadSteals();
+    testPokeWakesSleepingThread();
+    testAuxIODoesNotStarveReaders();
+    return 0;
+}